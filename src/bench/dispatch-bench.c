@@ -0,0 +1,196 @@
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Default number of message codes parsed on each run */
+#define BENCH_DEFAULT_CODES 5000000
+
+/* Default percentage of garbage in the traffic */
+#define BENCH_DEFAULT_GARBAGE 20
+
+/* Number of distinct message codes the traffic cycles through */
+#define BENCH_TRAFFIC_SIZE 4096
+
+/* Longest message code in the traffic (garbage included) */
+#define BENCH_CODE_SIZE 8
+
+/* Message codes of real traffic, the most common ones repeated */
+static const char *commonCodes[] = {"PST", "RTV", "RTV", "RTV", "ULS", "GLS", "GLM", "LOG", "OUT", "REG",
+                                    "GSR", "GUR", "RTS", "PSB", "RTF", "STA", "BIN", "UPS", "UPD", "UPF"};
+
+/**
+ * @brief Parses the program's arguments for the number of codes and the share of garbage.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ * @param numCodes reference to the number of codes to parse.
+ * @param garbage reference to the percentage of garbage.
+ */
+static void parseArgs(int argc, char *argv[], long *numCodes, int *garbage)
+{
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (!strcmp(argv[i], "-n"))
+        {
+            *numCodes = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-g"))
+        {
+            *garbage = atoi(argv[++i]);
+        }
+    }
+    if (*numCodes <= 0 || *garbage < 0 || *garbage > 100)
+    {
+        fprintf(stderr, "[-] Usage: ./dispatch-bench [-n codes] [-g garbage%%]\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Parses a message code with the strcmp chain the DS used before the opcode table (without its error message).
+ *
+ * @param command string containing the protocol message code.
+ * @return respective MACRO assigned to given message code.
+ */
+static int legacyParseCommand(char *command)
+{
+    if (!strcmp(command, "REG"))
+        return REGISTER;
+    else if (!strcmp(command, "UNR"))
+        return UNREGISTER;
+    else if (!strcmp(command, "LOG"))
+        return LOGIN;
+    else if (!strcmp(command, "OUT"))
+        return LOGOUT;
+    else if (!strcmp(command, "GLS"))
+        return GROUPS;
+    else if (!strcmp(command, "GSR"))
+        return SUBSCRIBE;
+    else if (!strcmp(command, "GUR"))
+        return UNSUBSCRIBE;
+    else if (!strcmp(command, "GLM"))
+        return MY_GROUPS;
+    else if (!strcmp(command, "ULS"))
+        return ULIST;
+    else if (!strcmp(command, "PST"))
+        return POST;
+    else if (!strcmp(command, "RTV"))
+        return RETRIEVE;
+    else if (!strcmp(command, "STA"))
+        return STATS;
+    else if (!strcmp(command, "PSH"))
+        return STREAM;
+    else if (!strcmp(command, "RTS"))
+        return RETRIEVE_ALL;
+    else if (!strcmp(command, "PSB"))
+        return POST_BATCH;
+    else if (!strcmp(command, "BIN"))
+        return BINARY;
+    else if (!strcmp(command, "UPS"))
+        return UPLOAD_START;
+    else if (!strcmp(command, "UPQ"))
+        return UPLOAD_QUERY;
+    else if (!strcmp(command, "UPD"))
+        return UPLOAD_DATA;
+    else if (!strcmp(command, "RTF"))
+        return RETRIEVE_FILE;
+    else if (!strcmp(command, "UPC"))
+        return UPLOAD_CHUNK;
+    else if (!strcmp(command, "UPF"))
+        return UPLOAD_FINISH;
+    else if (!strcmp(command, "RPL"))
+        return REPLICATE;
+    else if (!strcmp(command, "LAT"))
+        return LATENCY;
+    return INVALID_COMMAND;
+}
+
+/**
+ * @brief Fills the traffic with real message codes and garbage (random bytes of random length, including
+ * codes that differ from real ones in a single byte).
+ *
+ * @param traffic list of codes to be filled.
+ * @param garbage percentage of garbage.
+ */
+static void buildTraffic(char traffic[][BENCH_CODE_SIZE], int garbage)
+{
+    int numCommon = sizeof(commonCodes) / sizeof(char *);
+    srand(41);
+    for (int i = 0; i < BENCH_TRAFFIC_SIZE; ++i)
+    {
+        strcpy(traffic[i], commonCodes[rand() % numCommon]);
+        if (rand() % 100 >= garbage)
+        {
+            continue;
+        }
+        if (rand() % 2)
+        { // Near miss
+            traffic[i][rand() % 3] = 'A' + rand() % 26;
+        }
+        else
+        {
+            int len = rand() % BENCH_CODE_SIZE;
+            for (int j = 0; j < len; ++j)
+            {
+                traffic[i][j] = 1 + rand() % 255;
+            }
+            traffic[i][len] = '\0';
+        }
+    }
+}
+
+/**
+ * @brief Times parsing the traffic over and over.
+ *
+ * @param name name of the run.
+ * @param traffic list of codes.
+ * @param numCodes number of codes to parse.
+ * @param parse function that parses a code.
+ */
+static void runBench(const char *name, char traffic[][BENCH_CODE_SIZE], long numCodes, int (*parse)(char *))
+{
+    struct timespec begin, finish;
+    long invalid = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (long i = 0; i < numCodes; ++i)
+    {
+        invalid += parse(traffic[i % BENCH_TRAFFIC_SIZE]) == INVALID_COMMAND;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double secs = (finish.tv_sec - begin.tv_sec) + (finish.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-28s %10ld codes %12.0f codes/s %8.1f ns/code (%ld invalid)\n", name, numCodes, numCodes / secs, secs * 1e9 / numCodes, invalid);
+}
+
+int main(int argc, char *argv[])
+{
+    long numCodes = BENCH_DEFAULT_CODES;
+    int garbage = BENCH_DEFAULT_GARBAGE;
+    parseArgs(argc, argv, &numCodes, &garbage);
+
+    for (int cmd = 1; cmd < PROTOCOL_NUM_COMMANDS; ++cmd)
+    {
+        if (protocolCommandCode(cmd) != NULL && parseDSClientCommand((char *)protocolCommandCode(cmd)) != cmd)
+        {
+            fprintf(stderr, "[-] %s doesn't hash back to its command\n", protocolCommandCode(cmd));
+            exit(EXIT_FAILURE);
+        }
+    }
+    static char traffic[BENCH_TRAFFIC_SIZE][BENCH_CODE_SIZE];
+    buildTraffic(traffic, garbage);
+    for (int i = 0; i < BENCH_TRAFFIC_SIZE; ++i)
+    { // Both must agree before their speed means anything
+        if (parseDSClientCommand(traffic[i]) != legacyParseCommand(traffic[i]))
+        {
+            fprintf(stderr, "[-] The opcode table and the strcmp chain disagree on \"%s\"\n", traffic[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("[+] Dispatch benchmark: %ld codes, %d%% garbage\n", numCodes, garbage);
+    runBench("strcmp chain (legacy)", traffic, numCodes, legacyParseCommand);
+    runBench("perfect-hash opcode table", traffic, numCodes, parseDSClientCommand);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,771 @@
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* Default number of simulated users (one thread each) */
+#define BENCH_DEFAULT_USERS 50
+
+/* Default length of a run in seconds */
+#define BENCH_DEFAULT_SECS 10
+
+/* Default attachment size in bytes of the PST requests with a file */
+#define BENCH_DEFAULT_FILESIZE 4096
+
+/* Default mix of requests (weight of each operation) */
+#define BENCH_DEFAULT_MIX "REG:2,LOG:8,GLS:10,GSR:5,GLM:10,ULS:5,PST:20,PSTF:5,RTV:35"
+
+/* First UID of the simulated users and the password they all share */
+#define BENCH_DEFAULT_BASE_UID 20000
+#define BENCH_PASSWORD "dsbench1"
+
+/* Name of the group every simulated user posts to */
+#define BENCH_GROUP_NAME "dsbench"
+
+/* Number of seconds a request may take before it counts as an error */
+#define BENCH_TIMEOUT_SECS 5
+
+/* Size of the buffer requests are built in and replies are read to */
+#define BENCH_BUF_SIZE 65536
+
+/* HDR histogram layout: 2^11 sub-buckets keep 3 significant digits, values up to 2^32 us (over an hour) */
+#define HDR_SUB_BUCKET_BITS 11
+#define HDR_SUB_BUCKET_HALF (1 << (HDR_SUB_BUCKET_BITS - 1))
+#define HDR_MAX_BITS 32
+#define HDR_NUM_COUNTS ((HDR_MAX_BITS - HDR_SUB_BUCKET_BITS + 2) * HDR_SUB_BUCKET_HALF)
+
+/* Number of percentile ticks printed for every halving of the distance to 100% */
+#define HDR_TICKS_PER_HALF 5
+
+/* Operations a simulated user runs */
+enum benchop
+{
+    OP_REG,
+    OP_LOG,
+    OP_GLS,
+    OP_GSR,
+    OP_GLM,
+    OP_ULS,
+    OP_PST,
+    OP_PSTF,
+    OP_RTV,
+    BENCH_NUM_OPS
+};
+
+static const char *opNames[BENCH_NUM_OPS] = {"REG", "LOG", "GLS", "GSR", "GLM", "ULS", "PST", "PSTF", "RTV"};
+
+/* Struct that keeps an HDR latency histogram in microseconds. Every user thread records into the same
+ * histograms with atomic increments, so a run costs the same memory however many users it simulates */
+typedef struct histogram
+{
+    unsigned long counts[HDR_NUM_COUNTS];
+    unsigned long total;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long errors;
+} Histogram;
+
+/* Struct that keeps the state of a simulated user */
+typedef struct benchuser
+{
+    pthread_t thread;
+    char UID[CLIENT_UID_SIZE];
+    int fdUDP; // connected to the DS so that only its replies are received
+    unsigned int seed;
+    char buf[BENCH_BUF_SIZE];
+} BenchUser;
+
+/* Benchmark settings */
+static int numUsers = BENCH_DEFAULT_USERS;
+static int runSecs = BENCH_DEFAULT_SECS;
+static double targetRate = 0; // requests per second over all users (0 = closed loop)
+static long fileSize = BENCH_DEFAULT_FILESIZE;
+static int baseUID = BENCH_DEFAULT_BASE_UID;
+static int fullHistograms = 0;
+static char addrDS[DS_ADDR_SIZE] = DS_DEFAULT_ADDR;
+static char portDS[DS_PORT_SIZE] = DS_DEFAULT_PORT;
+static int mixWeights[BENCH_NUM_OPS];
+static int mixTotal;
+
+/* Shared state of a run */
+static struct addrinfo *resUDP, *resTCP;
+static char benchGID[DS_GID_SIZE];
+static char *attachment;
+static int lastMID; // highest MID posted so far (read by RTV)
+static struct timespec runEnd;
+static Histogram histograms[BENCH_NUM_OPS];
+
+/**
+ * @brief Returns the microseconds elapsed between two instants.
+ *
+ * @param from first instant.
+ * @param to second instant.
+ * @return microseconds from from to to (negative if to comes first).
+ */
+static long elapsedUsec(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/**
+ * @brief Adds microseconds to an instant.
+ *
+ * @param t instant to move.
+ * @param usec microseconds to add.
+ */
+static void addUsec(struct timespec *t, long usec)
+{
+    t->tv_sec += usec / 1000000;
+    t->tv_nsec += (usec % 1000000) * 1000;
+    if (t->tv_nsec >= 1000000000)
+    {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * @brief Finds the counts index of a value: the first HDR_SUB_BUCKET_HALF * 2 values have a count each, then
+ * every power of two is split in HDR_SUB_BUCKET_HALF counts.
+ *
+ * @param value value in microseconds.
+ * @return index in counts.
+ */
+static int hdrIndex(unsigned long value)
+{
+    int bucket = (63 - __builtin_clzl(value | ((1UL << HDR_SUB_BUCKET_BITS) - 1))) - (HDR_SUB_BUCKET_BITS - 1);
+    int sub = value >> bucket;
+    return bucket * HDR_SUB_BUCKET_HALF + sub;
+}
+
+/**
+ * @brief Finds the highest value that shares a count with the values of a counts index.
+ *
+ * @param index index in counts.
+ * @return highest value in microseconds of the index.
+ */
+static unsigned long hdrValue(int index)
+{
+    int bucket = index / HDR_SUB_BUCKET_HALF - 1;
+    int sub = index % HDR_SUB_BUCKET_HALF + HDR_SUB_BUCKET_HALF;
+    if (bucket < 0)
+    {
+        bucket = 0;
+        sub -= HDR_SUB_BUCKET_HALF;
+    }
+    return ((unsigned long)(sub + 1) << bucket) - 1;
+}
+
+/**
+ * @brief Records a latency in a histogram.
+ *
+ * @param h histogram.
+ * @param usec latency in microseconds.
+ * @param ok 0 if the request failed (it's counted as an error as well).
+ */
+static void hdrRecord(Histogram *h, long usec, int ok)
+{
+    unsigned long value = (usec < 0) ? 0 : MIN((unsigned long)usec, (1UL << HDR_MAX_BITS) - 1);
+    __atomic_fetch_add(&h->counts[hdrIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    if (!ok)
+    {
+        __atomic_fetch_add(&h->errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Finds the value at a percentile of a histogram.
+ *
+ * @param h histogram.
+ * @param percentile percentile between 0 and 100.
+ * @return highest value of the count the percentile falls in (in microseconds).
+ */
+static unsigned long hdrPercentile(const Histogram *h, double percentile)
+{
+    unsigned long wanted = (unsigned long)(percentile / 100 * h->total + 0.5);
+    unsigned long seen = 0;
+    wanted = MAX(wanted, 1);
+    for (int i = 0; i < HDR_NUM_COUNTS; ++i)
+    {
+        seen += h->counts[i];
+        if (seen >= wanted)
+        {
+            return MIN(hdrValue(i), h->max);
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Adds the counts of a histogram to another one.
+ *
+ * @param to histogram that receives the counts.
+ * @param from histogram whose counts are added.
+ */
+static void hdrAdd(Histogram *to, const Histogram *from)
+{
+    for (int i = 0; i < HDR_NUM_COUNTS; ++i)
+    {
+        to->counts[i] += from->counts[i];
+    }
+    to->total += from->total;
+    to->sum += from->sum;
+    to->max = MAX(to->max, from->max);
+    to->errors += from->errors;
+}
+
+/**
+ * @brief Prints the percentile distribution of a histogram in the HdrHistogram text format.
+ *
+ * @param name name of the histogram.
+ * @param h histogram.
+ */
+static void hdrPrintDistribution(const char *name, const Histogram *h)
+{
+    printf("\n%s\n%12s %14s %10s %14s\n", name, "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (double half = 100; half * h->total >= 100; half /= 2)
+    { // Ticks get closer as they approach 100% until a single request is left
+        for (int t = 0; t < HDR_TICKS_PER_HALF; ++t)
+        {
+            double p = 100 - half + half / 2 * t / HDR_TICKS_PER_HALF;
+            unsigned long value = hdrPercentile(h, p);
+            unsigned long count = 0;
+            for (int i = 0; i < HDR_NUM_COUNTS && hdrValue(i) <= value; ++i)
+            {
+                count += h->counts[i];
+            }
+            printf("%12lu %14.12f %10lu %14.2f\n", value, p / 100, count, 100 / (100 - p));
+        }
+    }
+    printf("%12lu %14.12f %10lu\n", h->max, 1.0, h->total);
+}
+
+/**
+ * @brief Parses a mix of operations (OP:weight,OP:weight,...).
+ *
+ * @param mix string that contains the mix.
+ * @return 1 if the mix is valid, 0 otherwise.
+ */
+static int parseMix(const char *mix)
+{
+    char copy[BENCH_BUF_SIZE];
+    if (strlen(mix) >= sizeof(copy))
+    {
+        return 0;
+    }
+    strcpy(copy, mix);
+    memset(mixWeights, 0, sizeof(mixWeights));
+    mixTotal = 0;
+    for (char *tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        char *sep = strchr(tok, ':');
+        if (sep == NULL || !isNumber(sep + 1))
+        {
+            return 0;
+        }
+        *sep = '\0';
+        int op = 0;
+        while (op < BENCH_NUM_OPS && strcmp(tok, opNames[op]))
+        {
+            op++;
+        }
+        if (op == BENCH_NUM_OPS)
+        {
+            return 0;
+        }
+        mixWeights[op] = atoi(sep + 1);
+        mixTotal += mixWeights[op];
+    }
+    return mixTotal > 0;
+}
+
+/**
+ * @brief Parses the program's arguments.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ */
+static void parseArgs(int argc, char *argv[])
+{
+    const char *mix = BENCH_DEFAULT_MIX;
+    int ok = 1;
+    for (int i = 1; i < argc && ok; ++i)
+    {
+        if (!strcmp(argv[i], "-H"))
+        {
+            fullHistograms = 1;
+            continue;
+        }
+        if (i == argc - 1)
+        {
+            ok = 0;
+            break;
+        }
+        char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "-n"))
+        {
+            ok = validAddress(value) && strlen(value) < DS_ADDR_SIZE;
+            if (ok)
+            {
+                strcpy(addrDS, value);
+            }
+        }
+        else if (!strcmp(argv[i - 1], "-p"))
+        {
+            ok = validPort(value);
+            if (ok)
+            {
+                strcpy(portDS, value);
+            }
+        }
+        else if (!strcmp(argv[i - 1], "-c"))
+        {
+            numUsers = atoi(value);
+        }
+        else if (!strcmp(argv[i - 1], "-d"))
+        {
+            runSecs = atoi(value);
+        }
+        else if (!strcmp(argv[i - 1], "-r"))
+        {
+            targetRate = atof(value);
+        }
+        else if (!strcmp(argv[i - 1], "-f"))
+        {
+            fileSize = atol(value);
+        }
+        else if (!strcmp(argv[i - 1], "-b"))
+        {
+            baseUID = atoi(value);
+        }
+        else if (!strcmp(argv[i - 1], "-m"))
+        {
+            mix = value;
+        }
+        else
+        {
+            ok = 0;
+        }
+    }
+    if (!ok || !parseMix(mix) || numUsers <= 0 || runSecs <= 0 || targetRate < 0 || fileSize <= 0 || fileSize > 9999999999 ||
+        baseUID < 10000 || baseUID + numUsers > 100000)
+    {
+        fprintf(stderr, "[-] Usage: ./dsbench [-n DSIP] [-p DSport] [-c users] [-d seconds] [-r requests/s] [-f filesize] [-b baseUID] [-m OP:weight,...] [-H]\n");
+        fprintf(stderr, "[-] Operations: REG LOG GLS GSR GLM ULS PST PSTF (PST with a file) RTV. Default mix: %s\n", BENCH_DEFAULT_MIX);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Sends a request to the DS over UDP and waits for its reply.
+ *
+ * @param u simulated user (its buffer receives the reply).
+ * @param request string that contains the request.
+ * @return number of bytes of the reply, -1 if it failed or timed out.
+ */
+static int requestUDP(BenchUser *u, const char *request)
+{
+    if (send(u->fdUDP, request, strlen(request), 0) == -1)
+    {
+        return -1;
+    }
+    int n = recv(u->fdUDP, u->buf, BENCH_BUF_SIZE - 1, 0);
+    if (n == -1)
+    {
+        return -1;
+    }
+    u->buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief Sends a request to the DS over a new TCP connection and reads the whole reply (until the DS closes it).
+ * A retrieve is confirmed once its closing nl arrived.
+ *
+ * @param u simulated user (its buffer receives the start of the reply).
+ * @param request request to send.
+ * @param len number of bytes of the request.
+ * @param confirm 1 if the DS waits for a confirmation after the reply.
+ * @return number of bytes of the reply, -1 if it failed or timed out.
+ */
+static long requestTCP(BenchUser *u, const char *request, size_t len, int confirm)
+{
+    int fd = socket(resTCP->ai_family, resTCP->ai_socktype, resTCP->ai_protocol);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    struct timeval timeout = {BENCH_TIMEOUT_SECS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, resTCP->ai_addr, resTCP->ai_addrlen) == -1 || sendData(fd, (unsigned char *)request, len) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    long total = 0;
+    char chunk[BENCH_BUF_SIZE];
+    while (1)
+    {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            close(fd);
+            return (n == 0 && total > 0) ? total : -1;
+        }
+        if (total < BENCH_BUF_SIZE - 1)
+        { // Keep the beginning of the reply to check its status
+            size_t keep = MIN((size_t)n, (size_t)(BENCH_BUF_SIZE - 1 - total));
+            memcpy(u->buf + total, chunk, keep);
+            u->buf[total + keep] = '\0';
+        }
+        total += n;
+        if (confirm && chunk[n - 1] == '\n')
+        { // Attachments have no nl so this is the end of the reply
+            write(fd, "OK\n", 3);
+            shutdown(fd, SHUT_WR);
+            confirm = 0;
+        }
+    }
+}
+
+/**
+ * @brief Checks whether a reply has the expected code and a successful status.
+ *
+ * @param reply string that contains the reply.
+ * @param code expected reply code.
+ * @return 1 if the reply is successful, 0 otherwise.
+ */
+static int replyOK(const char *reply, const char *code)
+{
+    return !strncmp(reply, code, PROTOCOL_CODE_SIZE - 1) && reply[PROTOCOL_CODE_SIZE - 1] == ' ' &&
+           strncmp(reply + PROTOCOL_CODE_SIZE, "NOK", 3) && strncmp(reply + PROTOCOL_CODE_SIZE, "E_", 2);
+}
+
+/**
+ * @brief Runs an operation as a simulated user.
+ *
+ * @param u simulated user.
+ * @param op operation.
+ * @return 1 if the DS answered successfully, 0 otherwise.
+ */
+static int runOperation(BenchUser *u, int op)
+{
+    char request[BENCH_BUF_SIZE];
+    char text[PROTOCOL_TEXT_SIZE];
+    long len;
+    switch (op)
+    {
+    case OP_REG: // The user already exists, so this measures the DUP path
+        sprintf(request, "REG %s %s\n", u->UID, BENCH_PASSWORD);
+        return requestUDP(u, request) > 0 && replyOK(u->buf, "RRG");
+    case OP_LOG:
+        sprintf(request, "LOG %s %s\n", u->UID, BENCH_PASSWORD);
+        return requestUDP(u, request) > 0 && replyOK(u->buf, "RLO");
+    case OP_GLS:
+        return requestUDP(u, "GLS\n") > 0 && replyOK(u->buf, "RGL");
+    case OP_GSR:
+        sprintf(request, "GSR %s %s %s\n", u->UID, benchGID, BENCH_GROUP_NAME);
+        return requestUDP(u, request) > 0 && replyOK(u->buf, "RGS");
+    case OP_GLM:
+        sprintf(request, "GLM %s\n", u->UID);
+        return requestUDP(u, request) > 0 && replyOK(u->buf, "RGM");
+    case OP_ULS:
+        len = sprintf(request, "ULS %s\n", benchGID);
+        return requestTCP(u, request, len, 0) > 0 && replyOK(u->buf, "RUL");
+    case OP_PST:
+    case OP_PSTF:
+        sprintf(text, "post %u from %s", rand_r(&u->seed), u->UID);
+        if (op == OP_PST)
+        {
+            len = sprintf(request, "PST %s %s %zu %s\n", u->UID, benchGID, strlen(text), text);
+            if (requestTCP(u, request, len, 0) <= 0)
+            {
+                return 0;
+            }
+        }
+        else
+        { // The attachment goes in the same request buffer when it fits
+            len = sprintf(request, "PST %s %s %zu %s bench.txt %ld ", u->UID, benchGID, strlen(text), text, fileSize);
+            char *full = (len + fileSize + 1 <= sizeof(request)) ? request : malloc(len + fileSize + 1);
+            if (full == NULL)
+            {
+                return 0;
+            }
+            if (full != request)
+            {
+                memcpy(full, request, len);
+            }
+            memcpy(full + len, attachment, fileSize);
+            full[len + fileSize] = '\n';
+            long n = requestTCP(u, full, len + fileSize + 1, 0);
+            if (full != request)
+            {
+                free(full);
+            }
+            if (n <= 0)
+            {
+                return 0;
+            }
+        }
+        int mid = atoi(u->buf + PROTOCOL_CODE_SIZE);
+        if (!replyOK(u->buf, "RPT") || mid <= 0)
+        {
+            return 0;
+        }
+        int last = __atomic_load_n(&lastMID, __ATOMIC_RELAXED);
+        while (mid > last && !__atomic_compare_exchange_n(&lastMID, &last, mid, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        return 1;
+    case OP_RTV: // The last messages, as a user catching up would ask for them
+        len = sprintf(request, "RTV %s %s %04d\n", u->UID, benchGID, MAX(__atomic_load_n(&lastMID, __ATOMIC_RELAXED) - 9, 1));
+        return requestTCP(u, request, len, 1) > 0 && replyOK(u->buf, "RRT");
+    }
+    return 0;
+}
+
+/**
+ * @brief Picks the next operation of a simulated user according to the mix.
+ *
+ * @param u simulated user.
+ * @return operation.
+ */
+static int pickOperation(BenchUser *u)
+{
+    int r = rand_r(&u->seed) % mixTotal;
+    int op = 0;
+    while (r >= mixWeights[op])
+    {
+        r -= mixWeights[op++];
+    }
+    return op;
+}
+
+/**
+ * @brief Registers a simulated user, logs it in and subscribes it to the benchmark group.
+ *
+ * @param u simulated user.
+ * @return 1 if the user is ready, 0 otherwise.
+ */
+static int setupUser(BenchUser *u)
+{
+    char request[BENCH_BUF_SIZE];
+    u->fdUDP = socket(resUDP->ai_family, resUDP->ai_socktype, resUDP->ai_protocol);
+    if (u->fdUDP == -1 || connect(u->fdUDP, resUDP->ai_addr, resUDP->ai_addrlen) == -1)
+    {
+        return 0;
+    }
+    struct timeval timeout = {BENCH_TIMEOUT_SECS, 0};
+    setsockopt(u->fdUDP, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sprintf(request, "REG %s %s\n", u->UID, BENCH_PASSWORD);
+    if (requestUDP(u, request) <= 0 || (strcmp(u->buf, "RRG OK\n") && strcmp(u->buf, "RRG DUP\n")))
+    {
+        return 0;
+    }
+    sprintf(request, "LOG %s %s\n", u->UID, BENCH_PASSWORD);
+    if (requestUDP(u, request) <= 0 || strcmp(u->buf, "RLO OK\n"))
+    {
+        return 0;
+    }
+    if (benchGID[0] == '\0')
+    { // Reuse the benchmark group of a previous run, otherwise create it
+        if (requestUDP(u, "GLS\n") <= 0 || strncmp(u->buf, "RGL ", 4))
+        {
+            return 0;
+        }
+        char *tok = strtok(u->buf + 4, " \n");
+        int numGroups = (tok != NULL) ? atoi(tok) : 0;
+        for (int i = 0; i < numGroups; ++i)
+        {
+            char *gid = strtok(NULL, " \n"), *name = strtok(NULL, " \n"), *mid = strtok(NULL, " \n");
+            if (gid != NULL && name != NULL && mid != NULL && !strcmp(name, BENCH_GROUP_NAME))
+            {
+                strcpy(benchGID, gid);
+                lastMID = atoi(mid);
+            }
+        }
+        if (benchGID[0] == '\0')
+        {
+            sprintf(request, "GSR %s 00 %s\n", u->UID, BENCH_GROUP_NAME);
+            if (requestUDP(u, request) <= 0 || strncmp(u->buf, "RGS NEW ", 8))
+            {
+                return 0;
+            }
+            strncpy(benchGID, u->buf + 8, DS_GID_SIZE - 1);
+        }
+        return 1;
+    }
+    sprintf(request, "GSR %s %s %s\n", u->UID, benchGID, BENCH_GROUP_NAME);
+    return requestUDP(u, request) > 0 && !strcmp(u->buf, "RGS OK\n");
+}
+
+/**
+ * @brief Runs the requests of a simulated user until the end of the run. In closed loop every request is sent
+ * as soon as the previous one is answered. In open loop requests are scheduled at a fixed rate and their latency
+ * is measured from the time they were due, so a DS that falls behind isn't hidden by the users waiting for it.
+ *
+ * @param arg simulated user.
+ * @return NULL.
+ */
+static void *runUser(void *arg)
+{
+    BenchUser *u = arg;
+    long intervalUsec = (targetRate > 0) ? (long)(1e6 * numUsers / targetRate) : 0;
+    struct timespec due, start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    if (intervalUsec > 0)
+    { // Spread the users over the first interval
+        addUsec(&due, rand_r(&u->seed) % intervalUsec);
+    }
+    while (1)
+    {
+        if (intervalUsec > 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (elapsedUsec(&start, &due) > 0)
+            {
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+            }
+            start = due;
+            addUsec(&due, intervalUsec);
+        }
+        else
+        {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+        if (elapsedUsec(&runEnd, &start) >= 0)
+        {
+            break;
+        }
+        int op = pickOperation(u);
+        int ok = runOperation(u, op);
+        clock_gettime(CLOCK_MONOTONIC, &finish);
+        hdrRecord(&histograms[op], elapsedUsec(&start, &finish), ok);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Prints a line of the results table.
+ *
+ * @param name name of the operation.
+ * @param h histogram of the operation.
+ * @param secs length of the run in seconds.
+ */
+static void printResult(const char *name, const Histogram *h, double secs)
+{
+    if (h->total == 0)
+    {
+        return;
+    }
+    printf("%-5s %9lu %7lu %9.1f %9.0f %9lu %9lu %9lu %9lu %9lu\n", name, h->total, h->errors, h->total / secs, (double)h->sum / h->total,
+           hdrPercentile(h, 50), hdrPercentile(h, 90), hdrPercentile(h, 99), hdrPercentile(h, 99.9), h->max);
+}
+
+int main(int argc, char *argv[])
+{
+    parseArgs(argc, argv);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(addrDS, portDS, &hints, &resUDP) != 0)
+    {
+        fprintf(stderr, "[-] Failed to get address of DS %s:%s\n", addrDS, portDS);
+        exit(EXIT_FAILURE);
+    }
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(addrDS, portDS, &hints, &resTCP) != 0)
+    {
+        fprintf(stderr, "[-] Failed to get address of DS %s:%s\n", addrDS, portDS);
+        exit(EXIT_FAILURE);
+    }
+    attachment = malloc(fileSize);
+    BenchUser *users = calloc(numUsers, sizeof(BenchUser));
+    if (attachment == NULL || users == NULL)
+    {
+        fprintf(stderr, "[-] Failed to allocate memory for the benchmark.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(attachment, 'f', fileSize);
+
+    // Users are set up one at a time (the first one finds or creates the group)
+    for (int i = 0; i < numUsers; ++i)
+    {
+        sprintf(users[i].UID, "%05d", baseUID + i);
+        users[i].seed = baseUID + i;
+        if (!setupUser(&users[i]))
+        {
+            fprintf(stderr, "[-] Failed to set up user %s (is the DS at %s:%s running with -i 0 -u 0?)\n", users[i].UID, addrDS, portDS);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("[+] DS benchmark: %d users, %s, %d s against %s:%s, group %s\n", numUsers,
+           (targetRate > 0) ? "open loop" : "closed loop", runSecs, addrDS, portDS, benchGID);
+    if (targetRate > 0)
+    {
+        printf("[+] Target rate: %.0f requests/s\n", targetRate);
+    }
+    struct timespec begin, finish;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    runEnd = begin;
+    runEnd.tv_sec += runSecs;
+    for (int i = 0; i < numUsers; ++i)
+    {
+        if (pthread_create(&users[i].thread, NULL, runUser, &users[i]) != 0)
+        {
+            fprintf(stderr, "[-] Failed to start user %s\n", users[i].UID);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < numUsers; ++i)
+    {
+        pthread_join(users[i].thread, NULL);
+        close(users[i].fdUDP);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double secs = elapsedUsec(&begin, &finish) / 1e6;
+
+    static Histogram all;
+    printf("%-5s %9s %7s %9s %9s %9s %9s %9s %9s %9s\n", "op", "requests", "errors", "req/s", "mean(us)", "p50(us)", "p90(us)",
+           "p99(us)", "p99.9(us)", "max(us)");
+    for (int op = 0; op < BENCH_NUM_OPS; ++op)
+    {
+        printResult(opNames[op], &histograms[op], secs);
+        hdrAdd(&all, &histograms[op]);
+    }
+    printResult("ALL", &all, secs);
+    if (fullHistograms)
+    {
+        for (int op = 0; op < BENCH_NUM_OPS; ++op)
+        {
+            if (histograms[op].total > 0)
+            {
+                hdrPrintDistribution(opNames[op], &histograms[op]);
+            }
+        }
+    }
+    freeaddrinfo(resUDP);
+    freeaddrinfo(resTCP);
+    free(attachment);
+    free(users);
+    exit(EXIT_SUCCESS);
+}
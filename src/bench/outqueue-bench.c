@@ -0,0 +1,313 @@
+#include "../centralizedmsg-api-constants.h"
+#include "../server/ds-api/ds-outqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+/* Default number of throttled readers */
+#define BENCH_DEFAULT_CONNS 200
+
+/* Default number of messages retrieved by each reader: enough for a reader's reply to be far bigger than the high
+ * watermark (as with a streaming retrieve, which has no 20 message cap) so that the backpressure shows */
+#define BENCH_DEFAULT_MSGS 200
+
+/* Default attachment size in bytes (one in every BENCH_FILE_EVERY messages has one) */
+#define BENCH_DEFAULT_FILESIZE 65536
+#define BENCH_FILE_EVERY 4
+
+/* Default number of bytes each reader takes per tick */
+#define BENCH_DEFAULT_RATE 4096
+
+/* Socket buffer sizes used to make the readers' slowness visible to the writers */
+#define BENCH_SOCKBUF_SIZE 16384
+
+/* Struct that keeps the state of a simulated retrieve towards a throttled reader */
+typedef struct benchconn
+{
+    OutQueue q;
+    int readerFd;
+    int produced; // messages produced so far
+    int paused;   // producer was stopped by the high watermark
+    int done;
+    long expected; // bytes the reader must receive
+    long received;
+    size_t peakQueued;
+} BenchConn;
+
+/* Struct that keeps the results of a run */
+typedef struct benchresult
+{
+    double secs;
+    long totalBytes;
+    size_t peakQueued, peakBuffered, peakConnQueued;
+    int peakFiles;
+    double fairness;
+} BenchResult;
+
+static int numConns = BENCH_DEFAULT_CONNS;
+static int numMsgs = BENCH_DEFAULT_MSGS;
+static long fileSize = BENCH_DEFAULT_FILESIZE;
+static int readRate = BENCH_DEFAULT_RATE;
+static char filePath[] = "/tmp/outqueue-bench-XXXXXX";
+
+/**
+ * @brief Parses the program's arguments.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ */
+static void parseArgs(int argc, char *argv[])
+{
+    for (int i = 1; i < argc - 1; i += 2)
+    {
+        if (!strcmp(argv[i], "-c"))
+            numConns = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-m"))
+            numMsgs = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-f"))
+            fileSize = atol(argv[i + 1]);
+        else if (!strcmp(argv[i], "-r"))
+            readRate = atoi(argv[i + 1]);
+    }
+    if (numConns <= 0 || numMsgs <= 0 || fileSize < 0 || readRate <= 0)
+    {
+        fprintf(stderr, "[-] Usage: ./outqueue-bench [-c readers] [-m messages] [-f filesize] [-r bytes/tick]\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Produces the next message of a retrieve just like retrieveDSGroupMessages does.
+ *
+ * @param c connection being produced to.
+ * @return number of bytes produced, -1 on failure.
+ */
+static long produceMessage(BenchConn *c)
+{
+    char header[DS_MSGTEXTINFO_SIZE + DS_MSGFILEINFO_SIZE];
+    char text[PROTOCOL_TEXT_SIZE];
+    memset(text, 't', PROTOCOL_TEXT_SIZE - 1);
+    text[PROTOCOL_TEXT_SIZE - 1] = '\0';
+    int len = sprintf(header, " %04d 12345 %d %s", ++c->produced, PROTOCOL_TEXT_SIZE - 1, text);
+    int hasFile = (c->produced % BENCH_FILE_EVERY == 0);
+    if (hasFile)
+    {
+        len += sprintf(header + len, " / bench.txt %ld ", fileSize);
+    }
+    if (c->produced == numMsgs)
+    { // Every reply ends with a nl
+        header[len++] = '\n';
+    }
+    if (!outqPushBuffer(&c->q, header, len) || (hasFile && !outqPushFile(&c->q, filePath, 0, fileSize)))
+    {
+        return -1;
+    }
+    return len + (hasFile ? fileSize : 0);
+}
+
+/**
+ * @brief Computes Jain's fairness index of the bytes received by each reader.
+ *
+ * @param conns all connections.
+ * @return index between 1/numConns (one reader got everything) and 1 (all got the same).
+ */
+static double jainIndex(BenchConn *conns)
+{
+    double sum = 0, sumSq = 0;
+    for (int i = 0; i < numConns; ++i)
+    {
+        sum += conns[i].received;
+        sumSq += (double)conns[i].received * conns[i].received;
+    }
+    return (sumSq == 0) ? 1 : (sum * sum) / (numConns * sumSq);
+}
+
+/**
+ * @brief Runs every retrieve to completion through its output queue in a single event loop.
+ *
+ * @param high high watermark of the queues.
+ * @param low low watermark of the queues.
+ * @param res results of the run.
+ */
+static void runBench(size_t high, size_t low, BenchResult *res)
+{
+    BenchConn *conns = calloc(numConns, sizeof(BenchConn));
+    struct pollfd *pfds = calloc(numConns, sizeof(struct pollfd));
+    char *readBuf = malloc(readRate);
+    if (conns == NULL || pfds == NULL || readBuf == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    int bufSize = BENCH_SOCKBUF_SIZE;
+    for (int i = 0; i < numConns; ++i)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        {
+            perror("[-] Failed to create socket pair");
+            exit(EXIT_FAILURE);
+        }
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+        setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+        fcntl(sv[1], F_SETFL, O_NONBLOCK);
+        outqInit(&conns[i].q, sv[0], high, low);
+        conns[i].readerFd = sv[1];
+    }
+    memset(res, 0, sizeof(BenchResult));
+    res->fairness = -1;
+
+    struct timespec begin, finish;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    long totalExpected = 0, totalReceived = 0;
+    int numDone = 0;
+    while (numDone < numConns)
+    {
+        // Producers run until their queue reaches the high watermark
+        size_t queued = 0, buffered = 0;
+        int files = 0;
+        for (int i = 0; i < numConns; ++i)
+        {
+            BenchConn *c = &conns[i];
+            while (!c->paused && c->produced < numMsgs)
+            {
+                long n = produceMessage(c);
+                if (n == -1)
+                {
+                    fprintf(stderr, "[-] Failed to queue message.\n");
+                    exit(EXIT_FAILURE);
+                }
+                c->expected += n;
+                totalExpected += (c->produced == numMsgs) ? c->expected : 0;
+                if (c->q.queuedBytes >= high)
+                {
+                    c->paused = 1;
+                }
+            }
+            c->peakQueued = MAX(c->peakQueued, c->q.queuedBytes);
+            queued += c->q.queuedBytes;
+            buffered += c->q.bufferedBytes;
+            files += c->q.numFiles;
+        }
+        res->peakQueued = MAX(res->peakQueued, queued);
+        res->peakBuffered = MAX(res->peakBuffered, buffered);
+        res->peakFiles = MAX(res->peakFiles, files);
+
+        // Writability events flush the queues
+        for (int i = 0; i < numConns; ++i)
+        {
+            pfds[i].fd = (conns[i].q.queuedBytes > 0) ? conns[i].q.fd : -1;
+            pfds[i].events = POLLOUT;
+        }
+        if (poll(pfds, numConns, 1) == -1)
+        {
+            perror("[-] Failed to poll");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < numConns; ++i)
+        {
+            if (pfds[i].revents & POLLOUT)
+            {
+                if (!outqFlush(&conns[i].q))
+                {
+                    exit(EXIT_FAILURE);
+                }
+                if (conns[i].paused && conns[i].q.queuedBytes <= low)
+                {
+                    conns[i].paused = 0;
+                }
+            }
+        }
+
+        // Each reader takes at most readRate bytes per tick
+        for (int i = 0; i < numConns; ++i)
+        {
+            BenchConn *c = &conns[i];
+            if (c->done)
+            {
+                continue;
+            }
+            ssize_t n = read(c->readerFd, readBuf, readRate);
+            if (n > 0)
+            {
+                c->received += n;
+                totalReceived += n;
+            }
+            if (c->produced == numMsgs && c->received == c->expected)
+            {
+                c->done = 1;
+                numDone++;
+            }
+        }
+        if (res->fairness < 0 && numDone < numConns && totalReceived * 2 >= totalExpected && totalExpected > 0 &&
+            conns[numConns - 1].produced == numMsgs)
+        { // Halfway through the whole transfer
+            res->fairness = jainIndex(conns);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    res->secs = (finish.tv_sec - begin.tv_sec) + (finish.tv_nsec - begin.tv_nsec) / 1e9;
+    res->totalBytes = totalReceived;
+    for (int i = 0; i < numConns; ++i)
+    {
+        res->peakConnQueued = MAX(res->peakConnQueued, conns[i].peakQueued);
+        outqFree(&conns[i].q);
+        close(conns[i].q.fd);
+        close(conns[i].readerFd);
+    }
+    free(conns);
+    free(pfds);
+    free(readBuf);
+}
+
+/**
+ * @brief Prints the results of a run.
+ *
+ * @param name name of the run.
+ * @param res results of the run.
+ */
+static void printResult(const char *name, BenchResult *res)
+{
+    printf("%-10s %7.2f s %8.1f MB/s %12zu %12zu %10d %14zu %10.3f\n", name, res->secs, res->totalBytes / res->secs / 1e6,
+           res->peakQueued, res->peakBuffered, res->peakFiles, res->peakConnQueued, res->fairness);
+}
+
+int main(int argc, char *argv[])
+{
+    parseArgs(argc, argv);
+
+    // Every queued file range keeps a file open
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    // Attachment shared by every message that has one
+    int fileFd = mkstemp(filePath);
+    if (fileFd == -1 || ftruncate(fileFd, fileSize) == -1)
+    {
+        perror("[-] Failed to create attachment");
+        exit(EXIT_FAILURE);
+    }
+    close(fileFd);
+
+    printf("[+] Output queue benchmark: %d throttled readers, %d messages (1 in %d with a %ld byte file), %d bytes/tick per reader\n",
+           numConns, numMsgs, BENCH_FILE_EVERY, fileSize, readRate);
+    printf("%-10s %9s %13s %12s %12s %10s %14s %10s\n", "mode", "time", "throughput", "peak queued", "peak memory",
+           "peak files", "peak per conn", "fairness");
+    BenchResult res;
+    runBench(DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK, &res);
+    printResult("bounded", &res);
+    runBench(SIZE_MAX, SIZE_MAX, &res);
+    printResult("unbounded", &res);
+    unlink(filePath);
+    exit(EXIT_SUCCESS);
+}
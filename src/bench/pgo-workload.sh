@@ -0,0 +1,82 @@
+#!/bin/sh
+# Workloads of make pgo, run from src against the DS (and user) built there:
+#   bench/pgo-workload.sh bench dsbench [dsbench args...]  load benchmark of the DS (report to STDOUT)
+#   bench/pgo-workload.sh train dsbench                    scripted user sessions and load that train a pgo-gen build
+# Every run starts its own DS in an empty directory and stops it with SIGTERM, so that its processes write their profile.
+
+if [ $# -lt 2 ] || { [ "$1" != "bench" ] && [ "$1" != "train" ]; }; then
+    echo "[-] Usage: bench/pgo-workload.sh bench|train dsbench [dsbench args...]" >&2
+    exit 1
+fi
+MODE=$1
+DSBENCH=$(realpath "$2")
+shift 2
+
+SRC=$(pwd)
+PORT=${PGO_PORT:-58049}
+RUN=$(mktemp -d /tmp/pgo-workload-XXXXXX)
+mkdir -p "$RUN/server/GROUPS" "$RUN/server/USERS"
+cd "$RUN" || exit 1
+
+# No admission control: the load must reach the DS
+"$SRC/DS" -p "$PORT" -i 0 -u 0 -g 0 -c 256 > ds.out 2>&1 &
+DS_PID=$!
+sleep 0.5
+if ! kill -0 $DS_PID 2> /dev/null; then
+    echo "[-] DS failed to start on port $PORT:" >&2
+    cat ds.out >&2
+    exit 1
+fi
+
+if [ "$MODE" = "train" ]; then
+    # Sessions of every command a user runs against a DS (text and binary protocol, UDP and TCP)
+    head -c 65536 /dev/urandom > attach.bin
+    head -c 300000 /dev/urandom > chunks.bin
+    printf '"first of a batch" attach.bin\n"second of a batch"\n' > batch.txt
+    for i in $(seq 10 29); do
+        GROUP="s 01 pgotrain"
+        [ "$i" = "10" ] && GROUP="s 0 pgotrain"
+        cat > session.txt << EOF
+reg 400$i pgotrain
+login 400$i pgotrain
+su
+gl
+$GROUP
+mgl
+sag 01
+sg
+ul
+post "plain post of 400$i"
+post "post of 400$i with a file" attach.bin
+pb batch.txt
+up "upload of 400$i" chunks.bin 2
+r 1
+r 1 meta
+ra 1
+dl 2
+gl
+logout
+exit
+EOF
+        timeout 60 "$SRC/user" -p "$PORT" < session.txt > /dev/null 2>&1
+    done
+    "$DSBENCH" -p "$PORT" -c 20 -d 5 -b 30000 > /dev/null
+else
+    "$DSBENCH" -p "$PORT" "$@"
+fi
+STATUS=$?
+
+# The UDP handler and the TCP acceptor exit on SIGTERM (it's sent again in case it landed between two requests)
+PIDS="$DS_PID $(pgrep -P $DS_PID -x DS)"
+for attempt in $(seq 1 25); do
+    ALIVE=""
+    for pid in $PIDS; do
+        kill -TERM $pid 2> /dev/null && ALIVE="$ALIVE $pid"
+    done
+    [ -z "$ALIVE" ] && break
+    sleep 0.2
+done
+kill -KILL $PIDS 2> /dev/null
+wait $DS_PID 2> /dev/null
+cd "$SRC" && rm -rf "$RUN"
+exit $STATUS
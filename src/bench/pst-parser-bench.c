@@ -0,0 +1,405 @@
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include "../server/ds-api/ds-pstparser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+/* Default number of PST requests sent on each run */
+#define BENCH_DEFAULT_REQUESTS 2000
+
+/* Default attachment size in bytes */
+#define BENCH_DEFAULT_FILESIZE 4096
+
+/* Fields of the generated PST requests (the text and the file bytes are generated too) */
+#define BENCH_UID "12345"
+#define BENCH_GID "01"
+#define BENCH_FNAME "bench.txt"
+
+/* Struct that keeps a generated PST request and where its variable fields are */
+typedef struct benchrequest
+{
+    char *data;       // the whole request (without the "PST " command code)
+    size_t len;       // size of data
+    const char *Text; // text inside data
+    int TSize;
+    const char *File; // file data inside data (NULL for a text only request)
+    long FSize;
+} BenchRequest;
+
+/* Number of read calls issued by the parser being measured */
+static long numReads;
+
+/**
+ * @brief Parses the program's arguments for the number of requests and the attachment size.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ * @param numRequests reference to the number of requests to send.
+ * @param fileSize reference to the attachment size.
+ */
+static void parseArgs(int argc, char *argv[], int *numRequests, long *fileSize)
+{
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (!strcmp(argv[i], "-n"))
+        {
+            *numRequests = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-f"))
+        {
+            *fileSize = atol(argv[++i]);
+        }
+    }
+    if (*numRequests <= 0 || *fileSize < 0)
+    {
+        fprintf(stderr, "[-] Usage: ./pst-parser-bench [-n requests] [-f filesize]\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Builds a PST request with the maximum text size. The text has spaces in it and the file has every byte
+ * value (spaces and nls included) so that the parsers can't get away with looking for delimiters.
+ *
+ * @param fileSize attachment size in bytes or -1 for a text only request.
+ * @param r reference to the request that is built.
+ */
+static void buildRequest(long fileSize, BenchRequest *r)
+{
+    char header[CLIENTDS_POSTWFILE_SIZE];
+    char text[PROTOCOL_TEXT_SIZE];
+    for (int i = 0; i < PROTOCOL_TEXT_SIZE - 1; ++i)
+    {
+        text[i] = (i % 7 == 6) ? ' ' : 'a' + i % 26;
+    }
+    text[PROTOCOL_TEXT_SIZE - 1] = '\0';
+    int headerLen;
+    if (fileSize < 0)
+    {
+        headerLen = sprintf(header, BENCH_UID " " BENCH_GID " %d %s\n", PROTOCOL_TEXT_SIZE - 1, text);
+    }
+    else
+    {
+        headerLen = sprintf(header, BENCH_UID " " BENCH_GID " %d %s " BENCH_FNAME " %ld ", PROTOCOL_TEXT_SIZE - 1, text, fileSize);
+    }
+    long dataSize = (fileSize < 0) ? 0 : fileSize;
+    r->data = malloc(headerLen + dataSize + 1);
+    if (r->data == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    memcpy(r->data, header, headerLen);
+    for (long i = 0; i < dataSize; ++i)
+    {
+        r->data[headerLen + i] = (char)(i * 7 + 3);
+    }
+    r->len = headerLen + dataSize;
+    r->TSize = PROTOCOL_TEXT_SIZE - 1;
+    r->Text = strstr(r->data, text);
+    r->FSize = fileSize;
+    r->File = NULL;
+    if (fileSize >= 0)
+    { // Requests with a file end with a nl after the data
+        r->File = r->data + headerLen;
+        r->data[r->len++] = '\n';
+    }
+}
+
+/**
+ * @brief Checks that the fields a parser got are the ones of the request that was sent, and stops the benchmark
+ * otherwise: a parser that gets them wrong isn't worth timing.
+ *
+ * @param r request that was sent.
+ * @param UID string that contains the parsed user ID.
+ * @param GID string that contains the parsed group ID.
+ * @param TSize parsed text size.
+ * @param Text buffer that contains the parsed text.
+ * @param FName string that contains the parsed file name (empty if there's no file).
+ * @param FSize parsed file size (-1 if there's no file).
+ */
+static void checkParsed(const BenchRequest *r, const char *UID, const char *GID, int TSize, const char *Text,
+                        const char *FName, long FSize)
+{
+    if (strcmp(UID, BENCH_UID) || strcmp(GID, BENCH_GID) || TSize != r->TSize || memcmp(Text, r->Text, TSize) ||
+        strcmp(FName, r->File == NULL ? "" : BENCH_FNAME) || FSize != r->FSize)
+    {
+        fprintf(stderr, "[-] Parsed %s %s %d %.*s %s %ld instead of the request that was sent\n", UID, GID, TSize, TSize, Text,
+                FName, FSize);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Checks that a piece of file data a parser handed over is the one that was sent at that offset, and stops
+ * the benchmark otherwise.
+ *
+ * @param r request that was sent.
+ * @param offset offset of the piece in the file.
+ * @param data buffer that contains the piece.
+ * @param len size of the piece.
+ */
+static void checkFileData(const BenchRequest *r, long offset, const char *data, size_t len)
+{
+    if (offset + (long)len > r->FSize || memcmp(data, r->File + offset, len))
+    {
+        fprintf(stderr, "[-] Parsed file bytes %ld to %ld don't match the ones that were sent\n", offset, offset + (long)len);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Reads one byte at a time just like the DS did before the streaming parser.
+ *
+ * @param fd file descriptor to read from.
+ * @param c buffer for the character.
+ * @return 1 if a byte was read, 0 otherwise.
+ */
+static int legacyReadChar(int fd, char *c)
+{
+    numReads++;
+    return readTCP(fd, c, 1) == 1;
+}
+
+/**
+ * @brief Reads a space terminated field one byte at a time just like the DS did before the streaming parser.
+ *
+ * @param fd file descriptor to read from.
+ * @param field buffer for the field.
+ * @param size size of the field buffer.
+ * @return 1 if the field was read, 0 otherwise.
+ */
+static int legacyReadField(int fd, char *field, int size)
+{
+    char c;
+    for (int i = 0; i < size; ++i)
+    {
+        if (!legacyReadChar(fd, &c))
+        {
+            return 0;
+        }
+        if (c == ' ')
+        {
+            field[i] = '\0';
+            return 1;
+        }
+        field[i] = c;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses a single PST request reading the header byte by byte (legacy DS behaviour). The attached file
+ * goes to /dev/null unchecked, just like the DS wrote it to its disk.
+ *
+ * @param fd file descriptor to read from.
+ * @param r request that was sent.
+ * @return 1 if the request was parsed, 0 otherwise.
+ */
+static int legacyParse(int fd, const BenchRequest *r)
+{
+    char UID[CLIENT_UID_SIZE], GID[DS_GID_SIZE], Text[PROTOCOL_TEXT_SIZE];
+    char TSizeBuf[PROTOCOL_TEXTSZ_SIZE] = "", FName[PROTOCOL_FNAME_SIZE] = "", FSizeBuf[PROTOCOL_FILESZ_SIZE] = "";
+    char c;
+    numReads += 2;
+    if (readTCP(fd, UID, CLIENT_UID_SIZE) != CLIENT_UID_SIZE || readTCP(fd, GID, DS_GID_SIZE) != DS_GID_SIZE)
+    {
+        return 0;
+    }
+    UID[CLIENT_UID_SIZE - 1] = '\0';
+    GID[DS_GID_SIZE - 1] = '\0';
+    if (!validUID(UID) || !validGID(GID))
+    { // Same validation as the DS
+        return 0;
+    }
+    if (!legacyReadField(fd, TSizeBuf, PROTOCOL_TEXTSZ_SIZE))
+    {
+        return 0;
+    }
+    int TSize = atoi(TSizeBuf);
+    numReads++;
+    if (readTCP(fd, Text, TSize) != TSize || !legacyReadChar(fd, &c))
+    {
+        return 0;
+    }
+    if (c == '\n')
+    {
+        checkParsed(r, UID, GID, TSize, Text, FName, -1);
+        return 1;
+    }
+    if (!legacyReadField(fd, FName, PROTOCOL_FNAME_SIZE) || !validFName(FName) ||
+        !legacyReadField(fd, FSizeBuf, PROTOCOL_FILESZ_SIZE))
+    {
+        return 0;
+    }
+    long FSize = atol(FSizeBuf);
+    checkParsed(r, UID, GID, TSize, Text, FName, FSize);
+    numReads += (FSize + FILEBUFFER_SIZE - 1) / FILEBUFFER_SIZE;
+    if (!recvFile(fd, "/dev/null", FSize))
+    {
+        return 0;
+    }
+    return legacyReadChar(fd, &c) && c == '\n';
+}
+
+/**
+ * @brief Parses PST requests with the streaming parser, checking every field and file byte against the request
+ * that was sent and handing the file data to /dev/null.
+ *
+ * @param fd file descriptor to read from.
+ * @param r request that was sent.
+ * @param numRequests number of back to back requests to parse.
+ * @param maxFeed most bytes handed to the parser at once (1 splits every request at each of its bytes).
+ * @return number of requests that were parsed.
+ */
+static int streamingParse(int fd, const BenchRequest *r, int numRequests, size_t maxFeed)
+{
+    static char connBuf[DS_CONNBUF_SIZE];
+    size_t start = 0, end = 0;
+    int parsed = 0;
+    int devNull = open("/dev/null", O_WRONLY);
+    PostParser parser;
+    pstParserInit(&parser);
+    while (parsed < numRequests)
+    {
+        if (start == end)
+        { // Every state still expects at least one more byte
+            int n = recvTCP(fd, connBuf, DS_CONNBUF_SIZE);
+            numReads++;
+            if (n <= 0)
+            {
+                break;
+            }
+            start = 0;
+            end = n;
+        }
+        size_t available = MIN(end - start, maxFeed);
+        if (parser.state == PST_FDATA)
+        {
+            long offset = parser.FRecv;
+            size_t numFileBytes = pstParserTakeFile(&parser, available);
+            checkFileData(r, offset, connBuf + start, numFileBytes);
+            if (write(devNull, connBuf + start, numFileBytes) != numFileBytes)
+            {
+                break;
+            }
+            start += numFileBytes;
+        }
+        else
+        {
+            start += pstParserFeed(&parser, connBuf + start, available);
+        }
+        if (parser.state == PST_ERROR)
+        {
+            break;
+        }
+        if (parser.state == PST_DONE)
+        { // Leftover bytes belong to the next request
+            checkParsed(r, parser.UID, parser.GID, parser.TSize, parser.Text, parser.hasFile == HAS_FILE ? parser.FName : "",
+                        parser.hasFile == HAS_FILE ? parser.FSize : -1);
+            if (parser.hasFile == HAS_FILE && parser.FRecv != r->FSize)
+            {
+                fprintf(stderr, "[-] Parsed %ld file bytes instead of %ld\n", parser.FRecv, r->FSize);
+                exit(EXIT_FAILURE);
+            }
+            parsed++;
+            pstParserInit(&parser);
+        }
+    }
+    close(devNull);
+    return parsed;
+}
+
+/**
+ * @brief Sends numRequests copies of a request through a socket pair and parses them.
+ *
+ * @param name name of the run.
+ * @param r request to send.
+ * @param numRequests number of requests to send.
+ * @param maxFeed most bytes the streaming parser is fed at once, 0 to use the legacy byte-wise parsing.
+ */
+static void runBench(const char *name, const BenchRequest *r, int numRequests, size_t maxFeed)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        perror("[-] Failed to create socket pair");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    { // Writer
+        close(sv[0]);
+        for (int i = 0; i < numRequests; ++i)
+        {
+            size_t sent = 0;
+            while (sent < r->len)
+            {
+                ssize_t n = write(sv[1], r->data + sent, r->len - sent);
+                if (n == -1)
+                {
+                    exit(EXIT_FAILURE);
+                }
+                sent += n;
+            }
+        }
+        close(sv[1]);
+        exit(EXIT_SUCCESS);
+    }
+    close(sv[1]);
+    struct timespec begin, finish;
+    numReads = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    int parsed = 0;
+    if (maxFeed > 0)
+    {
+        parsed = streamingParse(sv[0], r, numRequests, maxFeed);
+    }
+    else
+    {
+        while (parsed < numRequests && legacyParse(sv[0], r))
+        {
+            parsed++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    if (parsed < numRequests)
+    {
+        fprintf(stderr, "[-] %s only parsed %d of %d requests\n", name, parsed, numRequests);
+        exit(EXIT_FAILURE);
+    }
+    double secs = (finish.tv_sec - begin.tv_sec) + (finish.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-30s %8d reqs %10.0f reqs/s %8.2f us/req %8.1f reads/req\n", name, parsed, parsed / secs,
+           secs * 1e6 / (parsed ? parsed : 1), (double)numReads / (parsed ? parsed : 1));
+}
+
+int main(int argc, char *argv[])
+{
+    int numRequests = BENCH_DEFAULT_REQUESTS;
+    long fileSize = BENCH_DEFAULT_FILESIZE;
+    parseArgs(argc, argv, &numRequests, &fileSize);
+
+    BenchRequest textRequest, fileRequest;
+    buildRequest(-1, &textRequest);
+    buildRequest(fileSize, &fileRequest);
+
+    printf("[+] PST parsing benchmark: %d requests, %ld byte attachment\n", numRequests, fileSize);
+    runBench("legacy byte-wise (text)", &textRequest, numRequests, 0);
+    runBench("streaming parser (text)", &textRequest, numRequests, DS_CONNBUF_SIZE);
+    runBench("streaming 1 byte feeds (text)", &textRequest, numRequests, 1);
+    runBench("legacy byte-wise (file)", &fileRequest, numRequests, 0);
+    runBench("streaming parser (file)", &fileRequest, numRequests, DS_CONNBUF_SIZE);
+    runBench("streaming 1 byte feeds (file)", &fileRequest, numRequests, 1);
+
+    free(textRequest.data);
+    free(fileRequest.data);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,487 @@
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include "../server/centralizedmsg-server-api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* Default number of groups in the dataset (the DS holds at most 99) */
+#define BENCH_DEFAULT_GROUPS 8
+
+/* Default numbers of messages per group the operations are timed at (the dataset grows from one to the next) */
+#define BENCH_DEFAULT_LEVELS "100,1000,4000"
+
+/* Default number of users subscribed to each group */
+#define BENCH_DEFAULT_SUBSCRIBERS 40
+
+/* Default number of timed calls of each operation at each dataset size */
+#define BENCH_DEFAULT_CALLS 200
+
+/* Default attachment size distribution (weight:size in bytes, 0 = no attachment) */
+#define BENCH_DEFAULT_ATTACHMENTS "70:0,25:4096,5:262144"
+
+/* Maximum number of dataset sizes and of attachment sizes */
+#define BENCH_MAX_LEVELS 8
+#define BENCH_MAX_ATTACHMENTS 8
+
+/* First UID of the synthetic users and the password they all share */
+#define BENCH_BASE_UID 30000
+#define BENCH_PASSWORD "storage1"
+
+/* Text of every synthetic message */
+#define BENCH_TEXT "synthetic message written by the storage benchmark"
+
+/* Struct that keeps an attachment size and how often it shows up */
+typedef struct benchattachment
+{
+    int weight;
+    long size;
+} BenchAttachment;
+
+static int numGroups = BENCH_DEFAULT_GROUPS;
+static int levels[BENCH_MAX_LEVELS];
+static int numLevels;
+static int numSubscribers = BENCH_DEFAULT_SUBSCRIBERS;
+static int numCalls = BENCH_DEFAULT_CALLS;
+static BenchAttachment attachments[BENCH_MAX_ATTACHMENTS];
+static int numAttachments, totalWeight;
+static int keepDataset;
+
+/* Bytes of attachments written so far and the data they're cut from */
+static long datasetBytes;
+static char *attachmentData;
+static long maxAttachment;
+
+/* Timings of the calls of the operation being measured */
+static double *samples;
+
+/**
+ * @brief Prints the usage of the benchmark and exits.
+ *
+ */
+static void usage()
+{
+    fprintf(stderr, "[-] Usage: ./storage-bench [-g groups] [-m msgs,msgs,...] [-s subscribers] [-n calls] [-a weight:size,...] [-k]\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the program's arguments.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ */
+static void parseArgs(int argc, char *argv[])
+{
+    char levelList[256] = BENCH_DEFAULT_LEVELS, attachmentList[256] = BENCH_DEFAULT_ATTACHMENTS;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-k"))
+            keepDataset = 1;
+        else if (i == argc - 1)
+            usage();
+        else if (!strcmp(argv[i], "-g"))
+            numGroups = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m"))
+            snprintf(levelList, sizeof(levelList), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "-s"))
+            numSubscribers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n"))
+            numCalls = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-a"))
+            snprintf(attachmentList, sizeof(attachmentList), "%s", argv[++i]);
+        else
+            usage();
+    }
+    for (char *tok = strtok(levelList, ","); tok != NULL && numLevels < BENCH_MAX_LEVELS; tok = strtok(NULL, ","))
+    { // The dataset only grows
+        levels[numLevels] = atoi(tok);
+        if (levels[numLevels] < 1 || (numLevels > 0 && levels[numLevels] < levels[numLevels - 1]))
+            usage();
+        numLevels++;
+    }
+    for (char *tok = strtok(attachmentList, ","); tok != NULL && numAttachments < BENCH_MAX_ATTACHMENTS; tok = strtok(NULL, ","))
+    {
+        char *sep = strchr(tok, ':');
+        if (sep == NULL)
+            usage();
+        attachments[numAttachments].weight = atoi(tok);
+        attachments[numAttachments].size = atol(sep + 1);
+        if (attachments[numAttachments].weight < 0 || attachments[numAttachments].size < 0)
+            usage();
+        totalWeight += attachments[numAttachments].weight;
+        maxAttachment = MAX(maxAttachment, attachments[numAttachments].size);
+        numAttachments++;
+    }
+    // The last level must leave room for the messages created while timing createMessageInGroup
+    if (numGroups < 1 || numGroups > DS_MAX_NUM_GROUPS - 1 || numLevels == 0 || levels[numLevels - 1] + numCalls > 9999 || numSubscribers < 1 ||
+        numSubscribers > 34999 || numCalls < 1 || totalWeight == 0)
+        usage();
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return current time in microseconds.
+ */
+static double nowUsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * @brief Writes the GID of a synthetic group.
+ *
+ * @param GID buffer the GID is written to (DS_GID_SIZE bytes).
+ * @param g number of the group (1 to 99).
+ */
+static void formatGID(char *GID, unsigned g)
+{
+    sprintf(GID, "%02u", g % 100);
+}
+
+/**
+ * @brief Writes the UID of a synthetic user.
+ *
+ * @param UID buffer the UID is written to (CLIENT_UID_SIZE bytes).
+ * @param u number of the user (from 0).
+ */
+static void formatUID(char *UID, unsigned u)
+{
+    sprintf(UID, "%05u", (BENCH_BASE_UID + u) % 100000);
+}
+
+/**
+ * @brief Runs a DS UDP handler on a request and checks its reply.
+ *
+ * @param handler UDP handler of the request.
+ * @param request string that contains the request (without the nl).
+ * @param expected string that contains the beginning of the expected reply.
+ */
+static void runHandler(char *(*handler)(char **, int, char *), const char *request, const char *expected)
+{
+    char message[CLIENT_TO_DS_UDP_SIZE], reply[DS_TO_CLIENT_UDP_SIZE];
+    char *tokenList[CLIENT_NUMTOKENS];
+    int numTokens = 0;
+    strcpy(message, request);
+    for (char *tok = strtok(message, " "); tok != NULL && numTokens < CLIENT_NUMTOKENS; tok = strtok(NULL, " "))
+    {
+        tokenList[numTokens++] = tok;
+    }
+    handler(tokenList, numTokens, reply);
+    if (strncmp(reply, expected, strlen(expected)))
+    {
+        fprintf(stderr, "[-] \"%s\" got \"%s\" instead of \"%s\"\n", request, reply, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Creates the users and the groups of the dataset through the DS's own handlers: there are twice as many
+ * users as subscribers per group so that group g is followed by users g to g + subscribers - 1.
+ *
+ */
+static void createUsersAndGroups()
+{
+    char request[CLIENT_TO_DS_UDP_SIZE], UID[CLIENT_UID_SIZE], GID[DS_GID_SIZE];
+    for (int u = 0; u < 2 * numSubscribers; ++u)
+    {
+        formatUID(UID, u);
+        sprintf(request, "REG %s %s", UID, BENCH_PASSWORD);
+        runHandler(clientRegister, request, "RRG OK");
+        sprintf(request, "LOG %s %s", UID, BENCH_PASSWORD);
+        runHandler(clientLogin, request, "RLO OK");
+    }
+    for (int g = 1; g <= numGroups; ++g)
+    {
+        formatGID(GID, g);
+        formatUID(UID, g % (2 * numSubscribers));
+        sprintf(request, "GSR %s 00 bench%s", UID, GID);
+        runHandler(clientSubscribeGroup, request, "RGS NEW");
+        for (int s = 1; s < numSubscribers; ++s)
+        {
+            formatUID(UID, (g + s) % (2 * numSubscribers));
+            sprintf(request, "GSR %s %s bench%s", UID, GID, GID);
+            runHandler(clientSubscribeGroup, request, "RGS OK");
+        }
+    }
+}
+
+/**
+ * @brief Picks the size of the attachment of a new message from the distribution.
+ *
+ * @return attachment size in bytes (0 = no attachment).
+ */
+static long pickAttachmentSize()
+{
+    int r = rand() % totalWeight;
+    for (int i = 0; i < numAttachments; ++i)
+    {
+        if ((r -= attachments[i].weight) < 0)
+        {
+            return attachments[i].size;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Stores an attachment for a message the way a PST does (file and content hash).
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param size attachment size in bytes.
+ */
+static void writeAttachment(const char *GID, const char *MID, long size)
+{
+    char path[DS_GROUPMSGFILEPATH_SIZE], hash[DS_HASH_SIZE];
+    sprintf(path, "server/GROUPS/%s/MSG/%s/bench%s.bin", GID, MID, MID);
+    long offset = rand() % 251; // So that the files differ
+    if (!writeDSFile(path, attachmentData + offset, size))
+    {
+        exit(EXIT_FAILURE);
+    }
+    Sha256Ctx ctx;
+    sha256Init(&ctx);
+    sha256Update(&ctx, attachmentData + offset, size);
+    sha256FinalHex(&ctx, hash);
+    if (!writeGroupMessageHash(GID, MID, hash))
+    {
+        exit(EXIT_FAILURE);
+    }
+    datasetBytes += size;
+}
+
+/**
+ * @brief Adds messages to every group until each has a given number of them.
+ *
+ * @param msgs number of messages each group ends up with.
+ */
+static void growDataset(int msgs)
+{
+    char GID[DS_GID_SIZE], MID[DS_MID_SIZE];
+    for (int g = 1; g <= numGroups; ++g)
+    {
+        formatGID(GID, g);
+        for (int m = lastGroupMID(GID); m < msgs; ++m)
+        {
+            char UID[CLIENT_UID_SIZE];
+            formatUID(UID, (g + m % numSubscribers) % (2 * numSubscribers));
+            if (!createMessageInGroup(MID, UID, GID, strlen(BENCH_TEXT), BENCH_TEXT))
+            {
+                fprintf(stderr, "[-] Failed to create message %d of group %s\n", m + 1, GID);
+                exit(EXIT_FAILURE);
+            }
+            long size = pickAttachmentSize();
+            if (size > 0)
+            {
+                writeAttachment(GID, MID, size);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Compares two timings (for qsort).
+ *
+ * @return negative, zero or positive like strcmp.
+ */
+static int compareSamples(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints the timings of an operation at a dataset size.
+ *
+ * @param name name of the operation.
+ * @param msgs messages per group of the dataset.
+ * @param note string that contains what else was measured (may be empty).
+ */
+static void printSamples(const char *name, int msgs, const char *note)
+{
+    double sum = 0;
+    for (int i = 0; i < numCalls; ++i)
+    {
+        sum += samples[i];
+    }
+    qsort(samples, numCalls, sizeof(double), compareSamples);
+    printf("%-26s %6d %6d %10.1f %10.1f %10.1f %10.1f  %s\n", name, msgs, numCalls, sum / numCalls, samples[numCalls / 2],
+           samples[(int)(numCalls * 0.99)], samples[numCalls - 1], note);
+}
+
+/**
+ * @brief Reads everything retrieveDSGroupMessages writes to the other end of the connection.
+ *
+ * @param arg reference to the file descriptor of the client end.
+ * @return NULL once the connection is closed.
+ */
+static void *drainConnection(void *arg)
+{
+    int fd = *(int *)arg;
+    char buffer[65536];
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+        ;
+    return NULL;
+}
+
+/**
+ * @brief Times every storage operation on the dataset as it is.
+ *
+ * @param msgs messages per group of the dataset.
+ */
+static void benchOperations(int msgs)
+{
+    char GID[DS_GID_SIZE], UID[CLIENT_UID_SIZE], MID[DS_MID_SIZE], note[64];
+    char buffer[DS_TO_CLIENT_UDP_SIZE];
+    double begin;
+
+    // createMessageInGroup (the new messages are removed so the next sizes aren't skewed)
+    strcpy(GID, "01");
+    int firstMID = lastGroupMID(GID) + 1;
+    for (int i = 0; i < numCalls; ++i)
+    {
+        formatUID(UID, 1);
+        begin = nowUsec();
+        createMessageInGroup(MID, UID, GID, strlen(BENCH_TEXT), BENCH_TEXT);
+        samples[i] = nowUsec() - begin;
+    }
+    removeGroupMessages(GID, firstMID, numCalls);
+    printSamples("createMessageInGroup", msgs, "");
+
+    // checkNumberOfMsgsToRet from a random MID of a random group
+    for (int i = 0; i < numCalls; ++i)
+    {
+        formatGID(GID, 1 + rand() % numGroups);
+        begin = nowUsec();
+        checkNumberOfMsgsToRet(GID, 1 + rand() % msgs);
+        samples[i] = nowUsec() - begin;
+    }
+    printSamples("checkNumberOfMsgsToRet", msgs, "");
+
+    // retrieveDSGroupMessages of up to 20 messages from a random MID, sent through a socket that's drained
+    int fds[2];
+    pthread_t drainer;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1 || pthread_create(&drainer, NULL, drainConnection, &fds[1]) != 0)
+    {
+        perror("[-] Failed to set up the retrieve connection");
+        exit(EXIT_FAILURE);
+    }
+    char confirmation[DS_RETCONFBUF_SIZE];
+    memset(confirmation, 'K', DS_RETCONFBUF_SIZE - 1);
+    for (int i = 0; i < numCalls; ++i)
+    {
+        formatGID(GID, 1 + rand() % numGroups);
+        int startMID = 1 + rand() % msgs;
+        // The confirmation the DS waits for is sent ahead (readTCP waits for a full buffer)
+        if (write(fds[1], confirmation, DS_RETCONFBUF_SIZE - 1) != DS_RETCONFBUF_SIZE - 1)
+        {
+            exit(EXIT_FAILURE);
+        }
+        begin = nowUsec();
+        retrieveDSGroupMessages(fds[0], GID, startMID, checkNumberOfMsgsToRet(GID, startMID), HAS_FILE);
+        samples[i] = nowUsec() - begin;
+        arenaReset(&dsArena);
+    }
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(drainer, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    printSamples("retrieveDSGroupMessages", msgs, "(checkNumberOfMsgsToRet included)");
+
+    // createGroupListMessage of every group (GLS)
+    for (int i = 0; i < numCalls; ++i)
+    {
+        begin = nowUsec();
+        createGroupListMessage(buffer, NULL, 0);
+        samples[i] = nowUsec() - begin;
+    }
+    sprintf(note, "(%d groups)", numGroups);
+    printSamples("createGroupListMessage", msgs, note);
+
+    // listUsersInDSGroup of a random group
+    for (int i = 0; i < numCalls; ++i)
+    {
+        formatGID(GID, 1 + rand() % numGroups);
+        begin = nowUsec();
+        listUsersInDSGroup(GID);
+        samples[i] = nowUsec() - begin;
+        arenaReset(&dsArena);
+    }
+    sprintf(note, "(%d subscribers)", numSubscribers);
+    printSamples("listUsersInDSGroup", msgs, note);
+
+    // userSubscribedToGroup of a random user (half of them follow each group)
+    for (int i = 0; i < numCalls; ++i)
+    {
+        formatGID(GID, 1 + rand() % numGroups);
+        formatUID(UID, rand() % (2 * numSubscribers));
+        begin = nowUsec();
+        userSubscribedToGroup(UID, GID);
+        samples[i] = nowUsec() - begin;
+    }
+    printSamples("userSubscribedToGroup", msgs, "");
+}
+
+int main(int argc, char *argv[])
+{
+    parseArgs(argc, argv);
+    srand(48);
+
+    // The dataset lives in its own directory so a running DS is never touched
+    char dir[] = "/tmp/storage-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) == -1 || mkdir("server", 0700) == -1 || mkdir("server/GROUPS", 0700) == -1 ||
+        mkdir("server/USERS", 0700) == -1)
+    {
+        perror("[-] Failed to create the dataset directory");
+        exit(EXIT_FAILURE);
+    }
+    setupDSStats();
+    fillDSGroupsInfo();
+    samples = malloc(numCalls * sizeof(double));
+    attachmentData = malloc(maxAttachment + 256);
+    if (samples == NULL || attachmentData == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < maxAttachment + 256; ++i)
+    {
+        attachmentData[i] = rand();
+    }
+
+    printf("[+] Storage benchmark in %s: %d groups, %d subscribers per group, attachments %d:%ld", dir, numGroups, numSubscribers,
+           attachments[0].weight, attachments[0].size);
+    for (int i = 1; i < numAttachments; ++i)
+    {
+        printf(",%d:%ld", attachments[i].weight, attachments[i].size);
+    }
+    printf(" (page cache warm)\n");
+    createUsersAndGroups();
+    for (int l = 0; l < numLevels; ++l)
+    {
+        double begin = nowUsec();
+        growDataset(levels[l]);
+        printf("\n[+] Dataset of %d messages per group (%.1f MB of attachments) built in %.1f s\n", levels[l], datasetBytes / 1e6, (nowUsec() - begin) / 1e6);
+        printf("%-26s %6s %6s %10s %10s %10s %10s\n", "operation", "msgs", "calls", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+        benchOperations(levels[l]);
+    }
+
+    if (keepDataset)
+    {
+        printf("\n[+] Dataset kept in %s\n", dir);
+    }
+    else if (chdir("/tmp") == -1 || !removeDirectory(dir))
+    {
+        fprintf(stderr, "[-] Failed to remove %s\n", dir);
+    }
+    exit(EXIT_SUCCESS);
+}
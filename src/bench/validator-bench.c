@@ -0,0 +1,233 @@
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Default number of times each sample input is validated on the timed runs */
+#define BENCH_DEFAULT_ROUNDS 20000
+
+/* Longest input checked exhaustively over the alphabet below */
+#define BENCH_EXHAUSTIVE_LEN 4
+
+/* Number of random inputs checked on top of the exhaustive ones */
+#define BENCH_RANDOM_INPUTS 300000
+
+/* Longest random input */
+#define BENCH_RANDOM_LEN 30
+
+/* Characters the inputs are made of: both ends of every class the patterns use and their neighbours */
+static const char alphabet[] = "0123456789azAZ_-./:`@[{ \n\x80";
+
+/* Struct that pairs a hand-written validator with the pattern it replaced */
+typedef struct validator
+{
+    const char *name;
+    const char *pattern;
+    int (*check)(char *);
+    regex_t regex; // compiled once for the equivalence check
+} Validator;
+
+/**
+ * @brief validMID treats 0000 apart from its pattern, just like before.
+ *
+ * @param MID string that contains the message ID.
+ * @param regex compiled pattern of validMID.
+ * @return 1 if it's valid, 0 otherwise.
+ */
+static int legacyValidMID(char *MID, regex_t *regex)
+{
+    return strcmp(MID, "0000") && !regexec(regex, MID, 0, NULL, 0);
+}
+
+static Validator validators[] = {
+    {"validUID", "^[0-9]{5}$", validUID},
+    {"validPW", "^[a-zA-Z0-9]{8}$", validPW},
+    {"validGID", "^([0][1-9]|[1-9][0-9])$", validGID},
+    {"validGName", "^[a-zA-Z0-9_-]{1,24}$", validGName},
+    {"isMID", "^[0-9]{4}$", isMID},
+    {"validFName", "^[a-zA-Z0-9_-]{1,20}[.]{1}[a-zA-Z0-9]{3}$", validFName},
+    {"validMID", "^[0-9]{0,4}$", validMID},
+    {"validPort", "^([0-9]{1,4}|[1-5][0-9]{4}|6[0-4][0-9]{3}|65[0-4][0-9]{2}|655[0-2][0-9]|6553[0-5])$", validPort},
+    {"isGID", "^[0-9]{2}", isGID},
+};
+
+#define NUM_VALIDATORS (int)(sizeof(validators) / sizeof(Validator))
+
+/* Number of inputs checked and of inputs where a validator and its pattern disagreed */
+static long numChecked, numMismatches;
+
+/**
+ * @brief Parses the program's arguments for the number of timed rounds.
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ * @param rounds reference to the number of rounds.
+ */
+static void parseArgs(int argc, char *argv[], int *rounds)
+{
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (!strcmp(argv[i], "-n"))
+        {
+            *rounds = atoi(argv[++i]);
+        }
+    }
+    if (*rounds <= 0)
+    {
+        fprintf(stderr, "[-] Usage: ./validator-bench [-n rounds]\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Checks every validator against its pattern on a single input.
+ *
+ * @param input string to be validated.
+ */
+static void checkInput(char *input)
+{
+    numChecked++;
+    for (int i = 0; i < NUM_VALIDATORS; ++i)
+    {
+        Validator *v = &validators[i];
+        int expected = (v->check == validMID) ? legacyValidMID(input, &v->regex) : !regexec(&v->regex, input, 0, NULL, 0);
+        if (v->check(input) != expected)
+        {
+            if (numMismatches++ < 20)
+            {
+                fprintf(stderr, "[-] %s(\"%s\") = %d but the pattern says %d\n", v->name, input, !expected, expected);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Checks every input of up to a given length made of the alphabet.
+ *
+ * @param input buffer for the input being built.
+ * @param len length of the input built so far.
+ * @param maxLen maximum length.
+ */
+static void checkExhaustive(char *input, int len, int maxLen)
+{
+    input[len] = '\0';
+    checkInput(input);
+    if (len == maxLen)
+    {
+        return;
+    }
+    for (int i = 0; alphabet[i] != '\0'; ++i)
+    {
+        input[len] = alphabet[i];
+        checkExhaustive(input, len + 1, maxLen);
+    }
+}
+
+/**
+ * @brief Checks the inputs near the edges of the patterns: every port number, names and file names of
+ * every length around their limits and random strings.
+ *
+ */
+static void checkEdges()
+{
+    char input[BENCH_RANDOM_LEN + 8];
+    for (long port = 0; port <= 70000; ++port)
+    {
+        sprintf(input, "%ld", port);
+        checkInput(input);
+        sprintf(input, "%05ld", port);
+        checkInput(input);
+    }
+    for (int len = 0; len <= 26; ++len)
+    {
+        memset(input, 'a', len);
+        input[len] = '\0';
+        checkInput(input); // group names
+        strcpy(input + len, ".txt");
+        checkInput(input); // file names
+        strcpy(input + len, ".tx");
+        checkInput(input);
+        strcpy(input + len, ".txt.");
+        checkInput(input);
+    }
+    srand(18);
+    for (int i = 0; i < BENCH_RANDOM_INPUTS; ++i)
+    {
+        int len = rand() % (BENCH_RANDOM_LEN + 1);
+        for (int j = 0; j < len; ++j)
+        {
+            input[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        input[len] = '\0';
+        checkInput(input);
+    }
+}
+
+/**
+ * @brief Times validating a set of inputs with every validator.
+ *
+ * @param name name of the run.
+ * @param inputs inputs to be validated.
+ * @param numInputs number of inputs.
+ * @param rounds number of times the inputs are validated.
+ * @param legacy 1 to validate with validRegex (compiling the pattern on every call), 0 to use the validators.
+ */
+static void runBench(const char *name, char **inputs, int numInputs, int rounds, int legacy)
+{
+    struct timespec begin, finish;
+    long calls = 0, valid = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < NUM_VALIDATORS; ++i)
+        {
+            for (int j = 0; j < numInputs; ++j)
+            {
+                valid += legacy ? validRegex(inputs[j], (char *)validators[i].pattern) : validators[i].check(inputs[j]);
+                calls++;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double secs = (finish.tv_sec - begin.tv_sec) + (finish.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-28s %10ld calls %12.0f calls/s %10.1f ns/call (%ld valid)\n", name, calls, calls / secs, secs * 1e9 / calls, valid);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = BENCH_DEFAULT_ROUNDS;
+    parseArgs(argc, argv, &rounds);
+
+    for (int i = 0; i < NUM_VALIDATORS; ++i)
+    {
+        if (regcomp(&validators[i].regex, validators[i].pattern, REG_EXTENDED))
+        {
+            fprintf(stderr, "[-] Failed to compile %s\n", validators[i].pattern);
+            exit(EXIT_FAILURE);
+        }
+    }
+    char input[BENCH_EXHAUSTIVE_LEN + 1];
+    checkExhaustive(input, 0, BENCH_EXHAUSTIVE_LEN);
+    checkEdges();
+    for (int i = 0; i < NUM_VALIDATORS; ++i)
+    {
+        regfree(&validators[i].regex);
+    }
+    printf("[+] Validator equivalence: %ld inputs x %d validators, %ld mismatches\n", numChecked, NUM_VALIDATORS, numMismatches);
+    if (numMismatches > 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Fields as they show up in PST and RTV requests, plus some that fail
+    char *inputs[] = {"12345", "01", "0001", "abcdefgh", "bench.txt", "group_name-1", "58018", "1234", "x.y", "99999"};
+    int numInputs = sizeof(inputs) / sizeof(char *);
+    int legacyRounds = (rounds / 100 > 0) ? rounds / 100 : 1; // regcomp is orders of magnitude slower
+    printf("[+] Validator benchmark: %d inputs x %d validators, %d rounds (%d with regcomp)\n", numInputs, NUM_VALIDATORS, rounds, legacyRounds);
+    runBench("regcomp per call (legacy)", inputs, numInputs, legacyRounds, 1);
+    runBench("hand-written validators", inputs, numInputs, rounds, 0);
+    exit(EXIT_SUCCESS);
+}
@@ -4,6 +4,9 @@
 /* Preprocessed macro to determine min(x,y) */
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+/* Preprocessed macro to determine max(x,y) */
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
 /* DS wrong protocol message */
 #define ERR_MSG "ERR\n"
 
@@ -45,6 +48,31 @@
 #define ULIST 13
 #define POST 14
 #define RETRIEVE 15
+#define STATS 16
+#define STREAM 17
+#define RETRIEVE_ALL 18
+#define POST_BATCH 19
+#define BINARY 20
+#define UPLOAD_START 21
+#define UPLOAD_QUERY 22
+#define UPLOAD_DATA 23
+#define RETRIEVE_FILE 24
+#define UPLOAD_RESUME 25
+#define UPLOAD_CHUNK 26
+#define UPLOAD_FINISH 27
+#define REPLICATE 28
+#define LATENCY 29
+#define PROFILE 30
+
+/* Number of command macros (protocol tables are indexed by them) */
+#define PROTOCOL_NUM_COMMANDS 31
+
+/* Number of bits of the protocol opcode hash (its table has 2^bits slots, more than twice the number of commands) */
+#define PROTOCOL_HASH_BITS 6
+
+/* Odd multiplier of the protocol opcode hash, picked so that every message code gets a slot of its own (the build
+ * fails if a new code collides: search for another one starting from this) */
+#define PROTOCOL_HASH_MULTIPLIER 0x9E377F81u
 
 /* The buffer size for a message from the client to the DS via UDP protocol */
 #define CLIENT_TO_DS_UDP_SIZE 40
@@ -52,6 +80,9 @@
 /* The buffer size for a message from the DS to the client via UDP protocol */
 #define DS_TO_CLIENT_UDP_SIZE 4096
 
+/* Maximum number of UDP requests the DS receives (and replies to) with a single system call */
+#define DS_UDP_BATCH_SIZE 16
+
 /* The buffer size for a protocol message code */
 #define PROTOCOL_CODE_SIZE 4
 
@@ -68,9 +99,6 @@
 /* The size of a client's password according to the statement's rules */
 #define CLIENT_PWD_SIZE 9
 
-/* The size of a buffer containing all relevant information about a DS group */
-#define DS_GROUPINFO_SIZE 34
-
 /* The size of a DS's group ID according to the statement's rules */
 #define DS_GID_SIZE 3
 
@@ -98,11 +126,11 @@
 /* The maximum size of a buffer that contains the file name of the file being uploaded on post */
 #define PROTOCOL_FNAME_SIZE 25
 
-/* The size of a post command buffer with file excluding the file data that the client will send to the DS */
-#define CLIENTDS_POSTWFILE_SIZE 295
+/* The size of a post command buffer with file excluding the file data that the client will send to the DS (sizes printed as longs) */
+#define CLIENTDS_POSTWFILE_SIZE 322
 
-/* The size of a post command buffer without a file included that will be sent to the DS */
-#define CLIENTDS_POSTWOFILE_SIZE 259
+/* The size of a post command buffer without a file included that will be sent to the DS (size printed as a long) */
+#define CLIENTDS_POSTWOFILE_SIZE 276
 
 /* The size of a post command reply buffer from the DS to the client */
 #define DS_POSTREPLY_SIZE 10
@@ -110,8 +138,11 @@
 /* The size of the unsigned char buffer that is read from the file and sent to a fd via TCP protocol */
 #define FILEBUFFER_SIZE 2048
 
-/* The size of a retrieve command buffer from the client to the DS */
-#define CLIENTDS_RTVBUF_SIZE 19
+/* The size of the per-connection buffer that the DS fills with large reads while parsing a PST request */
+#define DS_CONNBUF_SIZE 65536
+
+/* The size of a retrieve command buffer from the client to the DS (with the optional wait time) */
+#define CLIENTDS_RTVBUF_SIZE 24
 
 /* The size of a retrieve status code from the DS to the client */
 #define DSCLIENT_RTVSTATUS_SIZE 3
@@ -132,9 +163,17 @@
 /* The size of a buffer that contains the number of bytes in a group message file */
 #define PROTOCOL_FILESZ_SIZE 11
 
-/* Macros for verbose on the DS */
-#define VERBOSE_OFF 0
-#define VERBOSE_ON 1
+/* Levels of the DS log (a record is written if its level is at most the one the DS was started with) */
+#define DS_LOG_OFF -1
+#define DS_LOG_ERROR 0
+#define DS_LOG_WARN 1
+#define DS_LOG_INFO 2
+#define DS_LOG_DEBUG 3
+
+/* Events kept in the DS log records */
+#define DS_LOG_REQUEST 0 // request a client sent
+#define DS_LOG_REPLY 1   // reply the DS sent
+#define DS_LOG_REFUSED 2 // request or connection refused by admission control
 
 /* Default size for the DS TCP listen queue */
 #define DS_LISTENQUEUE_SIZE 10
@@ -145,18 +184,30 @@
 /* Maximum number of existing groups in the DS */
 #define DS_MAX_NUM_GROUPS 100
 
+/* Maximum number of messages in a DS group (MIDs have 4 digits) */
+#define DS_MAX_NUM_MSGS 9999
+
 /* Macro used to read d_name attribute from struct dirent in all of DS operations */
 #define DIRENT_NAME_SIZE 256
 
 /* The size of a buffer containing a DS group's name file */
 #define DS_GNAMEPATH_SIZE 32
 
+/* The size of a buffer containing the content of a DS group's name file (the name and a nl) */
+#define DS_GNAMEFILE_SIZE 26
+
 /* The size of a buffer containing a registered DS client folder */
 #define DS_CLIENTDIRPATH_SIZE 19
 
 /* The size of a buffer containing a registered DS client password file */
 #define DS_CLIENTPWDPATH_SIZE 36
 
+/* The size of the salt of a stored password (16 hex digits and the : that separates it from the hash) */
+#define DS_PWDSALT_SIZE 17
+
+/* The size of a stored password record (Salt:Hash, the SHA-256 of the salt followed by the password, and a null terminator) */
+#define DS_PWDRECORD_SIZE (DS_PWDSALT_SIZE + DS_HASH_SIZE)
+
 /* The size of a buffer containing a user subscribed to group file path */
 #define DS_GROUPCLIENTSUBPATH_SIZE 27
 
@@ -166,9 +217,6 @@
 /* The size of a buffer containing a path to a DS group MSG folder */
 #define DS_GROUPMSGPATH_SIZE 21
 
-/* The size of a buffer containing all groups in the DS */
-#define DS_GROUPSLISTBUF_SIZE 3270
-
 /* The size of a buffer containing each group information */
 #define DS_GROUPINFOBUF_SIZE 34
 
@@ -193,23 +241,376 @@
 /* The size of a buffer containing the path to a message's text file */
 #define DS_GROUPMSGTEXTPATH_SIZE 39
 
+/* The size of a buffer containing the path to a message's file content hash */
+#define DS_GROUPMSGHASHPATH_SIZE 39
+
+/* The size of a file content hash (SHA-256 as 64 hex digits) */
+#define DS_HASH_SIZE 65
+
 /* The size of a buffer containing the path to a message file */
 #define DS_GROUPMSGFILEPATH_SIZE 53
 
+/* The size of a buffer containing the path to the directory a batch of messages is staged in (MSG/.PSB<pid>) */
+#define DS_GROUPSTAGEPATH_SIZE 40
+
+/* The size of a buffer containing the path to a staged message directory */
+#define DS_STAGEDMSGDIRPATH_SIZE 48
+
+/* The size of a buffer containing the path to a file of a message directory (posted or staged) */
+#define DS_MSGFILEPATH_SIZE 80
+
 /* The size of a buffer containing the initial retrieve status message */
 #define DS_RETINITSTATUS_SIZE 6
 
 /* Macros for file in message directory flag */
 #define NO_FILE 0
 #define HAS_FILE 1
+#define FILE_META 2 // Retrieve only the file's name, size and content hash
 
 /* The size of bufferS that contain fragments of message information to be retrieved from the DS to the client */
 #define DS_MSGTEXTINFO_SIZE 257
 #define DS_MSGFILEINFO_SIZE 41
+#define DS_MSGFILEMETA_SIZE 106
 
 /* The size of a buffer to receive confirmation from the DS to the client */
 #define DS_RETCONFBUF_SIZE 256
 
+/* Number of seconds without data after which a read via TCP or UDP protocol times out */
+#define TCP_TIMEOUT 3
+
+/* Number of seconds a client has to send the whole header of a TCP request to the DS */
+#define DS_TCP_HEADER_TIMEOUT 10
+
+/* Minimum transfer rate (bytes per second) the DS accepts while receiving or sending data via TCP protocol */
+#define DS_TCP_MIN_RATE 8192
+
+/* Number of commands the DS keeps counters for (indexed by the command macros) */
+#define DS_STATS_NUM_COMMANDS PROTOCOL_NUM_COMMANDS
+
+/* The size of a buffer containing the name of a DS counter */
+#define DS_STATNAME_SIZE 32
+
+/* Stages of a DS request whose latency is measured (DS_NUM_STAGES is the whole request) */
+#define DS_STAGE_PARSE 0
+#define DS_STAGE_STORAGE 1
+#define DS_STAGE_SEND 2
+#define DS_NUM_STAGES 3
+
+/* DS latency histograms: 2^11 sub-buckets (3 significant digits) over nanoseconds up to 2^36 (about a minute) */
+#define DS_HIST_SUB_BUCKET_BITS 11
+#define DS_HIST_MAX_BITS 36
+#define DS_HIST_NUM_COUNTS ((DS_HIST_MAX_BITS - DS_HIST_SUB_BUCKET_BITS + 2) << (DS_HIST_SUB_BUCKET_BITS - 1))
+
+/* Number of reply statuses counted for every command (OK NOK DUP NEW EOF ERR E_USR E_GRP E_GNAME E_FULL) */
+#define DS_NUM_STATUSES 10
+
+/* The size of a line of the latency snapshot (a stage or a command, its percentiles and statuses) */
+#define DS_LATLINE_SIZE 512
+
+/* Last line of a latency snapshot that didn't fit in the reply */
+#define DS_LAT_TRUNCATED "TRUNCATED\n"
+
+/* The size of each memory chunk that small replies are packed into in a TCP connection's output queue */
+#define DS_OUTQ_CHUNK_SIZE 16384
+
+/* Maximum number of memory chunks sent with a single writev */
+#define DS_OUTQ_IOV_SIZE 64
+
+/* Number of queued bytes at which the DS stops producing a reply for a slow client */
+#define DS_OUTQ_HIGH_WATERMARK 262144
+
+/* Number of queued bytes at which the DS resumes producing the reply */
+#define DS_OUTQ_LOW_WATERMARK 65536
+
+/* The size of the first block of the request arena (kept for the whole life of a DS process) */
+#define DS_ARENA_BLOCK_SIZE 65536
+
+/* Alignment of every allocation made from an arena */
+#define DS_ARENA_ALIGN 16
+
+/* Number of records in the DS log ring (must be a power of 2) */
+#define DS_LOG_RING_SIZE 4096
+
+/* Number of bytes of a request or reply kept in a DS log record */
+#define DS_LOG_TEXT_SIZE 96
+
+/* Number of microseconds the log writer lets records pile up after it emptied the ring */
+#define DS_LOG_BATCH_USEC 1000
+
+/* Number of milliseconds the log writer sleeps on an empty ring before checking the DS is still running */
+#define DS_LOG_IDLE_MSEC 1000
+
+/* Number of milliseconds a record may stay claimed but unwritten before the log writer skips it
+ * (the process that claimed it died) */
+#define DS_LOG_STALL_MSEC 100
+
+/* The size of the buffer the log writer formats records into before writing them out */
+#define DS_LOG_WRITEBUF_SIZE 65536
+
+/* The size of a formatted DS log line */
+#define DS_LOG_LINE_SIZE 256
+
+/* Maximum number of spans traced in a single request */
+#define DS_TRACE_MAX_SPANS 32
+
+/* Maximum number of arguments attached to a span */
+#define DS_TRACE_MAX_ARGS 3
+
+/* The size of the value of a span argument */
+#define DS_TRACE_ARG_SIZE 24
+
+/* The size of a trace event (a span in the Chrome trace-event format) */
+#define DS_TRACE_EVENT_SIZE 256
+
+/* The size of the buffer the spans of a request are written out from (every span fits) */
+#define DS_TRACEBUF_SIZE (DS_TRACE_MAX_SPANS * DS_TRACE_EVENT_SIZE)
+
+/* Number of stack samples the profiler keeps (once every slot is taken new samples are dropped and counted) */
+#define DS_PROF_MAX_SAMPLES 32768
+
+/* Maximum number of frames of a stack sample (the outermost ones are cut) */
+#define DS_PROF_MAX_DEPTH 32
+
+/* Frames a backtrace taken in the SIGPROF handler starts with (the handler and the signal return trampoline) */
+#define DS_PROF_HANDLER_FRAMES 2
+
+/* Default and maximum sampling rates of the profiler (samples per second of CPU time of each DS process) */
+#define DS_PROF_DEFAULT_HZ 997
+#define DS_PROF_MAX_HZ 10000
+
+/* The size of a frame name in a folded stack */
+#define DS_PROF_FRAME_SIZE 128
+
+/* The size of the buffer folded stacks are sent from */
+#define DS_PROF_SENDBUF_SIZE 65536
+
+/* Maximum number of addresses (besides the loopback ones) that may use PRF */
+#define DS_MAX_ADMIN_ADDRS 16
+
+/* The size of a profiler dump request read by the DS via TCP (DUMP\n) */
+#define DS_PRFREQ_SIZE 8
+
+/* Default number of requests per second the DS accepts from each IP address (0 = unlimited) */
+#define DS_DEFAULT_IP_RATE 200
+
+/* Default number of requests per second the DS accepts from each UID (0 = unlimited) */
+#define DS_DEFAULT_UID_RATE 50
+
+/* Default number of UDP requests per second the DS serves before shedding load (0 = unlimited) */
+#define DS_DEFAULT_UDP_RATE 5000
+
+/* Default number of TCP connections the DS serves at the same time (0 = unlimited) */
+#define DS_DEFAULT_MAX_TCP_CONNS 64
+
+/* Number of long-lived TCP connections (push streams, waiting retrieves, replica followers) the DS doesn't count
+ * against its TCP connection limit (past it they count) */
+#define DS_MAX_LONG_LIVED_CONNS 1024
+
+/* Number of seconds worth of requests a client may send in a burst */
+#define DS_ADMISSION_BURST 2
+
+/* Maximum number of addresses (routers) exempt from a DS's per-IP limit */
+#define DS_MAX_EXEMPT_ADDRS 16
+
+/* Number of token buckets kept for each of IP addresses and UIDs */
+#define DS_ADMISSION_TABLE_SIZE 4096
+
+/* Number of slots looked at when finding the token bucket of a client */
+#define DS_ADMISSION_PROBES 8
+
+/* Number of queued bytes at which the DS stops pushing posts to a slow subscriber */
+#define DS_PUSH_HIGH_WATERMARK 65536
+
+/* Number of queued bytes at which the DS resumes pushing posts */
+#define DS_PUSH_LOW_WATERMARK 16384
+
+/* Number of milliseconds a subscriber's connection waits for a new post before checking if the client is still there */
+#define DS_PUSH_WAIT_MSEC 1000
+
+/* Number of seconds a subscriber may go without reading any pushed bytes before the DS drops it */
+#define DS_PUSH_STALL_TIMEOUT 30
+
+/* The size of the prefix of a pushed post (NEW GID) */
+#define DS_PUSHPREFIX_SIZE 7
+
+/* The size of the buffer containing the posts pushed by the DS to the client */
+#define CLIENT_PUSHBUF_SIZE 4096
+
+/* The size of the stream message sent by the client to the DS via TCP protocol */
+#define CLIENTDS_STREAMBUF_SIZE 11
+
+/* The size of a streaming retrieve command buffer from the client to the DS (RTS UID GID MID[ LastMID[ AuthorUID]]) */
+#define CLIENTDS_RTSBUF_SIZE 30
+
+/* The size of the arguments of a streaming retrieve request read by the DS */
+#define DS_RTSREQ_SIZE 26
+
+/* Maximum number of messages in a batch post */
+#define DS_PSB_MAX_MSGS 100
+
+/* The size of the number of messages in a batch post (3 digits) */
+#define DS_PSBCOUNT_SIZE 4
+
+/* The size of the DS reply to a batch post (RPB OK and every assigned MID) */
+#define DS_PSBREPLY_SIZE (8 + DS_PSB_MAX_MSGS * DS_MID_SIZE)
+
+/* The size of the header of a batch post from the client to the DS (PSB UID GID N ) */
+#define CLIENTDS_PSBBUF_SIZE 18
+
+/* The size of a single message of a batch post from the client to the DS (TSize Text FName FSize ), with room for
+ * any long TSize and FSize */
+#define CLIENTDS_PSBENTRY_SIZE 309
+
+/* The size of a line of a batch post list file ("text" Fname\n) */
+#define CLIENT_PSBLINE_SIZE 272
+
+/* Maximum number of seconds a retrieve may wait for new messages */
+#define DS_RTV_MAX_WAIT 60
+
+/* The size of the optional retrieve wait time (2 digits and nl) */
+#define DS_RTVWAIT_SIZE 3
+
+/* The size of the optional retrieve arguments read by the DS (wait time, metadata only flag M and nl) */
+#define DS_RTVOPTS_SIZE 5
+
+/* Version of the binary protocol (a single digit) negotiated with BIN V\n */
+#define BIN_VERSION 1
+
+/* The size of the binary protocol handshake from the client to the DS (BIN V\n) */
+#define CLIENTDS_BINBUF_SIZE 7
+
+/* The size of the DS reply to a binary protocol handshake (RBN NOK V\n) */
+#define DS_BINREPLY_SIZE 11
+
+/* Client side knowledge of the DS binary protocol support */
+#define BIN_UNKNOWN 0
+#define BIN_ON 1
+#define BIN_OFF 2
+
+/* Binary frame header: opcode (1), status (1), number of records (2), length of the fields (4) */
+#define BIN_HEADER_SIZE 8
+
+/* Binary message record: UID (4), GID or MID (2), TSize (1), FName length (1), FSize (8) */
+#define BIN_RECORD_SIZE 16
+
+/* Binary retrieve request fields: UID (4), GID (2), MID (2), wait time (2) */
+#define BIN_RTVREQ_SIZE 10
+
+/* Binary post reply fields: MID (2) */
+#define BIN_PSTREPLY_SIZE 2
+
+/* Binary frame opcodes */
+#define BIN_OP_POST 1
+#define BIN_OP_RETRIEVE 2
+
+/* Binary frame statuses */
+#define BIN_OK 0
+#define BIN_NOK 1
+#define BIN_EOF 2
+#define BIN_ERR 3
+
+/* Maximum size of a file attached to a message (10 digits in the text protocol) */
+#define BIN_MAX_FSIZE 9999999999LL
+
+/* The size of an upload session ID (8 digits) */
+#define DS_SID_SIZE 9
+
+/* The size of an upload session's directory path (server/UPLOADS/SID) */
+#define DS_UPLOADPATH_SIZE 24
+
+/* The size of a file path inside an upload session's directory (server/UPLOADS/SID/FName) */
+#define DS_UPLOADFILEPATH_SIZE 49
+
+/* Number of seconds an upload session is kept without receiving any data */
+#define DS_UPLOAD_TTL 86400
+
+/* The size of an upload start request read by the DS (UID GID FName FSize TSize Text\n) */
+#define DS_UPSREQ_SIZE 291
+
+/* The size of an upload query request read by the DS (UID SID\n) */
+#define DS_UPQREQ_SIZE 16
+
+/* The size of the header of an upload data request read by the DS (UID SID Offset Len ) */
+#define DS_UPDHDR_SIZE 38
+
+/* The size of a ranged file retrieve request read by the DS (UID GID MID Offset Len\n) */
+#define DS_RTFREQ_SIZE 37
+
+/* The size of the DS reply to an upload request (RUQ OK Offset FSize\n) */
+#define DS_UPLOADREPLY_SIZE 32
+
+/* The size of the header of the DS reply to a ranged file retrieve (RRF OK FName FSize Offset Len ) */
+#define DS_RTFREPLY_SIZE 66
+
+/* The size of an upload start request from the client to the DS, with room for any long FSize and TSize */
+#define CLIENTDS_UPSBUF_SIZE 322
+
+/* The size of the name a download is received under until it's complete (Fname.part) */
+#define CLIENT_PARTNAME_SIZE (PROTOCOL_FNAME_SIZE + 5)
+
+/* The size of an upload data, upload chunk or ranged file retrieve request header from the client to the DS, with
+ * room for any long offset and length */
+#define CLIENTDS_UPDBUF_SIZE 61
+
+/* Number of times the client resumes an upload or a download that was interrupted */
+#define CLIENT_TRANSFER_TRIES 3
+
+/* The size of the chunks of a parallel upload (the last one may be shorter) */
+#define UPLOAD_CHUNK_SIZE 4194304
+
+/* Maximum number of connections a parallel upload is sent over */
+#define CLIENT_UPLOAD_MAX_CONNS 16
+
+/* Macros for the replication role of a DS */
+#define REPLICATION_OFF 0
+#define REPLICATION_PRIMARY 1  // Keeps a change log and ships it to followers
+#define REPLICATION_FOLLOWER 2 // Applies a primary's changes and only serves reads
+
+/* The size of a line of the change log (timestamp and a UDP request, with a password record in place of a password) */
+#define DS_CHANGELINE_SIZE 128
+
+/* The size of a replication request read by the DS (Offset\n) */
+#define DS_RPLREQ_SIZE 22
+
+/* The size of a field of a shipped change (an offset is the longest one) */
+#define DS_REPLFIELD_SIZE 21
+
+/* The size of the prefix of a shipped change (Next End and a change log line) */
+#define DS_REPLHDR_SIZE 192
+
+/* The size of the buffer a follower reads the shipped changes into */
+#define DS_REPLBUF_SIZE 65536
+
+/* The size of the offset a follower stores in server/REPLICA.txt (20 digits, so it's overwritten in place, and a nl) */
+#define DS_REPLOFFSET_SIZE 22
+
+/* Number of changes a lagging follower applies between syncs of its offset (it syncs whenever it catches up) */
+#define DS_REPL_FSYNC_CHANGES 64
+
+/* Maximum number of follower addresses (besides the loopback ones) a primary ships its changes to */
+#define DS_MAX_FOLLOWER_ADDRS 16
+
+/* Number of milliseconds without changes after which the primary sends a heartbeat to its followers */
+#define DS_REPL_HEARTBEAT_MSEC 1000
+
+/* Number of seconds a follower waits before reconnecting to its primary */
+#define DS_REPL_RETRY_SECS 1
+
+/* Maximum number of DS shards the groups can be partitioned across */
+#define DS_MAX_SHARDS 16
+
+/* The size of the part of a TCP request the router reads to find its GID (UID GID and a separator) */
+#define ROUTER_PREFIX_SIZE 16
+
+/* File the routers started from the same directory lock while they create a group (names are unique across shards) */
+#define ROUTER_LOCK_PATH "DSrouter.lock"
+
+/* The size of the buffer the router relays TCP data through */
+#define ROUTER_RELAYBUF_SIZE 65536
+
+/* The size of a group list entry the router merges (GID GName MID) */
+#define ROUTER_GROUPENTRY_SIZE 40
+
 /* The default number of tries to recover packets that were sent via UDP protocol */
 #define DEFAULT_UDPRECV_TRIES 3
 
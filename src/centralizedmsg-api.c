@@ -2,6 +2,7 @@
 #include "centralizedmsg-api-constants.h"
 
 #include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -10,6 +11,56 @@
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y)) // Macro to determine min(x, y)
 
+/**
+ * @brief Checks if a character is in the class [0-9].
+ *
+ * @param c character to be checked.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int isDigitChar(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * @brief Checks if a character is in the class [a-zA-Z0-9].
+ *
+ * @param c character to be checked.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int isAlnumChar(char c)
+{
+    return isDigitChar(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/**
+ * @brief Checks if a character is in the class [a-zA-Z0-9_-] (group and file names).
+ *
+ * @param c character to be checked.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int isNameChar(char c)
+{
+    return isAlnumChar(c) || c == '_' || c == '-';
+}
+
+/**
+ * @brief Counts how many characters at the start of a string belong to a class.
+ *
+ * @param str string to be checked.
+ * @param inClass function that checks if a character belongs to the class.
+ * @return number of characters.
+ */
+static int spanClass(const char *str, int (*inClass)(char))
+{
+    int n = 0;
+    while (str[n] != '\0' && inClass(str[n]))
+    {
+        n++;
+    }
+    return n;
+}
+
 int validRegex(char *buf, char *reg)
 {
     int reti;
@@ -36,8 +87,13 @@ int validAddress(char *address)
 }
 
 int validPort(char *port)
-{ // Ports range from 0 to 65535
-    return validRegex(port, "^([0-9]{1,4}|[1-5][0-9]{4}|6[0-4][0-9]{3}|65[0-4][0-9]{2}|655[0-2][0-9]|6553[0-5])$");
+{ // Ports range from 0 to 65535: up to 4 digits (leading zeros allowed) or 5 digits not starting with 0
+    int n = spanClass(port, isDigitChar);
+    if (port[n] != '\0' || n == 0 || n > 5)
+    {
+        return 0;
+    }
+    return n < 5 || (port[0] != '0' && strcmp(port, "65535") <= 0);
 }
 
 int parseClientDSCommand(char *command)
@@ -72,6 +128,18 @@ int parseClientDSCommand(char *command)
         return POST;
     else if (!strcmp(command, "retrieve") || !strcmp(command, "r"))
         return RETRIEVE;
+    else if (!strcmp(command, "stream") || !strcmp(command, "st"))
+        return STREAM;
+    else if (!strcmp(command, "retrieve_all") || !strcmp(command, "ra"))
+        return RETRIEVE_ALL;
+    else if (!strcmp(command, "post_batch") || !strcmp(command, "pb"))
+        return POST_BATCH;
+    else if (!strcmp(command, "upload") || !strcmp(command, "up"))
+        return UPLOAD_START;
+    else if (!strcmp(command, "upload_resume") || !strcmp(command, "ur"))
+        return UPLOAD_RESUME;
+    else if (!strcmp(command, "download") || !strcmp(command, "dl"))
+        return RETRIEVE_FILE;
     else
     { // No valid command was received
         fprintf(stderr, "[-] Invalid user command code. Please try again.\n");
@@ -81,12 +149,14 @@ int parseClientDSCommand(char *command)
 
 int validUID(char *UID)
 {
-    return validRegex(UID, "^[0-9]{5}$");
+    // ^[0-9]{5}$
+    return spanClass(UID, isDigitChar) == 5 && UID[5] == '\0';
 }
 
 int validPW(char *PW)
 {
-    return validRegex(PW, "^[a-zA-Z0-9]{8}$");
+    // ^[a-zA-Z0-9]{8}$
+    return spanClass(PW, isAlnumChar) == 8 && PW[8] == '\0';
 }
 
 int isNumber(char *num)
@@ -102,17 +172,21 @@ int isNumber(char *num)
 
 int validGID(char *GID)
 {
-    return validRegex(GID, "^([0][1-9]|[1-9][0-9])$");
+    // ^([0][1-9]|[1-9][0-9])$
+    return isDigitChar(GID[0]) && isDigitChar(GID[1]) && GID[2] == '\0' && (GID[0] != '0' || GID[1] != '0');
 }
 
 int validGName(char *GName)
 {
-    return validRegex(GName, "^[a-zA-Z0-9_-]{1,24}$");
+    // ^[a-zA-Z0-9_-]{1,24}$
+    int n = spanClass(GName, isNameChar);
+    return n >= 1 && n <= 24 && GName[n] == '\0';
 }
 
 int isMID(char *MID)
 {
-    return validRegex(MID, "^[0-9]{4}$");
+    // ^[0-9]{4}$
+    return spanClass(MID, isDigitChar) == 4 && MID[4] == '\0';
 }
 
 int sendTCP(int fd, char *message)
@@ -140,20 +214,7 @@ int readTCP(int fd, char *message, int maxSize)
 
     while (bytesRead < maxSize)
     {
-        if (timerOn(fd) == -1)
-        {
-            perror("[-] Failed to start TCP timer");
-            return -1;
-        }
         n = read(fd, message + bytesRead, maxSize - bytesRead);
-
-        // As soon as we read the first byte, turn off timer
-        if (timerOff(fd) == -1)
-        {
-            perror("[-] Failed to turn off TCP timer");
-            return -1;
-        }
-
         if (n == 0)
         {
             break; // Peer has performed an orderly shutdown -> POSSIBLE message complete
@@ -176,27 +237,42 @@ int readTCP(int fd, char *message, int maxSize)
     return bytesRead;
 }
 
+int recvTCP(int fd, char *message, int maxSize)
+{
+    ssize_t n = read(fd, message, maxSize);
+    if (n == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            perror("[-] TCP socket timed out while reading");
+            return 0;
+        }
+        perror("[-] Failed to receive from TCP");
+    }
+    return n;
+}
+
 int validFName(char *FName)
 {
-    return validRegex(FName, "^[a-zA-Z0-9_-]{1,20}[.]{1}[a-zA-Z0-9]{3}$");
+    // ^[a-zA-Z0-9_-]{1,20}[.]{1}[a-zA-Z0-9]{3}$ (the name class has no '.' so the name ends at the first one)
+    int n = spanClass(FName, isNameChar);
+    if (n < 1 || n > 20 || FName[n] != '.')
+    {
+        return 0;
+    }
+    return spanClass(FName + n + 1, isAlnumChar) == 3 && FName[n + 4] == '\0';
 }
 
 int validMID(char *MID)
 {
     if (!strcmp(MID, "0000"))
         return 0;
-    return validRegex(MID, "^[0-9]{0,4}$");
+    // ^[0-9]{0,4}$
+    int n = spanClass(MID, isDigitChar);
+    return n <= 4 && MID[n] == '\0';
 }
 
-/**
- * @brief Auxiliary function of sendFile that sends an unsigned char buffer via TCP protocol.
- *
- * @param fd file descriptor to send the data to.
- * @param buffer string that contains the buffer to be sent.
- * @param num number of bytes to be sent.
- * @return 1 if num bytes of buffer were sent, 0 otherwise.
- */
-static int sendData(int fd, unsigned char *buffer, size_t num)
+int sendData(int fd, unsigned char *buffer, size_t num)
 {
     unsigned char *tmpBuf = buffer;
     ssize_t n;
@@ -205,7 +281,7 @@ static int sendData(int fd, unsigned char *buffer, size_t num)
         n = write(fd, tmpBuf, num);
         if (n == -1)
         {
-            perror("[-] Failed to send file data via TCP");
+            perror("[-] Failed to send data via TCP");
             return 0;
         }
         tmpBuf += n;
@@ -215,12 +291,22 @@ static int sendData(int fd, unsigned char *buffer, size_t num)
 }
 
 int sendFile(int fd, char *filePath, long lenFile)
+{
+    return sendFileRange(fd, filePath, 0, lenFile);
+}
+
+int sendFileRange(int fd, char *filePath, long offset, long lenFile)
 {
     FILE *post = fopen(filePath, "rb");
     if (post == NULL)
     {
         return 0;
     }
+    if (fseek(post, offset, SEEK_SET) == -1)
+    {
+        fclose(post);
+        return 0;
+    }
     unsigned char buffer[FILEBUFFER_SIZE];
     do
     {
@@ -248,12 +334,17 @@ int sendFile(int fd, char *filePath, long lenFile)
 }
 
 int recvFile(int fd, char *FName, long Fsize)
+{
+    return recvFileAt(fd, FName, 0, Fsize);
+}
+
+int recvFileAt(int fd, char *FName, long offset, long Fsize)
 {
     long bytesRecv = 0;
     int toRead;
     unsigned char bufFile[FILEBUFFER_SIZE] = "";
     ssize_t n;
-    FILE *file = fopen(FName, "wb");
+    FILE *file = fopen(FName, (offset > 0) ? "r+b" : "wb"); // a resumed download keeps the bytes before the offset
 
     if (!file)
     {
@@ -261,13 +352,14 @@ int recvFile(int fd, char *FName, long Fsize)
         return 0;
     }
 
-    do
+    if (fseek(file, offset, SEEK_SET) == -1)
     {
-        if (timerOn(fd) == -1)
-        {
-            perror("[-] Failed to start TCP timer");
-            return 0;
-        }
+        perror("[-] Failed to seek file");
+        fclose(file);
+        return 0;
+    }
+    while (bytesRecv < Fsize)
+    { // An empty file has no data at all
         toRead = MIN(sizeof(bufFile), Fsize - bytesRecv);
         n = read(fd, bufFile, toRead);
 
@@ -276,6 +368,7 @@ int recvFile(int fd, char *FName, long Fsize)
             if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
                 perror("[-] TCP socket timed out while reading. Program will now exit.\n");
+                fclose(file);
                 return 0;
             }
             else
@@ -285,10 +378,9 @@ int recvFile(int fd, char *FName, long Fsize)
                 return 0;
             }
         }
-
-        if (timerOff(fd) == -1)
-        {
-            perror("[-] Failed to turn off TCP timer");
+        if (n == 0)
+        { // Peer closed the connection before sending the whole file
+            fclose(file);
             return 0;
         }
 
@@ -302,8 +394,7 @@ int recvFile(int fd, char *FName, long Fsize)
                 return 0;
             }
         }
-        memset(bufFile, 0, n);
-    } while (bytesRecv < Fsize);
+    }
     if (fclose(file) == -1)
     {
         fprintf(stderr, "[-] Failed to close file.\n");
@@ -324,47 +415,100 @@ void closeTCPSocket(int fdTCP, struct addrinfo *resTCP)
     close(fdTCP);
 }
 
+/* Struct that keeps the message code of a protocol command and the code of the DS reply to it */
+typedef struct protocolcommand
+{
+    const char *code;
+    const char *reply;
+} ProtocolCommand;
+
+/* Protocol commands (client only commands are left out): command macro, the 3 bytes of its message code and the code
+ * of the DS reply to it. A new command also needs its macro (PROTOCOL_NUM_COMMANDS grows with it), an entry here and
+ * its handler in the DS's udpHandlers or tcpHandlers */
+#define PROTOCOL_COMMANDS(X)               \
+    X(REGISTER, 'R', 'E', 'G', "RRG")      \
+    X(UNREGISTER, 'U', 'N', 'R', "RUN")    \
+    X(LOGIN, 'L', 'O', 'G', "RLO")         \
+    X(LOGOUT, 'O', 'U', 'T', "ROU")        \
+    X(GROUPS, 'G', 'L', 'S', "RGL")        \
+    X(SUBSCRIBE, 'G', 'S', 'R', "RGS")     \
+    X(UNSUBSCRIBE, 'G', 'U', 'R', "RGU")   \
+    X(MY_GROUPS, 'G', 'L', 'M', "RGM")     \
+    X(ULIST, 'U', 'L', 'S', "RUL")         \
+    X(POST, 'P', 'S', 'T', "RPT")          \
+    X(RETRIEVE, 'R', 'T', 'V', "RRT")      \
+    X(STATS, 'S', 'T', 'A', "RST")         \
+    X(STREAM, 'P', 'S', 'H', "RPS")        \
+    X(RETRIEVE_ALL, 'R', 'T', 'S', "RRS")  \
+    X(POST_BATCH, 'P', 'S', 'B', "RPB")    \
+    X(BINARY, 'B', 'I', 'N', "RBN")        \
+    X(UPLOAD_START, 'U', 'P', 'S', "RUS")  \
+    X(UPLOAD_QUERY, 'U', 'P', 'Q', "RUQ")  \
+    X(UPLOAD_DATA, 'U', 'P', 'D', "RUD")   \
+    X(RETRIEVE_FILE, 'R', 'T', 'F', "RRF") \
+    X(UPLOAD_CHUNK, 'U', 'P', 'C', "RUC")  \
+    X(UPLOAD_FINISH, 'U', 'P', 'F', "RUF") \
+    X(REPLICATE, 'R', 'P', 'L', "RRP")     \
+    X(LATENCY, 'L', 'A', 'T', "RLT")       \
+    X(PROFILE, 'P', 'R', 'F', "RPF")
+
+/* Packs the three bytes of a message code into an integer */
+#define PACK_OPCODE(a, b, c) (((uint32_t)(unsigned char)(a) << 16) | ((uint32_t)(unsigned char)(b) << 8) | (uint32_t)(unsigned char)(c))
+
+/* Slot of a packed message code in the perfect hash (multiplicative hash) */
+#define HASH_OPCODE(opcode) ((uint32_t)((opcode) * (uint32_t)PROTOCOL_HASH_MULTIPLIER) >> (32 - PROTOCOL_HASH_BITS))
+
+#define COMMAND_ENTRY(cmd, a, b, c, reply) [cmd] = {(const char[]){a, b, c, '\0'}, reply},
+#define COMMAND_SLOT(cmd, a, b, c, reply) [HASH_OPCODE(PACK_OPCODE(a, b, c))] = cmd,
+#define COMMAND_SLOT_BIT(cmd, a, b, c, reply) | (1ULL << HASH_OPCODE(PACK_OPCODE(a, b, c)))
+#define COMMAND_COUNT(cmd, a, b, c, reply) +1
+
+/* Protocol commands indexed by command macro */
+static const ProtocolCommand protocolCommands[PROTOCOL_NUM_COMMANDS] = {PROTOCOL_COMMANDS(COMMAND_ENTRY)};
+
+/* Perfect hash of the message codes: slot -> command macro (0 if empty) */
+static const unsigned char opcodeSlots[1 << PROTOCOL_HASH_BITS] = {PROTOCOL_COMMANDS(COMMAND_SLOT)};
+
+// Every message code must get a slot of its own (a slot set twice would silently lose a command)
+_Static_assert(PROTOCOL_HASH_BITS <= 6, "The slots of the opcode hash are checked in a 64 bit mask");
+_Static_assert(__builtin_popcountll(0 PROTOCOL_COMMANDS(COMMAND_SLOT_BIT)) == 0 PROTOCOL_COMMANDS(COMMAND_COUNT),
+               "Two message codes share a slot of the opcode hash: pick another PROTOCOL_HASH_MULTIPLIER");
+
 int parseDSClientCommand(char *command)
 {
-    if (!strcmp(command, "REG"))
-        return REGISTER;
-    else if (!strcmp(command, "UNR"))
-        return UNREGISTER;
-    else if (!strcmp(command, "LOG"))
-        return LOGIN;
-    else if (!strcmp(command, "OUT"))
-        return LOGOUT;
-    else if (!strcmp(command, "GLS"))
-        return GROUPS;
-    else if (!strcmp(command, "GSR"))
-        return SUBSCRIBE;
-    else if (!strcmp(command, "GUR"))
-        return UNSUBSCRIBE;
-    else if (!strcmp(command, "GLM"))
-        return MY_GROUPS;
-    else if (!strcmp(command, "ULS"))
-        return ULIST;
-    else if (!strcmp(command, "PST"))
-        return POST;
-    else if (!strcmp(command, "RTV"))
-        return RETRIEVE;
-    else
-    { // No valid command was received
-        fprintf(stderr, "[-] Invalid user command code.\n");
+    // Every message code has exactly 3 bytes
+    if (command[0] == '\0' || command[1] == '\0' || command[2] == '\0' || command[3] != '\0')
+    {
         return INVALID_COMMAND;
     }
+    uint32_t opcode = PACK_OPCODE(command[0], command[1], command[2]);
+    int cmd = opcodeSlots[HASH_OPCODE(opcode)];
+    // The slot may belong to another code (no message is printed: garbage requests are common)
+    const char *code = protocolCommands[cmd].code;
+    return (cmd != 0 && PACK_OPCODE(code[0], code[1], code[2]) == opcode) ? cmd : INVALID_COMMAND;
+}
+
+const char *protocolCommandCode(int command)
+{
+    return (command > 0 && command < PROTOCOL_NUM_COMMANDS) ? protocolCommands[command].code : NULL;
+}
+
+const char *protocolReplyCode(int command)
+{
+    return (command > 0 && command < PROTOCOL_NUM_COMMANDS) ? protocolCommands[command].reply : NULL;
 }
 
 int isGID(char *GID)
 {
-    return validRegex(GID, "^[0-9]{2}");
+    // ^[0-9]{2} (anything may follow)
+    return isDigitChar(GID[0]) && isDigitChar(GID[1]);
 }
 
 int timerOn(int fd)
 {
     struct timeval timeout;
     memset((char *)&timeout, 0, sizeof(timeout));
-    timeout.tv_sec = 3;
+    timeout.tv_sec = TCP_TIMEOUT;
     return (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (struct timeval *)&timeout, sizeof(struct timeval)));
 }
 
@@ -106,6 +106,16 @@ int sendTCP(int fd, char *message);
  */
 int readTCP(int fd, char *message, int maxSize);
 
+/**
+ * @brief Reads whatever is available (up to maxSize bytes) from a file descriptor via TCP protocol with a single read.
+ *
+ * @param fd file descriptor to read via TCP protocol.
+ * @param message buffer to store what is read.
+ * @param maxSize maximum number of bytes to read.
+ * @return -1 if read failed, 0 if the peer closed the connection or timed out, otherwise the number of bytes read.
+ */
+int recvTCP(int fd, char *message, int maxSize);
+
 /**
  * @brief Checks if a given file name is valid according to the statement's rules.
  *
@@ -122,6 +132,16 @@ int validFName(char *FName);
  */
 int validMID(char *MID);
 
+/**
+ * @brief Sends an unsigned char buffer (that may contain null bytes) via TCP protocol.
+ *
+ * @param fd file descriptor to send the data to.
+ * @param buffer buffer to be sent.
+ * @param num number of bytes to be sent.
+ * @return 1 if num bytes of buffer were sent, 0 otherwise.
+ */
+int sendData(int fd, unsigned char *buffer, size_t num);
+
 /**
  * @brief Sends a file via TCP.
  *
@@ -132,6 +152,17 @@ int validMID(char *MID);
  */
 int sendFile(int fd, char *filePath, long lenFile);
 
+/**
+ * @brief Sends part of a file via TCP.
+ *
+ * @param fd file descriptor to send the data to.
+ * @param filePath path of the file being sent.
+ * @param offset offset of the first byte to send.
+ * @param lenFile number of bytes to send.
+ * @return 1 if the bytes were sent, 0 otherwise.
+ */
+int sendFileRange(int fd, char *filePath, long offset, long lenFile);
+
 /**
  * @brief Receives a file via TCP.
  *
@@ -142,6 +173,17 @@ int sendFile(int fd, char *filePath, long lenFile);
  */
 int recvFile(int fd, char *FName, long Fsize);
 
+/**
+ * @brief Receives part of a file via TCP, writing it from a given offset on.
+ *
+ * @param fd file descriptor to read the data from.
+ * @param FName name of the file being received (it must exist if offset > 0).
+ * @param offset offset of the first byte received in the file.
+ * @param Fsize number of bytes to receive.
+ * @return 1 if the bytes were received, 0 otherwise (the bytes already received are kept).
+ */
+int recvFileAt(int fd, char *FName, long offset, long Fsize);
+
 /**
  * @brief Closes the socket created to exchange messages between the client and the DS via UDP protocol.
  *
@@ -155,13 +197,29 @@ void closeUDPSocket(int fdUDP, struct addrinfo *resUDP);
 void closeTCPSocket(int fdTCP, struct addrinfo *resTCP);
 
 /**
- * @brief "Translates" a given protocol message code into a pre-defined macro.
+ * @brief "Translates" a given protocol message code into a pre-defined macro through a perfect hash of its three bytes.
  *
  * @param command string containing the protocol message code.
- * @return respective MACRO assigned to given message code.
+ * @return respective MACRO assigned to given message code, INVALID_COMMAND if there's none.
  */
 int parseDSClientCommand(char *command);
 
+/**
+ * @brief Gets the protocol message code of a command (REG for REGISTER, ...).
+ *
+ * @param command command macro.
+ * @return the message code, NULL for client only commands.
+ */
+const char *protocolCommandCode(int command);
+
+/**
+ * @brief Gets the code of the DS reply to a command (RRG for REGISTER, ...).
+ *
+ * @param command command macro.
+ * @return the reply code, NULL for client only commands.
+ */
+const char *protocolReplyCode(int command);
+
 /**
  * @brief Checks if a given group ID is valid according to the statement's rules.
  *
@@ -171,7 +229,8 @@ int parseDSClientCommand(char *command);
 int isGID(char *GID);
 
 /**
- * @brief Sets a timeout to read data on the given file descriptor.
+ * @brief Sets a timeout to read data on the given file descriptor. It's meant to be set once per socket
+ * since it applies to every subsequent read.
  *
  * @param fd file descriptor that will be set a read timeout.
  * @return result of setsockopt().
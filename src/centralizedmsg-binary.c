@@ -0,0 +1,68 @@
+#include "centralizedmsg-binary.h"
+
+void binPut16(unsigned char *buf, uint16_t value)
+{
+    buf[0] = value >> 8;
+    buf[1] = value;
+}
+
+void binPut32(unsigned char *buf, uint32_t value)
+{
+    binPut16(buf, value >> 16);
+    binPut16(buf + 2, value);
+}
+
+void binPut64(unsigned char *buf, uint64_t value)
+{
+    binPut32(buf, value >> 32);
+    binPut32(buf + 4, value);
+}
+
+uint16_t binGet16(const unsigned char *buf)
+{
+    return (uint16_t)(buf[0] << 8 | buf[1]);
+}
+
+uint32_t binGet32(const unsigned char *buf)
+{
+    return (uint32_t)binGet16(buf) << 16 | binGet16(buf + 2);
+}
+
+uint64_t binGet64(const unsigned char *buf)
+{
+    return (uint64_t)binGet32(buf) << 32 | binGet32(buf + 4);
+}
+
+void binPackHeader(unsigned char *buf, const BinHeader *h)
+{
+    buf[0] = h->opcode;
+    buf[1] = h->status;
+    binPut16(buf + 2, h->count);
+    binPut32(buf + 4, h->length);
+}
+
+void binUnpackHeader(const unsigned char *buf, BinHeader *h)
+{
+    h->opcode = buf[0];
+    h->status = buf[1];
+    h->count = binGet16(buf + 2);
+    h->length = binGet32(buf + 4);
+}
+
+void binPackRecord(unsigned char *buf, const BinRecord *r)
+{
+    binPut32(buf, r->UID);
+    binPut16(buf + 4, r->ID);
+    buf[6] = r->TSize;
+    buf[7] = r->FNameLen;
+    binPut64(buf + 8, r->FSize);
+}
+
+void binUnpackRecord(const unsigned char *buf, BinRecord *r)
+{
+    r->UID = binGet32(buf);
+    r->ID = binGet16(buf + 4);
+    r->TSize = buf[6];
+    r->FNameLen = buf[7];
+    r->FSize = binGet64(buf + 8);
+}
@@ -0,0 +1,107 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include "centralizedmsg-api-constants.h"
+#include <stdint.h>
+
+/* Fixed header that starts every binary frame (all fields are sent in network byte order) */
+typedef struct binheader
+{
+    uint8_t opcode; // BIN_OP_*
+    uint8_t status; // BIN_OK in requests
+    uint16_t count; // number of message records that follow the fields
+    uint32_t length; // number of bytes of the fields that follow the header
+} BinHeader;
+
+/* Fixed part of a message: a posted message carries its GID and a retrieved one its MID.
+ * It's followed by TSize bytes of text, FNameLen bytes of file name and FSize bytes of file data */
+typedef struct binrecord
+{
+    uint32_t UID;
+    uint16_t ID;
+    uint8_t TSize;
+    uint8_t FNameLen;
+    uint64_t FSize;
+} BinRecord;
+
+/**
+ * @brief Writes a 16 bit integer in network byte order.
+ *
+ * @param buf buffer with room for 2 bytes.
+ * @param value integer to be written.
+ */
+void binPut16(unsigned char *buf, uint16_t value);
+
+/**
+ * @brief Writes a 32 bit integer in network byte order.
+ *
+ * @param buf buffer with room for 4 bytes.
+ * @param value integer to be written.
+ */
+void binPut32(unsigned char *buf, uint32_t value);
+
+/**
+ * @brief Writes a 64 bit integer in network byte order.
+ *
+ * @param buf buffer with room for 8 bytes.
+ * @param value integer to be written.
+ */
+void binPut64(unsigned char *buf, uint64_t value);
+
+/**
+ * @brief Reads a 16 bit integer in network byte order.
+ *
+ * @param buf buffer that contains the integer.
+ * @return the integer.
+ */
+uint16_t binGet16(const unsigned char *buf);
+
+/**
+ * @brief Reads a 32 bit integer in network byte order.
+ *
+ * @param buf buffer that contains the integer.
+ * @return the integer.
+ */
+uint32_t binGet32(const unsigned char *buf);
+
+/**
+ * @brief Reads a 64 bit integer in network byte order.
+ *
+ * @param buf buffer that contains the integer.
+ * @return the integer.
+ */
+uint64_t binGet64(const unsigned char *buf);
+
+/**
+ * @brief Encodes a frame header.
+ *
+ * @param buf buffer with room for BIN_HEADER_SIZE bytes.
+ * @param h header to be encoded.
+ */
+void binPackHeader(unsigned char *buf, const BinHeader *h);
+
+/**
+ * @brief Decodes a frame header.
+ *
+ * @param buf buffer that contains BIN_HEADER_SIZE bytes.
+ * @param h header that will contain the decoded fields.
+ */
+void binUnpackHeader(const unsigned char *buf, BinHeader *h);
+
+/**
+ * @brief Encodes the fixed part of a message.
+ *
+ * @param buf buffer with room for BIN_RECORD_SIZE bytes.
+ * @param r record to be encoded.
+ */
+void binPackRecord(unsigned char *buf, const BinRecord *r);
+
+/**
+ * @brief Decodes the fixed part of a message.
+ *
+ * @param buf buffer that contains BIN_RECORD_SIZE bytes.
+ * @param r record that will contain the decoded fields.
+ */
+void binUnpackRecord(const unsigned char *buf, BinRecord *r);
+
+#endif
@@ -7,11 +7,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 /* DS Server information variables */
 char addrDS[DS_ADDR_SIZE] = DS_DEFAULT_ADDR;
 char portDS[DS_PORT_SIZE] = DS_DEFAULT_PORT;
 
+/* Read replica information variables (reads go to the DS if there's none) */
+char addrReplicaDS[DS_ADDR_SIZE] = "";
+char portReplicaDS[DS_PORT_SIZE] = "";
+
 /* UDP Socket related variables */
 int fdDSUDP;
 struct addrinfo hintsUDP, *resUDP;
@@ -26,6 +33,15 @@ struct addrinfo hintsTCP, *resTCP;
 int clientSession; // LOGGED_IN or LOGGED_OUT
 char activeClientUID[CLIENT_UID_SIZE], activeClientPWD[CLIENT_PWD_SIZE];
 
+/* TCP connection on which the DS pushes new posts (-1 if there's none) */
+int fdDSPush = -1;
+char pushBuf[CLIENT_PUSHBUF_SIZE];
+size_t pushBufLen = 0;
+
+/* Whether the DS speaks the binary protocol (BIN_UNKNOWN until the first handshake) */
+int binaryDS = BIN_UNKNOWN;
+int binaryHandshakePending = 0; // the handshake reply is read along with the frame's reply
+
 /* Client DS group selected variable */
 char activeDSGID[DS_GID_SIZE];
 
@@ -107,6 +123,12 @@ void createDSUDPSocket()
         close(fdDSUDP);
         exit(EXIT_FAILURE);
     }
+    // The read timeout applies to every recvfrom so it's only set once
+    if (timerOn(fdDSUDP) == -1)
+    {
+        perror("[-] Failed to set read timeout on UDP socket");
+        failDSUDP();
+    }
 }
 
 void processDSUDPReply(char *message)
@@ -278,12 +300,6 @@ void exchangeDSUDPMsg(char *message)
             perror("[-] UDP message failed to send");
             failDSUDP();
         }
-        // Start recvfrom timer
-        if (timerOn(fdDSUDP) == -1)
-        {
-            perror("[-] Failed to set read timeout on UDP socket");
-            failDSUDP();
-        }
         // DS -> Client message
         addrlenUDP = sizeof(addrUDP);
         char dsReply[DS_TO_CLIENT_UDP_SIZE];
@@ -300,12 +316,6 @@ void exchangeDSUDPMsg(char *message)
                 failDSUDP();
             }
         }
-        // Turn timer off if message was received
-        if (timerOff(fdDSUDP) == -1)
-        {
-            perror("[-] Failed to reset read timeout on UDP socket");
-            failDSUDP();
-        }
         dsReply[n] = '\0';
         if (dsReply[n - 1] != '\n')
         { // Each request/reply ends with newline according to DS-Client communication protocol
@@ -400,6 +410,7 @@ void clientLogout(char **tokenList, int numTokens)
     exchangeDSUDPMsg(messageToDSUDP);
     if (clientSession == LOGGED_OUT)
     { // The exchangeDSUDPMsg function sets the client session to LOGGED_OUT if reply is OK
+        closeDSPushStream();
         memset(activeClientUID, 0, sizeof(activeClientUID));
         memset(activeClientPWD, 0, sizeof(activeClientPWD));
     }
@@ -429,6 +440,7 @@ void clientExit(int numTokens)
         fprintf(stderr, "[-] Incorrect exit command usage. Please try again.\n");
         return;
     }
+    closeDSPushStream();
     closeUDPSocket(fdDSUDP, resUDP);
     printf("[+] Exiting...\n");
     exit(EXIT_SUCCESS);
@@ -585,6 +597,293 @@ void connectDSTCPSocket()
         perror("[-] Failed to connect to TCP socket");
         failDSTCP();
     }
+    // The read timeout applies to every read on this connection so it's only set once
+    if (timerOn(fdDSTCP) == -1)
+    {
+        perror("[-] Failed to set read timeout on TCP socket");
+        failDSTCP();
+    }
+}
+
+void connectDSReadSocket()
+{
+    if (addrReplicaDS[0] != '\0')
+    {
+        memset(&hintsTCP, 0, sizeof(hintsTCP));
+        hintsTCP.ai_family = AF_INET;
+        hintsTCP.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(addrReplicaDS, (portReplicaDS[0] != '\0') ? portReplicaDS : portDS, &hintsTCP, &resTCP) == 0)
+        {
+            fdDSTCP = socket(AF_INET, SOCK_STREAM, 0);
+            if (fdDSTCP != -1 && connect(fdDSTCP, resTCP->ai_addr, resTCP->ai_addrlen) == 0 && timerOn(fdDSTCP) == 0)
+            {
+                return;
+            }
+            if (fdDSTCP != -1)
+            {
+                close(fdDSTCP);
+            }
+            freeaddrinfo(resTCP);
+        }
+        fprintf(stderr, "[-] Failed to connect to the read replica. Reading from the DS instead.\n");
+    }
+    connectDSTCPSocket();
+}
+
+/**
+ * @brief Reads the DS reply to a binary protocol handshake (RBN OK V, RBN NOK V or ERR from a DS that doesn't know it).
+ *
+ * @return 1 if the DS accepted the client's version, 0 otherwise.
+ */
+static int readBinaryHandshake()
+{
+    char reply[DS_BINREPLY_SIZE] = "";
+    if (readTCP(fdDSTCP, reply, PROTOCOL_CODE_SIZE) != PROTOCOL_CODE_SIZE)
+    {
+        failDSTCP();
+    }
+    if (!strcmp(reply, ERR_MSG))
+    {
+        return 0;
+    }
+    if (strcmp(reply, "RBN "))
+    {
+        errDSTCP();
+    }
+    if (readTCP(fdDSTCP, reply, 3) != 3)
+    { // OK or NOK
+        failDSTCP();
+    }
+    int accepted = !strncmp(reply, "OK ", 3);
+    if (!accepted && strncmp(reply, "NOK", 3))
+    {
+        errDSTCP();
+    }
+    // The version is a single digit followed by a nl
+    int len = accepted ? 2 : 3;
+    if (readTCP(fdDSTCP, reply, len) != len || reply[len - 1] != '\n')
+    {
+        errDSTCP();
+    }
+    return accepted && reply[0] == '0' + BIN_VERSION;
+}
+
+/**
+ * @brief Connects to the DS and negotiates the binary protocol. Once the DS is known to speak it the handshake
+ * is pipelined with the request so it doesn't cost a round trip.
+ *
+ * @return 1 if the connection carries binary frames, 0 if the text protocol must be used (not connected).
+ */
+static int connectDSBinary()
+{
+    if (binaryDS == BIN_OFF)
+    {
+        return 0;
+    }
+    connectDSTCPSocket();
+    char handshake[CLIENTDS_BINBUF_SIZE];
+    sprintf(handshake, "BIN %d\n", BIN_VERSION);
+    if (sendTCP(fdDSTCP, handshake) == -1)
+    {
+        failDSTCP();
+    }
+    if (binaryDS == BIN_ON)
+    {
+        binaryHandshakePending = 1;
+        return 1;
+    }
+    if (readBinaryHandshake())
+    {
+        binaryDS = BIN_ON;
+        return 1;
+    }
+    // The DS only speaks the text protocol and it closes the connection after refusing
+    binaryDS = BIN_OFF;
+    closeTCPSocket(fdDSTCP, resTCP);
+    return 0;
+}
+
+/**
+ * @brief Reads the header of a binary reply frame (and the pipelined handshake reply before it).
+ *
+ * @param h header that will contain the reply's header.
+ * @param opcode opcode of the request.
+ * @return 1 if the header was read, 0 if the DS refused the pipelined handshake (the connection is closed).
+ */
+static int readBinaryReplyHeader(BinHeader *h, int opcode)
+{
+    if (binaryHandshakePending)
+    {
+        binaryHandshakePending = 0;
+        if (!readBinaryHandshake())
+        {
+            binaryDS = BIN_OFF;
+            fprintf(stderr, "[-] The DS no longer accepts the binary protocol. Please try again.\n");
+            closeTCPSocket(fdDSTCP, resTCP);
+            return 0;
+        }
+    }
+    unsigned char header[BIN_HEADER_SIZE];
+    if (readTCP(fdDSTCP, (char *)header, BIN_HEADER_SIZE) != BIN_HEADER_SIZE)
+    {
+        failDSTCP();
+    }
+    binUnpackHeader(header, h);
+    if (h->opcode != opcode || h->status == BIN_ERR)
+    { // Wrong protocol message received
+        errDSTCP();
+    }
+    return 1;
+}
+
+/**
+ * @brief Gives the DS reply on the current TCP connection extra time to arrive.
+ *
+ * @param waitSecs number of seconds the DS may wait before it replies.
+ */
+static void extendDSReplyTimeout(int waitSecs)
+{
+    // The reply only arrives once there are messages or the wait time ends
+    struct timeval timeout;
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.tv_sec = waitSecs + TCP_TIMEOUT;
+    if (setsockopt(fdDSTCP, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+    {
+        perror("[-] Failed to set read timeout on TCP socket");
+        failDSTCP();
+    }
+}
+
+/**
+ * @brief Posts a message on the current selected DS group with a binary frame.
+ *
+ * @param Text string that contains the message text.
+ * @param Fname string that contains the name of the attached file ("" if there's none).
+ * @param lenFile size of the attached file.
+ */
+static void binaryPostInGroup(char *Text, char *Fname, long lenFile)
+{
+    unsigned char frame[BIN_HEADER_SIZE + BIN_RECORD_SIZE + PROTOCOL_TEXT_SIZE + PROTOCOL_FNAME_SIZE];
+    BinRecord r = {atoi(activeClientUID), atoi(activeDSGID), strlen(Text), strlen(Fname), lenFile};
+    BinHeader h = {BIN_OP_POST, BIN_OK, 0, BIN_RECORD_SIZE + r.TSize + r.FNameLen};
+    binPackHeader(frame, &h);
+    binPackRecord(frame + BIN_HEADER_SIZE, &r);
+    memcpy(frame + BIN_HEADER_SIZE + BIN_RECORD_SIZE, Text, r.TSize);
+    memcpy(frame + BIN_HEADER_SIZE + BIN_RECORD_SIZE + r.TSize, Fname, r.FNameLen);
+    if (!sendData(fdDSTCP, frame, BIN_HEADER_SIZE + h.length))
+    {
+        failDSTCP();
+    }
+    if (r.FNameLen > 0 && lenFile > 0 && sendFile(fdDSTCP, Fname, lenFile) == 0)
+    {
+        failDSTCP();
+    }
+
+    if (!readBinaryReplyHeader(&h, BIN_OP_POST))
+    {
+        return;
+    }
+    unsigned char reply[BIN_PSTREPLY_SIZE];
+    if (h.status == BIN_OK && h.length == BIN_PSTREPLY_SIZE && readTCP(fdDSTCP, (char *)reply, BIN_PSTREPLY_SIZE) == BIN_PSTREPLY_SIZE)
+    {
+        printf("[+] You have successfully posted in the selected group with message ID %04u.\n", binGet16(reply));
+    }
+    else if (h.status == BIN_NOK && h.length == 0)
+    {
+        fprintf(stderr, "[-] Failed to post in group. Please try again.\n");
+    }
+    else
+    {
+        errDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+}
+
+/**
+ * @brief Shows the messages from the current selected DS group starting from the given message ID with a binary frame.
+ *
+ * @param MID starting message ID.
+ * @param waitSecs number of seconds the DS may wait for new messages.
+ */
+static void binaryRetrieveFromGroup(int MID, int waitSecs)
+{
+    unsigned char frame[BIN_HEADER_SIZE + BIN_RTVREQ_SIZE];
+    BinHeader h = {BIN_OP_RETRIEVE, BIN_OK, 0, BIN_RTVREQ_SIZE};
+    binPackHeader(frame, &h);
+    binPut32(frame + BIN_HEADER_SIZE, atoi(activeClientUID));
+    binPut16(frame + BIN_HEADER_SIZE + 4, atoi(activeDSGID));
+    binPut16(frame + BIN_HEADER_SIZE + 6, MID);
+    binPut16(frame + BIN_HEADER_SIZE + 8, waitSecs);
+    if (!sendData(fdDSTCP, frame, sizeof(frame)))
+    {
+        failDSTCP();
+    }
+    if (waitSecs > 0)
+    {
+        extendDSReplyTimeout(waitSecs);
+    }
+
+    if (!readBinaryReplyHeader(&h, BIN_OP_RETRIEVE))
+    {
+        return;
+    }
+    if (h.length != 0 || (h.status != BIN_OK && h.count != 0))
+    {
+        errDSTCP();
+    }
+    if (h.status == BIN_EOF)
+    {
+        printf("[+] There are no available messages to show in the selected group from the given starting message.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    if (h.status == BIN_NOK)
+    {
+        fprintf(stderr, "[-] Failed to retrieve from group. Please check if you have a selected subscribed group and try again.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+
+    // Every message is a fixed size record followed by its text, file name and file data
+    printf("[+] %d message%s to display: (-> MID: text \\(Fname - Fsize)):\n", h.count, h.count == 1 ? "" : "s");
+    unsigned char fields[BIN_RECORD_SIZE + PROTOCOL_TEXT_SIZE + PROTOCOL_FNAME_SIZE];
+    BinRecord r;
+    for (int i = 0; i < h.count; ++i)
+    {
+        if (readTCP(fdDSTCP, (char *)fields, BIN_RECORD_SIZE) != BIN_RECORD_SIZE)
+        {
+            failDSTCP();
+        }
+        binUnpackRecord(fields, &r);
+        if (r.TSize > PROTOCOL_TEXT_SIZE - 1 || r.FNameLen > PROTOCOL_FNAME_SIZE - 1 || r.FSize > BIN_MAX_FSIZE)
+        {
+            errDSTCP();
+        }
+        int len = r.TSize + r.FNameLen;
+        if (len > 0 && readTCP(fdDSTCP, (char *)fields, len) != len)
+        {
+            failDSTCP();
+        }
+        char Text[PROTOCOL_TEXT_SIZE], FName[PROTOCOL_FNAME_SIZE];
+        memcpy(Text, fields, r.TSize);
+        Text[r.TSize] = '\0';
+        memcpy(FName, fields + r.TSize, r.FNameLen);
+        FName[r.FNameLen] = '\0';
+        printf("-> %04u: %s\n", r.ID, Text);
+        if (r.FNameLen > 0)
+        {
+            if (!validFName(FName))
+            {
+                errDSTCP();
+            }
+            printf("(%s - %llu bytes)\n", FName, (unsigned long long)r.FSize);
+            if (recvFile(fdDSTCP, FName, r.FSize) == 0)
+            {
+                failDSTCP();
+            }
+        }
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
 }
 
 void showClientsSubscribedToGroup(char **tokenList, int numTokens)
@@ -606,7 +905,7 @@ void showClientsSubscribedToGroup(char **tokenList, int numTokens)
     }
 
     // Connect to DS TCP socket
-    connectDSTCPSocket();
+    connectDSReadSocket();
 
     // Send protocol message to DS
     char ulistClientMessage[CLIENTDS_ULISTBUF_SIZE];
@@ -702,6 +1001,29 @@ void showClientsSubscribedToGroup(char **tokenList, int numTokens)
     closeTCPSocket(fdDSTCP, resTCP);
 }
 
+/**
+ * @brief Gets the size of a file to be posted.
+ *
+ * @param Fname string that contains the file's name.
+ * @return size of the file in bytes, -1 if it can't be read.
+ */
+static long postFileSize(char *Fname)
+{
+    FILE *post = fopen(Fname, "rb");
+    if (post == NULL)
+    {
+        perror("[-] Error opening given file");
+        return -1;
+    }
+    long lenFile = -1;
+    if (fseek(post, 0, SEEK_END) == -1 || (lenFile = ftell(post)) == -1)
+    {
+        perror("[-] Post file size failed");
+    }
+    fclose(post);
+    return lenFile;
+}
+
 void clientPostInGroup(char *command)
 {
     if (clientSession == LOGGED_OUT)
@@ -714,47 +1036,35 @@ void clientPostInGroup(char *command)
         fprintf(stderr, "[-] Please select a group before you post on it.\n");
         return;
     }
-    connectDSTCPSocket();
 
-    // Send message from client to the DS
+    // Validate the message before connecting to the DS
     char messageText[PROTOCOL_TEXT_SIZE];
     char Fname[PROTOCOL_FNAME_SIZE] = "";
-    sscanf(command, "post \"%240[^\"]\" %s", messageText, Fname); // makes sure that it only reads up to 240 characters
+    long lenFile = 0; // long because it can have at most 10 digits and int goes to 2^31 - 1 which is 214--.7 (len 10) - it can be 999 999 999 9 bytes
+    sscanf(command, "post \"%240[^\"]\" %24s", messageText, Fname); // makes sure that it only reads up to 240 characters
     if (strlen(Fname) > 0)
     { // fileName was 'filled' up with something -> there's a file to send
         if (!validFName(Fname))
         { // Validate the file sent
             fprintf(stderr, "[-] The file you submit can't exceed 24 characters and must have a 3 letter file extension. Please try again.\n");
-            closeTCPSocket(fdDSTCP, resTCP);
             return;
         }
 
         // Extract its size in bytes
-        FILE *post = fopen(Fname, "rb");
-        if (post == NULL)
+        if ((lenFile = postFileSize(Fname)) == -1)
         {
-            perror("[-] Error opening given file");
-            closeTCPSocket(fdDSTCP, resTCP);
             return;
         }
-        if (fseek(post, 0, SEEK_END) == -1)
-        {
-            perror("[-] Post file seek failed");
-            failDSTCP();
-        }
-        long lenFile = ftell(post); // long because it can have at most 10 digits and int goes to 2^31 - 1 which is 214--.7 (len 10) - it can be 999 999 999 9 bytes
-        if (lenFile == -1)
-        {
-            perror("[-] Post file tell failed");
-            failDSTCP();
-        }
-        rewind(post);
-        if (fclose(post) == -1)
-        {
-            perror("[-] Post file failed to close");
-            failDSTCP();
-        }
+    }
 
+    if (connectDSBinary())
+    {
+        binaryPostInGroup(messageText, Fname, lenFile);
+        return;
+    }
+    connectDSTCPSocket();
+    if (strlen(Fname) > 0)
+    {
         // Send initial message
         char postMessageWFile[CLIENTDS_POSTWFILE_SIZE];
         sprintf(postMessageWFile, "PST %s %s %ld %s %s %ld ", activeClientUID, activeDSGID, strlen(messageText), messageText, Fname, lenFile);
@@ -822,68 +1132,944 @@ void clientPostInGroup(char *command)
     closeTCPSocket(fdDSTCP, resTCP);
 }
 
-void clientRetrieveFromGroup(char **tokenList, int numTokens)
+/* A message of a batch post as read from the list file */
+typedef struct batchentry
+{
+    char Text[PROTOCOL_TEXT_SIZE];
+    char Fname[PROTOCOL_FNAME_SIZE];
+    long lenFile;
+} BatchEntry;
+
+/**
+ * @brief Reads the messages of a batch post from a list file, one "text" [Fname] per line.
+ *
+ * @param listPath string that contains the path of the list file.
+ * @param entries array that will contain the messages (DS_PSB_MAX_MSGS at most).
+ * @return number of messages read, 0 if the list file is invalid.
+ */
+static int readBatchList(char *listPath, BatchEntry *entries)
+{
+    FILE *list = fopen(listPath, "r");
+    if (list == NULL)
+    {
+        perror("[-] Error opening given list file");
+        return 0;
+    }
+    char line[CLIENT_PSBLINE_SIZE];
+    int num = 0;
+    while (fgets(line, CLIENT_PSBLINE_SIZE, list) != NULL)
+    {
+        if (line[0] == '\n')
+        { // Skip blank lines
+            continue;
+        }
+        if (num == DS_PSB_MAX_MSGS)
+        {
+            fprintf(stderr, "[-] A batch can't have more than %d messages. Please try again.\n", DS_PSB_MAX_MSGS);
+            fclose(list);
+            return 0;
+        }
+        BatchEntry *e = &entries[num];
+        e->Fname[0] = '\0';
+        e->lenFile = 0;
+        if (sscanf(line, "\"%240[^\"]\" %24s", e->Text, e->Fname) < 1)
+        {
+            fprintf(stderr, "[-] Line %d of the list file must be \"text\" [Fname]. Please try again.\n", num + 1);
+            fclose(list);
+            return 0;
+        }
+        if (strlen(e->Fname) > 0)
+        {
+            if (!validFName(e->Fname))
+            {
+                fprintf(stderr, "[-] The file you submit can't exceed 24 characters and must have a 3 letter file extension. Please try again.\n");
+                fclose(list);
+                return 0;
+            }
+            if ((e->lenFile = postFileSize(e->Fname)) == -1)
+            {
+                fclose(list);
+                return 0;
+            }
+        }
+        num++;
+    }
+    fclose(list);
+    if (num == 0)
+    {
+        fprintf(stderr, "[-] The list file has no messages to post. Please try again.\n");
+    }
+    return num;
+}
+
+void clientPostBatchInGroup(char **tokenList, int numTokens)
 {
     if (numTokens != 2)
-    { // R XXXX / RETRIEVE XXXX
-        fprintf(stderr, "[-] Incorrect retrieve command usage. Please try again.\n");
+    { // PB LISTFILE / POST_BATCH LISTFILE
+        fprintf(stderr, "[-] Incorrect post batch command usage. Please try again.\n");
         return;
     }
     if (clientSession == LOGGED_OUT)
-    {
-        fprintf(stderr, "[-] Please login before you retrieve messages from a group.\n");
+    { // Client logged out
+        fprintf(stderr, "[-] Please login before you post to a group.\n");
         return;
     }
     if (strlen(activeDSGID) == 0)
-    {
-        fprintf(stderr, "[-] Please select a group before you retrieve messages from it.\n");
+    { // No group selected
+        fprintf(stderr, "[-] Please select a group before you post on it.\n");
         return;
     }
-    if (!validMID(tokenList[1]))
+    // Every message is validated before connecting so the DS never gets a half-sent batch
+    BatchEntry entries[DS_PSB_MAX_MSGS];
+    int num = readBatchList(tokenList[1], entries);
+    if (num == 0)
     {
-        fprintf(stderr, "[-] Invalid starting message to retrieve. Please try again.\n");
         return;
     }
-
     connectDSTCPSocket();
 
-    // Send message from client to the DS
-    char retrieveMessageToDS[CLIENTDS_RTVBUF_SIZE];
-    sprintf(retrieveMessageToDS, "RTV %s %s %s\n", activeClientUID, activeDSGID, tokenList[1]);
-    if (sendTCP(fdDSTCP, retrieveMessageToDS) == -1)
+    // Send the header and then every message (TSize Text[ Fname Fsize data]\n)
+    char batchMessage[CLIENTDS_PSBENTRY_SIZE];
+    sprintf(batchMessage, "PSB %s %s %d ", activeClientUID, activeDSGID, num);
+    if (sendTCP(fdDSTCP, batchMessage) == -1)
     {
         failDSTCP();
     }
+    for (int i = 0; i < num; ++i)
+    {
+        if (strlen(entries[i].Fname) > 0)
+        {
+            snprintf(batchMessage, CLIENTDS_PSBENTRY_SIZE, "%ld %s %s %ld ", strlen(entries[i].Text), entries[i].Text, entries[i].Fname, entries[i].lenFile);
+            if (sendTCP(fdDSTCP, batchMessage) == -1 || sendFile(fdDSTCP, entries[i].Fname, entries[i].lenFile) == 0)
+            {
+                failDSTCP();
+            }
+            if (sendTCP(fdDSTCP, "\n") == -1)
+            {
+                failDSTCP();
+            }
+        }
+        else
+        {
+            snprintf(batchMessage, CLIENTDS_PSBENTRY_SIZE, "%ld %s\n", strlen(entries[i].Text), entries[i].Text);
+            if (sendTCP(fdDSTCP, batchMessage) == -1)
+            {
+                failDSTCP();
+            }
+        }
+    }
 
-    // Receive retrieve reply from the DS
-    char codeDS[PROTOCOL_CODE_SIZE + 1], statusDS[DSCLIENT_RTVSTATUS_SIZE + 1];
-    char singleCharDS[CHAR_SIZE];
+    // Receive reply from the DS (RPB OK MID1 ... MIDN or RPB NOK)
+    char batchDSReply[DS_PSBREPLY_SIZE];
     int n;
-
-    // Read the DS reply code
-    if ((n = readTCP(fdDSTCP, codeDS, PROTOCOL_CODE_SIZE)) == -1)
+    if ((n = readTCP(fdDSTCP, batchDSReply, DS_PSBREPLY_SIZE - 1)) <= 0)
     {
         failDSTCP();
     }
-    codeDS[n - 1] = '\0'; // replace backspace with null terminator
-    if (strcmp(codeDS, "RRT"))
+    if (batchDSReply[n - 1] != '\n')
+    { // Each request/reply ends with newline according to DS-Client communication protocol
+        errDSTCP();
+    }
+    batchDSReply[n - 1] = '\0';
+    char codeDS[PROTOCOL_CODE_SIZE], statusDS[PROTOCOL_STATUS_TCP_SIZE];
+    if (sscanf(batchDSReply, "%3s %4s", codeDS, statusDS) != 2 || strcmp(codeDS, "RPB"))
     { // Wrong protocol message received
         errDSTCP();
     }
-
-    // Read the DS reply status
-    if ((n = readTCP(fdDSTCP, statusDS, DSCLIENT_RTVSTATUS_SIZE)) == -1)
+    if (!strcmp(statusDS, "NOK"))
     {
-        failDSTCP();
+        fprintf(stderr, "[-] Failed to post the batch in group. Please try again.\n");
     }
-    statusDS[n] = '\0';
-    if (!strcmp(statusDS, "EOF") || !strcmp(statusDS, "NOK"))
-    { // Every reply/request must end with a \n
-        if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-        {
-            failDSTCP();
-        }
-        singleCharDS[n] = '\0';
+    else if (!strcmp(statusDS, "OK") && (int)strlen(batchDSReply) == 6 + num * DS_MID_SIZE)
+    {
+        printf("[+] You have successfully posted %d messages in the selected group with message IDs:%s.\n", num, batchDSReply + 6);
+    }
+    else
+    {
+        errDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+}
+
+/**
+ * @brief Asks the DS how many bytes of an upload it has stored.
+ *
+ * @param SID string that contains the upload session ID.
+ * @param FSize reference that will contain the size of the upload's file.
+ * @return offset the upload resumes from, -1 if the session doesn't exist.
+ */
+static long queryUploadOffset(char *SID, long *FSize)
+{
+    connectDSTCPSocket();
+    char queryMessage[CLIENTDS_UPDBUF_SIZE];
+    sprintf(queryMessage, "UPQ %s %s\n", activeClientUID, SID);
+    if (sendTCP(fdDSTCP, queryMessage) == -1)
+    {
+        failDSTCP();
+    }
+    char reply[DS_UPLOADREPLY_SIZE];
+    int n = readTCP(fdDSTCP, reply, DS_UPLOADREPLY_SIZE - 1);
+    if (n <= 0)
+    {
+        failDSTCP();
+    }
+    reply[n] = '\0';
+    long offset;
+    if (sscanf(reply, "RUQ OK %ld %ld\n", &offset, FSize) == 2 && reply[n - 1] == '\n')
+    {
+        closeTCPSocket(fdDSTCP, resTCP);
+        return offset;
+    }
+    if (strcmp(reply, "RUQ NOK\n"))
+    {
+        errDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+    return -1;
+}
+
+/**
+ * @brief Sends the rest of an upload's file, resuming from the offset stored by the DS whenever the transfer is interrupted.
+ *
+ * @param SID string that contains the upload session ID.
+ * @param Fname string that contains the file's name.
+ * @param lenFile size of the file.
+ * @param offset offset to start sending from (-1 to ask the DS).
+ */
+static void transferUpload(char *SID, char *Fname, long lenFile, long offset)
+{
+    for (int tries = 0; tries < CLIENT_TRANSFER_TRIES; ++tries)
+    {
+        if (offset == -1)
+        { // The DS knows how much was stored before the connection went down
+            long FSize;
+            if ((offset = queryUploadOffset(SID, &FSize)) == -1)
+            {
+                fprintf(stderr, "[-] The upload session %s doesn't exist (it may have been completed or expired).\n", SID);
+                return;
+            }
+            if (FSize != lenFile)
+            {
+                fprintf(stderr, "[-] The given file doesn't match the upload session's file (%ld bytes).\n", FSize);
+                return;
+            }
+            printf("[+] Resuming upload %s from byte %ld.\n", SID, offset);
+        }
+
+        connectDSTCPSocket();
+        char dataMessage[CLIENTDS_UPDBUF_SIZE];
+        sprintf(dataMessage, "UPD %s %s %ld %ld ", activeClientUID, SID, offset, lenFile - offset);
+        int sent = sendTCP(fdDSTCP, dataMessage) != -1 && (offset == lenFile || sendFileRange(fdDSTCP, Fname, offset, lenFile - offset)) &&
+                   sendTCP(fdDSTCP, "\n") != -1;
+        char reply[DS_UPLOADREPLY_SIZE];
+        int n = sent ? readTCP(fdDSTCP, reply, DS_UPLOADREPLY_SIZE - 1) : 0;
+        if (n <= 0 || reply[n - 1] != '\n')
+        { // Interrupted
+            closeTCPSocket(fdDSTCP, resTCP);
+            offset = -1;
+            continue;
+        }
+        reply[n] = '\0';
+        char MID[DS_MID_SIZE];
+        if (sscanf(reply, "RUD END %4s\n", MID) == 1 && validMID(MID))
+        {
+            printf("[+] You have successfully posted in the selected group with message ID %s.\n", MID);
+        }
+        else if (sscanf(reply, "RUD OK %ld\n", &offset) == 1)
+        { // The DS stored less than what was sent
+            closeTCPSocket(fdDSTCP, resTCP);
+            continue;
+        }
+        else if (!strcmp(reply, "RUD NOK\n"))
+        {
+            fprintf(stderr, "[-] Failed to upload the file. Please try again.\n");
+        }
+        else
+        {
+            errDSTCP();
+        }
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    fprintf(stderr, "[-] The upload was interrupted. Resume it with: upload_resume %s %s\n", SID, Fname);
+}
+
+/**
+ * @brief Sends a single chunk of a parallel upload on its own connection.
+ *
+ * @param SID string that contains the upload session ID.
+ * @param Fname string that contains the file's name.
+ * @param lenFile size of the file.
+ * @param chunk index of the chunk.
+ * @return 1 if the DS stored the chunk, 0 if it refused it, -1 if the connection failed.
+ */
+static int sendUploadChunk(char *SID, char *Fname, long lenFile, long chunk)
+{
+    long offset = chunk * UPLOAD_CHUNK_SIZE;
+    long len = (lenFile - offset < UPLOAD_CHUNK_SIZE) ? lenFile - offset : UPLOAD_CHUNK_SIZE;
+    connectDSTCPSocket();
+    char chunkMessage[CLIENTDS_UPDBUF_SIZE];
+    snprintf(chunkMessage, CLIENTDS_UPDBUF_SIZE, "UPC %s %s %ld %ld ", activeClientUID, SID, offset, len);
+    int sent = sendTCP(fdDSTCP, chunkMessage) != -1 && sendFileRange(fdDSTCP, Fname, offset, len) && sendTCP(fdDSTCP, "\n") != -1;
+    char reply[DS_UPLOADREPLY_SIZE];
+    int n = sent ? readTCP(fdDSTCP, reply, DS_UPLOADREPLY_SIZE - 1) : 0;
+    closeTCPSocket(fdDSTCP, resTCP);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    reply[n] = '\0';
+    if (!strcmp(reply, "RUC OK\n"))
+    {
+        return 1;
+    }
+    if (!strcmp(reply, "RUC NOK\n"))
+    {
+        return 0;
+    }
+    errDSTCP();
+    return 0;
+}
+
+/**
+ * @brief Sends an upload's file in fixed-size chunks over several connections at once and creates its
+ * message once every chunk was acknowledged. Each connection is driven by its own process and sends
+ * every numConns-th chunk.
+ *
+ * @param SID string that contains the upload session ID.
+ * @param Fname string that contains the file's name.
+ * @param lenFile size of the file.
+ * @param numConns number of connections.
+ */
+static void transferChunkedUpload(char *SID, char *Fname, long lenFile, int numConns)
+{
+    long numChunks = (lenFile + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE;
+    if (numConns > numChunks)
+    {
+        numConns = numChunks;
+    }
+    fflush(stdout); // Otherwise pending output would be printed by every child too
+    int failed = 0;
+    for (int w = 0; w < numConns; ++w)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("[-] Failed to start upload connection");
+            failed = 1;
+            break;
+        }
+        if (pid == 0)
+        { // A chunk that's refused or keeps failing fails the whole upload
+            for (long chunk = w; chunk < numChunks; chunk += numConns)
+            {
+                int ret = -1;
+                for (int tries = 0; tries < CLIENT_TRANSFER_TRIES && ret == -1; ++tries)
+                {
+                    ret = sendUploadChunk(SID, Fname, lenFile, chunk);
+                }
+                if (ret != 1)
+                {
+                    exit(EXIT_FAILURE);
+                }
+            }
+            exit(EXIT_SUCCESS);
+        }
+    }
+    int status;
+    while (wait(&status) != -1)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+            failed = 1;
+        }
+    }
+    if (failed)
+    {
+        fprintf(stderr, "[-] Failed to upload every chunk of the file. Please try again.\n");
+        return;
+    }
+
+    // Every chunk is stored so the message can be created
+    connectDSTCPSocket();
+    char finishMessage[CLIENTDS_UPDBUF_SIZE];
+    sprintf(finishMessage, "UPF %s %s\n", activeClientUID, SID);
+    if (sendTCP(fdDSTCP, finishMessage) == -1)
+    {
+        failDSTCP();
+    }
+    char reply[DS_UPLOADREPLY_SIZE];
+    int n = readTCP(fdDSTCP, reply, DS_UPLOADREPLY_SIZE - 1);
+    if (n <= 0)
+    {
+        failDSTCP();
+    }
+    reply[n] = '\0';
+    char MID[DS_MID_SIZE];
+    if (sscanf(reply, "RUF OK %4s\n", MID) == 1 && validMID(MID))
+    {
+        printf("[+] You have successfully posted in the selected group with message ID %s.\n", MID);
+    }
+    else if (!strcmp(reply, "RUF NOK\n"))
+    {
+        fprintf(stderr, "[-] Failed to upload the file. Please try again.\n");
+    }
+    else
+    {
+        errDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+}
+
+void clientUploadInGroup(char *command)
+{
+    if (clientSession == LOGGED_OUT)
+    { // Client logged out
+        fprintf(stderr, "[-] Please login before you post to a group.\n");
+        return;
+    }
+    if (strlen(activeDSGID) == 0)
+    { // No group selected
+        fprintf(stderr, "[-] Please select a group before you post on it.\n");
+        return;
+    }
+    char messageText[PROTOCOL_TEXT_SIZE] = "";
+    char Fname[PROTOCOL_FNAME_SIZE] = "";
+    char *quote = strchr(command, '"');
+    int numConns = 1;
+    int n = (quote == NULL) ? 0 : sscanf(quote, "\"%240[^\"]\" %24s %d", messageText, Fname, &numConns);
+    if (n < 2 || !validFName(Fname))
+    {
+        fprintf(stderr, "[-] Incorrect upload command usage (upload \"text\" Fname [connections]). Please try again.\n");
+        return;
+    }
+    if (numConns < 1 || numConns > CLIENT_UPLOAD_MAX_CONNS)
+    {
+        fprintf(stderr, "[-] Invalid number of connections (at most %d). Please try again.\n", CLIENT_UPLOAD_MAX_CONNS);
+        return;
+    }
+    long lenFile = postFileSize(Fname);
+    if (lenFile == -1)
+    {
+        return;
+    }
+    if (lenFile == 0)
+    {
+        fprintf(stderr, "[-] Empty files don't need a resumable upload. Please use post instead.\n");
+        return;
+    }
+
+    // Start the upload session (the text goes last so it may have spaces)
+    connectDSTCPSocket();
+    char startMessage[CLIENTDS_UPSBUF_SIZE];
+    snprintf(startMessage, CLIENTDS_UPSBUF_SIZE, "UPS %s %s %s %ld %ld %s\n", activeClientUID, activeDSGID, Fname, lenFile, strlen(messageText), messageText);
+    if (sendTCP(fdDSTCP, startMessage) == -1)
+    {
+        failDSTCP();
+    }
+    char reply[DS_UPLOADREPLY_SIZE];
+    n = readTCP(fdDSTCP, reply, DS_UPLOADREPLY_SIZE - 1);
+    if (n <= 0)
+    {
+        failDSTCP();
+    }
+    reply[n] = '\0';
+    char SID[DS_SID_SIZE];
+    if (!strcmp(reply, "RUS NOK\n"))
+    {
+        fprintf(stderr, "[-] Failed to start the upload. Please check if you're subscribed to the selected group and try again.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    if (sscanf(reply, "RUS OK %8s\n", SID) != 1 || reply[n - 1] != '\n')
+    {
+        errDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+    printf("[+] Upload session %s started.\n", SID);
+    if (numConns > 1)
+    {
+        transferChunkedUpload(SID, Fname, lenFile, numConns);
+        return;
+    }
+    transferUpload(SID, Fname, lenFile, 0);
+}
+
+void clientResumeUpload(char **tokenList, int numTokens)
+{
+    if (numTokens != 3)
+    { // UR SID FNAME / UPLOAD_RESUME SID FNAME
+        fprintf(stderr, "[-] Incorrect upload resume command usage. Please try again.\n");
+        return;
+    }
+    if (clientSession == LOGGED_OUT)
+    {
+        fprintf(stderr, "[-] Please login before you resume an upload.\n");
+        return;
+    }
+    if (strlen(tokenList[1]) != DS_SID_SIZE - 1 || !isNumber(tokenList[1]) || !validFName(tokenList[2]))
+    {
+        fprintf(stderr, "[-] Invalid upload session ID or file name. Please try again.\n");
+        return;
+    }
+    long lenFile = postFileSize(tokenList[2]);
+    if (lenFile == -1)
+    {
+        return;
+    }
+    transferUpload(tokenList[1], tokenList[2], lenFile, -1);
+}
+
+/**
+ * @brief Reads a field of a DS reply that ends with a space.
+ *
+ * @param field buffer that will contain the field.
+ * @param size size of the buffer.
+ * @return 1 if the field was read, 0 otherwise.
+ */
+static int readDSField(char *field, int size)
+{
+    for (int len = 0; len < size; ++len)
+    {
+        if (readTCP(fdDSTCP, field + len, 1) != 1)
+        {
+            return 0;
+        }
+        if (field[len] == ' ')
+        {
+            field[len] = '\0';
+            return len > 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Requests a byte range of the file attached to a message and reads the reply's header.
+ * On success the connection is left open so that the caller reads the range and the final nl.
+ *
+ * @param MID string that contains the message ID.
+ * @param offset offset of the first byte of the range.
+ * @param len number of bytes of the range.
+ * @param FName buffer that will contain the file's name.
+ * @param FSize reference that will contain the file's size.
+ * @param rangeLen reference that will contain the number of bytes the DS sends.
+ * @return 1 if the range follows, 0 if the message has no file, -1 if the DS refused it, -2 if the connection failed.
+ */
+static int requestFileRange(char *MID, long offset, long len, char *FName, long *FSize, long *rangeLen)
+{
+    connectDSReadSocket();
+    char rangeMessage[CLIENTDS_UPDBUF_SIZE];
+    sprintf(rangeMessage, "RTF %s %s %04d %ld %ld\n", activeClientUID, activeDSGID, atoi(MID), offset, len);
+    if (sendTCP(fdDSTCP, rangeMessage) == -1)
+    {
+        closeTCPSocket(fdDSTCP, resTCP);
+        return -2;
+    }
+    char status[DS_UPLOADREPLY_SIZE] = "";
+    if (readTCP(fdDSTCP, status, PROTOCOL_CODE_SIZE + 3) != PROTOCOL_CODE_SIZE + 3)
+    { // RRF OK , RRF NOK or RRF EOF
+        closeTCPSocket(fdDSTCP, resTCP);
+        return -2;
+    }
+    if (!strcmp(status, "RRF NOK") || !strcmp(status, "RRF EOF"))
+    {
+        char nl;
+        if (readTCP(fdDSTCP, &nl, 1) != 1 || nl != '\n')
+        {
+            errDSTCP();
+        }
+        closeTCPSocket(fdDSTCP, resTCP);
+        return status[4] == 'N' ? -1 : 0;
+    }
+    char FSizeBuf[PROTOCOL_FILESZ_SIZE], offsetBuf[PROTOCOL_FILESZ_SIZE], lenBuf[PROTOCOL_FILESZ_SIZE];
+    if (strcmp(status, "RRF OK ") || !readDSField(FName, PROTOCOL_FNAME_SIZE) || !validFName(FName) ||
+        !readDSField(FSizeBuf, PROTOCOL_FILESZ_SIZE) || !readDSField(offsetBuf, PROTOCOL_FILESZ_SIZE) ||
+        !readDSField(lenBuf, PROTOCOL_FILESZ_SIZE) || atol(offsetBuf) != offset)
+    {
+        errDSTCP();
+    }
+    *FSize = atol(FSizeBuf);
+    *rangeLen = atol(lenBuf);
+    return 1;
+}
+
+void clientDownloadFromGroup(char **tokenList, int numTokens)
+{
+    if (numTokens != 2)
+    { // DL MID / DOWNLOAD MID
+        fprintf(stderr, "[-] Incorrect download command usage. Please try again.\n");
+        return;
+    }
+    if (clientSession == LOGGED_OUT)
+    {
+        fprintf(stderr, "[-] Please login before you download a file.\n");
+        return;
+    }
+    if (strlen(activeDSGID) == 0)
+    {
+        fprintf(stderr, "[-] Please select a group before you download a file from it.\n");
+        return;
+    }
+    if (!validMID(tokenList[1]) || atoi(tokenList[1]) == 0)
+    {
+        fprintf(stderr, "[-] Invalid message ID. Please try again.\n");
+        return;
+    }
+
+    // An empty range tells the file's name and size
+    char FName[PROTOCOL_FNAME_SIZE];
+    long FSize, rangeLen;
+    char nl;
+    int ret = requestFileRange(tokenList[1], 0, 0, FName, &FSize, &rangeLen);
+    if (ret == 1 && (readTCP(fdDSTCP, &nl, 1) != 1 || nl != '\n'))
+    {
+        errDSTCP();
+    }
+    if (ret == 1)
+    {
+        closeTCPSocket(fdDSTCP, resTCP);
+    }
+    else if (ret == 0)
+    {
+        printf("[+] The message has no file attached.\n");
+        return;
+    }
+    else
+    {
+        fprintf(stderr, "[-] Failed to download the file. Please check if the message exists in your selected subscribed group.\n");
+        return;
+    }
+
+    // The file is received as Fname.part and only renamed once complete, so a download is only ever resumed from
+    // bytes an earlier download of it left behind (never from an unrelated file that has the same name)
+    char partName[CLIENT_PARTNAME_SIZE];
+    snprintf(partName, CLIENT_PARTNAME_SIZE, "%s.part", FName);
+    struct stat localStats;
+    long offset = 0;
+    if (stat(partName, &localStats) == 0 && S_ISREG(localStats.st_mode) && localStats.st_size <= FSize)
+    {
+        offset = localStats.st_size;
+        if (offset > 0)
+        {
+            printf("[+] Resuming download of %s from byte %ld.\n", FName, offset);
+        }
+    }
+    for (int tries = 0; tries < CLIENT_TRANSFER_TRIES; ++tries)
+    {
+        char rangeFName[PROTOCOL_FNAME_SIZE];
+        long rangeFSize;
+        ret = requestFileRange(tokenList[1], offset, FSize - offset, rangeFName, &rangeFSize, &rangeLen);
+        if (ret == 1 && (strcmp(rangeFName, FName) || rangeFSize != FSize || rangeLen != FSize - offset))
+        {
+            errDSTCP();
+        }
+        if (ret == 1 && recvFileAt(fdDSTCP, partName, offset, rangeLen) && readTCP(fdDSTCP, &nl, 1) == 1 && nl == '\n')
+        {
+            closeTCPSocket(fdDSTCP, resTCP);
+            if (rename(partName, FName) == -1)
+            {
+                perror("[-] Failed to rename the downloaded file");
+                return;
+            }
+            printf("[+] %s downloaded (%ld bytes).\n", FName, FSize);
+            return;
+        }
+        if (ret == 1)
+        {
+            closeTCPSocket(fdDSTCP, resTCP);
+        }
+        if (ret == 0 || ret == -1)
+        {
+            fprintf(stderr, "[-] Failed to download the file. Please try again.\n");
+            return;
+        }
+        // Interrupted: resume from whatever reached the disk
+        if (stat(partName, &localStats) == 0 && localStats.st_size <= FSize)
+        {
+            offset = localStats.st_size;
+        }
+        printf("[+] Resuming download of %s from byte %ld.\n", FName, offset);
+    }
+    fprintf(stderr, "[-] The download was interrupted. Run the download command again to resume it.\n");
+}
+
+/**
+ * @brief Reads a field of a DS reply up to the space that ends it, one char at a time.
+ *
+ * @param buf buffer where the field is written (null-terminated).
+ * @param size size of buf, the field can't be longer than size - 1 chars.
+ * @param singleCharDS buffer where the last character read is left (the space unless the field was too long).
+ */
+static void readFieldDS(char *buf, int size, char *singleCharDS)
+{
+    int j;
+    for (j = 0; j < size; ++j)
+    {
+        if (readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1) == -1)
+        {
+            failDSTCP();
+        }
+        if (singleCharDS[0] == ' ')
+        { // Space has been read
+            break;
+        }
+        if (j == size - 1)
+        { // No room left for the terminator - wrong protocol message received
+            errDSTCP();
+        }
+        buf[j] = singleCharDS[0];
+    }
+    buf[j] = '\0';
+}
+
+/**
+ * @brief Reads and displays a single message of a retrieve reply (MID UID Tsize text[ / Fname Fsize data]),
+ * saving its file if it has one.
+ *
+ * @param flagRTV MID_OK if the whole MID must be read or MID_CONCAT if its first digit is in singleCharDS.
+ * It's updated for the next message.
+ * @param singleCharDS buffer that contains the last character read.
+ * @param meta 1 if the reply only has the files' metadata (Fname Fsize hash instead of Fname Fsize data), 0 otherwise.
+ * @return 1 if another message follows, 0 if the reply ended.
+ */
+static int readRetrievedMessage(int *flagRTV, char *singleCharDS, int meta)
+{
+    char MID[DS_MID_SIZE] = "", UID[CLIENT_UID_SIZE] = "", TsizeBuf[DS_MSGTEXTSZ_SIZE] = "", Text[PROTOCOL_TEXT_SIZE + 1] = "";
+    char FName[PROTOCOL_FNAME_SIZE] = "", FsizeBuf[PROTOCOL_FILESZ_SIZE] = "";
+    int Tsize;
+    long Fsize;
+    int n;
+
+    // Read MID
+    if (*flagRTV == MID_OK)
+    { // If flag is MID_OK then we read a normal MID
+        if ((n = readTCP(fdDSTCP, MID, DS_MID_SIZE)) == -1)
+        { // RRTMID_SIZE to also read backspace
+            failDSTCP();
+        }
+        MID[n - 1] = '\0';
+        if (!validMID(MID))
+        {
+            errDSTCP();
+        }
+        printf("-> %s: ", MID);
+    }
+    else if (*flagRTV == MID_CONCAT)
+    { // If flag is MID_CONCAT then we must concat a character read previously to MID
+        strcat(MID, singleCharDS);
+        char *ptrMID = MID + 1;
+        if ((n = readTCP(fdDSTCP, ptrMID, DS_MID_SIZE - 1)) == -1)
+        { // RRTMID_SIZE-1 because discard contains first character and to also read backspace
+            failDSTCP();
+        }
+        MID[n] = '\0';
+        if (!validMID(MID))
+        {
+            errDSTCP();
+        }
+        printf("-> %s: ", MID);
+    }
+
+    // Read UID
+    if ((n = readTCP(fdDSTCP, UID, CLIENT_UID_SIZE)) == -1)
+    { // RRTMID_SIZE to also read backspace
+        failDSTCP();
+    }
+    UID[n - 1] = '\0';
+    if (!validUID(UID))
+    {
+        errDSTCP();
+    }
+
+    // Read text size
+    readFieldDS(TsizeBuf, DS_MSGTEXTSZ_SIZE, singleCharDS);
+    if (singleCharDS[0] != ' ' || !isNumber(TsizeBuf) || atoi(TsizeBuf) > 240)
+    { // Make sure space was read and Tsize is a number - otherwise wrong protocol message received
+        errDSTCP();
+    }
+
+    // Read text
+    Tsize = atoi(TsizeBuf);
+    if ((n = readTCP(fdDSTCP, Text, Tsize + 1)) == -1)
+    {
+        failDSTCP();
+    }
+    Text[n] = '\0';
+    if ((Text[Tsize] != ' ') && (Text[Tsize] != '\n'))
+    { // Wrong protocol message received -> either it ends or has a file
+        errDSTCP();
+    }
+    if (Text[Tsize] == '\n')
+    { // End of reply has been made - remove new line on printing
+        Text[Tsize] = '\0';
+        printf("%s\n", Text);
+        return 0;
+    }
+    printf("%s\n", Text);
+    // Read next character -> either it's a slash(/) or the first char of a MID
+    if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
+    {
+        failDSTCP();
+    }
+    singleCharDS[n] = '\0';
+    if (isNumber(&singleCharDS[0]))
+    { // it read the first digit of the next MID
+        *flagRTV = MID_CONCAT;
+    }
+    else if (singleCharDS[0] == '/')
+    { // there's a file to be read
+        *flagRTV = MID_OK;
+
+        // Read backspace
+        if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
+        {
+            failDSTCP();
+        }
+        singleCharDS[n] = '\0';
+        if (singleCharDS[0] != ' ')
+        {
+            errDSTCP();
+        }
+
+        // Read filename
+        readFieldDS(FName, PROTOCOL_FNAME_SIZE, singleCharDS);
+        if (singleCharDS[0] != ' ' || !validFName(FName))
+        {
+            errDSTCP();
+        }
+        printf("(%s - ", FName);
+
+        // Read file size
+        readFieldDS(FsizeBuf, PROTOCOL_FILESZ_SIZE, singleCharDS);
+        if (singleCharDS[0] != ' ' || !isNumber(FsizeBuf))
+        {
+            errDSTCP();
+        }
+        if (meta)
+        { // The file stays in the DS: show its content hash, it can be fetched later with download MID
+            char hash[DS_HASH_SIZE + 1];
+            if ((n = readTCP(fdDSTCP, hash, DS_HASH_SIZE)) != DS_HASH_SIZE)
+            {
+                failDSTCP();
+            }
+            singleCharDS[0] = hash[DS_HASH_SIZE - 1];
+            singleCharDS[1] = '\0';
+            hash[DS_HASH_SIZE - 1] = '\0';
+            printf("%s bytes, sha256 %s)\n", FsizeBuf, hash);
+        }
+        else
+        {
+            printf("%s bytes)\n", FsizeBuf);
+            Fsize = atol(FsizeBuf);
+            if (recvFile(fdDSTCP, FName, Fsize) == 0)
+            {
+                failDSTCP();
+            }
+            if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
+            {
+                failDSTCP();
+            }
+            singleCharDS[n] = '\0';
+        }
+        if (singleCharDS[0] != ' ' && singleCharDS[0] != '\n')
+        { // Read extra space in file or last message \n
+            errDSTCP();
+        }
+        return singleCharDS[0] != '\n';
+    }
+    return 1;
+}
+
+void clientRetrieveFromGroup(char **tokenList, int numTokens)
+{
+    if (numTokens < 2 || numTokens > 4)
+    { // R XXXX [WAIT] [META] / RETRIEVE XXXX [WAIT] [META]
+        fprintf(stderr, "[-] Incorrect retrieve command usage. Please try again.\n");
+        return;
+    }
+    if (clientSession == LOGGED_OUT)
+    {
+        fprintf(stderr, "[-] Please login before you retrieve messages from a group.\n");
+        return;
+    }
+    if (strlen(activeDSGID) == 0)
+    {
+        fprintf(stderr, "[-] Please select a group before you retrieve messages from it.\n");
+        return;
+    }
+    if (!validMID(tokenList[1]))
+    {
+        fprintf(stderr, "[-] Invalid starting message to retrieve. Please try again.\n");
+        return;
+    }
+    int meta = (numTokens > 2 && !strcmp(tokenList[numTokens - 1], "meta"));
+    int waitSecs = 0;
+    if (numTokens - meta == 4 || (numTokens - meta == 3 && !strcmp(tokenList[2], "meta")))
+    {
+        fprintf(stderr, "[-] Incorrect retrieve command usage. Please try again.\n");
+        return;
+    }
+    if (numTokens - meta == 3)
+    { // Wait for new messages if there are none yet
+        if (tokenList[2][0] == '\0' || strlen(tokenList[2]) > DS_RTVWAIT_SIZE - 1 || !isNumber(tokenList[2]) || atoi(tokenList[2]) > DS_RTV_MAX_WAIT)
+        {
+            fprintf(stderr, "[-] Invalid wait time (at most %d seconds). Please try again.\n", DS_RTV_MAX_WAIT);
+            return;
+        }
+        waitSecs = atoi(tokenList[2]);
+    }
+
+    if (!meta && addrReplicaDS[0] == '\0' && connectDSBinary())
+    { // Binary records always carry the files' data (read replicas only speak the text protocol)
+        binaryRetrieveFromGroup(atoi(tokenList[1]), waitSecs);
+        return;
+    }
+    connectDSReadSocket();
+
+    // Send message from client to the DS
+    char retrieveMessageToDS[CLIENTDS_RTVBUF_SIZE];
+    int len = sprintf(retrieveMessageToDS, "RTV %s %s %s", activeClientUID, activeDSGID, tokenList[1]);
+    if (waitSecs > 0)
+    {
+        len += sprintf(retrieveMessageToDS + len, " %d", waitSecs);
+        extendDSReplyTimeout(waitSecs);
+    }
+    sprintf(retrieveMessageToDS + len, meta ? " M\n" : "\n");
+    if (sendTCP(fdDSTCP, retrieveMessageToDS) == -1)
+    {
+        failDSTCP();
+    }
+
+    // Receive retrieve reply from the DS
+    char codeDS[PROTOCOL_CODE_SIZE + 1], statusDS[DSCLIENT_RTVSTATUS_SIZE + 1];
+    char singleCharDS[CHAR_SIZE];
+    int n;
+
+    // Read the DS reply code
+    if ((n = readTCP(fdDSTCP, codeDS, PROTOCOL_CODE_SIZE)) == -1)
+    {
+        failDSTCP();
+    }
+    codeDS[n - 1] = '\0'; // replace backspace with null terminator
+    if (strcmp(codeDS, "RRT"))
+    { // Wrong protocol message received
+        errDSTCP();
+    }
+
+    // Read the DS reply status
+    if ((n = readTCP(fdDSTCP, statusDS, DSCLIENT_RTVSTATUS_SIZE)) == -1)
+    {
+        failDSTCP();
+    }
+    statusDS[n] = '\0';
+    if (!strcmp(statusDS, "EOF") || !strcmp(statusDS, "NOK"))
+    { // Every reply/request must end with a \n
+        if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
+        {
+            failDSTCP();
+        }
+        singleCharDS[n] = '\0';
         if (singleCharDS[n - 1] != '\n')
         {
             errDSTCP();
@@ -935,196 +2121,298 @@ void clientRetrieveFromGroup(char **tokenList, int numTokens)
         printf("[+] %d messages to display: (-> MID: text \\(Fname - Fsize)):\n", numMsgs);
     }
     int flagRTV = MID_OK;
-    char MID[DS_MID_SIZE] = "", UID[CLIENT_UID_SIZE], TsizeBuf[DS_MSGTEXTSZ_SIZE] = "", Text[PROTOCOL_TEXT_SIZE + 1] = "";
-    char FName[PROTOCOL_FNAME_SIZE] = "", FsizeBuf[PROTOCOL_FILESZ_SIZE] = "";
-    int Tsize;
-    long Fsize;
-    int j;
     for (int i = 1; i <= numMsgs; ++i)
     {
-        memset(MID, 0, sizeof(MID));
-        memset(UID, 0, sizeof(UID));
-        memset(TsizeBuf, 0, sizeof(TsizeBuf));
-        memset(Text, 0, sizeof(Text));
-        memset(FName, 0, sizeof(FName));
-        memset(FsizeBuf, 0, sizeof(FsizeBuf));
-
-        // Read MID
-        if (flagRTV == MID_OK)
-        { // If flag is MID_OK then we read a normal MID
-            if ((n = readTCP(fdDSTCP, MID, DS_MID_SIZE)) == -1)
-            { // RRTMID_SIZE to also read backspace
-                failDSTCP();
-            }
-            MID[n - 1] = '\0';
-            if (!validMID(MID))
-            {
-                errDSTCP();
-            }
-            printf("-> %s: ", MID);
-        }
-        else if (flagRTV == MID_CONCAT)
-        { // If flag is MID_CONCAT then we must concat a character read previously to MID
-            strcat(MID, singleCharDS);
-            char *ptrMID = MID + 1;
-            if ((n = readTCP(fdDSTCP, ptrMID, DS_MID_SIZE - 1)) == -1)
-            { // RRTMID_SIZE-1 because discard contains first character and to also read backspace
-                failDSTCP();
-            }
-            MID[n] = '\0';
-            if (!validMID(MID))
-            {
-                errDSTCP();
-            }
-            printf("-> %s: ", MID);
-        }
-
-        // Read UID
-        if ((n = readTCP(fdDSTCP, UID, CLIENT_UID_SIZE)) == -1)
-        { // RRTMID_SIZE to also read backspace
-            failDSTCP();
-        }
-        UID[n - 1] = '\0';
-        if (!validUID(UID))
-        {
-            errDSTCP();
-        }
-
-        // Read text size
-        for (j = 0; j < DS_MSGTEXTSZ_SIZE; ++j)
+        if (!readRetrievedMessage(&flagRTV, singleCharDS, meta))
         {
-            if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-            {
-                failDSTCP();
-            }
-            if (singleCharDS[0] != ' ')
-            { // Anything other than the space we'll append or new line if retrieve message ends with text
-                strcat(TsizeBuf, &singleCharDS[0]);
-            }
-            else
-            { // Backpace has been read
-                break;
-            }
+            break;
         }
-        TsizeBuf[j] = '\0';
-        if (singleCharDS[0] != ' ' || !isNumber(TsizeBuf) || atoi(TsizeBuf) > 240)
-        { // Make sure space was read and Tsize is a number - otherwise wrong protocol message received
+        if (i == numMsgs)
+        { // Every reply/request must end with a \n
             errDSTCP();
         }
+    }
+
+    // After receiving the messsages the client sends the DS a confirmation
+    if (sendTCP(fdDSTCP, "OK\n") == -1)
+    {
+        failDSTCP();
+    }
+    closeTCPSocket(fdDSTCP, resTCP);
+}
+
+void clientRetrieveAllFromGroup(char **tokenList, int numTokens)
+{
+    if (numTokens < 2 || numTokens > 4)
+    { // RA XXXX [YYYY [UID]] / RETRIEVE_ALL XXXX [YYYY [UID]]
+        fprintf(stderr, "[-] Incorrect retrieve all command usage. Please try again.\n");
+        return;
+    }
+    if (clientSession == LOGGED_OUT)
+    {
+        fprintf(stderr, "[-] Please login before you retrieve messages from a group.\n");
+        return;
+    }
+    if (strlen(activeDSGID) == 0)
+    {
+        fprintf(stderr, "[-] Please select a group before you retrieve messages from it.\n");
+        return;
+    }
+    if (!validMID(tokenList[1]) || (numTokens >= 3 && !validMID(tokenList[2])))
+    {
+        fprintf(stderr, "[-] Invalid range of messages to retrieve. Please try again.\n");
+        return;
+    }
+    if (numTokens == 4 && !validUID(tokenList[3]))
+    {
+        fprintf(stderr, "[-] Invalid author user ID. Please try again.\n");
+        return;
+    }
+
+    connectDSReadSocket();
+
+    // Send message from client to the DS
+    char retrieveMessageToDS[CLIENTDS_RTSBUF_SIZE];
+    int len = sprintf(retrieveMessageToDS, "RTS %s %s %s", activeClientUID, activeDSGID, tokenList[1]);
+    for (int i = 2; i < numTokens; ++i)
+    {
+        len += sprintf(retrieveMessageToDS + len, " %s", tokenList[i]);
+    }
+    strcat(retrieveMessageToDS, "\n");
+    if (sendTCP(fdDSTCP, retrieveMessageToDS) == -1)
+    {
+        failDSTCP();
+    }
 
-        // Read text
-        Tsize = atoi(TsizeBuf);
-        if ((n = readTCP(fdDSTCP, Text, Tsize + 1)) == -1)
+    // Read the DS reply code and status (RRS OK, RRS EOF or RRS NOK)
+    char codeDS[PROTOCOL_CODE_SIZE + 1], statusDS[DSCLIENT_RTVSTATUS_SIZE + 1];
+    char singleCharDS[CHAR_SIZE];
+    int n;
+    if ((n = readTCP(fdDSTCP, codeDS, PROTOCOL_CODE_SIZE)) <= 0)
+    {
+        failDSTCP();
+    }
+    codeDS[n - 1] = '\0';
+    if (strcmp(codeDS, "RRS"))
+    { // Wrong protocol message received
+        errDSTCP();
+    }
+    if ((n = readTCP(fdDSTCP, statusDS, DSCLIENT_RTVSTATUS_SIZE)) <= 0)
+    {
+        failDSTCP();
+    }
+    statusDS[n] = '\0';
+    if (!strcmp(statusDS, "EOF") || !strcmp(statusDS, "NOK"))
+    { // Every reply/request must end with a \n
+        if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) <= 0)
         {
             failDSTCP();
         }
-        Text[n] = '\0';
-        if ((Text[Tsize] != ' ') && (Text[Tsize] != '\n'))
-        { // Wrong protocol message received -> either it ends or has a file
+        if (singleCharDS[0] != '\n')
+        {
             errDSTCP();
         }
-        if (Text[Tsize] == '\n')
-        { // End of reply has been made - remove new line on printing
-            Text[Tsize] = '\0';
-            printf("%s\n", Text);
-            break;
-        }
-        printf("%s\n", Text);
-        // Read next character -> either it's a slash(/) or the first char of a MID
-        if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
+    }
+    if (!strcmp(statusDS, "EOF"))
+    {
+        printf("[+] There are no available messages to show in the selected group in the given range.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    if (!strcmp(statusDS, "NOK"))
+    {
+        fprintf(stderr, "[-] Failed to retrieve from group. Please check if you have a selected subscribed group and try again.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    if (strcmp(statusDS, "OK "))
+    {
+        errDSTCP();
+    }
+
+    // Messages keep coming until the reply ends with a nl
+    printf("[+] Messages to display: (-> MID: text \\(Fname - Fsize)):\n");
+    int flagRTV = MID_OK;
+    int numMsgs = 1;
+    memset(singleCharDS, 0, sizeof(singleCharDS));
+    while (readRetrievedMessage(&flagRTV, singleCharDS, 0))
+    {
+        numMsgs++;
+    }
+    printf("[+] %d message(s) retrieved.\n", numMsgs);
+    closeTCPSocket(fdDSTCP, resTCP);
+}
+
+void clientStreamPosts(int numTokens)
+{
+    if (numTokens != 1)
+    { // STREAM / ST
+        fprintf(stderr, "[-] Incorrect stream command usage. Please try again.\n");
+        return;
+    }
+    if (clientSession == LOGGED_OUT)
+    {
+        fprintf(stderr, "[-] Please login before you stream new messages.\n");
+        return;
+    }
+    if (fdDSPush != -1)
+    {
+        fprintf(stderr, "[-] New messages are already being streamed.\n");
+        return;
+    }
+
+    connectDSReadSocket();
+    char streamMessageToDS[CLIENTDS_STREAMBUF_SIZE];
+    sprintf(streamMessageToDS, "PSH %s\n", activeClientUID);
+    if (sendTCP(fdDSTCP, streamMessageToDS) == -1)
+    {
+        failDSTCP();
+    }
+
+    // Read the DS reply (RPS OK or RPS NOK)
+    char replyDS[DS_TCPSTATUSBUF_SIZE];
+    int n, len = 0;
+    while (len < DS_TCPSTATUSBUF_SIZE - 1 && (len == 0 || replyDS[len - 1] != '\n'))
+    {
+        if ((n = readTCP(fdDSTCP, replyDS + len, 1)) <= 0)
         {
             failDSTCP();
         }
-        singleCharDS[n] = '\0';
-        if (isNumber(&singleCharDS[0]))
-        { // it read the first digit of the next MID
-            flagRTV = MID_CONCAT;
-        }
-        else if (singleCharDS[0] == '/')
-        { // there's a file to be read
-            flagRTV = MID_OK;
+        len += n;
+    }
+    replyDS[len] = '\0';
+    if (!strcmp(replyDS, "RPS NOK\n"))
+    {
+        fprintf(stderr, "[-] Failed to stream new messages. Please check if you're logged in and try again.\n");
+        closeTCPSocket(fdDSTCP, resTCP);
+        return;
+    }
+    if (strcmp(replyDS, "RPS OK\n"))
+    {
+        errDSTCP();
+    }
 
-            // Read backspace
-            if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-            {
-                failDSTCP();
-            }
-            singleCharDS[n] = '\0';
-            if (singleCharDS[0] != ' ')
-            {
-                errDSTCP();
-            }
+    // Pushes are only read when select says there's something to read
+    if (timerOff(fdDSTCP) == -1)
+    {
+        perror("[-] Failed to unset read timeout on TCP socket");
+        failDSTCP();
+    }
+    freeaddrinfo(resTCP);
+    fdDSPush = fdDSTCP;
+    pushBufLen = 0;
+    printf("[+] New messages in your subscribed groups will now be shown as they're posted.\n");
+}
 
-            // Read filename
-            for (j = 0; j < PROTOCOL_FNAME_SIZE; ++j)
-            {
-                if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-                {
-                    failDSTCP();
-                }
-                if (singleCharDS[0] != ' ')
-                { // Anything other than the space we'll append
-                    strcat(FName, &singleCharDS[0]);
-                }
-                else
-                { // Space has been read
-                    break;
-                }
-            }
-            FName[j] = '\0';
-            if (singleCharDS[0] != ' ' || !validFName(FName))
-            {
-                errDSTCP();
-            }
-            printf("(%s - ", FName);
+void closeDSPushStream()
+{
+    if (fdDSPush != -1)
+    {
+        close(fdDSPush);
+        fdDSPush = -1;
+    }
+}
 
-            // Read file size
-            for (j = 0; j < PROTOCOL_FILESZ_SIZE; ++j)
-            {
-                if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-                {
-                    failDSTCP();
-                }
-                if (singleCharDS[0] != ' ')
-                { // Anything other than the space we'll append
-                    strcat(FsizeBuf, &singleCharDS[0]);
-                }
-                else
-                { // Space has been read
-                    break;
-                }
-            }
-            FsizeBuf[j] = '\0';
-            printf("%s bytes)\n", FsizeBuf);
-            if (singleCharDS[0] != ' ')
-            {
-                errDSTCP();
-            }
-            Fsize = atol(FsizeBuf);
-            if (recvFile(fdDSTCP, FName, Fsize) == 0)
-            {
-                failDSTCP();
-            }
-            if ((n = readTCP(fdDSTCP, singleCharDS, CHAR_SIZE - 1)) == -1)
-            {
-                failDSTCP();
-            }
-            singleCharDS[n] = '\0';
-            if (singleCharDS[0] != ' ' && singleCharDS[0] != '\n')
-            { // Read extra space in file or last message \n
-                errDSTCP();
-            }
-            if (i == numMsgs && singleCharDS[0] != '\n')
-            { // Every reply/request must end with a \n
-                errDSTCP();
-            }
+/**
+ * @brief Displays a single post pushed by the DS (NEW GID MID UID TSize Text[ / FName FSize]).
+ *
+ * @param line string that contains the post without the nl.
+ * @return 1 if it's a valid post, 0 otherwise.
+ */
+static int displayPushedPost(char *line)
+{
+    char GID[DS_GID_SIZE], MID[DS_MID_SIZE], UID[CLIENT_UID_SIZE];
+    char FName[PROTOCOL_FNAME_SIZE];
+    int TSize, offset;
+    long FSize;
+    if (sscanf(line, "NEW %2s %4s %5s %3d%n", GID, MID, UID, &TSize, &offset) != 4 || line[offset] != ' ')
+    {
+        return 0;
+    }
+    char *text = line + offset + 1; // Only the separator is skipped: the text may start with spaces
+    if (!validGID(GID) || !validMID(MID) || !validUID(UID) || TSize < 0 || TSize > PROTOCOL_TEXT_SIZE - 1 || strlen(text) < TSize)
+    {
+        return 0;
+    }
+    char *rest = text + TSize;
+    if (*rest == '\0')
+    {
+        printf("\n[+] New message in group %s -> %s (by %s): %.*s\n", GID, MID, UID, TSize, text);
+        return 1;
+    }
+    if (sscanf(rest, " / %24s %ld", FName, &FSize) != 2)
+    {
+        return 0;
+    }
+    printf("\n[+] New message in group %s -> %s (by %s): %.*s \\(%s - %ld bytes)\n", GID, MID, UID, TSize, text, FName, FSize);
+    return 1;
+}
+
+/**
+ * @brief Reads the posts the DS pushed and displays every complete one.
+ *
+ */
+static void processDSPush()
+{
+    ssize_t n = read(fdDSPush, pushBuf + pushBufLen, CLIENT_PUSHBUF_SIZE - 1 - pushBufLen);
+    if (n <= 0)
+    {
+        fprintf(stderr, "\n[-] The DS closed the new messages stream.\n");
+        closeDSPushStream();
+        return;
+    }
+    pushBufLen += n;
+    pushBuf[pushBufLen] = '\0';
+    char *line = pushBuf, *nl;
+    while ((nl = strchr(line, '\n')) != NULL)
+    {
+        *nl = '\0';
+        if (!displayPushedPost(line))
+        {
+            fprintf(stderr, "\n[-] Wrong protocol message received from server via TCP. Closing the new messages stream.\n");
+            closeDSPushStream();
+            return;
         }
+        line = nl + 1;
     }
+    pushBufLen -= line - pushBuf;
+    memmove(pushBuf, line, pushBufLen);
+    if (pushBufLen == CLIENT_PUSHBUF_SIZE - 1)
+    { // A single post never gets this long
+        fprintf(stderr, "\n[-] Wrong protocol message received from server via TCP. Closing the new messages stream.\n");
+        closeDSPushStream();
+        return;
+    }
+    printf(">>> ");
+    fflush(stdout);
+}
 
-    // After receiving the messsages the client sends the DS a confirmation
-    if (sendTCP(fdDSTCP, "OK\n") == -1)
+void waitForUserInput()
+{
+    fflush(stdout);
+    while (fdDSPush != -1)
     {
-        failDSTCP();
+        fd_set readFds;
+        FD_ZERO(&readFds);
+        FD_SET(STDIN_FILENO, &readFds);
+        FD_SET(fdDSPush, &readFds);
+        if (select(MAX(STDIN_FILENO, fdDSPush) + 1, &readFds, NULL, NULL, NULL) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("[-] Failed to wait for user input");
+            closeDSPushStream();
+            return;
+        }
+        if (FD_ISSET(fdDSPush, &readFds))
+        {
+            processDSPush();
+        }
+        if (FD_ISSET(STDIN_FILENO, &readFds))
+        {
+            return;
+        }
     }
-    closeTCPSocket(fdDSTCP, resTCP);
-}
\ No newline at end of file
+}
@@ -3,9 +3,12 @@
 
 #include "../centralizedmsg-api.h"
 #include "../centralizedmsg-api-constants.h"
+#include "../centralizedmsg-binary.h"
 
 extern char addrDS[DS_ADDR_SIZE];
 extern char portDS[DS_PORT_SIZE];
+extern char addrReplicaDS[DS_ADDR_SIZE];
+extern char portReplicaDS[DS_PORT_SIZE];
 
 /**
  * @brief Creates socket that enables client-server communication via UDP protocol.
@@ -124,6 +127,13 @@ void showCurrentSelectedGID(int numTokens);
  */
 void connectDSTCPSocket();
 
+/**
+ * @brief Estabelish a connection via TCP protocol for a read-only request: to the read replica if there's one
+ * (and it can be reached), to the DS otherwise.
+ *
+ */
+void connectDSReadSocket();
+
 /**
  * @brief Shows all users that are subscribed to the current selected DS group.
  *
@@ -139,6 +149,38 @@ void showClientsSubscribedToGroup(char **tokenList, int numTokens);
  */
 void clientPostInGroup(char *message);
 
+/**
+ * @brief Posts every message of a list file ("text" [Fname] per line) on the current selected DS group at once.
+ *
+ * @param tokenList list that contains all the command's arguments (including the command itself).
+ * @param numTokens number of command arguments.
+ */
+void clientPostBatchInGroup(char **tokenList, int numTokens);
+
+/**
+ * @brief Posts a message with a file on the current selected DS group through a resumable upload session,
+ * optionally sending the file in chunks over several connections at once.
+ *
+ * @param command string that contains the input command given to stdin.
+ */
+void clientUploadInGroup(char *command);
+
+/**
+ * @brief Resumes an interrupted upload from the offset stored by the DS.
+ *
+ * @param tokenList list that contains all the command's arguments (including the command itself).
+ * @param numTokens number of command arguments.
+ */
+void clientResumeUpload(char **tokenList, int numTokens);
+
+/**
+ * @brief Downloads the file attached to a message of the current selected DS group, resuming a partial local copy.
+ *
+ * @param tokenList list that contains all the command's arguments (including the command itself).
+ * @param numTokens number of command arguments.
+ */
+void clientDownloadFromGroup(char **tokenList, int numTokens);
+
 /**
  * @brief Shows all messages from the current selected DS group starting from the given message ID.
  *
@@ -147,4 +189,31 @@ void clientPostInGroup(char *message);
  */
 void clientRetrieveFromGroup(char **tokenList, int numTokens);
 
+/**
+ * @brief Shows every message from the current selected DS group in a range, optionally only those of a given author.
+ *
+ * @param tokenList list that contains all the command's arguments (including the command itself).
+ * @param numTokens number of command arguments.
+ */
+void clientRetrieveAllFromGroup(char **tokenList, int numTokens);
+
+/**
+ * @brief Opens a TCP connection on which the DS pushes every new post in the current client's subscribed groups.
+ *
+ * @param numTokens number of command arguments.
+ */
+void clientStreamPosts(int numTokens);
+
+/**
+ * @brief Closes the connection on which the DS pushes new posts (if it's open).
+ *
+ */
+void closeDSPushStream();
+
+/**
+ * @brief Waits until the user types something, displaying the posts pushed by the DS meanwhile.
+ *
+ */
+void waitForUserInput();
+
 #endif
\ No newline at end of file
@@ -4,9 +4,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 /**
- * @brief Parses the program's arguments for the DS address and port.
+ * @brief Parses the program's arguments for the DS address and port and the read replica's address and port.
  *
  * @param argc number of arguments (including the executable) given.
  * @param argv arguments given.
@@ -21,7 +22,9 @@ void processInput();
 
 int main(int argc, char *argv[])
 {
+    setvbuf(stdin, NULL, _IONBF, 0); // Input must not be buffered where select can't see it (stream command)
     parseArgs(argc, argv);
+    signal(SIGPIPE, SIG_IGN); // A dropped TCP connection is reported by write so that transfers can be resumed
     createDSUDPSocket();
     processInput();
     exit(EXIT_SUCCESS);
@@ -29,9 +32,9 @@ int main(int argc, char *argv[])
 
 static void parseArgs(int argc, char *argv[])
 {
-    if (!(argc == 1 || argc == 3 || argc == 5))
-    { // Usage: ./user [-n DSIP] [-p DSport]
-        fprintf(stderr, "[-] Invalid client program arguments. Usage: ./user [-n DSIP] [-p DSport]\n");
+    if (argc % 2 == 0 || argc > 9)
+    { // Usage: ./user [-n DSIP] [-p DSport] [-N replicaIP] [-P replicaPort]
+        fprintf(stderr, "[-] Invalid client program arguments. Usage: ./user [-n DSIP] [-p DSport] [-N replicaIP] [-P replicaPort]\n");
         exit(EXIT_FAILURE);
     }
     for (int i = 1; i < argc - 1; ++i)
@@ -64,8 +67,30 @@ static void parseArgs(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'N':
+            if (validAddress(argv[i + 1]))
+            {
+                strcpy(addrReplicaDS, argv[i + 1]);
+            }
+            else
+            {
+                fprintf(stderr, "[-] Invalid read replica hostname/IP address given. Please try again.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            if (validPort(argv[i + 1]))
+            {
+                strcpy(portReplicaDS, argv[i + 1]);
+            }
+            else
+            {
+                fprintf(stderr, "[-] Invalid read replica port given. Please try again.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
-            fprintf(stderr, "[-] Invalid flag given. Usage: ./user [-n DSIP] [-p DSport]\n");
+            fprintf(stderr, "[-] Invalid flag given. Usage: ./user [-n DSIP] [-p DSport] [-N replicaIP] [-P replicaPort]\n");
             exit(EXIT_FAILURE);
         }
     }
@@ -81,6 +106,7 @@ void processInput()
         char *token;
         int numTokens = 0;
         printf(">>> "); // For user input
+        waitForUserInput();
         fgets(command, sizeof(command), stdin);
         strtok(command, "\n");
         char commandTok[CLIENT_COMMAND_SIZE]; // We must preserve command so perform token separation here
@@ -140,9 +166,27 @@ void processInput()
         case POST:
             clientPostInGroup(command);
             break;
+        case POST_BATCH:
+            clientPostBatchInGroup(tokenList, numTokens);
+            break;
+        case UPLOAD_START:
+            clientUploadInGroup(command);
+            break;
+        case UPLOAD_RESUME:
+            clientResumeUpload(tokenList, numTokens);
+            break;
+        case RETRIEVE_FILE:
+            clientDownloadFromGroup(tokenList, numTokens);
+            break;
         case RETRIEVE:
             clientRetrieveFromGroup(tokenList, numTokens);
             break;
+        case STREAM:
+            clientStreamPosts(numTokens);
+            break;
+        case RETRIEVE_ALL:
+            clientRetrieveAllFromGroup(tokenList, numTokens);
+            break;
         default:
             break;
         }
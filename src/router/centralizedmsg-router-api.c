@@ -0,0 +1,598 @@
+#include "centralizedmsg-router-api.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* Router information variables */
+char portRouter[DS_PORT_SIZE] = DS_DEFAULT_PORT;
+DSShard dsShards[DS_MAX_SHARDS];
+int numDSShards = 0;
+
+/* Sockets the clients reach the router through */
+static int fdRouterUDP, listenRouterTCP;
+
+/* Lock file of the group creation (-1 until the first group is created) */
+static int lockFd = -1;
+
+/* Replies of the shards to the UDP request being routed (indexed by shard) */
+static char shardReplies[DS_MAX_SHARDS][DS_TO_CLIENT_UDP_SIZE];
+
+/**
+ * @brief Creates a socket bound to the router's port.
+ *
+ * @param type SOCK_DGRAM or SOCK_STREAM.
+ * @return file descriptor of the socket.
+ */
+static int bindRouterSocket(int type)
+{
+    struct addrinfo hints, *res;
+    int fd = socket(AF_INET, type, 0);
+    if (fd == -1)
+    {
+        perror("[-] Router socket failed to create");
+        exit(EXIT_FAILURE);
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = type;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, portRouter, &hints, &res) != 0)
+    {
+        perror("[-] Failed on router address translation");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1)
+    {
+        perror("[-] Failed to bind router socket");
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Connects a socket to a shard.
+ *
+ * @param shard index of the shard.
+ * @param type SOCK_DGRAM or SOCK_STREAM.
+ * @return file descriptor of the socket, -1 if the shard couldn't be reached.
+ */
+static int connectShard(int shard, int type)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = type;
+    if (getaddrinfo(dsShards[shard].addr, dsShards[shard].port, &hints, &res) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(AF_INET, type, 0);
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) == -1)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+void setupRouterSockets()
+{
+    fdRouterUDP = bindRouterSocket(SOCK_DGRAM);
+    listenRouterTCP = bindRouterSocket(SOCK_STREAM);
+    if (listen(listenRouterTCP, DS_LISTENQUEUE_SIZE) == -1)
+    {
+        perror("[-] Failed to prepare TCP socket to accept connections");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numDSShards; ++i)
+    {
+        dsShards[i].fdUDP = connectShard(i, SOCK_DGRAM);
+        if (dsShards[i].fdUDP == -1 || timerOn(dsShards[i].fdUDP) == -1)
+        {
+            fprintf(stderr, "[-] Failed to create UDP socket for shard %s:%s.\n", dsShards[i].addr, dsShards[i].port);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("[+] Router listening in port %s for %d DS shards...\n", portRouter, numDSShards);
+    fflush(stdout); // Otherwise every forked connection would print it again on exit
+}
+
+/**
+ * @brief Gets the shard that owns a group.
+ *
+ * @param GID string that contains the group ID (01 - 99).
+ * @return index of the shard.
+ */
+static int shardOfGroup(char *GID)
+{
+    return (atoi(GID) - 1) % numDSShards;
+}
+
+/**
+ * @brief Sends a UDP request to some shards at once and waits for all their replies.
+ *
+ * @param request string that contains the request (with its nl).
+ * @param shards indexes of the shards (NULL for every shard).
+ * @param num number of shards.
+ * @return 1 if every shard replied, 0 otherwise (replies are in shardReplies, empty for the shards that didn't reply).
+ */
+static int askShards(char *request, int *shards, int num)
+{
+    char stale[DS_TO_CLIENT_UDP_SIZE];
+    for (int i = 0; i < num; ++i)
+    {
+        int fd = dsShards[shards ? shards[i] : i].fdUDP;
+        // A reply that arrived after its request timed out must not be taken for this one's
+        while (recv(fd, stale, sizeof(stale), MSG_DONTWAIT) > 0)
+            ;
+        if (send(fd, request, strlen(request), 0) == -1)
+        {
+            return 0;
+        }
+    }
+    int ok = 1;
+    for (int i = 0; i < num; ++i)
+    {
+        int shard = shards ? shards[i] : i;
+        ssize_t n = recv(dsShards[shard].fdUDP, shardReplies[shard], DS_TO_CLIENT_UDP_SIZE - 1, 0);
+        if (n <= 0)
+        { // Keep waiting for the others: a broadcast must know which shards replied
+            fprintf(stderr, "[-] Shard %s:%s didn't reply.\n", dsShards[shard].addr, dsShards[shard].port);
+            n = 0;
+            ok = 0;
+        }
+        shardReplies[shard][n] = '\0';
+    }
+    return ok;
+}
+
+/**
+ * @brief Forwards a UDP request to a single shard.
+ *
+ * @param shard index of the shard.
+ * @param request string that contains the request (with its nl).
+ * @return char* containing the shard's reply.
+ */
+static char *forwardToShard(int shard, char *request)
+{
+    return askShards(request, &shard, 1) ? strdup(shardReplies[shard]) : strdup(ERR_MSG);
+}
+
+/**
+ * @brief Sends a user request (REG, UNR, LOG or OUT) to every shard so that users and their sessions are
+ * known to all of them. If the shards don't all give the same reply the request is undone (REG and UNR, LOG and
+ * OUT undo each other) on every shard that didn't refuse it, so that they don't diverge, and the client gets NOK.
+ *
+ * @param request string that contains the request (with its nl).
+ * @param cmd macro that contains the request's operation.
+ * @return char* containing the reply of the shards.
+ */
+static char *broadcastUserRequest(char *request, int cmd)
+{
+    int agree = askShards(request, NULL, numDSShards);
+    for (int i = 1; agree && i < numDSShards; ++i)
+    {
+        agree = !strcmp(shardReplies[i], shardReplies[0]);
+    }
+    if (agree)
+    {
+        return strdup(shardReplies[0]);
+    }
+    fprintf(stderr, "[-] Shards disagree on %s", request);
+
+    // A shard that didn't reply may have made the change too
+    int shards[DS_MAX_SHARDS], num = 0;
+    for (int i = 0; i < numDSShards; ++i)
+    {
+        if (shardReplies[i][0] == '\0' || strstr(shardReplies[i], " OK\n"))
+        {
+            shards[num++] = i;
+        }
+    }
+    int undoCmd = (cmd == REGISTER) ? UNREGISTER : (cmd == UNREGISTER) ? REGISTER : (cmd == LOGIN) ? LOGOUT : LOGIN;
+    char undo[CLIENT_TO_DS_UDP_SIZE];
+    snprintf(undo, sizeof(undo), "%s%s", protocolCommandCode(undoCmd), request + PROTOCOL_CODE_SIZE - 1);
+    if (num > 0 && !askShards(undo, shards, num))
+    {
+        fprintf(stderr, "[-] Failed to undo %s", request);
+    }
+    char reply[DS_TO_CLIENT_UDP_SIZE];
+    sprintf(reply, "%s NOK\n", protocolReplyCode(cmd));
+    return strdup(reply);
+}
+
+/**
+ * @brief Compares two group list entries by GID.
+ *
+ * @param a first entry.
+ * @param b second entry.
+ * @return negative, zero or positive like strcmp.
+ */
+static int compareGroupEntries(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+/**
+ * @brief Reads the group list entries (GID GName MID) of a shard's RGL or RGM reply.
+ *
+ * @param reply string that contains the reply (it's split in place).
+ * @param code string that contains the reply's code.
+ * @param entries list the entries are appended to.
+ * @param numEntries reference to the number of entries in the list.
+ * @return number of groups the shard holds, -1 if the reply is wrong.
+ */
+static int readGroupEntries(char *reply, const char *code, char entries[][ROUTER_GROUPENTRY_SIZE], int *numEntries)
+{
+    char *token = strtok(reply, " \n");
+    if (token == NULL || strcmp(token, code) || (token = strtok(NULL, " \n")) == NULL || !isNumber(token))
+    {
+        return -1;
+    }
+    int num = atoi(token);
+    for (int i = 0; i < num; ++i)
+    {
+        char *GID = strtok(NULL, " \n"), *GName = strtok(NULL, " \n"), *MID = strtok(NULL, " \n");
+        if (MID == NULL || *numEntries == DS_MAX_NUM_GROUPS || strlen(GID) + strlen(GName) + strlen(MID) + 3 > ROUTER_GROUPENTRY_SIZE)
+        {
+            return -1;
+        }
+        sprintf(entries[(*numEntries)++], "%s %s %s", GID, GName, MID);
+    }
+    return num;
+}
+
+/**
+ * @brief Answers GLS or GLM with the groups of every shard, sorted by GID.
+ *
+ * @param request string that contains the request (with its nl).
+ * @param code string that contains the reply's code (RGL or RGM).
+ * @return char* containing the merged reply.
+ */
+static char *mergeGroupLists(char *request, const char *code)
+{
+    if (!askShards(request, NULL, numDSShards))
+    {
+        return strdup(ERR_MSG);
+    }
+    char entries[DS_MAX_NUM_GROUPS][ROUTER_GROUPENTRY_SIZE];
+    int numEntries = 0;
+    for (int i = 0; i < numDSShards; ++i)
+    {
+        if (strncmp(shardReplies[i], code, strlen(code)))
+        { // Errors are the same on every shard so pass the first one on
+            return strdup(shardReplies[i]);
+        }
+        if (readGroupEntries(shardReplies[i], code, entries, &numEntries) == -1)
+        {
+            return strdup(ERR_MSG);
+        }
+    }
+    qsort(entries, numEntries, ROUTER_GROUPENTRY_SIZE, compareGroupEntries);
+    char reply[DS_TO_CLIENT_UDP_SIZE];
+    int len = sprintf(reply, "%s %d", code, numEntries);
+    for (int i = 0; i < numEntries; ++i)
+    {
+        len += sprintf(reply + len, " %s", entries[i]);
+    }
+    sprintf(reply + len, "\n");
+    return strdup(reply);
+}
+
+/**
+ * @brief Creates a new group in the shard that holds the fewest groups. Group names must be unique across
+ * shards so they're checked against every shard first. Must be called with the group lock held.
+ *
+ * @param request string that contains the GSR request (with its nl).
+ * @param GName string that contains the new group's name.
+ * @return char* containing the reply.
+ */
+static char *createGroupInShard(char *request, char *GName)
+{
+    if (!askShards("GLS\n", NULL, numDSShards))
+    {
+        return strdup(ERR_MSG);
+    }
+    char entries[DS_MAX_NUM_GROUPS][ROUTER_GROUPENTRY_SIZE];
+    char name[ROUTER_GROUPENTRY_SIZE];
+    int numEntries = 0, target = 0, fewest = DS_MAX_NUM_GROUPS;
+    for (int i = 0; i < numDSShards; ++i)
+    {
+        int first = numEntries;
+        int num = readGroupEntries(shardReplies[i], "RGL", entries, &numEntries);
+        if (num == -1)
+        {
+            return strdup(ERR_MSG);
+        }
+        for (int j = first; j < numEntries; ++j)
+        {
+            if (sscanf(entries[j], "%*s %39s", name) == 1 && !strcmp(name, GName))
+            {
+                return strdup("RGS E_GNAME\n");
+            }
+        }
+        if (num < fewest)
+        {
+            fewest = num;
+            target = i;
+        }
+    }
+    return forwardToShard(target, request);
+}
+
+/**
+ * @brief Creates a new group holding the lock that every router started from the same directory takes to create
+ * a group, so that the check of its name and its creation are never interleaved with another router's.
+ *
+ * @param request string that contains the GSR request (with its nl).
+ * @param GName string that contains the new group's name.
+ * @return char* containing the reply.
+ */
+static char *createGroupLocked(char *request, char *GName)
+{
+    if (lockFd == -1)
+    {
+        lockFd = open(ROUTER_LOCK_PATH, O_RDWR | O_CREAT, 0600);
+    }
+    if (lockFd == -1 || flock(lockFd, LOCK_EX) == -1)
+    {
+        perror("[-] Failed to lock the group creation");
+        return strdup(ERR_MSG);
+    }
+    char *reply = createGroupInShard(request, GName);
+    flock(lockFd, LOCK_UN);
+    return reply;
+}
+
+/**
+ * @brief Routes a UDP request of a client.
+ *
+ * @param request string that contains the request (with its nl).
+ * @return char* containing the reply to the client.
+ */
+static char *routeClientUDP(char *request)
+{
+    char message[CLIENT_TO_DS_UDP_SIZE];
+    char *token, *tokenList[CLIENT_NUMTOKENS];
+    int numTokens = 0;
+    strcpy(message, request);
+    token = strtok(message, " \n");
+    while (token && numTokens < CLIENT_NUMTOKENS)
+    {
+        tokenList[numTokens++] = token;
+        token = strtok(NULL, " \n");
+    }
+    if (numTokens == 0)
+    {
+        return strdup(ERR_MSG);
+    }
+    switch (parseDSClientCommand(tokenList[0]))
+    {
+    case REGISTER:
+    case UNREGISTER:
+    case LOGIN:
+    case LOGOUT:
+        return broadcastUserRequest(request, parseDSClientCommand(tokenList[0]));
+    case GROUPS:
+        return mergeGroupLists(request, "RGL");
+    case MY_GROUPS:
+        return mergeGroupLists(request, "RGM");
+    case SUBSCRIBE:
+        if (numTokens == 4 && !strcmp(tokenList[2], "00"))
+        {
+            return createGroupLocked(request, tokenList[3]);
+        }
+        // fall through
+    case UNSUBSCRIBE:
+        // Requests without a valid GID get their error from any shard
+        return forwardToShard((numTokens >= 3 && validGID(tokenList[2])) ? shardOfGroup(tokenList[2]) : 0, request);
+    default:
+        return strdup(ERR_MSG);
+    }
+}
+
+void handleRouterUDP()
+{
+    char clientBuf[CLIENT_TO_DS_UDP_SIZE];
+    struct sockaddr_in cliaddr;
+    socklen_t addrlen;
+    ssize_t n;
+    while (1)
+    {
+        addrlen = sizeof(cliaddr);
+        n = recvfrom(fdRouterUDP, clientBuf, sizeof(clientBuf) - 1, 0, (struct sockaddr *)&cliaddr, &addrlen);
+        if (n == -1)
+        {
+            perror("[-] (UDP) Router failed on recvfrom");
+            exit(EXIT_FAILURE);
+        }
+        clientBuf[n] = '\0';
+        // Every request/reply must end with a newline \n
+        char *reply = (n > 0 && clientBuf[n - 1] == '\n') ? routeClientUDP(clientBuf) : strdup(ERR_MSG);
+        if (sendto(fdRouterUDP, reply, strlen(reply), 0, (struct sockaddr *)&cliaddr, addrlen) == -1)
+        {
+            perror("[-] (UDP) Router failed on sendto");
+        }
+        free(reply);
+    }
+}
+
+/**
+ * @brief Gets the position of the GID among the fields of a TCP request (after its code).
+ *
+ * @param cmd macro that contains the request's operation.
+ * @return index of the GID field, -1 if the request can't be routed by group.
+ */
+static int groupFieldOfCommand(int cmd)
+{
+    switch (cmd)
+    {
+    case ULIST:
+        return 0; // ULS GID
+    case POST:
+    case RETRIEVE:
+    case RETRIEVE_ALL:
+    case POST_BATCH:
+    case RETRIEVE_FILE:
+        return 1; // XXX UID GID ...
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Copies every byte between a client and a shard, in both directions, until the shard closes the connection.
+ *
+ * @param clientFd file descriptor of the client's connection.
+ * @param shardFd file descriptor of the shard's connection.
+ */
+static void relayTCP(int clientFd, int shardFd)
+{
+    char buf[ROUTER_RELAYBUF_SIZE];
+    struct pollfd pfds[2];
+    int clientOpen = 1;
+    while (1)
+    {
+        pfds[0].fd = clientOpen ? clientFd : -1; // a negative fd is ignored by poll
+        pfds[0].events = POLLIN;
+        pfds[1].fd = shardFd;
+        pfds[1].events = POLLIN;
+        if (poll(pfds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        if (clientOpen && (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t n = read(clientFd, buf, sizeof(buf));
+            if (n <= 0)
+            { // The client is done sending: let the shard know but keep relaying its reply
+                clientOpen = 0;
+                shutdown(shardFd, SHUT_WR);
+            }
+            else if (!sendData(shardFd, (unsigned char *)buf, n))
+            {
+                return;
+            }
+        }
+        if (pfds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = read(shardFd, buf, sizeof(buf));
+            if (n <= 0 || !sendData(clientFd, (unsigned char *)buf, n))
+            {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reads a TCP request up to its GID and relays the connection to the shard that owns the group.
+ *
+ * @param fd file descriptor of the client's connection.
+ */
+static void routeClientTCP(int fd)
+{
+    // The read timeout drops clients that never send their request
+    char prefix[PROTOCOL_CODE_SIZE + ROUTER_PREFIX_SIZE];
+    if (timerOn(fd) == -1 || readTCP(fd, prefix, PROTOCOL_CODE_SIZE) != PROTOCOL_CODE_SIZE || prefix[PROTOCOL_CODE_SIZE - 1] != ' ')
+    {
+        sendTCP(fd, ERR_MSG);
+        return;
+    }
+    prefix[PROTOCOL_CODE_SIZE - 1] = '\0';
+    int groupField = groupFieldOfCommand(parseDSClientCommand(prefix));
+    prefix[PROTOCOL_CODE_SIZE - 1] = ' ';
+    if (groupField == -1)
+    { // Requests that aren't about a single group are sent to the shards directly
+        sendTCP(fd, ERR_MSG);
+        return;
+    }
+
+    // Read the request's fields until the GID has arrived
+    int len = PROTOCOL_CODE_SIZE, field = 0, fieldStart = len;
+    while (field <= groupField)
+    {
+        if (len == (int)sizeof(prefix) - 1 || readTCP(fd, prefix + len, 1) != 1)
+        {
+            sendTCP(fd, ERR_MSG);
+            return;
+        }
+        if (prefix[len] == ' ' || prefix[len] == '\n')
+        {
+            field++;
+            if (field <= groupField)
+            {
+                fieldStart = len + 1;
+            }
+        }
+        len++;
+    }
+    char GID[DS_GID_SIZE];
+    if (len - 1 - fieldStart != DS_GID_SIZE - 1)
+    {
+        sendTCP(fd, ERR_MSG);
+        return;
+    }
+    memcpy(GID, prefix + fieldStart, DS_GID_SIZE - 1);
+    GID[DS_GID_SIZE - 1] = '\0';
+    if (!validGID(GID))
+    {
+        sendTCP(fd, ERR_MSG);
+        return;
+    }
+
+    int shardFd = connectShard(shardOfGroup(GID), SOCK_STREAM);
+    if (shardFd == -1)
+    {
+        fprintf(stderr, "[-] Failed to connect to the shard of group %s.\n", GID);
+        sendTCP(fd, ERR_MSG);
+        return;
+    }
+    if (sendData(shardFd, (unsigned char *)prefix, len))
+    {
+        relayTCP(fd, shardFd);
+    }
+    close(shardFd);
+}
+
+void handleRouterTCP()
+{
+    struct sockaddr_in cliaddr;
+    socklen_t addrlen;
+    int fd;
+    pid_t pid;
+    while (1)
+    {
+        addrlen = sizeof(cliaddr);
+        if ((fd = accept(listenRouterTCP, (struct sockaddr *)&cliaddr, &addrlen)) == -1)
+        { // If this connect failed to accept let's continue to try to look for new ones
+            continue;
+        }
+        if ((pid = fork()) == 0)
+        {
+            close(listenRouterTCP);
+            routeClientTCP(fd);
+            close(fd);
+            exit(EXIT_SUCCESS);
+        }
+        close(fd);
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ; // Reap the connections that are done
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef ROUTERAPI_H
+#define ROUTERAPI_H
+
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+
+/* Struct that keeps the address of a DS shard and the UDP socket the router talks to it through */
+typedef struct dsshard
+{
+    char addr[DS_ADDR_SIZE];
+    char port[DS_PORT_SIZE];
+    int fdUDP; // connected to the shard so that only its replies are received
+} DSShard;
+
+/* Router information variables */
+extern char portRouter[DS_PORT_SIZE];
+extern DSShard dsShards[DS_MAX_SHARDS];
+extern int numDSShards;
+
+/**
+ * @brief Creates the router's sockets (UDP and TCP protocol) and a UDP socket for every shard.
+ *
+ */
+void setupRouterSockets();
+
+/**
+ * @brief Answers the UDP requests of the clients: user requests are sent to every shard, group requests
+ * to the shard that owns the group and group lists are merged from every shard.
+ *
+ */
+void handleRouterUDP();
+
+/**
+ * @brief Relays every TCP connection of a client to the shard that owns the group of its request.
+ *
+ */
+void handleRouterTCP();
+
+#endif
@@ -0,0 +1,105 @@
+#include "centralizedmsg-router-api.h"
+#include "../centralizedmsg-api.h"
+#include "../centralizedmsg-api-constants.h"
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Usage of the router program */
+#define ROUTER_USAGE "./DSrouter [-p port] -s shardIP:shardPort [-s shardIP:shardPort ...]"
+
+/**
+ * @brief Parses the program's arguments for the router port and the shards (given in shard order).
+ *
+ * @param argc number of arguments (including the executable) given.
+ * @param argv arguments given.
+ */
+static void parseArgs(int argc, char *argv[]);
+
+int main(int argc, char *argv[])
+{
+    parseArgs(argc, argv);
+    signal(SIGPIPE, SIG_IGN); // A client or shard closing mid relay must not kill the router
+    setupRouterSockets();
+    // Have 2 separate processes handling different operations
+    pid_t pid = fork();
+    if (pid == 0)
+    { // Set child process to handle TCP operations
+        handleRouterTCP();
+    }
+    else if (pid > 0)
+    { // Set parent process to handle UDP operations
+        handleRouterUDP();
+    }
+    else
+    {
+        perror("[-] Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Parses the address of the next shard (shardIP:shardPort).
+ *
+ * @param value string that contains the address.
+ */
+static void parseShardAddress(char *value)
+{
+    char *sep = (value != NULL) ? strrchr(value, ':') : NULL;
+    if (sep == NULL || sep - value >= DS_ADDR_SIZE || numDSShards == DS_MAX_SHARDS)
+    {
+        fprintf(stderr, "[-] Invalid DS shard given. Usage: %s\n", ROUTER_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    DSShard *shard = &dsShards[numDSShards];
+    memset(shard->addr, 0, DS_ADDR_SIZE);
+    strncpy(shard->addr, value, sep - value);
+    if (!validAddress(shard->addr) || !validPort(sep + 1))
+    {
+        fprintf(stderr, "[-] Invalid DS shard given. Usage: %s\n", ROUTER_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(shard->port, sep + 1);
+    numDSShards++;
+}
+
+static void parseArgs(int argc, char *argv[])
+{
+    for (int i = 1; i <= argc - 1; ++i)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i == argc - 1)
+        {
+            fprintf(stderr, "[-] Invalid router program arguments. Usage: %s\n", ROUTER_USAGE);
+            exit(EXIT_FAILURE);
+        }
+        char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'p':
+            if (validPort(value))
+            {
+                strcpy(portRouter, value);
+            }
+            else
+            {
+                fprintf(stderr, "[-] Invalid router port number given. Please try again.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            parseShardAddress(value);
+            break;
+        default:
+            fprintf(stderr, "[-] Invalid flag given. Usage: %s\n", ROUTER_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (numDSShards == 0)
+    {
+        fprintf(stderr, "[-] No DS shards given. Usage: %s\n", ROUTER_USAGE);
+        exit(EXIT_FAILURE);
+    }
+}
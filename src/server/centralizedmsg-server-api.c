@@ -7,171 +7,314 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <limits.h>
+#include <sys/socket.h>
 
-char *processClientUDP(char *message)
+/**
+ * @brief Checks if a command changes the DS (so it's logged by a primary and refused by a follower).
+ *
+ * @param cmd macro that contains the respective operation.
+ * @return 1 if it's a write command, 0 otherwise.
+ */
+static int changesDSState(int cmd)
 {
-    char *token, *tokenList[CLIENT_NUMTOKENS];
-    int numTokens = 0;
-    int cmd;
-    char *response;
-    token = strtok(message, " ");
-    while (token)
-    {
-        tokenList[numTokens++] = token;
-        token = strtok(NULL, " ");
-    }
-    cmd = parseDSClientCommand(tokenList[0]);
     switch (cmd)
     {
     case REGISTER:
-        response = clientRegister(tokenList, numTokens);
-        break;
     case UNREGISTER:
-        response = clientUnregister(tokenList, numTokens);
-        break;
     case LOGIN:
-        response = clientLogin(tokenList, numTokens);
-        break;
     case LOGOUT:
-        response = clientLogout(tokenList, numTokens);
-        break;
-    case GROUPS:
-        response = listDSGroups(numTokens);
-        break;
     case SUBSCRIBE:
-        response = clientSubscribeGroup(tokenList, numTokens);
-        break;
     case UNSUBSCRIBE:
-        response = clientUnsubscribeGroup(tokenList, numTokens);
-        break;
-    case MY_GROUPS:
-        response = listClientDSGroups(tokenList, numTokens);
-        break;
+    case POST:
+    case POST_BATCH:
+    case BINARY:
+    case UPLOAD_START:
+    case UPLOAD_QUERY:
+    case UPLOAD_DATA:
+    case UPLOAD_CHUNK:
+    case UPLOAD_FINISH:
+    case REPLICATE:
+        return 1;
     default:
-        response = strdup(ERR_MSG);
-        break;
+        return 0;
+    }
+}
+
+/**
+ * @brief Splits a UDP request in tokens.
+ *
+ * @param message string that contains the request (it's split in place).
+ * @param tokenList list that will contain the request's tokens.
+ * @return number of tokens.
+ */
+static int splitClientUDP(char *message, char **tokenList)
+{
+    char *token;
+    int numTokens = 0;
+    token = strtok(message, " ");
+    while (token)
+    {
+        tokenList[numTokens++] = token;
+        token = strtok(NULL, " ");
+    }
+    return numTokens;
+}
+
+struct in_addr clientAddrUDP;
+
+/* Set while a follower applies a change of its primary, whose passwords are shipped as the stored password records */
+static int replayingChange = 0;
+
+/**
+ * @brief Checks the password of a request (a password record when a follower applies it).
+ *
+ * @param PW string that contains the password.
+ * @return 1 if it's valid, 0 otherwise.
+ */
+static int validPassword(char *PW)
+{
+    return replayingChange ? validPasswordRecord(PW) : validPW(PW);
+}
+
+/**
+ * @brief Checks if a request gave the password of a user (the primary already did when a follower applies it).
+ *
+ * @param UID string that contains the user ID.
+ * @param PW string that contains the password.
+ * @return 1 if it did, 0 otherwise.
+ */
+static int passwordGiven(const char *UID, const char *PW)
+{
+    return replayingChange || passwordsMatch(UID, PW);
+}
+
+/* Handlers of the UDP commands indexed by command macro (the reply codes are in the protocol table) */
+static char *(*const udpHandlers[PROTOCOL_NUM_COMMANDS])(char **, int, char *) = {
+    [REGISTER] = clientRegister,
+    [UNREGISTER] = clientUnregister,
+    [LOGIN] = clientLogin,
+    [LOGOUT] = clientLogout,
+    [GROUPS] = listDSGroups,
+    [SUBSCRIBE] = clientSubscribeGroup,
+    [UNSUBSCRIBE] = clientUnsubscribeGroup,
+    [MY_GROUPS] = listClientDSGroups,
+    [STATS] = showDSStats,
+    [LATENCY] = showDSLatency,
+    [PROFILE] = controlDSProfile,
+};
+
+/* Handlers of the TCP commands indexed by command macro */
+static void (*const tcpHandlers[PROTOCOL_NUM_COMMANDS])(int) = {
+    [ULIST] = showClientsInGroup,
+    [POST] = clientPostInGroup,
+    [RETRIEVE] = retrieveMessagesFromGroup,
+    [STREAM] = streamPostsToClient,
+    [RETRIEVE_ALL] = retrieveAllMessagesFromGroup,
+    [POST_BATCH] = clientPostBatchInGroup,
+    [BINARY] = clientBinarySession,
+    [UPLOAD_START] = clientStartUpload,
+    [UPLOAD_QUERY] = clientQueryUpload,
+    [UPLOAD_DATA] = clientUploadData,
+    [RETRIEVE_FILE] = retrieveFileFromGroup,
+    [UPLOAD_CHUNK] = clientUploadChunk,
+    [UPLOAD_FINISH] = clientFinishUpload,
+    [REPLICATE] = replicateChanges,
+    [PROFILE] = dumpDSProfile,
+};
+
+/**
+ * @brief Runs the command of a UDP request.
+ *
+ * @param tokenList list that contains all the protocol message's arguments (including the message code).
+ * @param numTokens number of command arguments.
+ * @param cmd macro that contains the respective operation.
+ * @param reply buffer the DS reply is written to.
+ * @return char* containing the DS reply to the client (reply).
+ */
+static char *dispatchClientUDP(char **tokenList, int numTokens, int cmd, char *reply)
+{
+    if (cmd > 0 && udpHandlers[cmd] != NULL)
+    {
+        enterDSStage(DS_STAGE_STORAGE);
+        udpHandlers[cmd](tokenList, numTokens, reply);
+        arenaReset(&dsArena); // Everything the request allocated is released at once
+        return reply;
+    }
+    return strcpy(reply, ERR_MSG);
+}
+
+/**
+ * @brief Appends a UDP request that changed a primary to its change log. A password is replaced by its stored record
+ * so that the log (and every follower it's shipped to) never gets it in clear.
+ *
+ * @param cmd macro that contains the respective operation.
+ * @param tokenList list that contains all the request's tokens.
+ * @param request string that contains the whole request.
+ * @param record buffer with the password record of the user if it was read before the request (UNR), empty otherwise.
+ */
+static void logClientChange(int cmd, char **tokenList, const char *request, char *record)
+{
+    if (cmd != REGISTER && cmd != UNREGISTER && cmd != LOGIN && cmd != LOGOUT)
+    {
+        logDSChange(request);
+        return;
+    }
+    if (record[0] == '\0' && !readPasswordRecord(tokenList[1], record))
+    {
+        fprintf(stderr, "[-] No password record to log for user %s\n", tokenList[1]);
+        return;
+    }
+    char change[DS_CHANGELINE_SIZE];
+    snprintf(change, sizeof(change), "%s %s %s", tokenList[0], tokenList[1], record);
+    logDSChange(change);
+}
+
+char *processClientUDP(char *message, char *reply)
+{
+    char request[CLIENT_TO_DS_UDP_SIZE];
+    strcpy(request, message); // The change log needs the request before strtok splits it
+    char *tokenList[CLIENT_NUMTOKENS];
+    int numTokens = splitClientUDP(message, tokenList);
+    int cmd = parseDSClientCommand(tokenList[0]);
+    setDSTimerCommand(cmd);
+    if (dsReplication == REPLICATION_FOLLOWER && changesDSState(cmd))
+    { // Writes only go to the primary, whose changes reach this DS through the replication stream
+        countDSStatus(cmd, "ERR");
+        return strcpy(reply, ERR_MSG);
+    }
+    char record[DS_PWDRECORD_SIZE] = "";
+    if (dsReplication == REPLICATION_PRIMARY && cmd == UNREGISTER && numTokens == 3 && validUID(tokenList[1]))
+    { // Unregistering removes the password record the change log needs
+        readPasswordRecord(tokenList[1], record);
+    }
+    char *response = dispatchClientUDP(tokenList, numTokens, cmd, reply);
+    if (dsReplication == REPLICATION_PRIMARY && changesDSState(cmd) && (strstr(response, " OK\n") || !strncmp(response, "RGS NEW", 7)))
+    {
+        logClientChange(cmd, tokenList, request, record);
     }
+    countDSStatus(cmd, strcmp(response, ERR_MSG) ? response + PROTOCOL_CODE_SIZE : "ERR");
+    return response;
+}
+
+char *replayClientUDP(char *message, char *reply)
+{
+    char *tokenList[CLIENT_NUMTOKENS];
+    int numTokens = splitClientUDP(message, tokenList);
+    replayingChange = 1;
+    char *response = dispatchClientUDP(tokenList, numTokens, parseDSClientCommand(tokenList[0]), reply);
+    replayingChange = 0;
     return response;
 }
 
 void processClientTCP(int fd, char *command)
 {
     int cmd = parseDSClientCommand(command);
-    switch (cmd)
+    setTCPDeadlineCommand(cmd);
+    setDSTimerCommand(cmd);
+    if (dsReplication == REPLICATION_FOLLOWER && changesDSState(cmd))
+    { // Followers only serve reads
+        cmd = INVALID_COMMAND;
+    }
+    if (cmd > 0 && tcpHandlers[cmd] != NULL)
     {
-    case ULIST:
-        showClientsInGroup(fd);
-        break;
-    case POST:
-        clientPostInGroup(fd);
-        break;
-    case RETRIEVE:
-        retrieveMessagesFromGroup(fd);
-        break;
-    default:
+        tcpHandlers[cmd](fd);
+    }
+    else
+    {
+        countDSStatus(cmd, "ERR");
         if (sendTCP(fd, ERR_MSG) == -1)
         {
             close(fd);
             exit(EXIT_FAILURE);
         }
     }
+    stopDSTimer();
+    finishDSTrace();
+    arenaReset(&dsArena); // Everything the command allocated is released at once
 }
 
 /**
  * @brief Formats a message to be sent to the client from the DS via UDP protocol.
  *
+ * @param reply buffer the message is written to (DS_TO_CLIENT_UDP_SIZE bytes).
  * @param command macro that contains the respective operation.
  * @param status string that contains the operation status.
  * @return message to be sent to the client via UDP protocol.
  */
-static char *createDSUDPReply(int command, char *status)
+static char *createDSUDPReply(char *reply, int command, char *status)
 {
-    char message[DS_TO_CLIENT_UDP_SIZE];
-    switch (command)
-    {
-    case REGISTER:
-        sprintf(message, "RRG %s\n", status);
-        break;
-    case UNREGISTER:
-        sprintf(message, "RUN %s\n", status);
-        break;
-    case LOGIN:
-        sprintf(message, "RLO %s\n", status);
-        break;
-    case LOGOUT:
-        sprintf(message, "ROU %s\n", status);
-        break;
-    case GROUPS:
-        sprintf(message, "RGL %s\n", status);
-        break;
-    case SUBSCRIBE:
-        sprintf(message, "RGS %s\n", status);
-        break;
-    case UNSUBSCRIBE:
-        sprintf(message, "RGU %s\n", status);
-        break;
-    case MY_GROUPS:
-        sprintf(message, "RGM %s\n", status);
-        break;
-    }
-    return strdup(message);
+    sprintf(reply, "%s %s\n", protocolReplyCode(command), status);
+    return reply;
 }
 
 /**
- * @brief Formats a message to be sent to the client from the DS via TCP protocol.
+ * @brief Formats a message to be sent to the client from the DS via TCP protocol, without counting its status
+ * (for replies whose request may still fail once they're sent).
  *
  * @param fd file descriptor where the TCP connection was estabelished.
  * @param command macro that contains the respective operation.
  * @param status string that contains the operation status.
  */
-static void sendDSStatusTCP(int fd, int command, char *status)
+static void sendDSReplyTCP(int fd, int command, char *status)
 {
     char message[DS_TCPSTATUSBUF_SIZE];
-    switch (command)
+    int failed = !strcmp(status, "NOK") || !strcmp(status, "EOF");
+    if ((command == ULIST || command == RETRIEVE || command == RETRIEVE_ALL) && !failed)
+    { // no nl here is intended: the users or messages follow
+        sprintf(message, "%s %s", protocolReplyCode(command), status);
+    }
+    else
     {
-    case ULIST:
-        if (!strcmp(status, "NOK"))
-        {
-            sprintf(message, "RUL NOK\n");
-        }
-        else
-        {
-            sprintf(message, "RUL %s", status); // no nl here is intended
-        }
-        break;
-    case POST:
-        sprintf(message, "RPT %s\n", status);
-        break;
-    case RETRIEVE:
-        if (!strcmp(status, "NOK") || !strcmp(status, "EOF"))
-        {
-            sprintf(message, "RRT %s\n", status);
-        }
-        else
-        {
-            sprintf(message, "RRT %s", status);
-        }
+        sprintf(message, "%s %s\n", protocolReplyCode(command), status);
     }
+    int stage = enterDSStage(DS_STAGE_SEND);
     if (sendTCP(fd, message) == -1)
     {
         close(fd);
         exit(EXIT_FAILURE);
     }
+    enterDSStage(stage);
+}
+
+/**
+ * @brief Formats a message to be sent to the client from the DS via TCP protocol and counts its status, the only
+ * one counted for the request.
+ *
+ * @param fd file descriptor where the TCP connection was estabelished.
+ * @param command macro that contains the respective operation.
+ * @param status string that contains the operation status.
+ */
+static void sendDSStatusTCP(int fd, int command, char *status)
+{
+    countDSStatus(command, status);
+    sendDSReplyTCP(fd, command, status);
 }
 
-char *clientRegister(char **tokenList, int numTokens)
+char *clientRegister(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 3)
     { // Wrong protocol message received
-        return createDSUDPReply(REGISTER, "NOK");
+        return createDSUDPReply(reply, REGISTER, "NOK");
     }
-    if (!(validUID(tokenList[1]) && validPW(tokenList[2])))
+    if (!(validUID(tokenList[1]) && validPassword(tokenList[2])))
     { // Wrong protocol message received
-        return createDSUDPReply(REGISTER, "NOK");
+        return createDSUDPReply(reply, REGISTER, "NOK");
     }
 
     char clientDirPath[DS_CLIENTDIRPATH_SIZE];
     char clientPwdPath[DS_CLIENTPWDPATH_SIZE];
+    char record[DS_PWDRECORD_SIZE];
+
+    // Only the salted hash of the password is stored (a follower gets the record its primary stored)
+    if (replayingChange)
+    {
+        strcpy(record, tokenList[2]);
+    }
+    else if (!createPasswordRecord(tokenList[2], record))
+    {
+        return createDSUDPReply(reply, REGISTER, "NOK");
+    }
 
     // Create user directory
     sprintf(clientDirPath, "server/USERS/%s", tokenList[1]);
@@ -180,41 +323,32 @@ char *clientRegister(char **tokenList, int numTokens)
     {
         if (errno == EEXIST)
         { // This folder already exists -> duplicate user
-            return createDSUDPReply(REGISTER, "DUP");
+            return createDSUDPReply(reply, REGISTER, "DUP");
         }
         else
         { // Other errno error -> registration process failed (NOK)
-            return createDSUDPReply(REGISTER, "NOK");
+            return createDSUDPReply(reply, REGISTER, "NOK");
         }
     }
 
     // Create user password file
     sprintf(clientPwdPath, "server/USERS/%s/%s_pass.txt", tokenList[1], tokenList[1]);
-    FILE *pwd = fopen(clientPwdPath, "w");
-    if (pwd == NULL)
-    {
-        return createDSUDPReply(REGISTER, "NOK");
-    }
-    if (fwrite(tokenList[2], sizeof(char), CLIENT_PWD_SIZE - 1, pwd) != CLIENT_PWD_SIZE - 1)
+    if (!writeDSFile(clientPwdPath, record, DS_PWDRECORD_SIZE - 1))
     {
-        return createDSUDPReply(REGISTER, "NOK");
+        return createDSUDPReply(reply, REGISTER, "NOK");
     }
-    if (fclose(pwd) == -1)
-    {
-        return createDSUDPReply(REGISTER, "NOK");
-    }
-    return createDSUDPReply(REGISTER, "OK");
+    return createDSUDPReply(reply, REGISTER, "OK");
 }
 
-char *clientUnregister(char **tokenList, int numTokens)
+char *clientUnregister(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 3)
     { // Wrong protocol message received
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
-    if (!(validUID(tokenList[1]) && validPW(tokenList[2])))
+    if (!(validUID(tokenList[1]) && validPassword(tokenList[2])))
     { // Wrong protocol message received
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
 
     char clientDirPath[DS_CLIENTDIRPATH_SIZE];
@@ -222,37 +356,37 @@ char *clientUnregister(char **tokenList, int numTokens)
 
     if (!directoryExists(clientDirPath))
     { // User wasn't previously registered - no dir folder
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
 
-    if (!passwordsMatch(tokenList[1], tokenList[2]))
+    if (!passwordGiven(tokenList[1], tokenList[2]))
     { // Given and stored passwords do not match
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
 
     if (!unsubscribeClientFromGroups(tokenList[1]))
     { // Failed to unsubscribe user from all of its subscribed groups
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
 
     if (!removeDirectory(clientDirPath))
     { // User directory failed to be removed
-        return createDSUDPReply(UNREGISTER, "NOK");
+        return createDSUDPReply(reply, UNREGISTER, "NOK");
     }
 
-    return createDSUDPReply(UNREGISTER, "OK");
+    return createDSUDPReply(reply, UNREGISTER, "OK");
 }
 
-char *clientLogin(char **tokenList, int numTokens)
+char *clientLogin(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 3)
     { // Wrong protocol message received
-        return createDSUDPReply(LOGIN, "NOK");
+        return createDSUDPReply(reply, LOGIN, "NOK");
     }
 
-    if (!(validUID(tokenList[1]) && validPW(tokenList[2])))
+    if (!(validUID(tokenList[1]) && validPassword(tokenList[2])))
     { // Wrong protocol message received
-        return createDSUDPReply(LOGIN, "NOK");
+        return createDSUDPReply(reply, LOGIN, "NOK");
     }
 
     char clientDirPath[DS_CLIENTDIRPATH_SIZE];
@@ -260,40 +394,35 @@ char *clientLogin(char **tokenList, int numTokens)
 
     if (!directoryExists(clientDirPath))
     { // User isn't registered -> can't login
-        return createDSUDPReply(LOGIN, "NOK");
+        return createDSUDPReply(reply, LOGIN, "NOK");
     }
 
-    if (!passwordsMatch(tokenList[1], tokenList[2]))
+    if (!passwordGiven(tokenList[1], tokenList[2]))
     { // Given and stored passwords do not match
-        return createDSUDPReply(LOGIN, "NOK");
+        return createDSUDPReply(reply, LOGIN, "NOK");
     }
 
     // Create user login file
     char clientLoginPath[DS_CLIENTLOGINPATH_SIZE];
     sprintf(clientLoginPath, "server/USERS/%s/%s_login.txt", tokenList[1], tokenList[1]);
-    FILE *login = fopen(clientLoginPath, "a"); // create dummy file
-    if (login == NULL)
-    {
-        return createDSUDPReply(LOGIN, "NOK");
-    }
-    if (fclose(login) == -1)
+    if (!writeDSFile(clientLoginPath, "", 0)) // create dummy file
     {
-        return createDSUDPReply(LOGIN, "NOK");
+        return createDSUDPReply(reply, LOGIN, "NOK");
     }
 
-    return createDSUDPReply(LOGIN, "OK");
+    return createDSUDPReply(reply, LOGIN, "OK");
 }
 
-char *clientLogout(char **tokenList, int numTokens)
+char *clientLogout(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 3)
     { // Wrong protocol message received
-        return createDSUDPReply(LOGOUT, "NOK");
+        return createDSUDPReply(reply, LOGOUT, "NOK");
     }
 
-    if (!(validUID(tokenList[1]) && validPW(tokenList[2])))
+    if (!(validUID(tokenList[1]) && validPassword(tokenList[2])))
     { // Wrong protocol message received
-        return createDSUDPReply(LOGOUT, "NOK");
+        return createDSUDPReply(reply, LOGOUT, "NOK");
     }
 
     // Check if user is registered
@@ -301,13 +430,13 @@ char *clientLogout(char **tokenList, int numTokens)
     sprintf(clientDirPath, "server/USERS/%s", tokenList[1]);
     if (!directoryExists(clientDirPath))
     {
-        return createDSUDPReply(LOGOUT, "NOK");
+        return createDSUDPReply(reply, LOGOUT, "NOK");
     }
 
     // Check if given and stored passwords match
-    if (!passwordsMatch(tokenList[1], tokenList[2]))
+    if (!passwordGiven(tokenList[1], tokenList[2]))
     {
-        return createDSUDPReply(LOGOUT, "NOK");
+        return createDSUDPReply(reply, LOGOUT, "NOK");
     }
 
     // Delete the login file
@@ -317,39 +446,39 @@ char *clientLogout(char **tokenList, int numTokens)
     { // Login file exists
         if (!unlink(clientLoginPath))
         { // Login file was deleted
-            return createDSUDPReply(LOGOUT, "OK");
+            return createDSUDPReply(reply, LOGOUT, "OK");
         }
     }
 
     // If it gets here either unlink failed or user isn't logged in
-    return createDSUDPReply(LOGOUT, "NOK");
+    return createDSUDPReply(reply, LOGOUT, "NOK");
 }
 
-char *listDSGroups(int numTokens)
+char *listDSGroups(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 1)
     { // Wrong protocol message received (no NOK status in RGL)
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
     }
 
-    // Create groups list message
-    char groupsDSBuf[DS_GROUPSLISTBUF_SIZE] = "";
-    if (!createGroupListMessage(groupsDSBuf, NULL, 0))
+    // Create groups list message right after the reply code
+    int len = sprintf(reply, "%s ", protocolReplyCode(GROUPS));
+    if (!createGroupListMessage(reply + len, NULL, 0))
     { // Failed to create group list messages (no NOK status in RGL)
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
     }
-    return createDSUDPReply(GROUPS, groupsDSBuf);
+    return strcat(reply, "\n");
 }
 
-char *clientSubscribeGroup(char **tokenList, int numTokens)
+char *clientSubscribeGroup(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 4)
     { // Wrong protocol message received
-        return createDSUDPReply(SUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, SUBSCRIBE, "NOK");
     }
     if (!(validUID(tokenList[1]) && isGID(tokenList[2]) && validGName(tokenList[3])))
     { // Wrong protocol message received
-        return createDSUDPReply(SUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, SUBSCRIBE, "NOK");
     }
 
     // Check if user is registered
@@ -357,7 +486,7 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
     sprintf(clientDirPath, "server/USERS/%s", tokenList[1]);
     if (!directoryExists(clientDirPath))
     {
-        return createDSUDPReply(SUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, SUBSCRIBE, "NOK");
     }
 
     // Check if user is logged in
@@ -365,38 +494,32 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
     sprintf(clientLoginPath, "server/USERS/%s/%s_login.txt", tokenList[1], tokenList[1]);
     if (access(clientLoginPath, F_OK) != 0)
     {
-        return createDSUDPReply(SUBSCRIBE, "E_USR");
+        return createDSUDPReply(reply, SUBSCRIBE, "E_USR");
     }
 
     // Check if given group ID exists
     int dsGroupNum = atoi(tokenList[2]);
-    if (dsGroupNum > dsGroups.no_groups)
+    if (dsGroupNum > 0 && !groupInDS(dsGroupNum))
     {
-        return createDSUDPReply(SUBSCRIBE, "E_GRP");
+        return createDSUDPReply(reply, SUBSCRIBE, "E_GRP");
     }
 
     if (!strcmp(tokenList[2], "00"))
     { // Create a new group
-        if (dsGroups.no_groups == 99)
+        int newDSGroupNum = nextDSGroupID();
+        if (newDSGroupNum == 0)
         { // DS is full
-            return createDSUDPReply(SUBSCRIBE, "E_FULL");
+            return createDSUDPReply(reply, SUBSCRIBE, "E_FULL");
         }
         char newDSGID[DS_GID_SIZE];
-        if (dsGroups.no_groups < 9)
-        {
-            sprintf(newDSGID, "0%d", dsGroups.no_groups + 1);
-        }
-        else
-        {
-            sprintf(newDSGID, "%d", dsGroups.no_groups + 1);
-        }
+        sprintf(newDSGID, "%02d", newDSGroupNum);
 
         // Check if there's a group with that same name
         for (int i = 0; i < dsGroups.no_groups; ++i)
         {
             if (!strcmp(tokenList[3], dsGroups.groupinfo[i].name))
             {
-                return createDSUDPReply(SUBSCRIBE, "E_GNAME");
+                return createDSUDPReply(reply, SUBSCRIBE, "E_GNAME");
             }
         }
 
@@ -413,7 +536,7 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
         ret = mkdir(dsGroupPath, 0700);
         if (ret == -1)
         {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
+            return createDSUDPReply(reply, SUBSCRIBE, "NOK");
         }
 
         // Create group messages directory
@@ -421,37 +544,22 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
         ret = mkdir(dsGroupMsgPath, 0700);
         if (ret == -1)
         {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
+            return createDSUDPReply(reply, SUBSCRIBE, "NOK");
         }
 
         // Create group name file
         sprintf(dsGroupNamePath, "server/GROUPS/%s/%s_name.txt", newDSGID, newDSGID);
-        FILE *name = fopen(dsGroupNamePath, "w");
-        if (name == NULL)
-        {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
-        }
-        sprintf(dsGroupName, "%s\n", tokenList[3]);
-        size_t lenDSGroupName = strlen(dsGroupName);
-        if (fwrite(dsGroupName, sizeof(char), lenDSGroupName, name) != lenDSGroupName)
-        {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
-        }
-        if (fclose(name) == -1)
+        int lenDSGroupName = sprintf(dsGroupName, "%s\n", tokenList[3]);
+        if (!writeDSFile(dsGroupNamePath, dsGroupName, lenDSGroupName))
         {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
+            return createDSUDPReply(reply, SUBSCRIBE, "NOK");
         }
 
         // Create group client subscribe file
         sprintf(dsGroupClientSubPath, "server/GROUPS/%s/%s.txt", newDSGID, tokenList[1]);
-        FILE *client = fopen(dsGroupClientSubPath, "a");
-        if (client == NULL)
-        {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
-        }
-        if (fclose(client) == -1)
+        if (!writeDSFile(dsGroupClientSubPath, "", 0))
         {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
+            return createDSUDPReply(reply, SUBSCRIBE, "NOK");
         }
 
         // Add new group to global struct
@@ -463,7 +571,7 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
         // Create new group status message
         char newGroupStatus[DS_NEWGROUPSTATUS_SIZE];
         sprintf(newGroupStatus, "NEW %s", newDSGID);
-        return createDSUDPReply(SUBSCRIBE, newGroupStatus);
+        return createDSUDPReply(reply, SUBSCRIBE, newGroupStatus);
     }
     // This else is safe to assume because isGID has already made sure that the given GID is valid (00 - 99)
     else
@@ -472,35 +580,30 @@ char *clientSubscribeGroup(char **tokenList, int numTokens)
         if (!groupNamesMatch(tokenList[2], tokenList[3]))
         { // Check if given group name matches the stored one
             fprintf(stderr, "[-] Wrong group name given.\n");
-            return createDSUDPReply(SUBSCRIBE, "E_GNAME");
+            return createDSUDPReply(reply, SUBSCRIBE, "E_GNAME");
         }
 
         // Create subscribed user file
         char dsGroupClientSubPath[DS_GROUPCLIENTSUBPATH_SIZE];
         sprintf(dsGroupClientSubPath, "server/GROUPS/%s/%s.txt", tokenList[2], tokenList[1]);
-        FILE *client = fopen(dsGroupClientSubPath, "a");
-        if (client == NULL)
-        {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
-        }
-        if (fclose(client) == -1)
+        if (!writeDSFile(dsGroupClientSubPath, "", 0))
         {
-            return createDSUDPReply(SUBSCRIBE, "NOK");
+            return createDSUDPReply(reply, SUBSCRIBE, "NOK");
         }
-        return createDSUDPReply(SUBSCRIBE, "OK");
+        return createDSUDPReply(reply, SUBSCRIBE, "OK");
     }
 }
 
-char *clientUnsubscribeGroup(char **tokenList, int numTokens)
+char *clientUnsubscribeGroup(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 3)
     { // Wrong protocol message received
-        return createDSUDPReply(UNSUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "NOK");
     }
 
     if (!(validUID(tokenList[1]) && validGID(tokenList[2])))
     { // Wrong protocol message received
-        return createDSUDPReply(UNSUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "NOK");
     }
 
     // Check if user is registered
@@ -508,7 +611,7 @@ char *clientUnsubscribeGroup(char **tokenList, int numTokens)
     sprintf(clientDirPath, "server/USERS/%s", tokenList[1]);
     if (!directoryExists(clientDirPath))
     {
-        return createDSUDPReply(UNSUBSCRIBE, "E_USR");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "E_USR");
     }
 
     // Check if user is logged in
@@ -516,14 +619,13 @@ char *clientUnsubscribeGroup(char **tokenList, int numTokens)
     sprintf(clientLoginPath, "server/USERS/%s/%s_login.txt", tokenList[1], tokenList[1]);
     if (access(clientLoginPath, F_OK) != 0)
     {
-        return createDSUDPReply(UNSUBSCRIBE, "E_USR");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "E_USR");
     }
 
     // Check if given group ID exists
-    int dsGroupNum = atoi(tokenList[2]);
-    if (dsGroupNum > dsGroups.no_groups)
+    if (!groupInDS(atoi(tokenList[2])))
     {
-        return createDSUDPReply(UNSUBSCRIBE, "E_GRP");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "E_GRP");
     }
 
     // Delete subscribed user file
@@ -531,22 +633,22 @@ char *clientUnsubscribeGroup(char **tokenList, int numTokens)
     sprintf(dsGroupClientSubPath, "server/GROUPS/%s/%s.txt", tokenList[2], tokenList[1]);
     if (unlink(dsGroupClientSubPath) != 0 && errno != ENOENT)
     { // errno = ENOENT means that the file doesn't exist -> the UID wasn't subscribed
-        return createDSUDPReply(UNSUBSCRIBE, "NOK");
+        return createDSUDPReply(reply, UNSUBSCRIBE, "NOK");
     }
 
-    return createDSUDPReply(UNSUBSCRIBE, "OK");
+    return createDSUDPReply(reply, UNSUBSCRIBE, "OK");
 }
 
-char *listClientDSGroups(char **tokenList, int numTokens)
+char *listClientDSGroups(char **tokenList, int numTokens, char *reply)
 {
     if (numTokens != 2)
     { // Wrong protocol message received (no NOK status in RGM)
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
     }
 
     if (!(validUID(tokenList[1])))
     { // Wrong protocol message received (no NOK status in RGM)
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
     }
 
     // Check if user is registered
@@ -554,7 +656,7 @@ char *listClientDSGroups(char **tokenList, int numTokens)
     sprintf(clientDirPath, "server/USERS/%s", tokenList[1]);
     if (!directoryExists(clientDirPath))
     {
-        return createDSUDPReply(MY_GROUPS, "E_USR");
+        return createDSUDPReply(reply, MY_GROUPS, "E_USR");
     }
 
     // Check if user is logged in
@@ -562,7 +664,7 @@ char *listClientDSGroups(char **tokenList, int numTokens)
     sprintf(clientLoginPath, "server/USERS/%s/%s_login.txt", tokenList[1], tokenList[1]);
     if (access(clientLoginPath, F_OK) != 0)
     {
-        return createDSUDPReply(MY_GROUPS, "E_USR");
+        return createDSUDPReply(reply, MY_GROUPS, "E_USR");
     }
 
     // Fill variables that contain information about the groups that the client is subscribed to
@@ -570,17 +672,76 @@ char *listClientDSGroups(char **tokenList, int numTokens)
     int numGroupsSub;
     if (!fillClientSubscribedGroups(tokenList[1], clientGroupsSubscribed, &numGroupsSub))
     {
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
     }
 
-    // Create client groups list message
-    char clientGroupsDSBuf[DS_GROUPSLISTBUF_SIZE] = "";
-    if (!createGroupListMessage(clientGroupsDSBuf, clientGroupsSubscribed, numGroupsSub))
+    // Create client groups list message right after the reply code
+    int len = sprintf(reply, "%s ", protocolReplyCode(MY_GROUPS));
+    if (!createGroupListMessage(reply + len, clientGroupsSubscribed, numGroupsSub))
     { // Failed to create client group list messages (no NOK status in RGM)
-        return strdup(ERR_MSG);
+        return strcpy(reply, ERR_MSG);
+    }
+    return strcat(reply, "\n");
+}
+
+char *showDSStats(char **tokenList, int numTokens, char *reply)
+{
+    if (numTokens != 1)
+    { // Wrong protocol message received
+        return strcpy(reply, ERR_MSG);
     }
+    int len = sprintf(reply, "%s\n", protocolReplyCode(STATS));
+    formatDSStats(reply + len, DS_TO_CLIENT_UDP_SIZE - len);
+    return reply;
+}
+
+char *showDSLatency(char **tokenList, int numTokens, char *reply)
+{
+    int command = 0;
+    if (numTokens == 2)
+    { // Only the histograms of one command
+        command = parseDSClientCommand(tokenList[1]);
+    }
+    if (numTokens > 2 || command == INVALID_COMMAND)
+    { // Wrong protocol message received
+        return strcpy(reply, ERR_MSG);
+    }
+    int len = sprintf(reply, "%s\n", protocolReplyCode(LATENCY));
+    formatDSLatency(reply + len, DS_TO_CLIENT_UDP_SIZE - len, command);
+    return reply;
+}
 
-    return createDSUDPReply(MY_GROUPS, clientGroupsDSBuf);
+char *controlDSProfile(char **tokenList, int numTokens, char *reply)
+{
+    if (!profilerAllowed(clientAddrUDP))
+    {
+        return createDSUDPReply(reply, PROFILE, "NOK");
+    }
+    if (numTokens == 2 && !strcmp(tokenList[1], "STOP"))
+    {
+        if (!stopDSProfile())
+        { // Wasn't running
+            return createDSUDPReply(reply, PROFILE, "NOK");
+        }
+        unsigned long samples, dropped;
+        countDSProfile(&samples, &dropped);
+        sprintf(reply, "%s OK %lu %lu\n", protocolReplyCode(PROFILE), samples, dropped);
+        return reply;
+    }
+    if ((numTokens != 2 && numTokens != 3) || strcmp(tokenList[1], "START"))
+    { // Wrong protocol message received
+        return strcpy(reply, ERR_MSG);
+    }
+    int hz = DS_PROF_DEFAULT_HZ;
+    if (numTokens == 3)
+    { // Samples per second of CPU time of every process
+        if (tokenList[2][0] == '\0' || !isNumber(tokenList[2]) || strlen(tokenList[2]) > 5 || atoi(tokenList[2]) < 1 || atoi(tokenList[2]) > DS_PROF_MAX_HZ)
+        {
+            return strcpy(reply, ERR_MSG);
+        }
+        hz = atoi(tokenList[2]);
+    }
+    return createDSUDPReply(reply, PROFILE, startDSProfile(hz) ? "OK" : "NOK");
 }
 
 void showClientsInGroup(int fd)
@@ -608,6 +769,7 @@ void showClientsInGroup(int fd)
     }
 
     // Check if group exists
+    enterDSStage(DS_STAGE_STORAGE);
     char dsGroupPath[DS_GROUPDIRPATH_SIZE];
     sprintf(dsGroupPath, "server/GROUPS/%s", GID);
     if (!directoryExists(dsGroupPath))
@@ -616,231 +778,374 @@ void showClientsInGroup(int fd)
         return;
     }
 
-    // Send to client initial message
-    char ulistInitialStatus[DS_TCPSTATUSBUF_SIZE - PROTOCOL_CODE_SIZE];
-    sprintf(ulistInitialStatus, "OK %s ", GID);
-    sendDSStatusTCP(fd, ULIST, ulistInitialStatus);
-
-    // Iterate over group's directory and print out users
+    // Iterate over group's directory and print out users (before the initial message so that it's the only status)
     char *response = listUsersInDSGroup(GID);
     if (response == NULL)
     { // Something went wrong while listing users in group
         sendDSStatusTCP(fd, ULIST, "NOK");
+        return;
     }
+
+    // Send to client initial message
+    char ulistInitialStatus[DS_TCPSTATUSBUF_SIZE - PROTOCOL_CODE_SIZE];
+    sprintf(ulistInitialStatus, "OK %s ", GID);
+    sendDSStatusTCP(fd, ULIST, ulistInitialStatus);
+    enterDSStage(DS_STAGE_SEND);
     if (sendTCP(fd, response) == -1)
     {
-        free(response);
         close(fd);
         exit(EXIT_FAILURE);
     }
-    free(response);
 }
 
-void clientPostInGroup(int fd)
+/**
+ * @brief Refills the per-connection buffer with a single large read when all of its bytes were consumed.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param connBuf per-connection buffer.
+ * @param start reference to the index of the first unconsumed byte in connBuf.
+ * @param end reference to the index after the last byte read into connBuf.
+ * @return 1 if there are unconsumed bytes in the buffer, 0 if the client failed to send any more bytes.
+ */
+static int refillConnBuffer(int fd, char *connBuf, size_t *start, size_t *end)
 {
-    int n;
-    int i;
-    char singleCharDS[CHAR_SIZE];
-
-    // Read UID and check if it's a valid protocol message and a valid UID
-    char UID[CLIENT_UID_SIZE];
-    if ((n = readTCP(fd, UID, CLIENT_UID_SIZE)) == -1)
+    if (*start < *end)
     {
-        exit(EXIT_FAILURE);
-    }
-    if (UID[n - 1] != ' ')
-    { // There must be a space between the UID and GID
-        exit(EXIT_FAILURE);
+        return 1;
     }
-    UID[n - 1] = '\0';
-    if (!validUID(UID))
-    { // Tejo aborts upon invalid UID
-        exit(EXIT_FAILURE);
+    int n = recvTCP(fd, connBuf, DS_CONNBUF_SIZE);
+    if (n <= 0)
+    {
+        return 0;
     }
+    progressTCPDeadline();
+    *start = 0;
+    *end = n;
+    return 1;
+}
 
-    // Read GID and check if it's a valid protocol message and a valid GID
-    char GID[DS_GID_SIZE];
-    if ((n = readTCP(fd, GID, DS_GID_SIZE)) == -1)
+/**
+ * @brief Writes a slice of received file data on to a file.
+ *
+ * @param fileFd file descriptor of the file being written.
+ * @param data buffer that contains the file data.
+ * @param len number of bytes in data.
+ * @return 1 if all bytes were written, 0 otherwise.
+ */
+static int writeFileData(int fileFd, const char *data, size_t len)
+{
+    ssize_t n;
+    while (len > 0)
     {
-        exit(EXIT_FAILURE);
-    }
-    if (GID[n - 1] != ' ')
-    { // There must be a space between the GID and TSize
-        exit(EXIT_FAILURE);
-    }
-    GID[n - 1] = '\0';
-    if (!validGID(GID))
-    { // Tejo aborts upon invalid GID
-        exit(EXIT_FAILURE);
+        n = write(fileFd, data, len);
+        if (n == -1)
+        {
+            perror("[-] Failed to write on file");
+            return 0;
+        }
+        data += n;
+        len -= n;
     }
+    return 1;
+}
 
-    // Read message TSize and check if it's a valid text size
-    char TSizeBuf[PROTOCOL_TEXTSZ_SIZE] = "";
-    for (i = 0; i < PROTOCOL_TEXTSZ_SIZE; ++i)
+/**
+ * @brief Receives the file attached to a posted message and the nl that ends the message.
+ * File bytes that came along with the header are handed straight to the file. If the message couldn't be
+ * created the file is still received (and discarded) so the client gets the NOK.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param parser parser in the PST_FDATA state.
+ * @param connBuf per-connection buffer.
+ * @param start reference to the index of the first unconsumed byte in connBuf.
+ * @param end reference to the index after the last byte read into connBuf.
+ * @param msgDir string that contains the path of the message directory the file goes in (NULL to discard the file).
+ * @param span span the time spent reading and writing the file is attached to (-1 if not traced).
+ * @return 1 if the file was stored, 0 otherwise, -1 if the connection was lost or the request is wrong
+ * (the caller must remove the message before the connection is dropped).
+ */
+static int receivePostFile(int fd, PostParser *parser, char *connBuf, size_t *start, size_t *end, const char *msgDir, int span)
+{
+    long readNsec = 0, writeNsec = 0;
+    int fileOk = (msgDir != NULL);
+    int fileFd = -1;
+    Sha256Ctx hashCtx; // The content hash is computed as the data goes by so retrieves never read the file for it
+    sha256Init(&hashCtx);
+    if (msgDir != NULL)
     {
-        if ((n = readTCP(fd, singleCharDS, CHAR_SIZE - 1)) == -1)
+        char newGroupMsgFilePath[DS_MSGFILEPATH_SIZE];
+        snprintf(newGroupMsgFilePath, DS_MSGFILEPATH_SIZE, "%s/%s", msgDir, parser->FName);
+        fileFd = open(newGroupMsgFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fileFd == -1)
         {
-            exit(EXIT_FAILURE);
+            perror("[-] Failed to create file");
+            fileOk = 0;
         }
-        if (singleCharDS[0] != ' ')
+    }
+    while (1)
+    {
+        size_t numFileBytes = pstParserTakeFile(parser, *end - *start);
+        long mark = readDSSpanClock(span);
+        if (fileFd != -1 && !writeFileData(fileFd, connBuf + *start, numFileBytes))
         {
-            strcat(TSizeBuf, &singleCharDS[0]);
+            close(fileFd);
+            fileFd = -1;
+            fileOk = 0;
         }
-        else
+        sha256Update(&hashCtx, connBuf + *start, numFileBytes);
+        *start += numFileBytes;
+        writeNsec += readDSSpanClock(span) - mark;
+        if (parser->state != PST_FDATA)
         {
             break;
         }
+        mark = readDSSpanClock(span);
+        int refilled = refillConnBuffer(fd, connBuf, start, end);
+        readNsec += readDSSpanClock(span) - mark;
+        if (!refilled)
+        {
+            if (fileFd != -1)
+            {
+                close(fileFd);
+            }
+            return -1;
+        }
     }
-    TSizeBuf[i] = '\0';
-    if (singleCharDS[0] != ' ')
-    { // Wrong protocol message
-        exit(EXIT_FAILURE);
+    if (fileFd != -1 && close(fileFd) == -1)
+    {
+        fileOk = 0;
     }
-    if (!isNumber(TSizeBuf) || atoi(TSizeBuf) > 240)
-    { // Tejo aborts upon invalid TSize or greater than 240
-        exit(EXIT_FAILURE);
+    if (fileOk)
+    {
+        char hash[DS_HASH_SIZE];
+        sha256FinalHex(&hashCtx, hash);
+        fileOk = writeMessageHash(msgDir, hash);
+    }
+    if (span != -1)
+    { // Tells a slow client apart from a slow disk
+        char usec[DS_TRACE_ARG_SIZE];
+        sprintf(usec, "%ld", readNsec / 1000);
+        argDSSpan(span, "read_us", usec);
+        sprintf(usec, "%ld", writeNsec / 1000);
+        argDSSpan(span, "write_us", usec);
     }
 
-    // Read message text and check if it's valid
-    int TSize = atoi(TSizeBuf);
-    char Text[PROTOCOL_TEXT_SIZE];
-    if ((n = readTCP(fd, Text, TSize)) == -1)
+    // All requests must end with a nl
+    while (parser->state == PST_END)
     {
-        exit(EXIT_FAILURE);
+        if (!refillConnBuffer(fd, connBuf, start, end))
+        {
+            return -1;
+        }
+        *start += pstParserFeed(parser, connBuf + *start, *end - *start);
     }
-
-    // Create new message in group
-    char newMID[DS_MID_SIZE] = "";
-    if (!createMessageInGroup(newMID, UID, GID, TSize, Text))
+    if (parser->state != PST_DONE)
     {
-        sendDSStatusTCP(fd, POST, "NOK");
+        sendTCP(fd, ERR_MSG); // No verification cause it'll exit with failure either way
+        return -1;
     }
+    return fileOk;
+}
 
-    // Check if it has a file
-    if ((n = readTCP(fd, singleCharDS, CHAR_SIZE - 1)) == -1)
+void clientPostInGroup(int fd)
+{
+    int request = beginDSSpan("PST");
+    int span = beginDSSpan("read header");
+    char connBuf[DS_CONNBUF_SIZE];
+    size_t start = 0, end = 0;
+    PostParser parser;
+    pstParserInit(&parser);
+
+    // Parse the request header (UID GID TSize Text[ FName FSize]) as it arrives in large chunks
+    while (parser.state != PST_DONE && parser.state != PST_FDATA)
     {
+        if (!refillConnBuffer(fd, connBuf, &start, &end))
+        {
+            exit(EXIT_FAILURE);
+        }
+        start += pstParserFeed(&parser, connBuf + start, end - start);
+        if (parser.state == PST_ERROR)
+        { // Wrong protocol message - Tejo aborts
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!admitUID(parser.UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
         exit(EXIT_FAILURE);
     }
-    if (singleCharDS[0] == '\n')
-    { // Only text was sent
-        if (!userSubscribedToGroup(UID, GID))
-        { // In order to prevent connection reset by peer and not getting the full message from the client
-          // we only check if the client is subscribed to the given group after receiving the whole message from it
-            sendDSStatusTCP(fd, POST, "NOK");
-            char newGroupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
-            sprintf(newGroupMsgDSPath, "server/GROUPS/%s/MSG/%s", GID, newMID);
-            if (!removeDirectory(newGroupMsgDSPath))
-            {
-                exit(EXIT_FAILURE);
-            }
-        }
-        else
+
+    // The whole header has arrived so the deadline now only has to cover the file data
+    endDSSpan(span);
+    argDSSpan(request, "UID", parser.UID);
+    argDSSpan(request, "GID", parser.GID);
+    enterDSStage(DS_STAGE_STORAGE);
+    if (parser.hasFile == HAS_FILE)
+    {
+        extendTCPDeadline(parser.FSize);
+    }
+
+    // The message is written aside and only gets its MID once it's complete (file included), so that readers never
+    // see part of it
+    char stagePath[DS_GROUPSTAGEPATH_SIZE], stagedDir[DS_STAGEDMSGDIRPATH_SIZE];
+    int staged = stageGroupMessage(parser.GID, parser.UID, parser.TSize, parser.Text, stagePath, stagedDir);
+    int fileOk = 1;
+
+    if (parser.hasFile == HAS_FILE)
+    { // There's a file attached to it too
+        span = beginDSSpan("receivePostFile");
+        fileOk = receivePostFile(fd, &parser, connBuf, &start, &end, staged ? stagedDir : NULL, span);
+        endDSSpan(span);
+    }
+    if (fileOk == -1)
+    { // Don't leave a message with a partial file behind
+        if (staged)
         {
-            sendDSStatusTCP(fd, POST, newMID);
+            removeDirectory(stagePath);
         }
+        exit(EXIT_FAILURE);
+    }
+
+    if (!staged)
+    {
+        sendDSStatusTCP(fd, POST, "NOK");
         return;
     }
-    else if (singleCharDS[0] == ' ')
-    { // There's a file attached to it too
-        char FName[PROTOCOL_FNAME_SIZE] = "";
-        char FSizeBuf[PROTOCOL_FILESZ_SIZE] = "";
+    span = beginDSSpan("userSubscribedToGroup");
+    int subscribed = fileOk && userSubscribedToGroup(parser.UID, parser.GID);
+    endDSSpan(span);
+    if (!subscribed)
+    { // In order to prevent connection reset by peer and not getting the full message from the client
+      // we only check if the client is subscribed to the given group after receiving the whole message from it
+        removeDirectory(stagePath);
+        sendDSStatusTCP(fd, POST, "NOK");
+        return;
+    }
+    span = beginDSSpan("commit");
+    int mid;
+    int posted = commitGroupStage(parser.GID, stagePath, 1, &mid);
+    char newMID[DS_MID_SIZE] = "";
+    if (posted)
+    { // Wake up the subscribers before replying so that pushes aren't delayed by the reply
+        snprintf(newMID, DS_MID_SIZE, "%04u", (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+        argDSSpan(request, "MID", newMID);
+        logGroupPosts(parser.GID, mid, 1);
+        notifyGroupPosts(parser.GID, mid, 1);
+    }
+    endDSSpan(span);
+    span = beginDSSpan("reply");
+    sendDSStatusTCP(fd, POST, posted ? newMID : "NOK");
+    endDSSpan(span);
+}
 
-        // Read file name
-        for (i = 0; i < PROTOCOL_FNAME_SIZE; ++i)
+void clientPostBatchInGroup(int fd)
+{
+    char connBuf[DS_CONNBUF_SIZE];
+    size_t start = 0, end = 0;
+    PostParser parser;
+    pstParserInitBatch(&parser);
+    char stagePath[DS_GROUPSTAGEPATH_SIZE];
+    char stagedDir[DS_STAGEDMSGDIRPATH_SIZE];
+    int staged = 0, ok = 1;
+
+    for (int i = 0; i == 0 || i < parser.count; ++i)
+    {
+        // Parse the next message (the first one comes after the UID GID N header)
+        while (parser.state != PST_DONE && parser.state != PST_FDATA)
         {
-            if ((n = readTCP(fd, singleCharDS, CHAR_SIZE - 1)) == -1)
-            {
-                exit(EXIT_FAILURE);
-            }
-            if (singleCharDS[0] != ' ')
+            if (refillConnBuffer(fd, connBuf, &start, &end))
             {
-                strcat(FName, &singleCharDS[0]);
+                start += pstParserFeed(&parser, connBuf + start, end - start);
             }
             else
             {
-                break;
+                parser.state = PST_ERROR;
+            }
+            if (parser.state == PST_ERROR)
+            { // Wrong protocol message or lost connection - Tejo aborts
+                if (staged)
+                {
+                    removeDirectory(stagePath);
+                }
+                exit(EXIT_FAILURE);
             }
-        }
-        FName[i] = '\0';
-        if (singleCharDS[0] != ' ')
-        { // Tejo aborts on wrong protocol message
-            exit(EXIT_FAILURE);
-        }
-        if (!validFName(FName))
-        { // Tejo aborts on wrong protocol message
-            exit(EXIT_FAILURE);
         }
 
-        // Read file size
-        for (i = 0; i < PROTOCOL_FILESZ_SIZE; ++i)
+        if (i == 0)
         {
-            if ((n = readTCP(fd, singleCharDS, CHAR_SIZE - 1)) == -1)
-            {
+            enterDSStage(DS_STAGE_STORAGE); // Later messages are parsed while storing the batch
+            if (!admitUID(parser.UID))
+            { // User exceeded its rate
+                sendTCP(fd, ERR_MSG);
                 exit(EXIT_FAILURE);
             }
-            if (singleCharDS[0] != ' ')
-            {
-                strcat(FSizeBuf, &singleCharDS[0]);
-            }
-            else
-            {
-                break;
-            }
+            // The messages are written aside and only get their MIDs once the whole batch is stored,
+            // so that readers never see part of the batch
+            staged = createGroupStage(parser.GID, stagePath);
+            ok = staged;
         }
-        FSizeBuf[i] = '\0';
-        if (singleCharDS[0] != ' ')
-        { // Tejo aborts on wrong protocol message
-            exit(EXIT_FAILURE);
-        }
-        if (strlen(FSizeBuf) > 10)
-        { // Tejo aborts on wrong protocol message
-            exit(EXIT_FAILURE);
-        }
-        long FSize = atol(FSizeBuf);
 
-        // Receive file
-        char newGroupMsgFilePath[DS_GROUPMSGFILEPATH_SIZE];
-        sprintf(newGroupMsgFilePath, "server/GROUPS/%s/MSG/%s/%s", GID, newMID, FName);
-        if (!recvFile(fd, newGroupMsgFilePath, FSize))
+        if (parser.hasFile == HAS_FILE)
         {
-            sendDSStatusTCP(fd, POST, "NOK");
+            extendTCPDeadline(parser.FSize);
         }
-
-        // All requests must end with a nl
-        if ((n = readTCP(fd, singleCharDS, CHAR_SIZE - 1)) == -1)
+        stagedMessageDir(stagePath, i, stagedDir);
+        if (ok && (mkdir(stagedDir, 0700) == -1 || !writeMessageFiles(stagedDir, parser.UID, parser.TSize, parser.Text)))
         {
-            exit(EXIT_FAILURE);
+            ok = 0;
         }
-        if (singleCharDS[0] != '\n')
+        int fileOk = (parser.hasFile == HAS_FILE) ? receivePostFile(fd, &parser, connBuf, &start, &end, ok ? stagedDir : NULL, -1) : 1;
+        if (fileOk == -1)
         {
-            sendTCP(fd, ERR_MSG);
-            exit(EXIT_FAILURE); // No verification cause it'll exit with failure either way
-        }
-
-        if (!userSubscribedToGroup(UID, GID))
-        { // In order to prevent connection reset by peer and not getting the full message from the client
-          // we only check if the client is subscribed to the given group after receiving the whole message from it
-            sendDSStatusTCP(fd, POST, "NOK");
-            char newGroupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
-            sprintf(newGroupMsgDSPath, "server/GROUPS/%s/MSG/%s", GID, newMID);
-            if (!removeDirectory(newGroupMsgDSPath))
+            if (staged)
             {
-                exit(EXIT_FAILURE);
+                removeDirectory(stagePath);
             }
+            exit(EXIT_FAILURE);
         }
-        else
+        ok = ok && fileOk;
+        pstParserNextMessage(&parser);
+    }
+
+    // The batch is all or nothing
+    int firstMID;
+    if (!ok || !userSubscribedToGroup(parser.UID, parser.GID))
+    {
+        if (staged)
         {
-            sendDSStatusTCP(fd, POST, newMID);
+            removeDirectory(stagePath);
         }
+        sendDSStatusTCP(fd, POST_BATCH, "NOK");
+        return;
     }
-    else
-    { // Wrong protocol message - Tejo aborts
+    if (!commitGroupStage(parser.GID, stagePath, parser.count, &firstMID) || !flushGroupMessages(parser.GID))
+    {
+        sendDSStatusTCP(fd, POST_BATCH, "NOK");
+        return;
+    }
+
+    // Reply with every new MID, in the order the messages were sent
+    char reply[DS_PSBREPLY_SIZE];
+    int len = sprintf(reply, "RPB OK");
+    for (int i = 0; i < parser.count; ++i)
+    {
+        len += sprintf(reply + len, " %04u", (unsigned int)(firstMID + i) % (DS_MAX_NUM_MSGS + 1));
+    }
+    sprintf(reply + len, "\n");
+    logGroupPosts(parser.GID, firstMID, parser.count);
+    notifyGroupPosts(parser.GID, firstMID, parser.count); // a single wakeup for the whole batch
+    if (sendTCP(fd, reply) == -1)
+    {
+        close(fd);
         exit(EXIT_FAILURE);
     }
 }
 
 void retrieveMessagesFromGroup(int fd)
 {
+    int request = beginDSSpan("RTV");
+    int span = beginDSSpan("read request");
     int n;
     // Read UID and check if it's a valid protocol message and a valid UID
     char UID[CLIENT_UID_SIZE];
@@ -857,6 +1162,11 @@ void retrieveMessagesFromGroup(int fd)
     { // Tejo aborts upon invalid UID
         exit(EXIT_FAILURE);
     }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
     // Read GID and check if it's a valid protocol message and a valid GID
     char GID[DS_GID_SIZE];
     if ((n = readTCP(fd, GID, DS_GID_SIZE)) == -1)
@@ -872,8 +1182,13 @@ void retrieveMessagesFromGroup(int fd)
     { // Tejo aborts upon invalid GID
         exit(EXIT_FAILURE);
     }
+    argDSSpan(request, "UID", UID);
+    argDSSpan(request, "GID", GID);
     // Check if user is subscribed to group with ID GID
-    if (!userSubscribedToGroup(UID, GID))
+    int check = beginDSSpan("userSubscribedToGroup");
+    int subscribed = userSubscribedToGroup(UID, GID);
+    endDSSpan(check);
+    if (!subscribed)
     {
         sendDSStatusTCP(fd, RETRIEVE, "NOK");
         return;
@@ -885,14 +1200,65 @@ void retrieveMessagesFromGroup(int fd)
     {
         exit(EXIT_FAILURE);
     }
+    int waitSecs = 0;
+    int fileMode = HAS_FILE;
+    if (n == DS_MID_SIZE && MID[n - 1] == ' ')
+    { // Optional number of seconds to wait for new messages and/or M to only get the files' metadata
+        char optsBuf[DS_RTVOPTS_SIZE + 1] = "";
+        int len = 0;
+        while (len < DS_RTVOPTS_SIZE && (len == 0 || optsBuf[len - 1] != '\n'))
+        {
+            if (readTCP(fd, optsBuf + len, 1) != 1)
+            {
+                exit(EXIT_FAILURE);
+            }
+            len++;
+        }
+        if (optsBuf[len - 1] != '\n')
+        { // Every request must end with a nl
+            sendTCP(fd, ERR_MSG);
+            exit(EXIT_FAILURE);
+        }
+        optsBuf[--len] = '\0';
+        if (len > 0 && optsBuf[len - 1] == 'M' && (len == 1 || optsBuf[len - 2] == ' '))
+        {
+            fileMode = FILE_META;
+            optsBuf[(len == 1) ? 0 : len - 2] = '\0';
+        }
+        if ((optsBuf[0] != '\0' || fileMode == HAS_FILE) &&
+            (optsBuf[0] == '\0' || strlen(optsBuf) > DS_RTVWAIT_SIZE - 1 || !isNumber(optsBuf) || atoi(optsBuf) > DS_RTV_MAX_WAIT))
+        {
+            sendTCP(fd, ERR_MSG);
+            exit(EXIT_FAILURE);
+        }
+        waitSecs = atoi(optsBuf);
+        MID[n - 1] = '\n';
+    }
     if (MID[n - 1] != '\n')
     { // Every request must end with a nl
         sendTCP(fd, ERR_MSG);
         exit(EXIT_FAILURE);
     }
     // Check number of messages to retrieve and send initial message
+    endDSSpan(span);
+    enterDSStage(DS_STAGE_STORAGE);
     int startMID = atoi(MID);
+    MID[n - 1] = '\0';
+    argDSSpan(request, "MID", MID);
+    span = beginDSSpan("checkNumberOfMsgsToRet");
     int numMsgsToRet = checkNumberOfMsgsToRet(GID, startMID);
+    endDSSpan(span);
+    if (numMsgsToRet == 0 && waitSecs > 0)
+    { // Park the request until a message is posted to the group or the wait time ends
+        delayTCPDeadline(waitSecs);
+        detachTCPConnection();
+        span = beginDSSpan("waitForGroupMessages");
+        if (waitForGroupMessages(GID, startMID, waitSecs))
+        {
+            numMsgsToRet = checkNumberOfMsgsToRet(GID, startMID);
+        }
+        endDSSpan(span);
+    }
     if (numMsgsToRet == -1)
     {
         sendDSStatusTCP(fd, RETRIEVE, "NOK");
@@ -906,11 +1272,799 @@ void retrieveMessagesFromGroup(int fd)
     // Send initial message
     char retrieveInitialStatus[DS_RETINITSTATUS_SIZE];
     sprintf(retrieveInitialStatus, "OK %d", numMsgsToRet);
-    sendDSStatusTCP(fd, RETRIEVE, retrieveInitialStatus);
+    span = beginDSSpan("reply");
+    sendDSReplyTCP(fd, RETRIEVE, retrieveInitialStatus);
+    endDSSpan(span);
     // Retrieve all requested messages
-    if (!retrieveDSGroupMessages(fd, GID, startMID, numMsgsToRet))
+    span = beginDSSpan("retrieveDSGroupMessages");
+    int retrieved = retrieveDSGroupMessages(fd, GID, startMID, numMsgsToRet, fileMode);
+    endDSSpan(span);
+    // The request is counted once, as NOK if it failed after its initial message
+    countDSStatus(RETRIEVE, retrieved ? "OK" : "NOK");
+    if (!retrieved)
     {
-        sendDSStatusTCP(fd, RETRIEVE, "NOK");
+        sendDSReplyTCP(fd, RETRIEVE, "NOK");
+        return;
+    }
+}
+
+void streamPostsToClient(int fd)
+{
+    // Read UID and check if it's a valid protocol message and a valid UID
+    char UID[CLIENT_UID_SIZE];
+    int n;
+    if ((n = readTCP(fd, UID, CLIENT_UID_SIZE)) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (UID[n - 1] != '\n')
+    { // Every request must end with a nl
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    UID[n - 1] = '\0';
+    if (!validUID(UID))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only logged in users can subscribe to the stream
+    enterDSStage(DS_STAGE_STORAGE);
+    char clientLoginPath[DS_CLIENTLOGINPATH_SIZE];
+    sprintf(clientLoginPath, "server/USERS/%s/%s_login.txt", UID, UID);
+    if (access(clientLoginPath, F_OK) != 0)
+    {
+        sendTCP(fd, "RPS NOK\n");
+        return;
+    }
+
+    // The stream stays open for as long as the client wants it
+    stopTCPDeadline();
+    detachTCPConnection();
+    if (!streamDSGroupPosts(fd, UID))
+    {
+        sendTCP(fd, "RPS NOK\n");
+    }
+}
+
+/**
+ * @brief Reads the rest of a request that ends with a nl and carries no data after it, aborting on a wrong protocol message.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param request buffer that will contain the request (without the nl).
+ * @param size size of the buffer.
+ */
+static void readRequestLine(int fd, char *request, int size)
+{
+    int len = 0;
+    while (len == 0 || request[len - 1] != '\n')
+    {
+        if (len == size - 1 || readTCP(fd, request + len, 1) != 1)
+        { // Tejo aborts on wrong protocol message
+            exit(EXIT_FAILURE);
+        }
+        len++;
+    }
+    request[len - 1] = '\0';
+    enterDSStage(DS_STAGE_STORAGE); // The whole request has arrived
+}
+
+void retrieveAllMessagesFromGroup(int fd)
+{
+    // Read the whole request (UID GID MID[ LastMID[ AuthorUID]])
+    char request[DS_RTSREQ_SIZE];
+    readRequestLine(fd, request, DS_RTSREQ_SIZE);
+    char *token, *tokenList[DS_RTSREQ_SIZE];
+    int numTokens = 0;
+    token = strtok(request, " ");
+    while (token)
+    {
+        tokenList[numTokens++] = token;
+        token = strtok(NULL, " ");
+    }
+    if (numTokens < 3 || numTokens > 5 || !validUID(tokenList[0]) || !validGID(tokenList[1]) || !validMID(tokenList[2]) ||
+        (numTokens >= 4 && !validMID(tokenList[3])) || (numTokens == 5 && !validUID(tokenList[4])))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(tokenList[0]))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!userSubscribedToGroup(tokenList[0], tokenList[1]))
+    {
+        sendDSStatusTCP(fd, RETRIEVE_ALL, "NOK");
+        return;
+    }
+
+    // The cursor streams the whole range (no 20 message cap) over this connection
+    MsgCursor cursor;
+    char MID[DS_MID_SIZE];
+    openMsgCursor(&cursor, tokenList[1], atoi(tokenList[2]), (numTokens >= 4) ? atoi(tokenList[3]) : INT_MAX,
+                  (numTokens == 5) ? tokenList[4] : "");
+    if (!nextCursorMessage(&cursor, MID))
+    {
+        sendDSStatusTCP(fd, RETRIEVE_ALL, "EOF");
+        return;
+    }
+    sendDSStatusTCP(fd, RETRIEVE_ALL, "OK");
+    if (!streamDSGroupMessages(fd, &cursor, MID))
+    { // Connection is dropped so that the client doesn't take a partial reply as complete
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Sends a binary reply frame without records.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param opcode opcode of the request being answered.
+ * @param status BIN_OK, BIN_NOK, BIN_EOF or BIN_ERR.
+ * @param fields buffer that contains the reply's fields (NULL if it has none).
+ * @param length number of bytes of fields.
+ */
+static void sendBinaryStatus(int fd, int opcode, int status, unsigned char *fields, int length)
+{
+    unsigned char reply[BIN_HEADER_SIZE + BIN_PSTREPLY_SIZE];
+    BinHeader h = {opcode, status, 0, length};
+    binPackHeader(reply, &h);
+    if (length > 0)
+    {
+        memcpy(reply + BIN_HEADER_SIZE, fields, length);
+    }
+    if (!sendData(fd, reply, BIN_HEADER_SIZE + length))
+    {
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Receives a known number of bytes of file data. The size is known upfront so the data is read
+ * in large chunks with no parsing at all.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param fileFd file descriptor of the file being written (-1 to discard the data).
+ * @param FSize number of bytes to receive.
+ * @param hashCtx digest the data is hashed into (NULL if it isn't hashed).
+ * @return 1 if every byte was written, 0 otherwise, -1 if the connection was lost.
+ */
+static int receiveFileData(int fd, int fileFd, long FSize, Sha256Ctx *hashCtx)
+{
+    int fileOk = (fileFd != -1);
+    char connBuf[DS_CONNBUF_SIZE];
+    while (FSize > 0)
+    {
+        int n = recvTCP(fd, connBuf, MIN(FSize, DS_CONNBUF_SIZE));
+        if (n <= 0)
+        {
+            return -1;
+        }
+        progressTCPDeadline();
+        if (fileOk && !writeFileData(fileFd, connBuf, n))
+        {
+            fileOk = 0;
+        }
+        if (hashCtx != NULL)
+        {
+            sha256Update(hashCtx, connBuf, n);
+        }
+        FSize -= n;
+    }
+    return fileOk;
+}
+
+/**
+ * @brief Posts a message in a DS group from a binary frame (record, text, file name and file data).
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param h header of the request.
+ */
+static void binaryPostInGroup(int fd, BinHeader *h)
+{
+    unsigned char fields[BIN_RECORD_SIZE + PROTOCOL_TEXT_SIZE + PROTOCOL_FNAME_SIZE];
+    if (h->length < BIN_RECORD_SIZE || h->length > BIN_RECORD_SIZE + (PROTOCOL_TEXT_SIZE - 1) + (PROTOCOL_FNAME_SIZE - 1))
+    {
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    if (readTCP(fd, (char *)fields, h->length) != h->length)
+    {
+        exit(EXIT_FAILURE);
+    }
+    BinRecord r;
+    binUnpackRecord(fields, &r);
+    char UID[CLIENT_UID_SIZE], GID[DS_GID_SIZE], Text[PROTOCOL_TEXT_SIZE], FName[PROTOCOL_FNAME_SIZE];
+    if (h->length != BIN_RECORD_SIZE + r.TSize + r.FNameLen || r.UID > 99999 || r.ID > 99 || r.TSize > PROTOCOL_TEXT_SIZE - 1 ||
+        r.FSize > BIN_MAX_FSIZE || (r.FNameLen == 0 && r.FSize > 0))
+    { // Wrong protocol message
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    // Both were checked to fit: the modulo only bounds the output for the compiler
+    snprintf(UID, CLIENT_UID_SIZE, "%05u", (unsigned int)r.UID % 100000);
+    snprintf(GID, DS_GID_SIZE, "%02u", (unsigned int)r.ID % 100);
+    memcpy(Text, fields + BIN_RECORD_SIZE, r.TSize);
+    Text[r.TSize] = '\0';
+    memcpy(FName, fields + BIN_RECORD_SIZE + r.TSize, r.FNameLen);
+    FName[r.FNameLen] = '\0';
+    if (!validGID(GID) || (r.FNameLen > 0 && !validFName(FName)))
+    {
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+
+    // Written aside like a text post, readers only see the message once it's complete
+    char stagePath[DS_GROUPSTAGEPATH_SIZE], stagedDir[DS_STAGEDMSGDIRPATH_SIZE];
+    int staged = stageGroupMessage(GID, UID, r.TSize, Text, stagePath, stagedDir);
+    int fileOk = 1;
+    if (r.FNameLen > 0)
+    {
+        extendTCPDeadline(r.FSize);
+        int fileFd = -1;
+        if (staged)
+        {
+            char stagedFilePath[DS_MSGFILEPATH_SIZE];
+            snprintf(stagedFilePath, DS_MSGFILEPATH_SIZE, "%s/%s", stagedDir, FName);
+            if ((fileFd = open(stagedFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+            {
+                perror("[-] Failed to create file");
+            }
+        }
+        Sha256Ctx hashCtx;
+        sha256Init(&hashCtx);
+        fileOk = receiveFileData(fd, fileFd, r.FSize, &hashCtx);
+        if (fileFd != -1 && close(fileFd) == -1 && fileOk == 1)
+        {
+            fileOk = 0;
+        }
+        if (fileOk == 1)
+        {
+            char hash[DS_HASH_SIZE];
+            sha256FinalHex(&hashCtx, hash);
+            fileOk = writeMessageHash(stagedDir, hash);
+        }
+        if (fileOk == -1)
+        { // Don't leave a message with a partial file behind
+            if (staged)
+            {
+                removeDirectory(stagePath);
+            }
+            exit(EXIT_FAILURE);
+        }
+        fileOk = fileOk && staged;
+    }
+    if (!staged)
+    {
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_NOK, NULL, 0);
+        return;
+    }
+    if (!fileOk || !userSubscribedToGroup(UID, GID))
+    { // Same as the text protocol: the subscription is only checked after the whole message arrived
+        removeDirectory(stagePath);
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_NOK, NULL, 0);
+        return;
+    }
+    int mid;
+    if (!commitGroupStage(GID, stagePath, 1, &mid))
+    {
+        sendBinaryStatus(fd, BIN_OP_POST, BIN_NOK, NULL, 0);
+        return;
+    }
+    char newMID[DS_MID_SIZE];
+    snprintf(newMID, DS_MID_SIZE, "%04u", (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+    logGroupPosts(GID, mid, 1);
+    notifyGroupPosts(GID, mid, 1);
+    unsigned char reply[BIN_PSTREPLY_SIZE];
+    binPut16(reply, mid);
+    sendBinaryStatus(fd, BIN_OP_POST, BIN_OK, reply, BIN_PSTREPLY_SIZE);
+}
+
+/**
+ * @brief Retrieves N (N <= 20) messages from a DS group for a binary frame (UID GID MID wait).
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param h header of the request.
+ */
+static void binaryRetrieveFromGroup(int fd, BinHeader *h)
+{
+    unsigned char fields[BIN_RTVREQ_SIZE];
+    if (h->length != BIN_RTVREQ_SIZE)
+    {
+        sendBinaryStatus(fd, BIN_OP_RETRIEVE, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    if (readTCP(fd, (char *)fields, BIN_RTVREQ_SIZE) != BIN_RTVREQ_SIZE)
+    {
+        exit(EXIT_FAILURE);
+    }
+    uint32_t uid = binGet32(fields);
+    uint16_t gid = binGet16(fields + 4), mid = binGet16(fields + 6), waitSecs = binGet16(fields + 8);
+    char UID[CLIENT_UID_SIZE], GID[DS_GID_SIZE];
+    if (uid > 99999 || gid > 99 || mid > 9999 || waitSecs > DS_RTV_MAX_WAIT)
+    {
+        sendBinaryStatus(fd, BIN_OP_RETRIEVE, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    // Both were checked to fit: the modulo only bounds the output for the compiler
+    snprintf(UID, CLIENT_UID_SIZE, "%05u", (unsigned int)uid % 100000);
+    snprintf(GID, DS_GID_SIZE, "%02u", (unsigned int)gid % 100);
+    if (!validGID(GID) || !admitUID(UID))
+    {
+        sendBinaryStatus(fd, BIN_OP_RETRIEVE, BIN_ERR, NULL, 0);
+        exit(EXIT_FAILURE);
+    }
+    if (!userSubscribedToGroup(UID, GID))
+    {
+        sendBinaryStatus(fd, BIN_OP_RETRIEVE, BIN_NOK, NULL, 0);
+        return;
+    }
+    int numMsgsToRet = checkNumberOfMsgsToRet(GID, mid);
+    if (numMsgsToRet == 0 && waitSecs > 0)
+    { // Park the request until a message is posted to the group or the wait time ends
+        delayTCPDeadline(waitSecs);
+        detachTCPConnection();
+        if (waitForGroupMessages(GID, mid, waitSecs))
+        {
+            numMsgsToRet = checkNumberOfMsgsToRet(GID, mid);
+        }
+    }
+    if (numMsgsToRet <= 0)
+    {
+        sendBinaryStatus(fd, BIN_OP_RETRIEVE, numMsgsToRet == 0 ? BIN_EOF : BIN_NOK, NULL, 0);
+        return;
+    }
+    if (!retrieveDSGroupMessagesBinary(fd, GID, mid, numMsgsToRet))
+    { // The records were already announced so the only way to report it is to drop the connection
+        exit(EXIT_FAILURE);
+    }
+}
+
+void clientBinarySession(int fd)
+{
+    // Handshake: BIN V\n is answered with RBN OK V\n if the DS speaks version V, RBN NOK V\n with its own version otherwise
+    char version[2];
+    if (readTCP(fd, version, 2) != 2 || version[1] != '\n')
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    char handshakeReply[DS_BINREPLY_SIZE];
+    if (version[0] != '0' + BIN_VERSION)
+    {
+        sprintf(handshakeReply, "RBN NOK %d\n", BIN_VERSION);
+        sendTCP(fd, handshakeReply);
+        return;
+    }
+    sprintf(handshakeReply, "RBN OK %d\n", BIN_VERSION);
+    if (sendTCP(fd, handshakeReply) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Frames follow one another on the same connection until the client closes it
+    unsigned char header[BIN_HEADER_SIZE];
+    BinHeader h;
+    while (1)
+    {
+        int n = readTCP(fd, (char *)header, BIN_HEADER_SIZE);
+        if (n == 0)
+        {
+            return;
+        }
+        if (n != BIN_HEADER_SIZE)
+        {
+            exit(EXIT_FAILURE);
+        }
+        binUnpackHeader(header, &h);
+        switch (h.opcode)
+        {
+        case BIN_OP_POST:
+            setTCPDeadlineCommand(POST);
+            binaryPostInGroup(fd, &h);
+            break;
+        case BIN_OP_RETRIEVE:
+            setTCPDeadlineCommand(RETRIEVE);
+            binaryRetrieveFromGroup(fd, &h);
+            break;
+        default:
+            sendBinaryStatus(fd, h.opcode, BIN_ERR, NULL, 0);
+            exit(EXIT_FAILURE);
+        }
+        startTCPDeadline(); // The next frame gets a fresh deadline
+    }
+}
+
+/**
+ * @brief Checks if a string is a file size or offset (1 to 10 digits).
+ *
+ * @param size string that contains the number.
+ * @return 1 if it's valid, 0 otherwise.
+ */
+static int validFileSize(char *size)
+{
+    return size[0] != '\0' && strlen(size) <= PROTOCOL_FILESZ_SIZE - 1 && isNumber(size);
+}
+
+void clientStartUpload(int fd)
+{
+    // Read the whole request (UID GID FName FSize TSize Text): the text goes last so it may have spaces
+    char request[DS_UPSREQ_SIZE];
+    readRequestLine(fd, request, DS_UPSREQ_SIZE);
+    char *tokenList[5];
+    char *p = request;
+    for (int i = 0; i < 5; ++i)
+    {
+        tokenList[i] = p;
+        if ((p = strchr(p, ' ')) == NULL)
+        {
+            sendTCP(fd, ERR_MSG);
+            exit(EXIT_FAILURE);
+        }
+        *p++ = '\0';
+    }
+    char *Text = p;
+    if (!validUID(tokenList[0]) || !validGID(tokenList[1]) || !validFName(tokenList[2]) || !validFileSize(tokenList[3]) ||
+        tokenList[4][0] == '\0' || strlen(tokenList[4]) > PROTOCOL_TEXTSZ_SIZE - 1 || !isNumber(tokenList[4]) ||
+        atoi(tokenList[4]) > PROTOCOL_TEXT_SIZE - 1 || strlen(Text) != (size_t)atoi(tokenList[4]))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(tokenList[0]))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    UploadSession upload;
+    strcpy(upload.UID, tokenList[0]);
+    strcpy(upload.GID, tokenList[1]);
+    strcpy(upload.FName, tokenList[2]);
+    upload.FSize = atol(tokenList[3]);
+    // Empty files don't need to be resumed so they're posted with PST
+    if (upload.FSize == 0 || !userSubscribedToGroup(upload.UID, upload.GID) || !createUploadSession(&upload, strlen(Text), Text))
+    {
+        sendDSStatusTCP(fd, UPLOAD_START, "NOK");
+        return;
+    }
+    char status[DS_UPLOADREPLY_SIZE];
+    sprintf(status, "OK %s", upload.SID);
+    sendDSStatusTCP(fd, UPLOAD_START, status);
+}
+
+void clientQueryUpload(int fd)
+{
+    // Read the whole request (UID SID)
+    char request[DS_UPQREQ_SIZE];
+    readRequestLine(fd, request, DS_UPQREQ_SIZE);
+    char UID[CLIENT_UID_SIZE], SID[DS_SID_SIZE], extra;
+    if (sscanf(request, "%5s %8s%c", UID, SID, &extra) != 2 || !validUID(UID))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    UploadSession upload;
+    long offset;
+    if (!loadUploadSession(&upload, UID, SID) || (offset = uploadedBytes(&upload)) == -1)
+    {
+        sendDSStatusTCP(fd, UPLOAD_QUERY, "NOK");
+        return;
+    }
+    char status[DS_UPLOADREPLY_SIZE];
+    sprintf(status, "OK %ld %ld", offset, upload.FSize);
+    sendDSStatusTCP(fd, UPLOAD_QUERY, status);
+}
+
+/**
+ * @brief Reads the header of a request that carries a range of an upload's file (UID SID Offset Len ).
+ * It's read one byte at a time so the data that follows isn't consumed.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param UID buffer that will contain the user ID.
+ * @param SID buffer that will contain the session ID.
+ * @param offset reference that will contain the offset of the range.
+ * @param dataLen reference that will contain the number of bytes of the range.
+ */
+static void readUploadRangeHeader(int fd, char *UID, char *SID, long *offset, long *dataLen)
+{
+    char header[DS_UPDHDR_SIZE];
+    int len = 0, numSpaces = 0;
+    while (numSpaces < 4)
+    {
+        if (len == DS_UPDHDR_SIZE - 1 || readTCP(fd, header + len, 1) != 1)
+        {
+            exit(EXIT_FAILURE);
+        }
+        numSpaces += (header[len++] == ' ');
+    }
+    header[len] = '\0';
+    char offsetBuf[PROTOCOL_FILESZ_SIZE], lenBuf[PROTOCOL_FILESZ_SIZE];
+    if (sscanf(header, "%5s %8s %10s %10s ", UID, SID, offsetBuf, lenBuf) != 4 || !validUID(UID) || !validFileSize(offsetBuf) ||
+        !validFileSize(lenBuf))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    *offset = atol(offsetBuf);
+    *dataLen = atol(lenBuf);
+    extendTCPDeadline(*dataLen);
+    enterDSStage(DS_STAGE_STORAGE); // The data is written as it arrives
+}
+
+void clientUploadData(int fd)
+{
+    char UID[CLIENT_UID_SIZE], SID[DS_SID_SIZE];
+    long offset, dataLen;
+    readUploadRangeHeader(fd, UID, SID, &offset, &dataLen);
+
+    // A resumed upload can't leave a gap nor go past the announced size. The data is still received so that
+    // the client gets the NOK
+    UploadSession upload;
+    int dataFd = -1;
+    if (loadUploadSession(&upload, UID, SID) && offset <= uploadedBytes(&upload) && offset + dataLen <= upload.FSize)
+    {
+        dataFd = openUploadData(&upload, offset);
+    }
+    int dataOk = receiveFileData(fd, dataFd, dataLen, NULL);
+    if (dataOk == -1)
+    { // Whatever arrived is kept: the client resumes from there
+        if (dataFd != -1)
+        {
+            fsync(dataFd);
+            close(dataFd);
+        }
+        exit(EXIT_FAILURE);
+    }
+    // The stored offset is only reported once the data is durable
+    if (dataFd != -1 && (fsync(dataFd) == -1 || close(dataFd) == -1))
+    {
+        dataOk = 0;
+    }
+    char nl;
+    if (readTCP(fd, &nl, 1) != 1 || nl != '\n')
+    { // Every request must end with a nl
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!dataOk)
+    {
+        sendDSStatusTCP(fd, UPLOAD_DATA, "NOK");
+        return;
+    }
+
+    char status[DS_UPLOADREPLY_SIZE];
+    if (offset + dataLen < upload.FSize)
+    {
+        sprintf(status, "OK %ld", offset + dataLen);
+        sendDSStatusTCP(fd, UPLOAD_DATA, status);
         return;
     }
-}
\ No newline at end of file
+    // The whole file is stored so the message is created in the group
+    char newMID[DS_MID_SIZE] = "";
+    if (!userSubscribedToGroup(upload.UID, upload.GID) || !commitUploadSession(&upload, newMID))
+    {
+        sendDSStatusTCP(fd, UPLOAD_DATA, "NOK");
+        return;
+    }
+    logGroupPosts(upload.GID, atoi(newMID), 1);
+    notifyGroupPosts(upload.GID, atoi(newMID), 1);
+    sprintf(status, "END %s", newMID);
+    sendDSStatusTCP(fd, UPLOAD_DATA, status);
+}
+
+/**
+ * @brief Receives a chunk of an upload's file and writes it at its offset. pwrite leaves the file offset
+ * alone, so the connections that write the other chunks never interfere with this one.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param fileFd file descriptor of the upload's file (-1 to discard the data).
+ * @param offset offset of the chunk in the file.
+ * @param len number of bytes of the chunk.
+ * @return 1 if every byte was written, 0 otherwise, -1 if the connection was lost.
+ */
+static int receiveChunkData(int fd, int fileFd, long offset, long len)
+{
+    int fileOk = (fileFd != -1);
+    char connBuf[DS_CONNBUF_SIZE];
+    while (len > 0)
+    {
+        int n = recvTCP(fd, connBuf, MIN(len, DS_CONNBUF_SIZE));
+        if (n <= 0)
+        {
+            return -1;
+        }
+        progressTCPDeadline();
+        for (int written = 0; fileOk && written < n;)
+        {
+            ssize_t w = pwrite(fileFd, connBuf + written, n - written, offset + written);
+            if (w == -1)
+            {
+                perror("[-] Failed to write on file");
+                fileOk = 0;
+                break;
+            }
+            written += w;
+        }
+        offset += n;
+        len -= n;
+    }
+    return fileOk;
+}
+
+void clientUploadChunk(int fd)
+{
+    char UID[CLIENT_UID_SIZE], SID[DS_SID_SIZE];
+    long offset, dataLen;
+    readUploadRangeHeader(fd, UID, SID, &offset, &dataLen);
+
+    // Chunks start at a multiple of the chunk size and only the last one may be shorter. The data is still
+    // received when the chunk is refused so that the client gets the NOK
+    UploadSession upload;
+    int dataFd = -1;
+    if (loadUploadSession(&upload, UID, SID) && offset % UPLOAD_CHUNK_SIZE == 0 && offset < upload.FSize &&
+        dataLen == MIN(UPLOAD_CHUNK_SIZE, upload.FSize - offset))
+    {
+        dataFd = openUploadChunks(&upload);
+    }
+    int dataOk = receiveChunkData(fd, dataFd, offset, dataLen);
+    if (dataOk == -1)
+    { // The chunk isn't marked so the client sends it again
+        if (dataFd != -1)
+        {
+            close(dataFd);
+        }
+        exit(EXIT_FAILURE);
+    }
+    // The chunk is only marked (and acknowledged) once its data is durable
+    if (dataFd != -1 && (fdatasync(dataFd) == -1 || close(dataFd) == -1))
+    {
+        dataOk = 0;
+    }
+    char nl;
+    if (readTCP(fd, &nl, 1) != 1 || nl != '\n')
+    { // Every request must end with a nl
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!dataOk || !markUploadChunk(&upload, offset / UPLOAD_CHUNK_SIZE))
+    {
+        sendDSStatusTCP(fd, UPLOAD_CHUNK, "NOK");
+        return;
+    }
+    sendDSStatusTCP(fd, UPLOAD_CHUNK, "OK");
+}
+
+void clientFinishUpload(int fd)
+{
+    // Read the whole request (UID SID)
+    char request[DS_UPQREQ_SIZE];
+    readRequestLine(fd, request, DS_UPQREQ_SIZE);
+    char UID[CLIENT_UID_SIZE], SID[DS_SID_SIZE], extra;
+    if (sscanf(request, "%5s %8s%c", UID, SID, &extra) != 2 || !validUID(UID))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    // The message is created once every chunk was acknowledged
+    UploadSession upload;
+    char newMID[DS_MID_SIZE] = "";
+    if (!loadUploadSession(&upload, UID, SID) || !uploadChunksComplete(&upload) || !userSubscribedToGroup(upload.UID, upload.GID) ||
+        !commitUploadSession(&upload, newMID))
+    {
+        sendDSStatusTCP(fd, UPLOAD_FINISH, "NOK");
+        return;
+    }
+    logGroupPosts(upload.GID, atoi(newMID), 1);
+    notifyGroupPosts(upload.GID, atoi(newMID), 1);
+    char status[DS_UPLOADREPLY_SIZE];
+    sprintf(status, "OK %s", newMID);
+    sendDSStatusTCP(fd, UPLOAD_FINISH, status);
+}
+
+void retrieveFileFromGroup(int fd)
+{
+    // Read the whole request (UID GID MID Offset Len)
+    char request[DS_RTFREQ_SIZE];
+    readRequestLine(fd, request, DS_RTFREQ_SIZE);
+    char UID[CLIENT_UID_SIZE], GID[DS_GID_SIZE], MID[DS_MID_SIZE], offsetBuf[PROTOCOL_FILESZ_SIZE], lenBuf[PROTOCOL_FILESZ_SIZE], extra;
+    if (sscanf(request, "%5s %2s %4s %10s %10s%c", UID, GID, MID, offsetBuf, lenBuf, &extra) != 5 || !validUID(UID) ||
+        !validGID(GID) || !isMID(MID) || !validMID(MID) || !validFileSize(offsetBuf) || !validFileSize(lenBuf))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!admitUID(UID))
+    { // User exceeded its rate
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (!userSubscribedToGroup(UID, GID))
+    {
+        sendDSStatusTCP(fd, RETRIEVE_FILE, "NOK");
+        return;
+    }
+    switch (retrieveDSGroupMessageFile(fd, GID, MID, atol(offsetBuf), atol(lenBuf)))
+    {
+    case 0:
+        sendDSStatusTCP(fd, RETRIEVE_FILE, "EOF");
+        break;
+    case -1:
+        sendDSStatusTCP(fd, RETRIEVE_FILE, "NOK");
+        break;
+    case -2: // Connection is dropped so that the client doesn't take a partial range as complete
+        exit(EXIT_FAILURE);
+    }
+}
+
+void replicateChanges(int fd)
+{
+    // Read the whole request (Offset)
+    char request[DS_RPLREQ_SIZE];
+    readRequestLine(fd, request, DS_RPLREQ_SIZE);
+    if (request[0] == '\0' || !isNumber(request) || strlen(request) > DS_RPLREQ_SIZE - 4)
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    if (dsReplication != REPLICATION_PRIMARY || !followerAllowed(fd))
+    { // There's no change log to ship (or not to this peer)
+        sendTCP(fd, "RRP NOK\n");
+        return;
+    }
+
+    // The follower stays connected for as long as it replicates this DS, without holding a connection slot
+    stopTCPDeadline();
+    detachTCPConnection();
+    if (!shipDSChanges(fd, atol(request)))
+    {
+        sendTCP(fd, "RRP NOK\n");
+    }
+}
+
+void dumpDSProfile(int fd)
+{
+    char request[DS_PRFREQ_SIZE];
+    readRequestLine(fd, request, DS_PRFREQ_SIZE);
+    if (strcmp(request, "DUMP"))
+    {
+        sendTCP(fd, ERR_MSG);
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *)&addr, &addrlen) == -1 || addr.sin_family != AF_INET || !profilerAllowed(addr.sin_addr))
+    {
+        sendDSStatusTCP(fd, PROFILE, "NOK");
+        return;
+    }
+    countDSStatus(PROFILE, "OK");
+    enterDSStage(DS_STAGE_SEND);
+    if (!sendDSProfile(fd))
+    {
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+}
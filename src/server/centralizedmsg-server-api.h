@@ -2,16 +2,28 @@
 #define SERVERAPI_H
 
 #include "ds-api/ds-operations.h"
+#include "ds-api/ds-pstparser.h"
+#include "ds-api/ds-deadline.h"
+#include "ds-api/ds-stats.h"
+#include "ds-api/ds-admission.h"
+#include "ds-api/ds-upload.h"
+#include "ds-api/ds-replication.h"
+#include "ds-api/ds-log.h"
+#include "ds-api/ds-profile.h"
 #include "../centralizedmsg-api.h"
 #include "../centralizedmsg-api-constants.h"
 
+/* Address of the client whose UDP request is being processed */
+extern struct in_addr clientAddrUDP;
+
 /**
  * @brief Process and exchange of messages between the client and the DS via UDP protocol.
  *
  * @param message string that contains the buffer the client sent to the DS.
- * @return char* string that contains the buffer that the DS will send to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes, reused for every request).
+ * @return char* string that contains the buffer that the DS will send to the client (reply).
  */
-char *processClientUDP(char *message);
+char *processClientUDP(char *message, char *reply);
 
 /**
  * @brief Process and exchange of messages between the client and the DS via TCP protocol.
@@ -21,76 +33,125 @@ char *processClientUDP(char *message);
  */
 void processClientTCP(int fd, char *command);
 
+/**
+ * @brief Applies a UDP request that a primary DS logged to this follower (writes aren't refused nor logged).
+ *
+ * @param message string that contains the request.
+ * @param reply buffer the reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* string that contains the reply the DS would send to the client (reply).
+ */
+char *replayClientUDP(char *message, char *reply);
+
 /**
  * @brief Registers a client in the DS.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientRegister(char **tokenList, int numTokens);
+char *clientRegister(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Unregisters a client from the DS.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientUnregister(char **tokenList, int numTokens);
+char *clientUnregister(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Logs a client in to the DS.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientLogin(char **tokenList, int numTokens);
+char *clientLogin(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Logs a client out from the DS.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientLogout(char **tokenList, int numTokens);
+char *clientLogout(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Lists all existing DS groups.
  *
+ * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *listDSGroups(int numTokens);
+char *listDSGroups(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Subscribes a client to an existing DS group or creates a new one.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientSubscribeGroup(char **tokenList, int numTokens);
+char *clientSubscribeGroup(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Unsubscribes a client from an existing DS group.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *clientUnsubscribeGroup(char **tokenList, int numTokens);
+char *clientUnsubscribeGroup(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Lists all groups that a given client is subscribed to.
  *
  * @param tokenList list that contains all the protocol message's arguments (including the message code).
  * @param numTokens number of command arguments.
- * @return char* containing the DS reply to the client.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
+ */
+char *listClientDSGroups(char **tokenList, int numTokens, char *reply);
+
+/**
+ * @brief Takes a snapshot of the DS counters.
+ *
+ * @param tokenList list that contains all the protocol message's arguments (including the message code).
+ * @param numTokens number of command arguments.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
+ */
+char *showDSStats(char **tokenList, int numTokens, char *reply);
+
+/**
+ * @brief Takes a snapshot of the latency histograms and status counts of every command (or of the one
+ * whose code follows LAT).
+ *
+ * @param tokenList list that contains all the protocol message's arguments (including the message code).
+ * @param numTokens number of command arguments.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
+ */
+char *showDSLatency(char **tokenList, int numTokens, char *reply);
+
+/**
+ * @brief Starts (PRF START [hz]) or stops (PRF STOP) the sampling profiler of the DS (only for admins, NOK otherwise).
+ *
+ * @param tokenList list that contains all the protocol message's arguments (including the message code).
+ * @param numTokens number of command arguments.
+ * @param reply buffer the DS reply is written to (DS_TO_CLIENT_UDP_SIZE bytes).
+ * @return char* containing the DS reply to the client (reply).
  */
-char *listClientDSGroups(char **tokenList, int numTokens);
+char *controlDSProfile(char **tokenList, int numTokens, char *reply);
 
 /**
  * @brief Lists all clients that are subscribed to a selected client group.
@@ -106,6 +167,13 @@ void showClientsInGroup(int fd);
  */
 void clientPostInGroup(int fd);
 
+/**
+ * @brief Posts a batch of client messages in a DS group with consecutive message IDs.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientPostBatchInGroup(int fd);
+
 /**
  * @brief Retrieves N (N <= 20) messages from a given DS group.
  *
@@ -113,4 +181,84 @@ void clientPostInGroup(int fd);
  */
 void retrieveMessagesFromGroup(int fd);
 
+/**
+ * @brief Keeps the connection open and pushes new posts in the client's subscribed groups as they're committed.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void streamPostsToClient(int fd);
+
+/**
+ * @brief Streams every message of a range of a DS group, optionally only those of a given author.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void retrieveAllMessagesFromGroup(int fd);
+
+/**
+ * @brief Negotiates the binary protocol version and serves binary frames (PST and RTV) until the client closes the connection.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientBinarySession(int fd);
+
+/**
+ * @brief Starts a resumable upload of a message with a file in a DS group and replies with its session ID.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientStartUpload(int fd);
+
+/**
+ * @brief Replies with the number of bytes of an upload that are stored (the offset it resumes from).
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientQueryUpload(int fd);
+
+/**
+ * @brief Stores a range of an upload's file and creates its message once the whole file is stored.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientUploadData(int fd);
+
+/**
+ * @brief Stores a chunk of an upload's file at its offset. The chunks of an upload may arrive in any order
+ * over several connections at once.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientUploadChunk(int fd);
+
+/**
+ * @brief Creates the message of an upload sent in chunks once every chunk is stored.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void clientFinishUpload(int fd);
+
+/**
+ * @brief Sends a byte range of the file attached to a DS group message so that downloads can be resumed.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void retrieveFileFromGroup(int fd);
+
+/**
+ * @brief Ships the change log of a primary DS to a follower from the offset it asks for, for as long as
+ * the follower stays connected.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void replicateChanges(int fd);
+
+/**
+ * @brief Sends the stack samples taken by the profiler as folded stacks, ready for a flame graph (PRF DUMP).
+ * Only admins get them, others get RPF NOK.
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ */
+void dumpDSProfile(int fd);
+
 #endif
\ No newline at end of file
@@ -7,20 +7,54 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <arpa/inet.h>
+
+/* Usage of the DS program */
+#define DS_USAGE "./DS [-p DSport] [-v] [-L error|warn|info|debug] [-S sampleRate] [-t traceFile [-T slowMsec]] [-i IPrate] [-u UIDrate] [-g UDPrate] [-c maxTCPconns] [-R routerIP]... [-a adminIP]... [-l [-r followerIP]... | -f primaryIP:primaryPort] [-s shard/numShards]"
 
 /**
- * @brief Parses the program's arguments for the DS port and verbose mode.
+ * @brief Parses the program's arguments for the DS port, log level and sampling, tracing, admission control limits
+ * (and exempt routers), replication role (and followers) and shard.
  *
  * @param argc number of arguments (including the executable) given.
  * @param argv arguments given.
  */
 static void parseArgs(int argc, char *argv[]);
 
+/* Path of the file the spans of traced requests are written to (NULL while tracing is off) */
+static char *tracePath;
+
 int main(int argc, char *argv[])
 {
     parseArgs(argc, argv);
+    setupDSStats(); // Counters must be shared by every process so map them before forking
+    setupDSLog();
+    setupDSProfile();
+    if (tracePath != NULL)
+    {
+        setupDSTrace(tracePath);
+    }
+    setupDSAdmission();
     setupDSSockets();
     fillDSGroupsInfo();
+    hashStoredPasswords();
+    setupDSUploads();
+    setupDSNotify();
+    setupDSReplication();
+    if (dsReplication == REPLICATION_FOLLOWER)
+    { // A separate process applies the primary's changes while the DS serves reads
+        pid_t follower = fork();
+        if (follower == 0)
+        {
+            followPrimaryDS(replayClientUDP);
+        }
+        else if (follower == -1)
+        {
+            perror("[-] Failed to fork");
+            exit(EXIT_FAILURE);
+        }
+    }
+    setupDSStop();
     // Have 2 separate processes handling different operations
     pid_t pid = fork();
     if (pid == 0)
@@ -39,25 +73,153 @@ int main(int argc, char *argv[])
     exit(EXIT_SUCCESS);
 }
 
-static void parseArgs(int argc, char *argv[])
+/**
+ * @brief Parses a non negative admission control limit.
+ *
+ * @param value string that contains the limit.
+ * @return the limit.
+ */
+static long parseLimit(char *value)
+{
+    if (value == NULL || value[0] == '\0' || !isNumber(value) || strlen(value) > 9)
+    {
+        fprintf(stderr, "[-] Invalid admission control limit given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    return atol(value);
+}
+
+/**
+ * @brief Parses the address of a router, which is exempt from the per-IP limit.
+ *
+ * @param value string that contains the IP address.
+ */
+static void parseRouter(char *value)
+{
+    if (value == NULL || admissionConfig.numExemptAddrs == DS_MAX_EXEMPT_ADDRS ||
+        inet_pton(AF_INET, value, &admissionConfig.exemptAddrs[admissionConfig.numExemptAddrs]) != 1)
+    {
+        fprintf(stderr, "[-] Invalid router given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    admissionConfig.numExemptAddrs++;
+}
+
+/**
+ * @brief Parses the address of an admin, which may use PRF besides the loopback addresses.
+ *
+ * @param value string that contains the IP address.
+ */
+static void parseAdmin(char *value)
+{
+    if (value == NULL || numAdminAddrsDS == DS_MAX_ADMIN_ADDRS || inet_pton(AF_INET, value, &adminAddrsDS[numAdminAddrsDS]) != 1)
+    {
+        fprintf(stderr, "[-] Invalid admin given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    numAdminAddrsDS++;
+}
+
+/**
+ * @brief Parses the level of the DS log.
+ *
+ * @param value string that contains the level name.
+ * @return the level.
+ */
+static int parseLogLevel(char *value)
+{
+    const char *names[] = {"error", "warn", "info", "debug"};
+    for (int level = DS_LOG_ERROR; value != NULL && level <= DS_LOG_DEBUG; ++level)
+    {
+        if (!strcmp(value, names[level]))
+        {
+            return level;
+        }
+    }
+    fprintf(stderr, "[-] Invalid DS log level given. Usage: %s\n", DS_USAGE);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the address of the primary DS a follower replicates (primaryIP:primaryPort).
+ *
+ * @param value string that contains the address.
+ */
+static void parsePrimary(char *value)
 {
-    if (!(argc == 1 || argc == 2 || argc == 3 || argc == 4))
+    char *sep = (value != NULL) ? strrchr(value, ':') : NULL;
+    if (sep == NULL || dsReplication == REPLICATION_PRIMARY)
     {
-        fprintf(stderr, "[-] Invalid client program arguments. Usage: ./DS [-p DSport] [-v]\n");
+        fprintf(stderr, "[-] Invalid primary DS given. Usage: %s\n", DS_USAGE);
         exit(EXIT_FAILURE);
     }
+    *sep = '\0';
+    if (strlen(value) >= DS_ADDR_SIZE || !validAddress(value) || !validPort(sep + 1))
+    {
+        fprintf(stderr, "[-] Invalid primary DS given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(primaryAddrDS, value);
+    strcpy(primaryPortDS, sep + 1);
+    dsReplication = REPLICATION_FOLLOWER;
+}
+
+/**
+ * @brief Parses the address of a follower a primary ships its changes to.
+ *
+ * @param value string that contains the IP address.
+ */
+static void parseFollower(char *value)
+{
+    if (value == NULL || numFollowerAddrsDS == DS_MAX_FOLLOWER_ADDRS || inet_pton(AF_INET, value, &followerAddrsDS[numFollowerAddrsDS]) != 1)
+    {
+        fprintf(stderr, "[-] Invalid follower DS given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    numFollowerAddrsDS++;
+}
+
+/**
+ * @brief Parses the shard of the groups this DS holds (shard/numShards, shards numbered from 0).
+ *
+ * @param value string that contains the shard.
+ */
+static void parseShard(char *value)
+{
+    char *sep = (value != NULL) ? strchr(value, '/') : NULL;
+    if (sep == NULL || sep == value || sep - value > 2 || sep[1] == '\0' || strlen(sep + 1) > 2)
+    {
+        fprintf(stderr, "[-] Invalid DS shard given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    char shard[DS_GID_SIZE] = "";
+    strncpy(shard, value, sep - value);
+    if (!isNumber(shard) || !isNumber(sep + 1) || atoi(sep + 1) < 1 || atoi(sep + 1) > DS_MAX_SHARDS || atoi(shard) >= atoi(sep + 1))
+    {
+        fprintf(stderr, "[-] Invalid DS shard given. Usage: %s\n", DS_USAGE);
+        exit(EXIT_FAILURE);
+    }
+    dsShardIndex = atoi(shard);
+    dsNumShards = atoi(sep + 1);
+}
+
+static void parseArgs(int argc, char *argv[])
+{
     for (int i = 1; i <= argc - 1; ++i)
     {
-        if (argv[i][0] != '-')
-        { // If it's not a flag ignore
-            continue;
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+        {
+            fprintf(stderr, "[-] Invalid DS program arguments. Usage: %s\n", DS_USAGE);
+            exit(EXIT_FAILURE);
         }
-        switch (argv[i][1])
+        char flag = argv[i][1];
+        char *value = (flag == 'v' || flag == 'l') ? NULL : argv[++i]; // Every flag but -v and -l takes a value
+        switch (flag)
         {
         case 'p':
-            if (validPort(argv[i + 1]))
+            if (value != NULL && validPort(value))
             {
-                strcpy(portDS, argv[i + 1]);
+                strcpy(portDS, value);
             }
             else
             {
@@ -66,19 +228,73 @@ static void parseArgs(int argc, char *argv[])
             }
             break;
         case 'v':
-            if (argc == 2 || argc == 4)
+            dsLogLevel = DS_LOG_INFO;
+            break;
+        case 'L':
+            dsLogLevel = parseLogLevel(value);
+            break;
+        case 't':
+            if (value == NULL)
             {
-                verbose = VERBOSE_ON;
+                fprintf(stderr, "[-] No DS trace file given. Usage: %s\n", DS_USAGE);
+                exit(EXIT_FAILURE);
             }
-            else
+            tracePath = value;
+            break;
+        case 'T':
+            if (value == NULL || value[0] == '\0' || !isNumber(value) || strlen(value) > 9)
+            { // Only requests slower than this many milliseconds are traced
+                fprintf(stderr, "[-] Invalid DS trace threshold given. Usage: %s\n", DS_USAGE);
+                exit(EXIT_FAILURE);
+            }
+            dsTraceSlowMsec = atol(value);
+            break;
+        case 'S':
+            if (value == NULL || value[0] == '\0' || !isNumber(value) || strlen(value) > 9 || atoi(value) == 0)
+            { // Logs 1 in every sampleRate requests
+                fprintf(stderr, "[-] Invalid DS log sampling given. Usage: %s\n", DS_USAGE);
+                exit(EXIT_FAILURE);
+            }
+            dsLogSample = atoi(value);
+            break;
+        case 'i':
+            admissionConfig.ipRate = parseLimit(value);
+            break;
+        case 'u':
+            admissionConfig.uidRate = parseLimit(value);
+            break;
+        case 'g':
+            admissionConfig.udpRate = parseLimit(value);
+            break;
+        case 'c':
+            admissionConfig.maxTCPConns = parseLimit(value);
+            break;
+        case 'R':
+            parseRouter(value);
+            break;
+        case 'a':
+            parseAdmin(value);
+            break;
+        case 'l':
+            if (dsReplication == REPLICATION_FOLLOWER)
             {
-                fprintf(stderr, "[-] Verbose mode doesn't take any arguments. Usage: ./DS [-p DSport] [-v]\n");
+                fprintf(stderr, "[-] A DS can't be a primary and a follower. Usage: %s\n", DS_USAGE);
                 exit(EXIT_FAILURE);
             }
+            dsReplication = REPLICATION_PRIMARY;
+            break;
+        case 'r':
+            parseFollower(value);
+            break;
+        case 'f':
+            parsePrimary(value);
+            break;
+        case 's':
+            parseShard(value);
             break;
         default:
-            fprintf(stderr, "[-] Invalid flag given. Usage: ./DS [-p DSport] [-v]\n");
+            fprintf(stderr, "[-] Invalid flag given. Usage: %s\n", DS_USAGE);
             exit(EXIT_FAILURE);
         }
     }
-}
\ No newline at end of file
+}
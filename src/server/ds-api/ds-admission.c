@@ -0,0 +1,263 @@
+#include "ds-admission.h"
+#include "ds-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* Struct that keeps the token bucket of a client */
+typedef struct tokenbucket
+{
+    unsigned long key; // IP address or UID plus one (0 = free slot)
+    long tokens;       // in thousandths of a token
+    long lastRefill;   // in microseconds (CLOCK_MONOTONIC)
+} TokenBucket;
+
+/* Struct that keeps every token bucket. It lives in shared memory so that the UDP process,
+ * the TCP process and every TCP connection process charge the same buckets */
+typedef struct admissiontables
+{
+    char lock;
+    TokenBucket udpBucket;
+    TokenBucket ipBuckets[DS_ADMISSION_TABLE_SIZE];
+    TokenBucket uidBuckets[DS_ADMISSION_TABLE_SIZE];
+    int numLongLived;                          // long-lived connection processes not counted against the limit
+    pid_t longLived[DS_MAX_LONG_LIVED_CONNS]; // their PIDs (0 = free slot)
+} AdmissionTables;
+
+AdmissionConfig admissionConfig = {DS_DEFAULT_IP_RATE, DS_DEFAULT_UID_RATE, DS_DEFAULT_UDP_RATE, DS_DEFAULT_MAX_TCP_CONNS};
+
+static AdmissionTables *tables;
+
+/* Number of TCP connection processes that weren't reaped yet (only used by the TCP process) */
+static int activeTCPConns = 0;
+
+/* 1 once the calling TCP connection process stopped counting against the connection limit */
+static int detached = 0;
+
+void setupDSAdmission()
+{
+    tables = mmap(NULL, sizeof(AdmissionTables), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (tables == MAP_FAILED)
+    {
+        perror("[-] Failed to map DS token buckets");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Gets the current time in microseconds.
+ *
+ * @return current CLOCK_MONOTONIC time in microseconds.
+ */
+static long nowUsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Locks the token buckets. The deadline signal is blocked so that a connection process
+ * can't die while holding the lock.
+ *
+ * @param oldMask signal mask to be restored by unlockTables.
+ */
+static void lockTables(sigset_t *oldMask)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, oldMask);
+    while (__atomic_test_and_set(&tables->lock, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Unlocks the token buckets.
+ *
+ * @param oldMask signal mask saved by lockTables.
+ */
+static void unlockTables(sigset_t *oldMask)
+{
+    __atomic_clear(&tables->lock, __ATOMIC_RELEASE);
+    sigprocmask(SIG_SETMASK, oldMask, NULL);
+}
+
+/**
+ * @brief Refills a token bucket and takes a token from it. Must be called with the lock held.
+ *
+ * @param b token bucket.
+ * @param rate number of tokens added per second.
+ * @return 1 if a token was taken, 0 if the bucket is empty.
+ */
+static int takeToken(TokenBucket *b, long rate)
+{
+    long now = nowUsec();
+    long capacity = rate * DS_ADMISSION_BURST * 1000;
+    long elapsed = MIN(now - b->lastRefill, DS_ADMISSION_BURST * 1000000L);
+    b->tokens = (b->lastRefill == 0) ? capacity : MIN(capacity, b->tokens + elapsed * rate / 1000);
+    b->lastRefill = now;
+    if (b->tokens < 1000)
+    {
+        return 0;
+    }
+    b->tokens -= 1000;
+    return 1;
+}
+
+/**
+ * @brief Finds the token bucket of a client. If it has none a free slot is used or,
+ * when all probed slots are taken, the least recently used one is recycled.
+ *
+ * @param table table of token buckets.
+ * @param key IP address or UID of the client.
+ * @return token bucket of the client.
+ */
+static TokenBucket *findBucket(TokenBucket *table, unsigned long key)
+{
+    key += 1;
+    unsigned long hash = key * 2654435761UL;
+    TokenBucket *oldest = NULL;
+    for (int i = 0; i < DS_ADMISSION_PROBES; ++i)
+    {
+        TokenBucket *b = &table[(hash + i) % DS_ADMISSION_TABLE_SIZE];
+        if (b->key == key)
+        {
+            return b;
+        }
+        if (b->key == 0)
+        {
+            oldest = b;
+            break;
+        }
+        if (oldest == NULL || b->lastRefill < oldest->lastRefill)
+        {
+            oldest = b;
+        }
+    }
+    oldest->key = key;
+    oldest->lastRefill = 0; // starts with a full bucket
+    return oldest;
+}
+
+/**
+ * @brief Takes a token from the bucket of a client.
+ *
+ * @param table table of token buckets.
+ * @param key IP address or UID of the client.
+ * @param rate number of requests per second the client is allowed.
+ * @param rejected counter of rejected requests.
+ * @return 1 if the request is admitted, 0 otherwise.
+ */
+static int admitKey(TokenBucket *table, unsigned long key, long rate, unsigned long *rejected)
+{
+    if (rate <= 0)
+    {
+        return 1;
+    }
+    sigset_t oldMask;
+    lockTables(&oldMask);
+    int ok = takeToken(table ? findBucket(table, key) : &tables->udpBucket, rate);
+    unlockTables(&oldMask);
+    if (!ok)
+    {
+        incrementDSStat(rejected);
+    }
+    return ok;
+}
+
+int admitUDPLoad()
+{
+    return admitKey(NULL, 0, admissionConfig.udpRate, &dsStats->shedUDP);
+}
+
+int admitIP(struct in_addr addr)
+{
+    for (int i = 0; i < admissionConfig.numExemptAddrs; ++i)
+    {
+        if (admissionConfig.exemptAddrs[i].s_addr == addr.s_addr)
+        { // The per-UID limit still applies to the clients behind a router
+            return 1;
+        }
+    }
+    return admitKey(tables->ipBuckets, ntohl(addr.s_addr), admissionConfig.ipRate, &dsStats->rejectedIP);
+}
+
+int admitUID(const char *UID)
+{
+    return admitKey(tables->uidBuckets, strtoul(UID, NULL, 10), admissionConfig.uidRate, &dsStats->rejectedUID);
+}
+
+/**
+ * @brief Forgets a reaped TCP connection process if it was a long-lived one.
+ *
+ * @param pid PID of the reaped process.
+ */
+static void reapedTCPConnection(pid_t pid)
+{
+    sigset_t oldMask;
+    lockTables(&oldMask);
+    for (int i = 0; i < DS_MAX_LONG_LIVED_CONNS && tables->numLongLived > 0; ++i)
+    {
+        if (tables->longLived[i] == pid)
+        {
+            tables->longLived[i] = 0;
+            tables->numLongLived--;
+            break;
+        }
+    }
+    unlockTables(&oldMask);
+}
+
+int admitTCPConnection(struct in_addr addr)
+{
+    pid_t pid;
+    while (activeTCPConns > 0 && (pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    {
+        activeTCPConns--;
+        reapedTCPConnection(pid);
+    }
+    __atomic_store_n(&dsStats->activeTCPConns, activeTCPConns, __ATOMIC_RELAXED);
+    int served = activeTCPConns - __atomic_load_n(&tables->numLongLived, __ATOMIC_RELAXED);
+    if (admissionConfig.maxTCPConns > 0 && served >= admissionConfig.maxTCPConns)
+    { // DS is saturated so shed the connection before forking
+        incrementDSStat(&dsStats->shedTCP);
+        return 0;
+    }
+    return admitIP(addr);
+}
+
+void startedTCPConnection()
+{
+    activeTCPConns++;
+    __atomic_store_n(&dsStats->activeTCPConns, activeTCPConns, __ATOMIC_RELAXED);
+}
+
+void detachTCPConnection()
+{
+    if (detached)
+    {
+        return;
+    }
+    sigset_t oldMask;
+    lockTables(&oldMask);
+    for (int i = 0; i < DS_MAX_LONG_LIVED_CONNS; ++i)
+    {
+        if (tables->longLived[i] == 0)
+        {
+            tables->longLived[i] = getpid();
+            tables->numLongLived++;
+            detached = 1;
+            break;
+        }
+    }
+    unlockTables(&oldMask);
+}
@@ -0,0 +1,73 @@
+#ifndef DS_ADMISSION_H
+#define DS_ADMISSION_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <netinet/in.h>
+
+/* Struct that keeps the DS admission control limits (0 disables a limit) */
+typedef struct admissionconfig
+{
+    long ipRate;     // requests per second accepted from each IP address
+    long uidRate;    // requests per second accepted from each UID
+    long udpRate;    // UDP requests per second served before shedding load
+    int maxTCPConns; // TCP connections served at the same time
+    struct in_addr exemptAddrs[DS_MAX_EXEMPT_ADDRS]; // routers, whose requests come from many clients
+    int numExemptAddrs;
+} AdmissionConfig;
+
+/* Variable that contains the DS admission control limits */
+extern AdmissionConfig admissionConfig;
+
+/**
+ * @brief Maps the token buckets in shared memory. Must be called before the DS forks.
+ *
+ */
+void setupDSAdmission();
+
+/**
+ * @brief Checks if the DS still has capacity to serve another UDP request.
+ *
+ * @return 1 if the request can be served, 0 if it must be shed.
+ */
+int admitUDPLoad();
+
+/**
+ * @brief Takes a token from the bucket of an IP address (routers given with -R aren't limited).
+ *
+ * @param addr IP address of the client.
+ * @return 1 if the request is admitted, 0 if the client exceeded its rate.
+ */
+int admitIP(struct in_addr addr);
+
+/**
+ * @brief Takes a token from the bucket of a UID.
+ *
+ * @param UID string that contains a valid user ID.
+ * @return 1 if the request is admitted, 0 if the user exceeded its rate.
+ */
+int admitUID(const char *UID);
+
+/**
+ * @brief Reaps finished TCP connection processes and checks if a new connection can be served.
+ * Must only be called by the process that accepts the TCP connections.
+ *
+ * @param addr IP address of the client.
+ * @return 1 if the connection is admitted, 0 if it must be refused.
+ */
+int admitTCPConnection(struct in_addr addr);
+
+/**
+ * @brief Accounts for a TCP connection process that was just forked.
+ *
+ */
+void startedTCPConnection();
+
+/**
+ * @brief Stops counting the calling TCP connection process against the connection limit, once its connection
+ * turned into a long-lived one (push stream, retrieve waiting for new messages or replica follower).
+ * Past DS_MAX_LONG_LIVED_CONNS such connections the rest keep counting.
+ *
+ */
+void detachTCPConnection();
+
+#endif
@@ -0,0 +1,143 @@
+#include "ds-arena.h"
+#include "ds-stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+Arena dsArena;
+
+/**
+ * @brief Rounds a size up to the arena alignment.
+ *
+ * @param size number of bytes.
+ * @return size rounded up to a multiple of DS_ARENA_ALIGN.
+ */
+static size_t alignArenaSize(size_t size)
+{
+    return (size + DS_ARENA_ALIGN - 1) & ~((size_t)DS_ARENA_ALIGN - 1);
+}
+
+/**
+ * @brief Creates a new block for an arena and makes it the current one.
+ *
+ * @param a arena that needs the block.
+ * @param size minimum number of bytes the block must hold.
+ * @return 1 if the block was created, 0 otherwise.
+ */
+static int addArenaBlock(Arena *a, size_t size)
+{
+    size_t blockSize = MAX(size, DS_ARENA_BLOCK_SIZE);
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + blockSize);
+    if (block == NULL)
+    {
+        return 0;
+    }
+    block->next = NULL;
+    block->size = blockSize;
+    block->used = 0;
+    if (a->first == NULL)
+    {
+        a->first = block;
+    }
+    else
+    { // The command outgrew the first block
+        a->current->next = block;
+        if (dsStats != NULL)
+        {
+            incrementDSStat(&dsStats->arenaOverflows);
+        }
+    }
+    a->current = block;
+    return 1;
+}
+
+void *arenaAlloc(Arena *a, size_t size)
+{
+    size = alignArenaSize(size);
+    if (a->current == NULL || a->current->size - a->current->used < size)
+    {
+        if (!addArenaBlock(a, size))
+        {
+            return NULL;
+        }
+    }
+    void *ptr = a->current->data + a->current->used;
+    a->current->used += size;
+    a->used += size;
+    return ptr;
+}
+
+void *arenaGrow(Arena *a, void *ptr, size_t oldSize, size_t newSize)
+{
+    ArenaBlock *block = a->current;
+    oldSize = alignArenaSize(oldSize);
+    newSize = alignArenaSize(newSize);
+    if (ptr != NULL && (char *)ptr + oldSize == block->data + block->used && newSize - oldSize <= block->size - block->used)
+    { // Last allocation of the block: just bump it
+        block->used += newSize - oldSize;
+        a->used += newSize - oldSize;
+        return ptr;
+    }
+    void *grown = arenaAlloc(a, newSize);
+    if (grown != NULL && ptr != NULL)
+    {
+        memcpy(grown, ptr, oldSize);
+    }
+    return grown;
+}
+
+ArenaMark arenaMark(Arena *a)
+{
+    ArenaMark mark;
+    mark.block = a->current;
+    mark.blockUsed = (a->current != NULL) ? a->current->used : 0;
+    mark.used = a->used;
+    return mark;
+}
+
+/**
+ * @brief Frees every block after a given one.
+ *
+ * @param block last block kept.
+ */
+static void freeArenaBlocksAfter(ArenaBlock *block)
+{
+    ArenaBlock *next = block->next;
+    block->next = NULL;
+    while (next != NULL)
+    {
+        ArenaBlock *b = next;
+        next = b->next;
+        free(b);
+    }
+}
+
+void arenaRewind(Arena *a, ArenaMark mark)
+{
+    if (mark.block == NULL)
+    { // Nothing was allocated when the mark was taken
+        arenaReset(a);
+        return;
+    }
+    freeArenaBlocksAfter(mark.block);
+    mark.block->used = mark.blockUsed;
+    a->current = mark.block;
+    a->used = mark.used;
+}
+
+void arenaReset(Arena *a)
+{
+    if (a->first == NULL)
+    {
+        return;
+    }
+    if (dsStats != NULL)
+    { // Keep the highest number of bytes a single command needed
+        unsigned long high = __atomic_load_n(&dsStats->arenaHighWater, __ATOMIC_RELAXED);
+        while (a->used > high && !__atomic_compare_exchange_n(&dsStats->arenaHighWater, &high, a->used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    freeArenaBlocksAfter(a->first);
+    a->first->used = 0;
+    a->current = a->first;
+    a->used = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef DS_ARENA_H
+#define DS_ARENA_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <stddef.h>
+
+/* Struct that keeps a block of memory of an arena (the first one is kept for the whole life of the process) */
+typedef struct arenablock
+{
+    struct arenablock *next;
+    size_t size; // number of bytes in data
+    size_t used; // number of bytes of data already handed out
+    char data[];
+} ArenaBlock;
+
+/* Struct that keeps a bump allocator: every allocation of a command comes from it and all of them are
+ * released at once when the command ends, so an early return can't leak */
+typedef struct arena
+{
+    ArenaBlock *first;   // block reused by every command
+    ArenaBlock *current; // block allocations are taken from (first or the last overflow block)
+    size_t used;         // bytes handed out since the last reset (over every block)
+} Arena;
+
+/* Struct that marks a point of an arena that can be rewound to */
+typedef struct arenamark
+{
+    ArenaBlock *block;
+    size_t blockUsed;
+    size_t used;
+} ArenaMark;
+
+/* Arena of the current request: UDP requests and TCP connections allocate from it */
+extern Arena dsArena;
+
+/**
+ * @brief Allocates memory from an arena. It's only released when the arena is reset (or rewound).
+ *
+ * @param a arena to allocate from.
+ * @param size number of bytes needed.
+ * @return reference to the memory (aligned to DS_ARENA_ALIGN), NULL if the system ran out of memory.
+ */
+void *arenaAlloc(Arena *a, size_t size);
+
+/**
+ * @brief Grows the last allocation of an arena in place when it fits, otherwise moves it to a bigger one.
+ *
+ * @param a arena the memory was allocated from.
+ * @param ptr reference to the memory (NULL allocates new memory).
+ * @param oldSize number of bytes of the current allocation.
+ * @param newSize number of bytes needed.
+ * @return reference to the grown memory (with the old bytes preserved), NULL if the system ran out of memory.
+ */
+void *arenaGrow(Arena *a, void *ptr, size_t oldSize, size_t newSize);
+
+/**
+ * @brief Marks the current point of an arena so that everything allocated after it can be released.
+ *
+ * @param a arena to mark.
+ * @return mark of the current point.
+ */
+ArenaMark arenaMark(Arena *a);
+
+/**
+ * @brief Releases everything allocated from an arena since a mark.
+ *
+ * @param a arena to rewind.
+ * @param mark mark taken with arenaMark.
+ */
+void arenaRewind(Arena *a, ArenaMark mark);
+
+/**
+ * @brief Releases every allocation of an arena (the first block is kept for the next command) and records
+ * the high-water mark of the command in the DS counters.
+ *
+ * @param a arena to reset.
+ */
+void arenaReset(Arena *a);
+
+#endif
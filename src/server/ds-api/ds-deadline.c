@@ -0,0 +1,139 @@
+#include "ds-deadline.h"
+#include "ds-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* Command being served by the current TCP connection */
+static volatile sig_atomic_t deadlineCommand = 0;
+
+/* Absolute deadline of the current TCP connection (CLOCK_MONOTONIC) */
+static struct timespec deadline;
+
+/* Set while the current TCP connection transfers data, which must then keep moving until transferEnd */
+static int transferring = 0;
+static struct timespec transferEnd;
+
+/* Second (CLOCK_MONOTONIC) the deadline was last moved by progress, it's moved at most once per second */
+static time_t progressSec;
+
+/**
+ * @brief Drops the TCP connection once its deadline expires.
+ *
+ * @param sig signal number.
+ */
+static void deadlineExpired(int sig)
+{
+    incrementDSStat(&dsStats->tcpTimeouts[deadlineCommand]);
+    _exit(EXIT_FAILURE); // closes the connection
+}
+
+/**
+ * @brief Programs the process interval timer to fire at the current deadline.
+ *
+ */
+static void armDeadline()
+{
+    struct timespec now;
+    struct itimerval timer;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memset(&timer, 0, sizeof(timer));
+    long remainingUsec = (deadline.tv_sec - now.tv_sec) * 1000000L + (deadline.tv_nsec - now.tv_nsec) / 1000;
+    if (remainingUsec <= 0)
+    { // A zero timer would disarm it
+        remainingUsec = 1;
+    }
+    timer.it_value.tv_sec = remainingUsec / 1000000L;
+    timer.it_value.tv_usec = remainingUsec % 1000000L;
+    if (setitimer(ITIMER_REAL, &timer, NULL) == -1)
+    {
+        perror("[-] Failed to arm TCP connection deadline");
+        _exit(EXIT_FAILURE);
+    }
+}
+
+void startTCPDeadline()
+{
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = deadlineExpired;
+    sigemptyset(&act.sa_mask);
+    if (sigaction(SIGALRM, &act, NULL) == -1)
+    {
+        perror("[-] Failed to set TCP deadline handler");
+        exit(EXIT_FAILURE);
+    }
+    deadlineCommand = 0;
+    transferring = 0;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += DS_TCP_HEADER_TIMEOUT;
+    armDeadline();
+}
+
+void setTCPDeadlineCommand(int command)
+{
+    deadlineCommand = (command > 0 && command < DS_STATS_NUM_COMMANDS) ? command : 0;
+}
+
+/**
+ * @brief Moves the deadline of a transfer to TCP_TIMEOUT seconds from now, without going past the transfer's end.
+ *
+ * @param now current time (CLOCK_MONOTONIC).
+ */
+static void idleDeadline(struct timespec *now)
+{
+    deadline.tv_sec = now->tv_sec + TCP_TIMEOUT;
+    deadline.tv_nsec = now->tv_nsec;
+    if (deadline.tv_sec > transferEnd.tv_sec || (deadline.tv_sec == transferEnd.tv_sec && deadline.tv_nsec > transferEnd.tv_nsec))
+    {
+        deadline = transferEnd;
+    }
+    progressSec = now->tv_sec;
+    armDeadline();
+}
+
+void extendTCPDeadline(long numBytes)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!transferring || transferEnd.tv_sec < now.tv_sec + TCP_TIMEOUT)
+    { // Always leave at least the idle timeout to start the transfer
+        transferEnd.tv_sec = now.tv_sec + TCP_TIMEOUT;
+        transferEnd.tv_nsec = now.tv_nsec;
+    }
+    transferEnd.tv_sec += numBytes / DS_TCP_MIN_RATE;
+    transferring = 1;
+    idleDeadline(&now);
+}
+
+void progressTCPDeadline()
+{
+    if (!transferring)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec != progressSec)
+    { // setitimer isn't worth a call on every read
+        idleDeadline(&now);
+    }
+}
+
+void delayTCPDeadline(int seconds)
+{
+    deadline.tv_sec += seconds;
+    armDeadline();
+}
+
+void stopTCPDeadline()
+{
+    transferring = 0;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
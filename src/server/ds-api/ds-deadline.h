@@ -0,0 +1,50 @@
+#ifndef DS_DEADLINE_H
+#define DS_DEADLINE_H
+
+/**
+ * @brief Arms the absolute deadline of the TCP connection served by the current process. The whole
+ * request header must arrive before it expires, otherwise the connection is dropped and counted as a
+ * timeout of the command being served. It replaces the read timeout that used to be toggled on every read.
+ *
+ */
+void startTCPDeadline();
+
+/**
+ * @brief Records which command the current TCP connection is serving (for the timeout counters).
+ *
+ * @param command macro of the command.
+ */
+void setTCPDeadlineCommand(int command);
+
+/**
+ * @brief Starts (or adds to) a transfer of the current TCP connection: from now on the connection is dropped
+ * if no data moves for TCP_TIMEOUT seconds or if the transfers don't end by the time numBytes of data (on top of
+ * the earlier transfers) take at the minimum accepted rate. Called once per transfer, not once per read.
+ *
+ * @param numBytes number of bytes that are about to be transferred.
+ */
+void extendTCPDeadline(long numBytes);
+
+/**
+ * @brief Records that data moved on the current TCP connection, which gives a transfer another TCP_TIMEOUT
+ * seconds (never past its end). Does nothing outside a transfer. Cheap enough to be called on every read/write.
+ *
+ */
+void progressTCPDeadline();
+
+/**
+ * @brief Moves the deadline of the current TCP connection forward by a number of seconds. Used while
+ * a request is parked waiting for something to happen in the DS.
+ *
+ * @param seconds number of seconds.
+ */
+void delayTCPDeadline(int seconds);
+
+/**
+ * @brief Disarms the deadline of the current TCP connection. Used by connections that are meant to stay
+ * open, which must then detect idle or stalled clients themselves.
+ *
+ */
+void stopTCPDeadline();
+
+#endif
@@ -0,0 +1,137 @@
+#include "ds-hash.h"
+#include "../../centralizedmsg-api-constants.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/**
+ * @brief Mixes a 64 byte block into the digest state.
+ *
+ * @param ctx digest state.
+ * @param p block to mix.
+ */
+static void sha256Block(Sha256Ctx *ctx, const unsigned char *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void sha256Init(Sha256Ctx *ctx)
+{
+    static const uint32_t H0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->length = 0;
+    ctx->blockLen = 0;
+}
+
+void sha256Update(Sha256Ctx *ctx, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    ctx->length += len;
+    if (ctx->blockLen > 0)
+    { // Complete the block left over by the previous update
+        size_t take = 64 - ctx->blockLen < len ? 64 - ctx->blockLen : len;
+        memcpy(ctx->block + ctx->blockLen, p, take);
+        ctx->blockLen += take;
+        p += take;
+        len -= take;
+        if (ctx->blockLen < 64)
+        {
+            return;
+        }
+        sha256Block(ctx, ctx->block);
+        ctx->blockLen = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64)
+    { // Whole blocks are mixed straight from the caller's buffer
+        sha256Block(ctx, p);
+    }
+    memcpy(ctx->block, p, len);
+    ctx->blockLen = len;
+}
+
+void sha256FinalHex(Sha256Ctx *ctx, char *hex)
+{
+    // Pad with a 1 bit, zeros and the length in bits so the content ends on a block boundary
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padLen = (ctx->blockLen < 56) ? 56 - ctx->blockLen : 120 - ctx->blockLen;
+    for (int i = 0; i < 8; ++i)
+    {
+        pad[padLen + i] = bits >> (56 - 8 * i);
+    }
+    sha256Update(ctx, pad, padLen + 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        sprintf(hex + 8 * i, "%08x", ctx->state[i]);
+    }
+}
+
+int sha256File(const char *path, char *hex)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    Sha256Ctx ctx;
+    sha256Init(&ctx);
+    char buf[DS_CONNBUF_SIZE];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        sha256Update(&ctx, buf, n);
+    }
+    close(fd);
+    if (n == -1)
+    {
+        return 0;
+    }
+    sha256FinalHex(&ctx, hex);
+    return 1;
+}
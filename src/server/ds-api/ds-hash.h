@@ -0,0 +1,49 @@
+#ifndef DS_HASH_H
+#define DS_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Struct that keeps the state of an incremental SHA-256 digest */
+typedef struct sha256ctx
+{
+    uint32_t state[8];
+    uint64_t length; // number of bytes hashed so far
+    unsigned char block[64];
+    size_t blockLen;
+} Sha256Ctx;
+
+/**
+ * @brief Starts a new SHA-256 digest.
+ *
+ * @param ctx digest state.
+ */
+void sha256Init(Sha256Ctx *ctx);
+
+/**
+ * @brief Hashes the next bytes of the content.
+ *
+ * @param ctx digest state.
+ * @param data bytes to hash.
+ * @param len number of bytes.
+ */
+void sha256Update(Sha256Ctx *ctx, const void *data, size_t len);
+
+/**
+ * @brief Ends the digest and writes it as lowercase hex.
+ *
+ * @param ctx digest state.
+ * @param hex buffer with room for DS_HASH_SIZE bytes (64 hex digits and a null terminator).
+ */
+void sha256FinalHex(Sha256Ctx *ctx, char *hex);
+
+/**
+ * @brief Hashes the whole content of a file.
+ *
+ * @param path string that contains the file's path.
+ * @param hex buffer with room for DS_HASH_SIZE bytes.
+ * @return 1 if the file was hashed, 0 otherwise.
+ */
+int sha256File(const char *path, char *hex);
+
+#endif
@@ -0,0 +1,269 @@
+#include "ds-log.h"
+#include "ds-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+int dsLogLevel = DS_LOG_OFF;
+int dsLogSample = 1;
+
+/* Log ring shared by every DS process (NULL while the log is off) */
+static DSLogRing *dsLogRing;
+
+/* Names of the levels (indexed by level) */
+static const char *levelNames[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+/**
+ * @brief Number of milliseconds between two times.
+ *
+ * @param begin earlier time.
+ * @param end later time.
+ * @return milliseconds elapsed.
+ */
+static long elapsedMsec(const struct timespec *begin, const struct timespec *end)
+{
+    return (end->tv_sec - begin->tv_sec) * 1000 + (end->tv_nsec - begin->tv_nsec) / 1000000;
+}
+
+int sampleDSLog(int level)
+{
+    if (dsLogLevel < level)
+    {
+        return 0;
+    }
+    if (level < DS_LOG_INFO || dsLogSample <= 1)
+    { // Errors and warnings are never sampled
+        return 1;
+    }
+    return __atomic_fetch_add(&dsLogRing->requests, 1, __ATOMIC_RELAXED) % dsLogSample == 0;
+}
+
+void logDS(int level, int event, int tcp, const struct sockaddr_in *addr, const char *text)
+{
+    if (dsLogLevel < level)
+    {
+        return;
+    }
+    // Claim the next slot unless the writer hasn't released it yet (the ring is full)
+    unsigned long pos = __atomic_load_n(&dsLogRing->head, __ATOMIC_RELAXED);
+    DSLogSlot *slot;
+    while (1)
+    {
+        slot = &dsLogRing->slots[pos & (DS_LOG_RING_SIZE - 1)];
+        long diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0 && __atomic_compare_exchange_n(&dsLogRing->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        if (diff < 0)
+        { // Never block the DS on its log
+            incrementDSStat(&dsStats->logDropped);
+            return;
+        }
+        if (diff > 0)
+        { // Another process claimed it first
+            pos = __atomic_load_n(&dsLogRing->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Only raw bytes are copied here: the writer formats them
+    DSLogRecord *r = &slot->record;
+    clock_gettime(CLOCK_REALTIME, &r->time);
+    r->pid = getpid();
+    r->level = level;
+    r->event = event;
+    r->tcp = tcp;
+    r->addr = *addr;
+    int len = 0;
+    while (len < DS_LOG_TEXT_SIZE - 1 && text[len] != '\0' && text[len] != '\n')
+    {
+        r->text[len] = text[len];
+        len++;
+    }
+    r->text[len] = '\0';
+
+    // Publish it, unless the writer gave up on the slot meanwhile
+    unsigned long expected = pos;
+    if (!__atomic_compare_exchange_n(&slot->seq, &expected, pos + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        incrementDSStat(&dsStats->logDropped);
+        return;
+    }
+    if (__atomic_load_n(&dsLogRing->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&dsLogRing->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &dsLogRing->sleeping, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief Turns a log record into a line of text.
+ *
+ * @param r record.
+ * @param line buffer the line is written to (DS_LOG_LINE_SIZE bytes).
+ * @return number of bytes of the line.
+ */
+static int formatLogRecord(const DSLogRecord *r, char *line)
+{
+    struct tm tm;
+    char ip[INET_ADDRSTRLEN];
+    localtime_r(&r->time.tv_sec, &tm);
+    inet_ntop(AF_INET, &r->addr.sin_addr, ip, sizeof(ip));
+    int len = strftime(line, DS_LOG_LINE_SIZE, "[!] %H:%M:%S", &tm);
+    len += snprintf(line + len, DS_LOG_LINE_SIZE - len, ".%06ld %-5s [%d] (%s) ", r->time.tv_nsec / 1000, levelNames[r->level], r->pid, r->tcp ? "TCP" : "UDP");
+    if (r->event == DS_LOG_REQUEST)
+    {
+        len += snprintf(line + len, DS_LOG_LINE_SIZE - len, "Client @ %s in port %d sent: %s\n", ip, ntohs(r->addr.sin_port), r->text);
+    }
+    else if (r->event == DS_LOG_REPLY)
+    {
+        len += snprintf(line + len, DS_LOG_LINE_SIZE - len, "Replied to %s in port %d: %s\n", ip, ntohs(r->addr.sin_port), r->text);
+    }
+    else
+    {
+        len += snprintf(line + len, DS_LOG_LINE_SIZE - len, "Refused client @ %s in port %d: %s\n", ip, ntohs(r->addr.sin_port), r->text);
+    }
+    return MIN(len, DS_LOG_LINE_SIZE - 1);
+}
+
+/**
+ * @brief Writes out a buffer of formatted lines.
+ *
+ * @param buffer string that contains the lines.
+ * @param len number of bytes in buffer.
+ */
+static void writeLogBuffer(const char *buffer, int len)
+{
+    int written = 0;
+    while (written < len)
+    {
+        ssize_t n = write(STDOUT_FILENO, buffer + written, len - written);
+        if (n <= 0)
+        { // Nowhere to write the log to: drop it
+            return;
+        }
+        written += n;
+    }
+}
+
+/**
+ * @brief Formats every published record in order and writes them out in as few writes as possible.
+ *
+ * @param tail reference to the next position to be read.
+ * @param stallStart reference to the time the record at tail was first seen claimed but unwritten.
+ * @return number of records taken out of the ring.
+ */
+static int drainLogRing(unsigned long *tail, struct timespec *stallStart)
+{
+    static char buffer[DS_LOG_WRITEBUF_SIZE];
+    int len = 0, taken = 0;
+    while (1)
+    {
+        DSLogSlot *slot = &dsLogRing->slots[*tail & (DS_LOG_RING_SIZE - 1)];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == *tail + 1)
+        { // Published
+            if (len > DS_LOG_WRITEBUF_SIZE - DS_LOG_LINE_SIZE)
+            {
+                writeLogBuffer(buffer, len);
+                len = 0;
+            }
+            len += formatLogRecord(&slot->record, buffer + len);
+            __atomic_store_n(&slot->seq, *tail + DS_LOG_RING_SIZE, __ATOMIC_RELEASE);
+            stallStart->tv_sec = 0;
+            (*tail)++;
+            taken++;
+            continue;
+        }
+        if (*tail == __atomic_load_n(&dsLogRing->head, __ATOMIC_RELAXED))
+        { // Empty
+            break;
+        }
+        // Claimed but not written yet: the producer may have died (e.g. a TCP connection past its deadline)
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (stallStart->tv_sec == 0)
+        {
+            *stallStart = now;
+        }
+        if (elapsedMsec(stallStart, &now) < DS_LOG_STALL_MSEC)
+        {
+            break;
+        }
+        unsigned long expected = *tail;
+        if (__atomic_compare_exchange_n(&slot->seq, &expected, *tail + DS_LOG_RING_SIZE, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        { // Skip it (a late producer sees its publish fail)
+            incrementDSStat(&dsStats->logDropped);
+            stallStart->tv_sec = 0;
+            (*tail)++;
+        }
+    }
+    writeLogBuffer(buffer, len);
+    return taken;
+}
+
+/**
+ * @brief Loop of the log writer: drains the ring in batches and sleeps while it's empty. Exits once the DS does.
+ *
+ * @param parent PID of the DS process that forked the writer.
+ */
+static void writeDSLog(pid_t parent)
+{
+    unsigned long tail = 0;
+    struct timespec stallStart = {0, 0};
+    struct timespec batch = {0, DS_LOG_BATCH_USEC * 1000L};
+    struct timespec idle = {DS_LOG_IDLE_MSEC / 1000, (DS_LOG_IDLE_MSEC % 1000) * 1000000L};
+    while (1)
+    {
+        if (drainLogRing(&tail, &stallStart) > 0 || stallStart.tv_sec != 0)
+        { // Let more records pile up so they're written together
+            nanosleep(&batch, NULL);
+            continue;
+        }
+        if (getppid() != parent)
+        { // The DS is gone and so is everything it could still log
+            exit(EXIT_SUCCESS);
+        }
+        __atomic_store_n(&dsLogRing->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (tail == __atomic_load_n(&dsLogRing->head, __ATOMIC_SEQ_CST))
+        { // A producer that publishes after this check wakes the writer up
+            syscall(SYS_futex, &dsLogRing->sleeping, FUTEX_WAIT, 1, &idle, NULL, 0);
+        }
+        __atomic_store_n(&dsLogRing->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void setupDSLog()
+{
+    if (dsLogLevel == DS_LOG_OFF)
+    {
+        return;
+    }
+    dsLogRing = mmap(NULL, sizeof(DSLogRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dsLogRing == MAP_FAILED)
+    {
+        perror("[-] Failed to map DS log");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned long i = 0; i < DS_LOG_RING_SIZE; ++i)
+    {
+        dsLogRing->slots[i].seq = i;
+    }
+    fflush(stdout); // The writer mustn't inherit buffered output
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        writeDSLog(parent);
+    }
+    else if (pid == -1)
+    {
+        perror("[-] Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+}
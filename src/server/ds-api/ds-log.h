@@ -0,0 +1,69 @@
+#ifndef DS_LOG_H
+#define DS_LOG_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/* Struct that keeps a log record as it was taken on the hot path: it's only turned into text by the log writer */
+typedef struct dslogrecord
+{
+    struct timespec time;
+    pid_t pid;
+    int level;
+    int event;                   // DS_LOG_REQUEST, DS_LOG_REPLY or DS_LOG_REFUSED
+    int tcp;                     // 1 if it came through TCP, 0 if through UDP
+    struct sockaddr_in addr;     // client
+    char text[DS_LOG_TEXT_SIZE]; // request or reply (cut at DS_LOG_TEXT_SIZE - 1 bytes)
+} DSLogRecord;
+
+/* Struct that keeps a slot of the log ring. seq tells who owns it: the writer once it equals the position
+ * it was claimed for plus 1, producers of the next lap once the writer moved it DS_LOG_RING_SIZE ahead */
+typedef struct dslogslot
+{
+    unsigned long seq;
+    DSLogRecord record;
+} DSLogSlot;
+
+/* Struct that keeps the log ring. It lives in shared memory: every DS process claims slots with a compare and
+ * swap on head and a single writer process turns them into text and writes them out */
+typedef struct dslogring
+{
+    unsigned long head;       // next position to be claimed by a producer
+    unsigned long requests;   // requests seen, used for sampling
+    unsigned int sleeping;    // 1 while the writer waits on an empty ring (futex)
+    DSLogSlot slots[DS_LOG_RING_SIZE];
+} DSLogRing;
+
+/* Level the DS was started with (DS_LOG_OFF disables the log) and 1 in how many requests are logged */
+extern int dsLogLevel;
+extern int dsLogSample;
+
+/**
+ * @brief Maps the log ring in shared memory and forks the process that writes the log to STDOUT.
+ * Must be called after setupDSStats and before the DS forks. Does nothing if the log is off.
+ *
+ */
+void setupDSLog();
+
+/**
+ * @brief Decides if a request is logged (1 in dsLogSample requests are, over every DS process).
+ *
+ * @param level level of the request's records.
+ * @return 1 if the request should be logged, 0 otherwise.
+ */
+int sampleDSLog(int level);
+
+/**
+ * @brief Copies a record into the log ring without blocking. The record is dropped (and counted) if the ring is full.
+ *
+ * @param level level of the record.
+ * @param event DS_LOG_REQUEST, DS_LOG_REPLY or DS_LOG_REFUSED.
+ * @param tcp 1 if the client came through TCP, 0 if through UDP.
+ * @param addr address of the client.
+ * @param text string that contains the request or reply (without the ending nl).
+ */
+void logDS(int level, int event, int tcp, const struct sockaddr_in *addr, const char *text);
+
+#endif
@@ -0,0 +1,88 @@
+#include "ds-notify.h"
+#include "ds-operations.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+DSNotify *dsNotify;
+
+void setupDSNotify()
+{
+    dsNotify = mmap(NULL, sizeof(DSNotify), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dsNotify == MAP_FAILED)
+    {
+        perror("[-] Failed to map DS post notifications");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < dsGroups.no_groups; ++i)
+    {
+        int gid = atoi(dsGroups.groupinfo[i].no);
+        if (gid > 0 && gid < DS_MAX_NUM_GROUPS)
+        {
+            dsNotify->groupLastMID[gid] = lastGroupMID(dsGroups.groupinfo[i].no);
+        }
+    }
+}
+
+/**
+ * @brief Bumps a sequence counter and wakes up all of its waiters. The futex isn't private
+ * because the waiters are other processes.
+ *
+ * @param seq reference to the sequence counter.
+ */
+static void bumpSeq(unsigned int *seq)
+{
+    __atomic_fetch_add(seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void notifyGroupPosts(const char *GID, int firstMID, int num)
+{
+    int gid = atoi(GID);
+    int mid = firstMID + num - 1;
+    if (gid <= 0 || gid >= DS_MAX_NUM_GROUPS || firstMID <= 0 || mid > DS_MAX_NUM_MSGS)
+    {
+        return;
+    }
+    for (int i = firstMID; i <= mid; ++i)
+    { // Published before the last MID so that whoever sees the new last MID sees the posts below it too
+        __atomic_fetch_or(&dsNotify->committed[gid][i / 8], 1 << (i % 8), __ATOMIC_RELEASE);
+    }
+    // Concurrent posts may commit out of order so only move the last MID forward
+    int last = __atomic_load_n(&dsNotify->groupLastMID[gid], __ATOMIC_RELAXED);
+    while (last < mid && !__atomic_compare_exchange_n(&dsNotify->groupLastMID[gid], &last, mid, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    bumpSeq(&dsNotify->groupSeq[gid]);
+    bumpSeq(&dsNotify->commitSeq);
+}
+
+int groupPostCommitted(int gid, int mid)
+{
+    if (gid <= 0 || gid >= DS_MAX_NUM_GROUPS || mid <= 0 || mid > DS_MAX_NUM_MSGS)
+    {
+        return 0;
+    }
+    return (__atomic_load_n(&dsNotify->committed[gid][mid / 8], __ATOMIC_ACQUIRE) >> (mid % 8)) & 1;
+}
+
+void notifyDSChange()
+{
+    bumpSeq(&dsNotify->changeSeq);
+}
+
+int waitForPost(unsigned int *seq, unsigned int seen, long timeoutMsec)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMsec / 1000;
+    timeout.tv_nsec = (timeoutMsec % 1000) * 1000000L;
+    if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == seen)
+    { // Returns right away if the counter already moved
+        syscall(SYS_futex, seq, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    }
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE) != seen;
+}
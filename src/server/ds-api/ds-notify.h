@@ -0,0 +1,62 @@
+#ifndef DS_NOTIFY_H
+#define DS_NOTIFY_H
+
+#include "../../centralizedmsg-api-constants.h"
+
+/* Struct that lets the TCP connection processes know about new posts. It lives in shared memory:
+ * the process that commits a post bumps the sequence counters and wakes up every process that waits on them */
+typedef struct dsnotify
+{
+    unsigned int commitSeq;                        // bumped on every post in any group
+    unsigned int groupSeq[DS_MAX_NUM_GROUPS];      // bumped on every post in a group (indexed by GID)
+    int groupLastMID[DS_MAX_NUM_GROUPS];           // highest committed MID of each group (indexed by GID)
+    unsigned char committed[DS_MAX_NUM_GROUPS][DS_MAX_NUM_MSGS / 8 + 1]; // bit of every MID committed since the DS started
+    unsigned int changeSeq;                        // bumped on every change appended to the change log
+} DSNotify;
+
+/* Variable that points to the post notifications in shared memory */
+extern DSNotify *dsNotify;
+
+/**
+ * @brief Maps the post notifications in shared memory and loads the last MID of every existing group.
+ * Must be called after fillDSGroupsInfo and before the DS forks.
+ *
+ */
+void setupDSNotify();
+
+/**
+ * @brief Publishes one or more consecutive committed posts and wakes up every process waiting for posts.
+ *
+ * @param GID string that contains the group ID.
+ * @param firstMID integer that contains the first message ID.
+ * @param num number of messages.
+ */
+void notifyGroupPosts(const char *GID, int firstMID, int num);
+
+/**
+ * @brief Checks if a post was committed since the DS started. Posts commit out of order so a MID below the last
+ * committed one may still be in progress.
+ *
+ * @param gid group ID.
+ * @param mid message ID.
+ * @return 1 if it was committed, 0 otherwise.
+ */
+int groupPostCommitted(int gid, int mid);
+
+/**
+ * @brief Wakes up every process that ships the change log to followers.
+ *
+ */
+void notifyDSChange();
+
+/**
+ * @brief Sleeps until a sequence counter moves away from a given value or the timeout expires.
+ *
+ * @param seq reference to the sequence counter (commitSeq or one of groupSeq).
+ * @param seen value of the counter the caller has already handled.
+ * @param timeoutMsec maximum number of milliseconds to wait.
+ * @return 1 if the counter changed, 0 otherwise.
+ */
+int waitForPost(unsigned int *seq, unsigned int seen, long timeoutMsec);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // syncfs
 #include "ds-operations.h"
 #include <sys/types.h>
 #include <dirent.h>
@@ -7,16 +8,24 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <sys/random.h>
 
 GroupList dsGroups;
+int dsShardIndex = 0;
+int dsNumShards = 1;
 
 void fillDSGroupsInfo()
 {
     DIR *d;
     struct dirent *dir;
     int i = 0;
-    FILE *fp;
     char groupID[DS_GID_SIZE];
+    char groupName[DS_GNAMEFILE_SIZE];
     char groupNamePath[DS_GNAMEPATH_SIZE];
     (&dsGroups)->no_groups = 0;
     d = opendir("server/GROUPS");
@@ -37,11 +46,9 @@ void fillDSGroupsInfo()
 
             // Open the group name file and fill the global ds struct
             sprintf(groupNamePath, "server/GROUPS/%s/%s_name.txt", groupID, groupID);
-            fp = fopen(groupNamePath, "r");
-            if (fp)
+            if (readDSFile(groupNamePath, groupName, sizeof(groupName)) > 0)
             {
-                fscanf(fp, "%24s", (&dsGroups)->groupinfo[i].name);
-                fclose(fp);
+                sscanf(groupName, "%24s", (&dsGroups)->groupinfo[i].name);
             }
             ++i;
             if (i == 99)
@@ -54,6 +61,38 @@ void fillDSGroupsInfo()
     }
 }
 
+int groupInDS(int gid)
+{
+    if (dsNumShards == 1)
+    { // Groups are numbered from 1 with no gaps
+        return gid <= dsGroups.no_groups;
+    }
+    for (int i = 0; i < dsGroups.no_groups; ++i)
+    {
+        if (atoi(dsGroups.groupinfo[i].no) == gid)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int nextDSGroupID()
+{
+    if (dsNumShards == 1)
+    {
+        return (dsGroups.no_groups < DS_MAX_NUM_GROUPS - 1) ? dsGroups.no_groups + 1 : 0;
+    }
+    for (int gid = dsShardIndex + 1; gid < DS_MAX_NUM_GROUPS; gid += dsNumShards)
+    {
+        if (!groupInDS(gid))
+        {
+            return gid;
+        }
+    }
+    return 0;
+}
+
 int directoryExists(const char *path)
 {
     struct stat stats;
@@ -64,42 +103,177 @@ int directoryExists(const char *path)
     return S_ISDIR(stats.st_mode);
 }
 
-int passwordsMatch(const char *userID, const char *userPW)
+int readDSFile(const char *path, char *buffer, size_t size)
 {
-    char clientPwdPath[DS_CLIENTPWDPATH_SIZE];
-    char clientStoredPwd[CLIENT_PWD_SIZE];
-    size_t n;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, buffer, size - 1);
+    close(fd);
+    if (n == -1)
+    {
+        return -1;
+    }
+    buffer[n] = '\0';
+    return n;
+}
 
-    // Open stored password file
-    sprintf(clientPwdPath, "server/USERS/%s/%s_pass.txt", userID, userID);
-    FILE *pwd = fopen(clientPwdPath, "r");
-    if (pwd == NULL)
+int writeDSFile(const char *path, const char *content, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    ssize_t n = (len > 0) ? write(fd, content, len) : 0;
+    if (close(fd) == -1 || n != len)
     {
         return 0;
     }
+    return 1;
+}
 
-    // Read password from stored file
-    n = fread(clientStoredPwd, sizeof(char), CLIENT_PWD_SIZE - 1, pwd);
-    if (n == -1)
+/**
+ * @brief Hashes a password with the salt of its record.
+ *
+ * @param salt string that starts with the 16 hex digits of the salt.
+ * @param userPW string that contains the password.
+ * @param hex buffer with room for DS_HASH_SIZE bytes.
+ */
+static void hashPassword(const char *salt, const char *userPW, char *hex)
+{
+    Sha256Ctx ctx;
+    sha256Init(&ctx);
+    sha256Update(&ctx, salt, DS_PWDSALT_SIZE - 1);
+    sha256Update(&ctx, userPW, strlen(userPW));
+    sha256FinalHex(&ctx, hex);
+}
+
+int validPasswordRecord(const char *record)
+{
+    // ^[0-9a-f]{16}:[0-9a-f]{64}$
+    for (int i = 0; i < DS_PWDRECORD_SIZE - 1; ++i)
+    {
+        if (i == DS_PWDSALT_SIZE - 1 ? record[i] != ':' : !((record[i] >= '0' && record[i] <= '9') || (record[i] >= 'a' && record[i] <= 'f')))
+        {
+            return 0;
+        }
+    }
+    return record[DS_PWDRECORD_SIZE - 1] == '\0';
+}
+
+int createPasswordRecord(const char *userPW, char *record)
+{
+    unsigned char salt[(DS_PWDSALT_SIZE - 1) / 2];
+    if (getrandom(salt, sizeof(salt), 0) != sizeof(salt))
     {
+        perror("[-] Failed to salt a password");
         return 0;
     }
+    for (int i = 0; i < sizeof(salt); ++i)
+    {
+        sprintf(record + 2 * i, "%02x", salt[i]);
+    }
+    record[DS_PWDSALT_SIZE - 1] = ':';
+    hashPassword(record, userPW, record + DS_PWDSALT_SIZE);
+    return 1;
+}
 
-    // Close stored file
-    if (fclose(pwd) == -1)
+int readPasswordRecord(const char *userID, char *record)
+{
+    char clientPwdPath[DS_CLIENTPWDPATH_SIZE];
+    snprintf(clientPwdPath, sizeof(clientPwdPath), "server/USERS/%.5s/%.5s_pass.txt", userID, userID);
+    if (readDSFile(clientPwdPath, record, DS_PWDRECORD_SIZE) == -1 || !validPasswordRecord(record))
     {
+        record[0] = '\0';
         return 0;
     }
+    return 1;
+}
 
-    // Compare stored and given passwords
-    if (strcmp(clientStoredPwd, userPW))
+int passwordsMatch(const char *userID, const char *userPW)
+{
+    char clientStoredPwd[DS_PWDRECORD_SIZE];
+    char hash[DS_HASH_SIZE];
+
+    // Read the password record from the stored file
+    if (!readPasswordRecord(userID, clientStoredPwd))
     {
         return 0;
     }
 
+    // Compare the hash of the given password with the stored one in constant time so that the time taken doesn't
+    // tell how much of it matched
+    hashPassword(clientStoredPwd, userPW, hash);
+    unsigned char diff = 0;
+    for (int i = 0; i < DS_HASH_SIZE - 1; ++i)
+    {
+        diff |= clientStoredPwd[DS_PWDSALT_SIZE + i] ^ hash[i];
+    }
+    return diff == 0;
+}
+
+/**
+ * @brief Replaces a file with new content as a whole: the content is written (and synced) to a temporary file
+ * that is then renamed over it, so that a crash leaves either the old or the new file and never a truncated one.
+ *
+ * @param path string that contains the path of the file.
+ * @param tmpPath string that contains the path of the temporary file (in the same directory).
+ * @param content content to be written.
+ * @param len length of the content.
+ * @return 1 if the file was replaced, 0 otherwise.
+ */
+static int replaceDSFile(const char *path, const char *tmpPath, const char *content, size_t len)
+{
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    ssize_t n = write(fd, content, len);
+    int ok = n == len && fsync(fd) == 0;
+    if (close(fd) == -1 || !ok || rename(tmpPath, path) == -1)
+    {
+        unlink(tmpPath);
+        return 0;
+    }
     return 1;
 }
 
+void hashStoredPasswords()
+{
+    DIR *d = opendir("server/USERS");
+    if (d == NULL)
+    {
+        return;
+    }
+    struct dirent *dir;
+    char clientPwdPath[DS_CLIENTPWDPATH_SIZE];
+    char clientTmpPwdPath[DS_CLIENTPWDPATH_SIZE];
+    char clientStoredPwd[DS_PWDRECORD_SIZE];
+    char record[DS_PWDRECORD_SIZE];
+    while ((dir = readdir(d)) != NULL)
+    {
+        if (!validUID(dir->d_name))
+        {
+            continue;
+        }
+        snprintf(clientPwdPath, sizeof(clientPwdPath), "server/USERS/%.5s/%.5s_pass.txt", dir->d_name, dir->d_name);
+        if (readDSFile(clientPwdPath, clientStoredPwd, sizeof(clientStoredPwd)) == -1 || !validPW(clientStoredPwd))
+        { // Already hashed (or not a user)
+            continue;
+        }
+        snprintf(clientTmpPwdPath, sizeof(clientTmpPwdPath), "server/USERS/%.5s/%.5s_pass.tmp", dir->d_name, dir->d_name);
+        if (!createPasswordRecord(clientStoredPwd, record) || !replaceDSFile(clientPwdPath, clientTmpPwdPath, record, DS_PWDRECORD_SIZE - 1))
+        {
+            fprintf(stderr, "[-] Failed to hash the password of user %s\n", dir->d_name);
+        }
+    }
+    closedir(d);
+}
+
 int unsubscribeClientFromGroups(const char *userID)
 {
     DIR *d;
@@ -168,32 +342,35 @@ int removeDirectory(const char *path)
         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
             continue;
 
-        // Determina a full path of an entry
-        fullPath = calloc(sizeof(char), pathLen + strlen(entry->d_name) + 1);
+        // Determine a full path of an entry (released before the next one, whichever way this one ends)
+        ArenaMark mark = arenaMark(&dsArena);
+        fullPath = arenaAlloc(&dsArena, pathLen + strlen(entry->d_name) + 2);
         if (fullPath == NULL)
         {
+            closedir(dir);
             return 0;
         }
-        strcpy(fullPath, path);
-        strcat(fullPath, "/");
-        strcat(fullPath, entry->d_name);
+        sprintf(fullPath, "%s/%s", path, entry->d_name);
 
         // Stat for the full path
         stat(fullPath, &statEntry);
 
         // Recursively remove a nested directory
+        int removed = 1;
         if (S_ISDIR(statEntry.st_mode))
         {
             removeDirectory(fullPath);
-            continue;
         }
-
-        // Remove a file object
-        if (unlink(fullPath) == -1)
+        else
+        { // Remove a file object
+            removed = unlink(fullPath) != -1;
+        }
+        arenaRewind(&dsArena, mark);
+        if (!removed)
         {
+            closedir(dir);
             return 0;
         }
-        free(fullPath);
     }
 
     // Remove empty directory
@@ -225,6 +402,25 @@ static int compare(const void *a, const void *b)
     return strcmp(q1->no, q2->no);
 }
 
+/**
+ * @brief Gets the position of a group in the DS groups list. A shard's groups aren't numbered
+ * without gaps so the position can't be taken from the group ID.
+ *
+ * @param gid group ID.
+ * @return position of the group, -1 if the DS doesn't hold it.
+ */
+static int groupIndexInDS(int gid)
+{
+    for (int i = 0; i < dsGroups.no_groups; ++i)
+    {
+        if (atoi(dsGroups.groupinfo[i].no) == gid)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /**
  * @brief Sorts a GroupList struct by their groups' IDs.
  *
@@ -237,99 +433,42 @@ static void sortGList(GroupList *list)
 
 int createGroupListMessage(char *buffer, int *groups, int num)
 {
-    char infoDSGroup[DS_GROUPINFO_SIZE];
     fillDSGroupsInfo(); // In case manual directories were inputted during program execution
     int numDSGroups = (groups == NULL) ? dsGroups.no_groups : num;
     sortGList((&dsGroups));
-    sprintf(infoDSGroup, "%d", numDSGroups);
-    strcat(buffer, infoDSGroup);
-    if (numDSGroups > 0)
-    {
-        struct dirent **d;
-        int n, flag;
-        int j;
-        char dsGroupMsgPath[DS_GROUPMSGPATH_SIZE];
-        for (int i = 0; i < numDSGroups; ++i)
-        {
-            j = (groups == NULL) ? i : groups[i];
-            sprintf(dsGroupMsgPath, "server/GROUPS/%s/MSG", dsGroups.groupinfo[j].no);
-            n = scandir(dsGroupMsgPath, &d, 0, alphasort);
-            if (n < 0)
-            {
-                return 0;
-            }
-            else
-            {
-                flag = 0;
-                while (n--)
-                {
-                    if (!flag)
-                    {
-                        if (validMID(d[n]->d_name))
-                        { // Check for garbage
-                            char MID[DS_MID_SIZE];
-                            strncpy(MID, d[n]->d_name, DS_MID_SIZE - 1);
-                            MID[DS_MID_SIZE - 1] = '\0';
-                            sprintf(infoDSGroup, " %s %s %s", dsGroups.groupinfo[j].no, dsGroups.groupinfo[j].name, MID);
-                            strcat(buffer, infoDSGroup);
-                            flag = 1;
-                        }
-                    }
-                    free(d[n]);
-                }
-                free(d);
-                if (!flag)
-                { // No messages are in the group
-                    sprintf(infoDSGroup, " %s %s 0000", dsGroups.groupinfo[j].no, dsGroups.groupinfo[j].name);
-                    strcat(buffer, infoDSGroup);
-                }
-            }
+    int len = sprintf(buffer, "%d", numDSGroups);
+    for (int i = 0; i < numDSGroups; ++i)
+    {
+        int j = (groups == NULL) ? i : groupIndexInDS(groups[i]);
+        if (j == -1)
+        { // The group was removed in the meantime
+            return 0;
+        }
+        int lastMID = lastGroupMID(dsGroups.groupinfo[j].no);
+        if (lastMID < 0)
+        {
+            return 0;
         }
+        len += sprintf(buffer + len, " %s %s %04d", dsGroups.groupinfo[j].no, dsGroups.groupinfo[j].name, lastMID);
     }
     return 1;
 }
 
 int groupNamesMatch(const char *GID, const char *GName)
 {
-    // Open group name file
+    // Read group name file (the name is followed by a nl)
     char groupNamePath[DS_GNAMEPATH_SIZE];
+    char realGName[DS_GNAMEFILE_SIZE];
     sprintf(groupNamePath, "server/GROUPS/%s/%s_name.txt", GID, GID);
-    FILE *name = fopen(groupNamePath, "r");
-    if (name == NULL)
-    {
-        return 0;
-    }
-    fseek(name, 0, SEEK_END);
-    int length = ftell(name) - 1; // -1 to avoid \n
-    fseek(name, 0, SEEK_SET);
-    char *realGName = calloc(sizeof(char), length + 1);
-    if (!realGName)
-    {
-        return 0;
-    }
-
-    // Read group name
-    size_t n = fread(realGName, 1, length, name);
-    if (n == -1)
-    {
-        fprintf(stderr, "[-] Unable to read from group name file.\n");
-        return 0;
-    }
-    realGName[length] = '\0';
-    if (fclose(name) == -1)
+    int length = readDSFile(groupNamePath, realGName, sizeof(realGName));
+    if (length <= 0)
     {
         return 0;
     }
+    realGName[length - 1] = '\0';
 
     // Compare group names
-    if (strcmp(realGName, GName) != 0)
-    { // Group names don't match
-        free(realGName);
-        return 0;
-    }
-    // Group names match
-    free(realGName);
-    return 1;
+    return !strcmp(realGName, GName);
 }
 
 /**
@@ -370,8 +509,8 @@ int fillClientSubscribedGroups(const char *UID, int *clientGroupsSubscribed, int
         GID[DS_GID_SIZE - 1] = '\0';
         sprintf(dsGroupClientSubPath, "server/GROUPS/%s/%s.txt", GID, UID);
         if (!access(dsGroupClientSubPath, F_OK))
-        { // User is subscribed to this group -> save its index
-            clientGroupsSubscribed[(*numGroupsSub)++] = atoi(GID) - 1;
+        { // User is subscribed to this group -> save its ID
+            clientGroupsSubscribed[(*numGroupsSub)++] = atoi(GID);
         }
     }
     if (closedir(d) == -1)
@@ -398,9 +537,10 @@ char *listUsersInDSGroup(const char *GID)
     }
     struct dirent *dir;
     char UID[CLIENT_UID_SIZE];
-    char *users = (char *)calloc(sizeof(char), DS_ULISTBUFINIT_SIZE);
+    char *users = arenaAlloc(&dsArena, DS_ULISTBUFINIT_SIZE);
     if (users == NULL)
     { // Failed to allocate memory
+        closedir(d);
         return NULL;
     }
     size_t lenUsers = DS_ULISTBUFINIT_SIZE;
@@ -421,13 +561,12 @@ char *listUsersInDSGroup(const char *GID)
         {
             if (cur + CLIENT_UID_SIZE >= lenUsers - 2) // -2 to always to leave space for nl and null terminator
             {
-                char *new = (char *)realloc(users, 2 * lenUsers);
+                char *new = arenaGrow(&dsArena, users, lenUsers, 2 * lenUsers);
                 if (new == NULL)
                 {
-                    free(users);
+                    closedir(d);
                     return NULL;
                 }
-                memset(new + lenUsers, 0, lenUsers);
                 users = new;
                 lenUsers *= 2;
             }
@@ -435,6 +574,8 @@ char *listUsersInDSGroup(const char *GID)
         }
     }
 
+    closedir(d);
+
     // End users string - this will never SIGSEGV because of line 421
     users[cur] = '\n';
     users[cur + 1] = '\0';
@@ -467,6 +608,7 @@ int userSubscribedToGroup(const char *UID, const char *GID)
         txtUID[CLIENT_UID_SIZE - 1] = '\0';
         if (!strcmp(txtUID, UID))
         {
+            closedir(d);
             return 1;
         }
     }
@@ -474,68 +616,75 @@ int userSubscribedToGroup(const char *UID, const char *GID)
     return 0;
 }
 
-int createMessageInGroup(char *newMID, const char *UID, const char *GID, int TSize, const char *Text)
+int lastGroupMID(const char *GID)
 {
     char dsGroupMsgPath[DS_GROUPMSGPATH_SIZE];
     sprintf(dsGroupMsgPath, "server/GROUPS/%s/MSG", GID);
-    struct dirent **dir;
-
-    // alphasort will sort the messages by ascending order
-    int n = scandir(dsGroupMsgPath, &dir, 0, alphasort);
-    int max = 0, flag = 0;
-    if (n < 0)
+    DIR *d = opendir(dsGroupMsgPath);
+    if (d == NULL)
     {
-        return 0;
+        return -1;
     }
-    while (n--)
+
+    // The last message is the greatest valid name (a single pass, scandir would allocate every entry and sort them)
+    char last[DS_MID_SIZE] = "";
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL)
     {
-        if (!flag)
+        if (validMID(dir->d_name) && strcmp(dir->d_name, last) > 0)
         {
-            if (validMID(dir[n]->d_name))
-            {
-                max = atoi(dir[n]->d_name); // + 1 because of new message
-                flag = 1;
-            }
+            strcpy(last, dir->d_name);
         }
-        free(dir[n]);
-    }
-    free(dir);
-
-    // Create new message ID
-    if (0 <= max && max <= 8)
-    {
-        sprintf(newMID, "000%d", max + 1);
-    }
-    else if (9 <= max && max <= 98)
-    {
-        sprintf(newMID, "00%d", max + 1);
-    }
-    else if (99 <= max && max <= 998)
-    {
-        sprintf(newMID, "0%d", max + 1);
-    }
-    else if (999 <= max && max <= 9998)
-    {
-        sprintf(newMID, "%d", max + 1);
-    }
-    else
-    { // Message limit
-        return 0;
     }
+    closedir(d);
+    return atoi(last);
+}
 
-    // Create new message directory
+int allocateGroupMIDs(const char *GID, int num, int *firstMID)
+{
+    int max = lastGroupMID(GID);
     char newGroupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
-    sprintf(newGroupMsgDSPath, "server/GROUPS/%s/MSG/%s", GID, newMID);
-    int ret = mkdir(newGroupMsgDSPath, 0700);
-    if (ret == -1)
-    {
-        return 0;
+    while (max >= 0 && max + num <= DS_MAX_NUM_MSGS)
+    { // Stops at the message limit
+        // Create the new message directories (mkdir fails if a concurrent post already took the MID)
+        int i;
+        for (i = 1; i <= num; ++i)
+        {
+            snprintf(newGroupMsgDSPath, DS_GROUPMSGDIRPATH_SIZE, "server/GROUPS/%.2s/MSG/%04u", GID, (unsigned int)(max + i) % (DS_MAX_NUM_MSGS + 1));
+            if (mkdir(newGroupMsgDSPath, 0700) == -1)
+            {
+                break;
+            }
+        }
+        if (i > num)
+        {
+            *firstMID = max + 1;
+            return 1;
+        }
+        int err = errno;
+        int taken = max + i;
+        while (--i > 0)
+        {
+            snprintf(newGroupMsgDSPath, DS_GROUPMSGDIRPATH_SIZE, "server/GROUPS/%.2s/MSG/%04u", GID, (unsigned int)(max + i) % (DS_MAX_NUM_MSGS + 1));
+            rmdir(newGroupMsgDSPath);
+        }
+        if (err != EEXIST)
+        {
+            perror("[-] Failed to create message directory");
+            return 0;
+        }
+        // A concurrent post took that MID: try again right after it
+        max = taken;
     }
+    return 0;
+}
 
+int writeMessageFiles(const char *msgDir, const char *UID, int TSize, const char *Text)
+{
     // Create new message author file
     FILE *author;
-    char newGroupMsgAuthorPath[DS_GROUPMSGAUTHORPATH_SIZE];
-    sprintf(newGroupMsgAuthorPath, "server/GROUPS/%s/MSG/%s/A U T H O R.txt", GID, newMID);
+    char newGroupMsgAuthorPath[DS_MSGFILEPATH_SIZE];
+    snprintf(newGroupMsgAuthorPath, DS_MSGFILEPATH_SIZE, "%s/A U T H O R.txt", msgDir);
     author = fopen(newGroupMsgAuthorPath, "w");
     if (author == NULL)
     {
@@ -558,10 +707,10 @@ int createMessageInGroup(char *newMID, const char *UID, const char *GID, int TSi
         return 0;
     }
 
-    // Create new message text file
+    // Create new message text file (retrieves take a message without it as not posted yet)
     FILE *text;
-    char newGroupMsgTextPath[DS_GROUPMSGTEXTPATH_SIZE];
-    sprintf(newGroupMsgTextPath, "server/GROUPS/%s/MSG/%s/T E X T.txt", GID, newMID);
+    char newGroupMsgTextPath[DS_MSGFILEPATH_SIZE];
+    snprintf(newGroupMsgTextPath, DS_MSGFILEPATH_SIZE, "%s/T E X T.txt", msgDir);
     text = fopen(newGroupMsgTextPath, "w");
     if (text == NULL)
     {
@@ -579,6 +728,157 @@ int createMessageInGroup(char *newMID, const char *UID, const char *GID, int TSi
     return 1;
 }
 
+int createMessageInGroup(char *newMID, const char *UID, const char *GID, int TSize, const char *Text)
+{
+    char stagePath[DS_GROUPSTAGEPATH_SIZE], msgDir[DS_STAGEDMSGDIRPATH_SIZE];
+    int mid;
+    if (!stageGroupMessage(GID, UID, TSize, Text, stagePath, msgDir) || !commitGroupStage(GID, stagePath, 1, &mid))
+    {
+        return 0;
+    }
+    snprintf(newMID, DS_MID_SIZE, "%04u", (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+    return 1;
+}
+
+int writeMessageHash(const char *msgDir, const char *hash)
+{
+    char groupMsgHashPath[DS_MSGFILEPATH_SIZE];
+    snprintf(groupMsgHashPath, DS_MSGFILEPATH_SIZE, "%s/H A S H.txt", msgDir);
+    FILE *hashFile = fopen(groupMsgHashPath, "w");
+    if (hashFile == NULL)
+    {
+        perror("[-] Failed to create message hash file");
+        return 0;
+    }
+    if (fprintf(hashFile, "%s\n", hash) != DS_HASH_SIZE)
+    {
+        perror("[-] Failed to write on message hash file");
+        fclose(hashFile);
+        return 0;
+    }
+    return fclose(hashFile) == 0;
+}
+
+int writeGroupMessageHash(const char *GID, const char *MID, const char *hash)
+{
+    char groupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
+    sprintf(groupMsgDSPath, "server/GROUPS/%s/MSG/%s", GID, MID);
+    return writeMessageHash(groupMsgDSPath, hash);
+}
+
+int createGroupStage(const char *GID, char *stagePath)
+{
+    // Hidden inside MSG: not a valid MID so every retrieve skips it, and on the same file system as the messages
+    snprintf(stagePath, DS_GROUPSTAGEPATH_SIZE, "server/GROUPS/%.2s/MSG/.PSB%d", GID, (int)getpid());
+    removeDirectory(stagePath); // Left behind by a dead process with the same PID
+    if (mkdir(stagePath, 0700) == -1)
+    {
+        perror("[-] Failed to create batch stage directory");
+        return 0;
+    }
+    return 1;
+}
+
+void stagedMessageDir(const char *stagePath, int index, char *msgDir)
+{
+    snprintf(msgDir, DS_STAGEDMSGDIRPATH_SIZE, "%s/%03d", stagePath, index % 1000);
+}
+
+int stageGroupMessage(const char *GID, const char *UID, int TSize, const char *Text, char *stagePath, char *msgDir)
+{
+    int span = beginDSSpan("writeGroupMessage");
+    int ok = createGroupStage(GID, stagePath);
+    if (ok)
+    {
+        stagedMessageDir(stagePath, 0, msgDir);
+        if (mkdir(msgDir, 0700) == -1 || !writeMessageFiles(msgDir, UID, TSize, Text))
+        {
+            removeDirectory(stagePath);
+            ok = 0;
+        }
+    }
+    endDSSpan(span);
+    return ok;
+}
+
+int commitGroupStage(const char *GID, const char *stagePath, int num, int *firstMID)
+{
+    // A deadline firing in the middle would leave allocated MIDs without their messages
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    int span = beginDSSpan("allocateGroupMIDs");
+    int ok = allocateGroupMIDs(GID, num, firstMID);
+    endDSSpan(span);
+    if (ok)
+    { // Each staged message replaces its empty MID directory in a single rename
+        char stagedDir[DS_STAGEDMSGDIRPATH_SIZE];
+        char groupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
+        int i;
+        for (i = 0; i < num; ++i)
+        {
+            stagedMessageDir(stagePath, i, stagedDir);
+            snprintf(groupMsgDSPath, DS_GROUPMSGDIRPATH_SIZE, "server/GROUPS/%.2s/MSG/%04d", GID, *firstMID + i);
+            if (rename(stagedDir, groupMsgDSPath) == -1)
+            {
+                perror("[-] Failed to post staged message");
+                break;
+            }
+        }
+        if (i < num)
+        { // Messages that were already renamed are removed along with the rest
+            removeGroupMessages(GID, *firstMID, num);
+            ok = 0;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    removeDirectory(stagePath);
+    return ok;
+}
+
+int flushGroupMessages(const char *GID)
+{
+    // A single syncfs flushes every file of the batch instead of one fsync per file
+    char dsGroupMsgPath[DS_GROUPMSGPATH_SIZE];
+    sprintf(dsGroupMsgPath, "server/GROUPS/%s/MSG", GID);
+    int dirFd = open(dsGroupMsgPath, O_RDONLY | O_DIRECTORY);
+    if (dirFd == -1)
+    {
+        return 0;
+    }
+    int ret = syncfs(dirFd);
+    close(dirFd);
+    return ret == 0;
+}
+
+int removeGroupMessages(const char *GID, int firstMID, int num)
+{
+    int ok = 1;
+    char groupMsgDSPath[DS_GROUPMSGDIRPATH_SIZE];
+    for (int i = 0; i < num; ++i)
+    {
+        snprintf(groupMsgDSPath, DS_GROUPMSGDIRPATH_SIZE, "server/GROUPS/%.2s/MSG/%04d", GID, firstMID + i);
+        ok = removeDirectory(groupMsgDSPath) && ok;
+    }
+    return ok;
+}
+
+/**
+ * @brief Checks if a message directory holds a posted message. Every post is written aside and renamed whole into
+ * the directory it allocated, so a directory without the text belongs to a post being committed or to one that failed.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @return 1 if the message was posted, 0 otherwise.
+ */
+static int messagePosted(const char *GID, const char *MID)
+{
+    char groupMsgTextPath[DS_GROUPMSGTEXTPATH_SIZE];
+    snprintf(groupMsgTextPath, DS_GROUPMSGTEXTPATH_SIZE, "server/GROUPS/%.2s/MSG/%.4s/T E X T.txt", GID, MID);
+    return access(groupMsgTextPath, F_OK) == 0;
+}
+
 int checkNumberOfMsgsToRet(const char *GID, int MID)
 {
     struct dirent **dir;
@@ -592,7 +892,8 @@ int checkNumberOfMsgsToRet(const char *GID, int MID)
     }
     for (int i = 0; i < n; ++i)
     {
-        if (dir[i]->d_type == DT_DIR && validMID(dir[i]->d_name) && atoi(dir[i]->d_name) >= MID)
+        if (num < 20 && dir[i]->d_type == DT_DIR && validMID(dir[i]->d_name) && atoi(dir[i]->d_name) >= MID &&
+            messagePosted(GID, dir[i]->d_name))
         {
             num++;
         }
@@ -602,214 +903,599 @@ int checkNumberOfMsgsToRet(const char *GID, int MID)
     return (num > 20) ? 20 : num;
 }
 
-int retrieveDSGroupMessages(int fd, const char *GID, int startMID, int numMsgsToRet)
+int waitForGroupMessages(const char *GID, int MID, int waitSecs)
 {
-    struct dirent **msg;
-    char dsGroupMsgPath[DS_GROUPMSGPATH_SIZE];
-    sprintf(dsGroupMsgPath, "server/GROUPS/%s/MSG", GID);
-    int n = scandir(dsGroupMsgPath, &msg, 0, alphasort);
-    if (n < 0)
-    { // scandir failed
+    int gid = atoi(GID);
+    if (gid <= 0 || gid >= DS_MAX_NUM_GROUPS)
+    {
         return 0;
     }
-    int numMsgsRtvd = 0;
-    for (int i = 0; i < n; ++i)
+    // Only the group's own waiters are woken up by its posts, so nothing is rescanned while waiting
+    struct timespec now, end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += waitSecs;
+    while (1)
     {
-        if (msg[i]->d_type == DT_DIR && validMID(msg[i]->d_name) && atoi(msg[i]->d_name) >= startMID && numMsgsRtvd < numMsgsToRet)
-        { // We found a message directory from a message that is supposed to be retrieved
-            char MID[DS_MID_SIZE] = "";
-            strncpy(MID, msg[i]->d_name, DS_MID_SIZE - 1);
-            MID[DS_MID_SIZE - 1] = '\0';
-            // Open the message directory and check its content looking for a file
-
-            char messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
-            sprintf(messageDSGroupPath, "server/GROUPS/%s/MSG/%s", GID, MID);
-            DIR *msgDir = opendir(messageDSGroupPath);
-            if (msgDir == NULL)
-            { // opendir failed
-                return 0;
-            }
-            // Message file related variables
-            char groupMsgFilePath[DS_GROUPMSGFILEPATH_SIZE] = "";
-            char groupMsgFileName[PROTOCOL_FNAME_SIZE] = "";
-            struct dirent *msgEntry;
-            int msgFileFlag = NO_FILE;
-            FILE *file;
-            long fileLength;
-            while ((msgEntry = readdir(msgDir)) != NULL)
-            { // Check if message has a file attached
-                if (!strcmp(".", msgEntry->d_name) || !strcmp("..", msgEntry->d_name) || !strcmp(msgEntry->d_name, "A U T H O R.txt") || !strcmp(msgEntry->d_name, "T E X T.txt"))
-                {
-                    continue;
-                }
-                if (msgEntry->d_type == DT_REG)
-                { // Message has a file attached
-                    msgFileFlag = HAS_FILE;
-                    memset(groupMsgFilePath, 0, sizeof(groupMsgFilePath));
-                    memset(groupMsgFileName, 0, sizeof(groupMsgFileName));
-                    if (strlen(msgEntry->d_name) > 24)
-                    { // Unexpected file name format -> NOK
-                        return 0;
-                    }
-                    size_t lenFName = strlen(msgEntry->d_name);
-                    strncpy(groupMsgFileName, msgEntry->d_name, lenFName);
-                    groupMsgFileName[lenFName] = '\0';
-                    sprintf(groupMsgFilePath, "server/GROUPS/%s/MSG/%s/%s", GID, MID, groupMsgFileName);
-                    file = fopen(groupMsgFilePath, "rb");
-                    if (file == NULL)
-                    {
-                        return 0;
-                    }
-                    if (fseek(file, 0, SEEK_END) == -1)
-                    {
-                        return 0;
-                    }
-                    fileLength = ftell(file);
-                    if (fileLength == -1)
-                    {
-                        return 0;
-                    }
-                    rewind(file);
-                    if (fclose(file) == -1)
-                    {
-                        return 0;
-                    }
-                }
-            }
-            if (closedir(msgDir) == -1)
-            { // closedir failed
-                return 0;
-            }
+        unsigned int seen = __atomic_load_n(&dsNotify->groupSeq[gid], __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&dsNotify->groupLastMID[gid], __ATOMIC_ACQUIRE) >= MID)
+        {
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long remainingMsec = (end.tv_sec - now.tv_sec) * 1000L + (end.tv_nsec - now.tv_nsec) / 1000000L;
+        if (remainingMsec <= 0)
+        {
+            return 0;
+        }
+        waitForPost(&dsNotify->groupSeq[gid], seen, remainingMsec);
+    }
+}
 
-            // Open author and text files and read them
-            FILE *author;
-            char groupMsgAuthorPath[DS_GROUPMSGAUTHORPATH_SIZE];
-            int lenAuthor;
-            sprintf(groupMsgAuthorPath, "server/GROUPS/%s/MSG/%s/A U T H O R.txt", GID, MID);
-            FILE *text;
-            char groupMsgTextPath[DS_GROUPMSGTEXTPATH_SIZE];
-            int lenText;
-            sprintf(groupMsgTextPath, "server/GROUPS/%s/MSG/%s/T E X T.txt", GID, MID);
-            // A U T H O R.txt
-            author = fopen(groupMsgAuthorPath, "r");
-            if (author == NULL)
-            {
-                return 0;
-            }
-            if (fseek(author, 0, SEEK_END) == -1)
-            {
-                return 0;
-            }
-            lenAuthor = ftell(author) - 1; // author has \n so we avoid this extra byte
-            if (lenAuthor == -2)
-            {
-                return 0;
-            }
-            rewind(author);
-            if (lenAuthor != CLIENT_UID_SIZE - 1)
-            { // Invalid author was written -> it must a valid client ID
-                return 0;
-            }
-            // T E X T.txt
-            text = fopen(groupMsgTextPath, "r");
-            if (text == NULL)
-            {
-                return 0;
-            }
-            if (fseek(text, 0, SEEK_END) == -1)
-            {
-                return 0;
-            }
-            lenText = ftell(text);
-            if (lenText == -1)
-            {
-                return 0;
-            }
-            rewind(text);
-            if (lenText > 240)
-            { // Size verification
-                return 0;
-            }
-            // Allocate needed memory for both buffers
-            char *msgAuthor = (char *)calloc(sizeof(char), lenAuthor + 1);
-            if (!msgAuthor)
-            {
-                return 0;
-            }
-            char *msgText = (char *)calloc(sizeof(char), lenText + 1);
-            if (!msgText)
-            {
-                free(msgAuthor);
-                return 0;
-            }
-            // Fill both buffers
-            if (fread(msgAuthor, sizeof(char), lenAuthor, author) == -1)
-            {
-                return 0;
-            }
-            if (fread(msgText, sizeof(char), lenText, text) == -1)
-            {
-                return 0;
-            }
-            if (fclose(author) == -1)
-            {
+/* Struct that keeps everything about a stored DS group message except its file's content */
+typedef struct groupmsg
+{
+    char UID[CLIENT_UID_SIZE];
+    char Text[PROTOCOL_TEXT_SIZE];
+    int TSize;
+    int hasFile; // NO_FILE or HAS_FILE
+    char FName[PROTOCOL_FNAME_SIZE];
+    char FPath[DS_GROUPMSGFILEPATH_SIZE];
+    long FSize;
+} GroupMessage;
+
+/**
+ * @brief Reads a small file that must have at most maxLen bytes.
+ *
+ * @param path string that contains the file's path.
+ * @param buf buffer with room for maxLen + 1 bytes.
+ * @param maxLen maximum number of bytes of the file.
+ * @return number of bytes read, -1 on failure or if the file is too large.
+ */
+static int readSmallFile(const char *path, char *buf, int maxLen)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    size_t n = fread(buf, sizeof(char), maxLen + 1, file);
+    if (ferror(file) || fclose(file) == -1 || n > (size_t)maxLen)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief Loads the author, text and file information of a DS group message.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param m struct that will contain the message.
+ * @return 1 if the message was loaded, 0 otherwise.
+ */
+static int loadGroupMessage(const char *GID, const char *MID, GroupMessage *m)
+{
+    // Open the message directory and check its content looking for a file
+    char messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
+    sprintf(messageDSGroupPath, "server/GROUPS/%s/MSG/%s", GID, MID);
+    DIR *msgDir = opendir(messageDSGroupPath);
+    if (msgDir == NULL)
+    { // opendir failed
+        return 0;
+    }
+    struct dirent *msgEntry;
+    struct stat fileStats;
+    m->hasFile = NO_FILE;
+    m->FSize = 0;
+    while ((msgEntry = readdir(msgDir)) != NULL)
+    { // Check if message has a file attached
+        if (!strcmp(".", msgEntry->d_name) || !strcmp("..", msgEntry->d_name) || !strcmp(msgEntry->d_name, "A U T H O R.txt") || !strcmp(msgEntry->d_name, "T E X T.txt") ||
+            !strcmp(msgEntry->d_name, "H A S H.txt"))
+        {
+            continue;
+        }
+        if (msgEntry->d_type == DT_REG)
+        { // Message has a file attached
+            if (strlen(msgEntry->d_name) > 24)
+            { // Unexpected file name format -> NOK
+                closedir(msgDir);
                 return 0;
             }
-            if (fclose(text) == -1)
+            m->hasFile = HAS_FILE;
+            strcpy(m->FName, msgEntry->d_name);
+            sprintf(m->FPath, "server/GROUPS/%s/MSG/%s/%s", GID, MID, m->FName);
+            if (stat(m->FPath, &fileStats) == -1)
             {
+                closedir(msgDir);
                 return 0;
             }
-            msgAuthor[lenAuthor] = '\0';
-            msgText[lenText] = '\0';
-            if (!validUID(msgAuthor))
-            { // Author verification
-                return 0;
-            }
+            m->FSize = fileStats.st_size;
+        }
+    }
+    if (closedir(msgDir) == -1)
+    { // closedir failed
+        return 0;
+    }
+
+    // A U T H O R.txt has the UID followed by a nl
+    char groupMsgAuthorPath[DS_GROUPMSGAUTHORPATH_SIZE];
+    char author[CLIENT_UID_SIZE + 1];
+    sprintf(groupMsgAuthorPath, "server/GROUPS/%s/MSG/%s/A U T H O R.txt", GID, MID);
+    if (readSmallFile(groupMsgAuthorPath, author, CLIENT_UID_SIZE) != CLIENT_UID_SIZE)
+    { // Invalid author was written -> it must a valid client ID
+        return 0;
+    }
+    author[CLIENT_UID_SIZE - 1] = '\0';
+    if (!validUID(author))
+    { // Author verification
+        return 0;
+    }
+    strcpy(m->UID, author);
+
+    // T E X T.txt
+    char groupMsgTextPath[DS_GROUPMSGTEXTPATH_SIZE];
+    sprintf(groupMsgTextPath, "server/GROUPS/%s/MSG/%s/T E X T.txt", GID, MID);
+    m->TSize = readSmallFile(groupMsgTextPath, m->Text, PROTOCOL_TEXT_SIZE - 1);
+    return m->TSize != -1;
+}
+
+/**
+ * @brief Gets the content hash of a message's file. Messages posted before hashes were kept get theirs
+ * computed once and stored.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param m message with a file attached.
+ * @param hash buffer with room for DS_HASH_SIZE bytes.
+ * @return 1 if the hash is known, 0 otherwise.
+ */
+static int groupMessageHash(const char *GID, const char *MID, const GroupMessage *m, char *hash)
+{
+    char groupMsgHashPath[DS_GROUPMSGHASHPATH_SIZE];
+    sprintf(groupMsgHashPath, "server/GROUPS/%s/MSG/%s/H A S H.txt", GID, MID);
+    char stored[DS_HASH_SIZE + 1];
+    if (readSmallFile(groupMsgHashPath, stored, DS_HASH_SIZE) == DS_HASH_SIZE && stored[DS_HASH_SIZE - 1] == '\n')
+    {
+        stored[DS_HASH_SIZE - 1] = '\0';
+        strcpy(hash, stored);
+        return 1;
+    }
+    return sha256File(m->FPath, hash) && writeGroupMessageHash(GID, MID, hash);
+}
 
-            // Send a message to the client
-            char msgTextMessage[DS_MSGTEXTINFO_SIZE] = "";
-            sprintf(msgTextMessage, " %s %s %d %s", MID, msgAuthor, lenText, msgText);
-            if (sendTCP(fd, msgTextMessage) == -1)
+/**
+ * @brief Queues a single DS group message (and its file, if it has one) to be sent to the client.
+ *
+ * @param q output queue of the TCP connection.
+ * @param prefix string that goes before the message ID (empty for RTV).
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param fileMode HAS_FILE to send the file's content after its name and size, NO_FILE to only announce it
+ * or FILE_META to announce it with its content hash.
+ * @return 1 if the message was queued, 0 otherwise.
+ */
+static int queueGroupMessage(OutQueue *q, const char *prefix, const char *GID, const char *MID, int fileMode)
+{
+    GroupMessage m;
+    if (!loadGroupMessage(GID, MID, &m))
+    {
+        return 0;
+    }
+
+    // Queue the message to the client
+    char msgTextMessage[DS_PUSHPREFIX_SIZE + DS_MSGTEXTINFO_SIZE] = "";
+    int lenMsg = sprintf(msgTextMessage, "%s %s %s %d %s", prefix, MID, m.UID, m.TSize, m.Text);
+    if (!outqPushBuffer(q, msgTextMessage, lenMsg))
+    {
+        return 0;
+    }
+
+    // Queues the file if it has one to send
+    if (m.hasFile == HAS_FILE)
+    {
+        char msgFileMessage[DS_MSGFILEMETA_SIZE] = "";
+        if (fileMode == FILE_META)
+        { // The file itself is fetched on demand with RTF
+            char hash[DS_HASH_SIZE];
+            if (!groupMessageHash(GID, MID, &m, hash))
             {
                 return 0;
             }
+            lenMsg = sprintf(msgFileMessage, " / %s %ld %s", m.FName, m.FSize, hash);
+        }
+        else
+        {
+            lenMsg = sprintf(msgFileMessage, (fileMode == HAS_FILE) ? " / %s %ld " : " / %s %ld", m.FName, m.FSize);
+        }
+        if (!outqPushBuffer(q, msgFileMessage, lenMsg))
+        {
+            return 0;
+        }
+        if (fileMode != HAS_FILE)
+        {
+            return 1;
+        }
+        extendTCPDeadline(m.FSize);
+        if (!outqPushFile(q, m.FPath, 0, m.FSize))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-            // Sends a file if it has one to send
-            if (msgFileFlag == HAS_FILE)
-            {
-                char msgFileMessage[DS_MSGFILEINFO_SIZE] = "";
-                sprintf(msgFileMessage, " / %s %ld ", groupMsgFileName, fileLength);
-                if (sendTCP(fd, msgFileMessage) == -1)
-                {
-                    return 0;
-                }
-                if (!sendFile(fd, groupMsgFilePath, fileLength))
-                {
-                    return 0;
-                }
-            }
-            free(msgAuthor);
-            free(msgText);
+/**
+ * @brief Queues a single DS group message as a binary record followed by its text, file name and file data.
+ *
+ * @param q output queue of the TCP connection.
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @return 1 if the message was queued, 0 otherwise.
+ */
+static int queueBinaryGroupMessage(OutQueue *q, const char *GID, const char *MID)
+{
+    GroupMessage m;
+    if (!loadGroupMessage(GID, MID, &m))
+    {
+        return 0;
+    }
+    BinRecord r;
+    r.UID = atoi(m.UID);
+    r.ID = atoi(MID);
+    r.TSize = m.TSize;
+    r.FNameLen = (m.hasFile == HAS_FILE) ? strlen(m.FName) : 0;
+    r.FSize = m.FSize;
+    unsigned char record[BIN_RECORD_SIZE + PROTOCOL_TEXT_SIZE + PROTOCOL_FNAME_SIZE];
+    binPackRecord(record, &r);
+    memcpy(record + BIN_RECORD_SIZE, m.Text, r.TSize);
+    memcpy(record + BIN_RECORD_SIZE + r.TSize, m.FName, r.FNameLen);
+    if (!outqPushBuffer(q, (char *)record, BIN_RECORD_SIZE + r.TSize + r.FNameLen))
+    {
+        return 0;
+    }
+    if (m.hasFile == HAS_FILE)
+    {
+        extendTCPDeadline(m.FSize);
+        return outqPushFile(q, m.FPath, 0, m.FSize);
+    }
+    return 1;
+}
+
+/**
+ * @brief Queues the messages of a retrieve, with flow control.
+ *
+ * @param q output queue of the TCP connection.
+ * @param GID string that contains the group ID.
+ * @param startMID integer that contains the starting message.
+ * @param numMsgsToRet integer that contains N.
+ * @param binary 1 to queue binary records, 0 to queue the text protocol messages.
+ * @param fileMode HAS_FILE to send the files inline or FILE_META to send only their metadata (text protocol only).
+ * @return 1 if every message was queued, 0 otherwise.
+ */
+static int queueRetrievedMessages(OutQueue *q, const char *GID, int startMID, int numMsgsToRet, int binary, int fileMode)
+{
+    struct dirent **msg;
+    char dsGroupMsgPath[DS_GROUPMSGPATH_SIZE];
+    sprintf(dsGroupMsgPath, "server/GROUPS/%s/MSG", GID);
+    int n = scandir(dsGroupMsgPath, &msg, 0, alphasort);
+    if (n < 0)
+    { // scandir failed
+        return 0;
+    }
+
+    int ok = 1;
+    int numMsgsRtvd = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (ok && msg[i]->d_type == DT_DIR && validMID(msg[i]->d_name) && atoi(msg[i]->d_name) >= startMID && numMsgsRtvd < numMsgsToRet &&
+            messagePosted(GID, msg[i]->d_name))
+        { // We found a message directory from a message that is supposed to be retrieved
+            char MID[DS_MID_SIZE] = "";
+            snprintf(MID, DS_MID_SIZE, "%.4s", msg[i]->d_name); // validMID checked it's at most 4 digits
+            ok = (binary ? queueBinaryGroupMessage(q, GID, MID) : queueGroupMessage(q, "", GID, MID, fileMode)) && outqThrottle(q);
             numMsgsRtvd++;
         }
         free(msg[i]);
     }
     free(msg);
+    return ok;
+}
+
+int retrieveDSGroupMessages(int fd, const char *GID, int startMID, int numMsgsToRet, int fileMode)
+{
+    // Messages are produced into the connection's output queue: a slow client makes the DS
+    // stop reading messages once the queue reaches its high watermark instead of growing it
+    OutQueue q;
+    int ok = outqInit(&q, fd, DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK) && queueRetrievedMessages(&q, GID, startMID, numMsgsToRet, 0, fileMode);
     // Every reply must end with a nl
-    if (sendTCP(fd, "\n") == -1)
+    ok = ok && outqPushBuffer(&q, "\n", 1) && outqFinish(&q);
+    outqFree(&q);
+    if (!ok)
     {
         return 0;
     }
 
-    // Wait for message confirmation from client
+    // Wait for message confirmation from client (the reply was sent so the request isn't timed any longer)
+    stopDSTimer();
+    finishDSTrace();
     // Since the message confirmation nature is ambiguous per the statement we assume a client won't send a
     // confirmation with more than 256 characters
     char clientRetrieveConfirmation[DS_RETCONFBUF_SIZE] = "";
     int b;
-    if ((b = readTCP(fd, clientRetrieveConfirmation, DS_RETCONFBUF_SIZE)) == -1)
+    if ((b = readTCP(fd, clientRetrieveConfirmation, DS_RETCONFBUF_SIZE - 1)) == -1)
     {
         return 0;
     }
     clientRetrieveConfirmation[b] = '\0';
     return 1;
-}
\ No newline at end of file
+}
+
+int retrieveDSGroupMessagesBinary(int fd, const char *GID, int startMID, int numMsgsToRet)
+{
+    unsigned char header[BIN_HEADER_SIZE];
+    BinHeader h = {BIN_OP_RETRIEVE, BIN_OK, numMsgsToRet, 0};
+    binPackHeader(header, &h);
+    // Records are self-delimiting so there's neither a trailing nl nor a confirmation from the client
+    OutQueue q;
+    int ok = outqInit(&q, fd, DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK) && outqPushBuffer(&q, (char *)header, BIN_HEADER_SIZE);
+    ok = ok && queueRetrievedMessages(&q, GID, startMID, numMsgsToRet, 1, HAS_FILE) && outqFinish(&q);
+    outqFree(&q);
+    return ok;
+}
+
+int retrieveDSGroupMessageFile(int fd, const char *GID, const char *MID, long offset, long len)
+{
+    GroupMessage m;
+    if (!loadGroupMessage(GID, MID, &m) || offset > m.FSize)
+    {
+        return -1;
+    }
+    if (m.hasFile == NO_FILE)
+    {
+        return 0;
+    }
+    // The range is cut at the end of the file
+    len = MIN(len, m.FSize - offset);
+    char replyHeader[DS_RTFREPLY_SIZE];
+    int lenHeader = sprintf(replyHeader, "RRF OK %s %ld %ld %ld ", m.FName, m.FSize, offset, len);
+    OutQueue q;
+    int ok = outqInit(&q, fd, DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK) && outqPushBuffer(&q, replyHeader, lenHeader);
+    if (ok && len > 0)
+    {
+        extendTCPDeadline(len);
+        ok = outqPushFile(&q, m.FPath, offset, len);
+    }
+    // Every reply must end with a nl
+    ok = ok && outqPushBuffer(&q, "\n", 1) && outqFinish(&q);
+    outqFree(&q);
+    return ok ? 1 : -2;
+}
+
+void openMsgCursor(MsgCursor *c, const char *GID, int firstMID, int lastMID, const char *author)
+{
+    int gid = atoi(GID);
+    int committed = (gid > 0 && gid < DS_MAX_NUM_GROUPS) ? __atomic_load_n(&dsNotify->groupLastMID[gid], __ATOMIC_ACQUIRE) : 0;
+    strcpy(c->GID, GID);
+    strcpy(c->author, author);
+    c->nextMID = firstMID;
+    c->lastMID = MIN(lastMID, committed);
+}
+
+/**
+ * @brief Checks if a message was posted by a given user.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param author string that contains the user ID.
+ * @return 1 if it was, 0 otherwise.
+ */
+static int messageAuthoredBy(const char *GID, const char *MID, const char *author)
+{
+    char groupMsgAuthorPath[DS_GROUPMSGAUTHORPATH_SIZE];
+    char msgAuthor[CLIENT_UID_SIZE] = "";
+    sprintf(groupMsgAuthorPath, "server/GROUPS/%s/MSG/%s/A U T H O R.txt", GID, MID);
+    FILE *fp = fopen(groupMsgAuthorPath, "r");
+    if (fp == NULL)
+    {
+        return 0;
+    }
+    size_t n = fread(msgAuthor, sizeof(char), CLIENT_UID_SIZE - 1, fp);
+    fclose(fp);
+    msgAuthor[n] = '\0';
+    return !strcmp(msgAuthor, author);
+}
+
+int nextCursorMessage(MsgCursor *c, char *MID)
+{
+    // MIDs are sequential so the cursor walks them instead of listing and sorting the whole directory
+    while (c->nextMID <= c->lastMID)
+    {
+        sprintf(MID, "%04d", c->nextMID++);
+        if (!messagePosted(c->GID, MID))
+        { // Post failed and was removed
+            continue;
+        }
+        if (c->author[0] == '\0' || messageAuthoredBy(c->GID, MID, c->author))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int streamDSGroupMessages(int fd, MsgCursor *c, const char *firstMID)
+{
+    OutQueue q;
+    if (!outqInit(&q, fd, DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK))
+    {
+        return 0;
+    }
+    char MID[DS_MID_SIZE];
+    strcpy(MID, firstMID);
+    int ok = 1;
+    do
+    { // Every message keeps the connection's deadline ahead of a client that is still reading
+        extendTCPDeadline(DS_MSGTEXTINFO_SIZE);
+        ok = queueGroupMessage(&q, "", c->GID, MID, HAS_FILE) && outqThrottle(&q);
+    } while (ok && nextCursorMessage(c, MID));
+    // Every reply must end with a nl
+    ok = ok && outqPushBuffer(&q, "\n", 1) && outqFinish(&q);
+    outqFree(&q);
+    return ok;
+}
+
+/**
+ * @brief Checks if the client on the other end of a TCP connection is still there.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @return 1 if the connection is still open, 0 otherwise.
+ */
+static int clientConnected(int fd)
+{
+    char discard[DS_RETCONFBUF_SIZE];
+    ssize_t n = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+    return n > 0 || (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+/**
+ * @brief Queues a post that is pushed to a subscriber (NEW GID MID UID TSize Text[ / FName FSize]).
+ * The attached file is only announced: the client retrieves it if it wants it.
+ *
+ * @param q output queue of the TCP connection.
+ * @param GID string that contains the group ID.
+ * @param mid message ID.
+ * @return 1 if the post was queued, 0 if it doesn't exist (anymore).
+ */
+static int queuePushedMessage(OutQueue *q, const char *GID, int mid)
+{
+    char MID[DS_MID_SIZE];
+    char messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
+    char prefix[DS_PUSHPREFIX_SIZE];
+    if (mid <= 0 || mid > DS_MAX_NUM_MSGS)
+    {
+        return 0;
+    }
+    snprintf(MID, DS_MID_SIZE, "%04u", (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+    sprintf(messageDSGroupPath, "server/GROUPS/%s/MSG/%s", GID, MID);
+    sprintf(prefix, "NEW %s", GID);
+    if (!directoryExists(messageDSGroupPath))
+    { // Post failed and was removed after being announced
+        return 0;
+    }
+    return queueGroupMessage(q, prefix, GID, MID, NO_FILE) && outqPushBuffer(q, "\n", 1);
+}
+
+/**
+ * @brief Checks if a MID was allocated in a group, i.e. if its directory exists.
+ *
+ * @param GID string that contains the group ID.
+ * @param mid message ID.
+ * @return 1 if it was, 0 otherwise.
+ */
+static int groupMIDAllocated(const char *GID, int mid)
+{
+    char messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
+    snprintf(messageDSGroupPath, DS_GROUPMSGDIRPATH_SIZE, "server/GROUPS/%s/MSG/%04u", GID, (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+    return directoryExists(messageDSGroupPath);
+}
+
+int streamDSGroupPosts(int fd, const char *UID)
+{
+    // Only posts committed from now on are pushed
+    int lastSent[DS_MAX_NUM_GROUPS];
+    for (int i = 0; i < DS_MAX_NUM_GROUPS; ++i)
+    {
+        lastSent[i] = __atomic_load_n(&dsNotify->groupLastMID[i], __ATOMIC_ACQUIRE);
+    }
+
+    // Each subscriber has its own bounded queue: once it's full the remaining posts stay on disk
+    // until the client catches up, so a slow subscriber never holds more than the high watermark
+    OutQueue q;
+    if (!outqInit(&q, fd, DS_PUSH_HIGH_WATERMARK, DS_PUSH_LOW_WATERMARK))
+    {
+        return 0;
+    }
+    // The reply only goes out after the snapshot so every post the client makes after it is pushed
+    if (!outqPushBuffer(&q, "RPS OK\n", strlen("RPS OK\n")))
+    {
+        outqFree(&q);
+        return 0;
+    }
+    time_t lastProgress = time(NULL);
+    int ok = 1;
+    while (ok)
+    {
+        // Read the counter before the last MIDs so that a post committed meanwhile isn't missed
+        unsigned int seen = __atomic_load_n(&dsNotify->commitSeq, __ATOMIC_ACQUIRE);
+        for (int i = 1; i < DS_MAX_NUM_GROUPS && q.queuedBytes < q.highWatermark; ++i)
+        {
+            int last = __atomic_load_n(&dsNotify->groupLastMID[i], __ATOMIC_ACQUIRE);
+            if (lastSent[i] >= last)
+            {
+                continue;
+            }
+            char GID[DS_GID_SIZE];
+            sprintf(GID, "%02d", i);
+            if (!userSubscribedToGroup(UID, GID))
+            {
+                lastSent[i] = last;
+                continue;
+            }
+            // Posts commit out of order so stop at the first MID that is still being written: it's retried on the
+            // next commit. A MID whose directory is gone was abandoned by a failed post and is skipped
+            while (lastSent[i] < last && q.queuedBytes < q.highWatermark)
+            {
+                if (!groupPostCommitted(i, lastSent[i] + 1) && groupMIDAllocated(GID, lastSent[i] + 1))
+                {
+                    break;
+                }
+                queuePushedMessage(&q, GID, ++lastSent[i]);
+            }
+        }
+
+        if (q.queuedBytes == 0)
+        { // Nothing to send so sleep until someone posts
+            lastProgress = time(NULL);
+            waitForPost(&dsNotify->commitSeq, seen, DS_PUSH_WAIT_MSEC);
+            ok = clientConnected(fd);
+            continue;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, DS_PUSH_WAIT_MSEC) == -1 && errno != EINTR)
+        {
+            break;
+        }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && !clientConnected(fd))
+        {
+            break;
+        }
+        if (pfd.revents & POLLOUT)
+        {
+            size_t queued = q.queuedBytes;
+            ok = outqFlush(&q);
+            if (q.queuedBytes < queued)
+            {
+                lastProgress = time(NULL);
+            }
+        }
+        if (time(NULL) - lastProgress > DS_PUSH_STALL_TIMEOUT)
+        { // Subscriber stopped reading
+            incrementDSStat(&dsStats->tcpTimeouts[STREAM]);
+            break;
+        }
+    }
+    outqFree(&q);
+    return 1;
+}
+
+int queueReplicaMessage(OutQueue *q, const char *GID, const char *MID)
+{
+    char prefix[DS_PUSHPREFIX_SIZE];
+    sprintf(prefix, "MSG %s", GID);
+    return queueGroupMessage(q, prefix, GID, MID, HAS_FILE) && outqPushBuffer(q, "\n", 1);
+}
@@ -3,6 +3,14 @@
 
 #include "../../centralizedmsg-api.h"
 #include "../../centralizedmsg-api-constants.h"
+#include "../../centralizedmsg-binary.h"
+#include "ds-deadline.h"
+#include "ds-outqueue.h"
+#include "ds-arena.h"
+#include "ds-notify.h"
+#include "ds-stats.h"
+#include "ds-trace.h"
+#include "ds-hash.h"
 
 /* Struct that mantains information about each group in the DS */
 typedef struct ginfo
@@ -18,15 +26,44 @@ typedef struct glist
     int no_groups;
 } GroupList;
 
+/* Struct that keeps the position of a streaming retrieve in a group (a server-side cursor) */
+typedef struct msgcursor
+{
+    char GID[DS_GID_SIZE];
+    int nextMID;                  // next message ID to look at
+    int lastMID;                  // last message ID of the range
+    char author[CLIENT_UID_SIZE]; // only messages posted by this user are returned ("" for any user)
+} MsgCursor;
+
 /* Variable that is used to keep all information about the DS's groups */
 extern GroupList dsGroups;
 
+/* Shard of the groups this DS holds: it owns every GID with (GID - 1) % dsNumShards == dsShardIndex */
+extern int dsShardIndex;
+extern int dsNumShards;
+
 /**
  * @brief Fills the dsGroups struct variable with all the existing groups in the beggining of the program.
  *
  */
 void fillDSGroupsInfo();
 
+/**
+ * @brief Checks if a group exists in this DS.
+ *
+ * @param gid integer that contains the group ID.
+ * @return 1 if it exists, 0 otherwise.
+ */
+int groupInDS(int gid);
+
+/**
+ * @brief Picks the ID of a new group: the next one in a DS that holds every group or the lowest free one
+ * this shard owns.
+ *
+ * @return the new group ID, 0 if the DS (or shard) is full.
+ */
+int nextDSGroupID();
+
 /**
  * @brief Checks if a given path is a directory.
  *
@@ -35,6 +72,53 @@ void fillDSGroupsInfo();
  */
 int directoryExists(const char *path);
 
+/**
+ * @brief Reads a small DS file (a password, a group name...) with a single read and no stdio buffers.
+ *
+ * @param path string that contains the path of the file.
+ * @param buffer buffer the file is read to (it's NUL terminated).
+ * @param size size of buffer.
+ * @return number of bytes read, -1 if the file couldn't be read.
+ */
+int readDSFile(const char *path, char *buffer, size_t size);
+
+/**
+ * @brief Creates a small DS file (or truncates it) with the given content and no stdio buffers.
+ *
+ * @param path string that contains the path of the file.
+ * @param content content of the file.
+ * @param len number of bytes of content (0 creates an empty file).
+ * @return 1 if the file was written, 0 otherwise.
+ */
+int writeDSFile(const char *path, const char *content, size_t len);
+
+/**
+ * @brief Checks if a string is a stored password record (Salt:Hash).
+ *
+ * @param record string to be checked.
+ * @return 1 if it's a password record, 0 otherwise.
+ */
+int validPasswordRecord(const char *record);
+
+/**
+ * @brief Creates the record a password is stored as: a random salt and the SHA-256 of the salt followed by the
+ * password, so that the password itself is never written to the disk.
+ *
+ * @param userPW string that contains the password.
+ * @param record buffer with room for DS_PWDRECORD_SIZE bytes.
+ * @return 1 if the record was created, 0 otherwise.
+ */
+int createPasswordRecord(const char *userPW, char *record);
+
+/**
+ * @brief Reads the stored password record of a DS client.
+ *
+ * @param userID string that contains the ID of the client.
+ * @param record buffer with room for DS_PWDRECORD_SIZE bytes (left empty if there's no valid record).
+ * @return 1 if the record was read, 0 otherwise.
+ */
+int readPasswordRecord(const char *userID, char *record);
+
 /**
  * @brief Checks if a given DS client password matches the stored one.
  *
@@ -44,6 +128,14 @@ int directoryExists(const char *path);
  */
 int passwordsMatch(const char *userID, const char *userPW);
 
+/**
+ * @brief Replaces the passwords stored in clear by a DS that didn't hash them yet with their records.
+ * Each pass file is replaced through a temporary file and rename() so a crash never leaves it truncated.
+ * Must be called before the DS forks.
+ *
+ */
+void hashStoredPasswords();
+
 /**
  * @brief Unsubscribes a given user ID from all of its subscribed groups.
  *
@@ -64,7 +156,7 @@ int removeDirectory(const char *path);
  * @brief Puts in a given buffer a message containing all desired DS groups.
  *
  * @param buffer string that will contain the DS groups.
- * @param groups if NULL add to buffer all DS groups, otherwise add to buffer all client subscribed groups.
+ * @param groups if NULL add to buffer all DS groups, otherwise add to buffer the groups with these IDs.
  * @param num if 0 then add to buffer all DS groups, otherwise add to buffer all client subscribed groups.
  * @return 1 if buffer contains all desired DS groups, 0 otherwise.
  */
@@ -80,10 +172,10 @@ int createGroupListMessage(char *buffer, int *groups, int num);
 int groupNamesMatch(const char *GID, const char *GName);
 
 /**
- * @brief Fills an integer array with the groups that the user with ID UID is subscribed to.
+ * @brief Fills an integer array with the IDs of the groups that the user with ID UID is subscribed to.
  *
  * @param UID string that contains the client ID.
- * @param clientGroupsSubscribed array that will be filled with the groups.
+ * @param clientGroupsSubscribed array that will be filled with the group IDs (sorted).
  * @param numGroupsSub reference to integer containing number of groups that client is subscribed to.
  * @return 1 if the array was properly filled, 0 otherwise.
  */
@@ -93,7 +185,7 @@ int fillClientSubscribedGroups(const char *UID, int *clientGroupsSubscribed, int
  * @brief Buffers all users in a given DS group.
  *
  * @param GID string that contains the group ID.
- * @return buffer that contains all the users subscribed to the group with ID GID.
+ * @return buffer (from the request arena) that contains all the users subscribed to the group with ID GID.
  */
 char *listUsersInDSGroup(const char *GID);
 
@@ -107,7 +199,119 @@ char *listUsersInDSGroup(const char *GID);
 int userSubscribedToGroup(const char *UID, const char *GID);
 
 /**
- * @brief Creates a new message in a group.
+ * @brief Finds the highest message ID of a group.
+ *
+ * @param GID string that contains the group ID.
+ * @return highest message ID (0 if the group has no messages), -1 on failure.
+ */
+int lastGroupMID(const char *GID);
+
+/**
+ * @brief Allocates a range of consecutive message IDs in a group by creating their directories. MIDs a concurrent
+ * post takes first are skipped.
+ *
+ * @param GID string that contains the group ID.
+ * @param num number of message IDs to allocate.
+ * @param firstMID first allocated message ID.
+ * @return 1 if the whole range was allocated, 0 otherwise (e.g. the group reached the message limit).
+ */
+int allocateGroupMIDs(const char *GID, int num, int *firstMID);
+
+/**
+ * @brief Writes the author and text of a message into an existing directory.
+ *
+ * @param msgDir string that contains the path of the message directory.
+ * @param UID string that contains the author's user ID.
+ * @param TSize size of the text.
+ * @param Text string that contains the text.
+ * @return 1 if the message was written, 0 otherwise.
+ */
+int writeMessageFiles(const char *msgDir, const char *UID, int TSize, const char *Text);
+
+/**
+ * @brief Stores the content hash of a message's file so that retrieves don't have to read the file.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param hash string that contains the hash as hex.
+ * @return 1 if the hash was written, 0 otherwise.
+ */
+int writeGroupMessageHash(const char *GID, const char *MID, const char *hash);
+
+/**
+ * @brief Stores the content hash of a file in a message directory (posted or staged).
+ *
+ * @param msgDir string that contains the path of the message directory.
+ * @param hash string that contains the hash as hex.
+ * @return 1 if the hash was written, 0 otherwise.
+ */
+int writeMessageHash(const char *msgDir, const char *hash);
+
+/**
+ * @brief Creates the directory where the messages of a batch (or a single post) are written before they're posted. Retrieves never
+ * look into it.
+ *
+ * @param GID string that contains the group ID.
+ * @param stagePath buffer with room for DS_GROUPSTAGEPATH_SIZE bytes that will contain the directory's path.
+ * @return 1 if it was created, 0 otherwise.
+ */
+int createGroupStage(const char *GID, char *stagePath);
+
+/**
+ * @brief Gets the directory of a message staged in a batch (created by the caller).
+ *
+ * @param stagePath string that contains the path of the batch's stage directory.
+ * @param index position of the message in the batch.
+ * @param msgDir buffer with room for DS_STAGEDMSGDIRPATH_SIZE bytes that will contain the path.
+ */
+void stagedMessageDir(const char *stagePath, int index, char *msgDir);
+
+/**
+ * @brief Writes the author and text of a single message in a stage of its own, where its file (if any) is written
+ * too before commitGroupStage posts it.
+ *
+ * @param GID string that contains the group ID.
+ * @param UID string that contains the author's user ID.
+ * @param TSize size of the text.
+ * @param Text string that contains the text.
+ * @param stagePath buffer with room for DS_GROUPSTAGEPATH_SIZE bytes that will contain the stage directory's path.
+ * @param msgDir buffer with room for DS_STAGEDMSGDIRPATH_SIZE bytes that will contain the staged message's path.
+ * @return 1 if the message was staged, 0 otherwise (nothing is left behind).
+ */
+int stageGroupMessage(const char *GID, const char *UID, int TSize, const char *Text, char *stagePath, char *msgDir);
+
+/**
+ * @brief Posts every message staged in a batch: allocates their consecutive message IDs and renames each message
+ * into its directory, so retrieves see whole messages only. The stage directory is removed either way.
+ *
+ * @param GID string that contains the group ID.
+ * @param stagePath string that contains the path of the batch's stage directory.
+ * @param num number of staged messages.
+ * @param firstMID first message ID of the batch.
+ * @return 1 if the whole batch was posted, 0 otherwise (none of it is).
+ */
+int commitGroupStage(const char *GID, const char *stagePath, int num, int *firstMID);
+
+/**
+ * @brief Flushes a group's new messages to storage.
+ *
+ * @param GID string that contains the group ID.
+ * @return 1 if they were flushed, 0 otherwise.
+ */
+int flushGroupMessages(const char *GID);
+
+/**
+ * @brief Removes a range of consecutive messages of a group (e.g. a post that failed midway).
+ *
+ * @param GID string that contains the group ID.
+ * @param firstMID first message ID of the range.
+ * @param num number of messages.
+ * @return 1 if every message was removed, 0 otherwise.
+ */
+int removeGroupMessages(const char *GID, int firstMID, int num);
+
+/**
+ * @brief Creates a new message (without a file) in a group.
  *
  * @param newMID string that will contain the new message ID.
  * @param UID string that contains the author of the message.
@@ -127,14 +331,101 @@ int createMessageInGroup(char *newMID, const char *UID, const char *GID, int TSi
  */
 int checkNumberOfMsgsToRet(const char *GID, int MID);
 
+/**
+ * @brief Sends a byte range of the file attached to a DS group message (RRF OK FName FSize Offset Len data\n).
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @param offset offset of the first byte of the range.
+ * @param len maximum number of bytes of the range (it's cut at the end of the file).
+ * @return 1 if the range was sent, 0 if the message has no file, -1 if it doesn't exist or the range starts
+ * past the end of the file, -2 if the connection failed while sending.
+ */
+int retrieveDSGroupMessageFile(int fd, const char *GID, const char *MID, long offset, long len);
+
+/**
+ * @brief Opens a cursor over a range of a group's messages. The range ends at the last message that
+ * was committed when the cursor was opened.
+ *
+ * @param c cursor to be opened.
+ * @param GID string that contains the group ID.
+ * @param firstMID first message ID of the range.
+ * @param lastMID last message ID of the range.
+ * @param author string that contains the user ID whose messages are wanted ("" for any user).
+ */
+void openMsgCursor(MsgCursor *c, const char *GID, int firstMID, int lastMID, const char *author);
+
+/**
+ * @brief Moves a cursor to the next existing message of its range that matches its filter.
+ *
+ * @param c cursor.
+ * @param MID string that will contain the message ID.
+ * @return 1 if a message was found, 0 at the end of the range.
+ */
+int nextCursorMessage(MsgCursor *c, char *MID);
+
+/**
+ * @brief Streams every message of a cursor to the client, with flow control, and ends the reply with a nl.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param c cursor positioned after the first message.
+ * @param firstMID string that contains the message ID of the first message.
+ * @return 1 if every message was sent, 0 otherwise.
+ */
+int streamDSGroupMessages(int fd, MsgCursor *c, const char *firstMID);
+
+/**
+ * @brief Parks a retrieve until a message at or after the given MID is committed in a group or the wait time ends.
+ *
+ * @param GID string that contains the group ID.
+ * @param MID starting message ID to retrieve.
+ * @param waitSecs maximum number of seconds to wait.
+ * @return 1 if there's a message to retrieve, 0 if the wait time ended.
+ */
+int waitForGroupMessages(const char *GID, int MID, int waitSecs);
+
 /**
  * @brief Retrieves N (1 <= N <= 20) messages from a given DS group.
  *
  * @param fd file descriptor where the TCP connection was made to request this command.
  * @param startMID integer that contains the starting message.
  * @param numMsgsToRet integer that contains N.
+ * @param fileMode HAS_FILE to send every attached file inline, FILE_META to only send their name, size and content hash.
+ * @return 1 if retrieve was successful, 0 otherwise.
+ */
+int retrieveDSGroupMessages(int fd, const char *GID, int startMID, int numMsgsToRet, int fileMode);
+
+/**
+ * @brief Retrieves N (1 <= N <= 20) messages from a given DS group as a binary frame (OK header and N records).
+ *
+ * @param fd file descriptor where the TCP connection was made to request this command.
+ * @param GID string that contains the group ID.
+ * @param startMID integer that contains the starting message.
+ * @param numMsgsToRet integer that contains N.
  * @return 1 if retrieve was successful, 0 otherwise.
  */
-int retrieveDSGroupMessages(int fd, const char *GID, int startMID, int numMsgsToRet);
+int retrieveDSGroupMessagesBinary(int fd, const char *GID, int startMID, int numMsgsToRet);
+
+/**
+ * @brief Replies RPS OK and then pushes, in MID order, every post committed in the groups a client is subscribed to
+ * until the client closes the connection or stops reading.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param UID string that contains the subscriber's user ID.
+ * @return 1 once the stream ended, 0 if it couldn't be started.
+ */
+int streamDSGroupPosts(int fd, const char *UID);
+
+/**
+ * @brief Queues a DS group message as a replicated change (MSG GID MID UID TSize Text[ / FName FSize data]
+ * and a nl), with its file inline so that the follower doesn't need to fetch it.
+ *
+ * @param q output queue of the replication connection.
+ * @param GID string that contains the group ID.
+ * @param MID string that contains the message ID.
+ * @return 1 if the message was queued, 0 otherwise.
+ */
+int queueReplicaMessage(OutQueue *q, const char *GID, const char *MID);
 
 #endif
\ No newline at end of file
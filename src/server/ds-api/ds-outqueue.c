@@ -0,0 +1,309 @@
+#include "ds-outqueue.h"
+#include "ds-arena.h"
+#include "ds-stats.h"
+#include "ds-deadline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+int outqInit(OutQueue *q, int fd, size_t highWatermark, size_t lowWatermark)
+{
+    memset(q, 0, sizeof(OutQueue));
+    q->fd = fd;
+    q->highWatermark = highWatermark;
+    q->lowWatermark = lowWatermark;
+    q->flags = fcntl(fd, F_GETFL);
+    if (q->flags == -1 || fcntl(fd, F_SETFL, q->flags | O_NONBLOCK) == -1)
+    {
+        perror("[-] Failed to make TCP socket non-blocking");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Appends a segment to the end of an output queue.
+ *
+ * @param q queue to append to.
+ * @param seg segment to be appended.
+ */
+static void appendSegment(OutQueue *q, OutSegment *seg)
+{
+    seg->next = NULL;
+    if (q->tail == NULL)
+    {
+        q->head = seg;
+    }
+    else
+    {
+        q->tail->next = seg;
+    }
+    q->tail = seg;
+}
+
+/**
+ * @brief Takes a segment that was already sent (keeping its chunk) or allocates one from the request arena.
+ *
+ * @param q queue the segment is for.
+ * @return reference to the segment, NULL if the system ran out of memory.
+ */
+static OutSegment *newSegment(OutQueue *q)
+{
+    OutSegment *seg = q->free;
+    if (seg != NULL)
+    {
+        q->free = seg->next;
+    }
+    else
+    {
+        seg = arenaAlloc(&dsArena, sizeof(OutSegment));
+        if (seg == NULL)
+        {
+            return NULL;
+        }
+        seg->data = NULL;
+        seg->capacity = 0;
+    }
+    seg->offset = 0;
+    seg->len = 0;
+    return seg;
+}
+
+int outqPushBuffer(OutQueue *q, const char *data, size_t len)
+{
+    OutSegment *seg = q->tail;
+    if (seg == NULL || seg->type != OUTSEG_BUFFER || seg->capacity - (seg->offset + seg->len) < len)
+    { // Small buffers are packed together in chunks so that they're sent with few writev
+        seg = newSegment(q);
+        if (seg == NULL)
+        {
+            return 0;
+        }
+        if (seg->capacity < len || seg->data == NULL)
+        { // Chunks are only reused when they're big enough, the arena takes the others back at the end of the command
+            seg->capacity = MAX(len, DS_OUTQ_CHUNK_SIZE);
+            seg->data = arenaAlloc(&dsArena, seg->capacity);
+            if (seg->data == NULL)
+            {
+                seg->capacity = 0;
+                seg->next = q->free;
+                q->free = seg;
+                return 0;
+            }
+        }
+        seg->type = OUTSEG_BUFFER;
+        appendSegment(q, seg);
+    }
+    memcpy(seg->data + seg->offset + seg->len, data, len);
+    seg->len += len;
+    q->queuedBytes += len;
+    q->bufferedBytes += len;
+    return 1;
+}
+
+int outqPushFile(OutQueue *q, const char *path, off_t offset, size_t len)
+{
+    OutSegment *seg = newSegment(q);
+    if (seg == NULL)
+    {
+        return 0;
+    }
+    seg->type = OUTSEG_FILE;
+    seg->fileFd = open(path, O_RDONLY);
+    if (seg->fileFd == -1)
+    {
+        perror("[-] Failed to open file to send");
+        seg->next = q->free;
+        q->free = seg;
+        return 0;
+    }
+    seg->offset = offset;
+    seg->len = len;
+    appendSegment(q, seg);
+    q->queuedBytes += len;
+    q->numFiles++;
+    return 1;
+}
+
+/**
+ * @brief Removes the first segment of an output queue.
+ *
+ * @param q queue whose first segment is removed.
+ */
+static void popSegment(OutQueue *q)
+{
+    OutSegment *seg = q->head;
+    q->head = seg->next;
+    if (q->head == NULL)
+    {
+        q->tail = NULL;
+    }
+    if (seg->type == OUTSEG_FILE)
+    {
+        close(seg->fileFd);
+        q->numFiles--;
+    }
+    seg->next = q->free;
+    q->free = seg;
+}
+
+/**
+ * @brief Marks n bytes from the beginning of an output queue as sent.
+ *
+ * @param q queue whose bytes were sent.
+ * @param n number of bytes that were sent.
+ */
+static void consumeBytes(OutQueue *q, size_t n)
+{
+    q->queuedBytes -= n;
+    while (n > 0)
+    {
+        OutSegment *seg = q->head;
+        size_t m = MIN(n, seg->len);
+        seg->offset += m;
+        seg->len -= m;
+        if (seg->type == OUTSEG_BUFFER)
+        {
+            q->bufferedBytes -= m;
+        }
+        n -= m;
+        if (seg->len == 0)
+        {
+            popSegment(q);
+        }
+    }
+}
+
+/**
+ * @brief Sends as much of an output queue as the socket takes without blocking.
+ *
+ * @param q queue to send.
+ * @return 1 if everything was sent or the socket is full, 0 if the connection failed.
+ */
+static int sendSegments(OutQueue *q)
+{
+    while (q->head != NULL)
+    {
+        OutSegment *seg = q->head;
+        ssize_t n;
+        if (seg->len == 0)
+        { // Empty file range
+            popSegment(q);
+            continue;
+        }
+        if (seg->type == OUTSEG_BUFFER)
+        { // Send every consecutive buffer at once
+            struct iovec iov[DS_OUTQ_IOV_SIZE];
+            int numIov = 0;
+            for (OutSegment *s = seg; s != NULL && s->type == OUTSEG_BUFFER && numIov < DS_OUTQ_IOV_SIZE; s = s->next)
+            {
+                iov[numIov].iov_base = s->data + s->offset;
+                iov[numIov++].iov_len = s->len;
+            }
+            n = writev(q->fd, iov, numIov);
+        }
+        else
+        {
+            off_t offset = seg->offset;
+            n = sendfile(q->fd, seg->fileFd, &offset, seg->len);
+            if (n == 0)
+            { // File is shorter than expected
+                fprintf(stderr, "[-] File being sent was truncated.\n");
+                return 0;
+            }
+        }
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            { // Socket buffer is full
+                return 1;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("[-] Failed to write on TCP");
+            return 0;
+        }
+        consumeBytes(q, n);
+        progressTCPDeadline(); // A reader that keeps taking data keeps its connection
+    }
+    return 1;
+}
+
+int outqFlush(OutQueue *q)
+{
+    int stage = enterDSStage(DS_STAGE_SEND);
+    int ok = sendSegments(q);
+    enterDSStage(stage);
+    return ok;
+}
+
+/**
+ * @brief Blocks until an output queue drops to a given number of bytes.
+ *
+ * @param q queue being sent.
+ * @param watermark number of bytes that may stay in the queue.
+ * @return 1 if the queue dropped to watermark, 0 otherwise.
+ */
+static int drainTo(OutQueue *q, size_t watermark)
+{
+    struct pollfd pfd;
+    pfd.fd = q->fd;
+    pfd.events = POLLOUT;
+    int stage = enterDSStage(DS_STAGE_SEND); // Waiting on a slow reader is charged to sending
+    int ok;
+    while ((ok = sendSegments(q)) && q->queuedBytes > watermark)
+    {
+        // Slow readers are dropped by the connection deadline
+        pfd.revents = 0; // Left untouched when poll is interrupted
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        {
+            perror("[-] Failed to wait for TCP socket");
+            ok = 0;
+            break;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP))
+        {
+            ok = 0;
+            break;
+        }
+    }
+    enterDSStage(stage);
+    return ok;
+}
+
+int outqThrottle(OutQueue *q)
+{
+    if (q->queuedBytes < q->lowWatermark)
+    {
+        return 1;
+    }
+    if (q->queuedBytes < q->highWatermark)
+    { // Opportunistically send what the socket takes right away
+        return outqFlush(q);
+    }
+    return drainTo(q, q->lowWatermark);
+}
+
+int outqFinish(OutQueue *q)
+{
+    return drainTo(q, 0);
+}
+
+void outqFree(OutQueue *q)
+{
+    while (q->head != NULL)
+    {
+        popSegment(q);
+    }
+    q->queuedBytes = 0;
+    q->bufferedBytes = 0;
+    fcntl(q->fd, F_SETFL, q->flags);
+}
@@ -0,0 +1,103 @@
+#ifndef DS_OUTQUEUE_H
+#define DS_OUTQUEUE_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Types of segments kept in an output queue */
+#define OUTSEG_BUFFER 0
+#define OUTSEG_FILE 1
+
+/* Struct that keeps a piece of data waiting to be sent: either bytes in memory or a range of a file */
+typedef struct outseg
+{
+    int type;        // OUTSEG_BUFFER or OUTSEG_FILE
+    char *data;      // OUTSEG_BUFFER: bytes to send
+    size_t capacity; // OUTSEG_BUFFER: size of data
+    int fileFd;      // OUTSEG_FILE: file being sent
+    off_t offset;    // next byte to send (index in data or offset in file)
+    size_t len;      // number of bytes left to send
+    struct outseg *next;
+} OutSegment;
+
+/* Struct that keeps the output queue of a TCP connection */
+typedef struct outqueue
+{
+    int fd;    // socket the queue is flushed to (non-blocking while the queue is in use)
+    int flags; // socket flags before the queue was set up
+    OutSegment *head, *tail;
+    OutSegment *free;     // segments already sent, reused before allocating from the request arena
+    size_t queuedBytes;   // bytes waiting to be sent (buffers and file ranges)
+    size_t bufferedBytes; // bytes held in memory
+    int numFiles;         // file ranges waiting to be sent
+    size_t highWatermark; // producers stop once queuedBytes reaches it...
+    size_t lowWatermark;  // ...and resume once it drops to it
+} OutQueue;
+
+/**
+ * @brief Sets up an output queue for a socket and makes the socket non-blocking.
+ *
+ * @param q queue to set up.
+ * @param fd socket the queue will be flushed to.
+ * @param highWatermark number of queued bytes at which producers must stop.
+ * @param lowWatermark number of queued bytes at which producers may resume.
+ * @return 1 if the queue was set up, 0 otherwise.
+ */
+int outqInit(OutQueue *q, int fd, size_t highWatermark, size_t lowWatermark);
+
+/**
+ * @brief Appends a copy of a buffer to an output queue.
+ *
+ * @param q queue to append to.
+ * @param data buffer to be sent.
+ * @param len number of bytes in data.
+ * @return 1 if the buffer was queued, 0 otherwise.
+ */
+int outqPushBuffer(OutQueue *q, const char *data, size_t len);
+
+/**
+ * @brief Appends a range of a file to an output queue. The file is sent straight from the page cache.
+ *
+ * @param q queue to append to.
+ * @param path path of the file to be sent.
+ * @param offset offset of the first byte to send.
+ * @param len number of bytes to send.
+ * @return 1 if the range was queued, 0 otherwise.
+ */
+int outqPushFile(OutQueue *q, const char *path, off_t offset, size_t len);
+
+/**
+ * @brief Sends as much of an output queue as the socket accepts right now, without blocking.
+ *
+ * @param q queue to flush.
+ * @return 1 if no error occurred (the queue may still have data), 0 otherwise.
+ */
+int outqFlush(OutQueue *q);
+
+/**
+ * @brief Applies backpressure to the producer: if the queue reached its high watermark, blocks until the socket
+ * is writable enough for the queue to drop to its low watermark.
+ *
+ * @param q queue being produced to.
+ * @return 1 if the producer may go on, 0 if the connection failed.
+ */
+int outqThrottle(OutQueue *q);
+
+/**
+ * @brief Blocks until the whole output queue was sent.
+ *
+ * @param q queue to send.
+ * @return 1 if everything was sent, 0 otherwise.
+ */
+int outqFinish(OutQueue *q);
+
+/**
+ * @brief Releases every segment of an output queue and restores the socket flags. The segments' memory belongs
+ * to the request arena and goes back to it when the command ends.
+ *
+ * @param q queue to release.
+ */
+void outqFree(OutQueue *q);
+
+#endif
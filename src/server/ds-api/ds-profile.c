@@ -0,0 +1,443 @@
+#define _GNU_SOURCE // dladdr and dl_iterate_phdr
+#include "ds-profile.h"
+#include "../../centralizedmsg-api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+/* Profiler shared by every DS process */
+static DSProfile *dsProfile;
+
+struct in_addr adminAddrsDS[DS_MAX_ADMIN_ADDRS];
+int numAdminAddrsDS = 0;
+
+/* Struct that keeps a function of the DS executable (from its symbol table) */
+typedef struct dssymbol
+{
+    unsigned long addr; // address in the running process
+    unsigned long size;
+    const char *name;
+} DSSymbol;
+
+/* Functions of the DS executable sorted by address (only loaded by the process that folds the samples) */
+static DSSymbol *symbols;
+static int numSymbols;
+
+/**
+ * @brief Programs the sampling timer of the calling process.
+ *
+ * @param hz samples per second of CPU time (0 disarms it).
+ */
+static void armSampling(int hz)
+{
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    if (hz > 0)
+    {
+        long periodUsec = 1000000L / hz;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        // The first sample comes at a random point of the period: a connection process that burns less than a period
+        // of CPU would never be sampled otherwise
+        long firstUsec = 1 + (unsigned long)(now.tv_nsec ^ ((unsigned long)getpid() * 2654435761UL)) % periodUsec;
+        timer.it_interval.tv_sec = periodUsec / 1000000L;
+        timer.it_interval.tv_usec = periodUsec % 1000000L;
+        timer.it_value.tv_sec = firstUsec / 1000000L;
+        timer.it_value.tv_usec = firstUsec % 1000000L;
+    }
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/**
+ * @brief Takes a stack sample of the process (SIGPROF handler). Only async-signal-safe work is done here:
+ * the backtrace was primed by setupDSProfile and the sample goes to a slot claimed with an atomic add.
+ *
+ * @param sig signal number.
+ */
+static void takeDSSample(int sig)
+{
+    int savedErrno = errno;
+    if (!__atomic_load_n(&dsProfile->running, __ATOMIC_ACQUIRE))
+    { // Stopped while this process was still sampling
+        armSampling(0);
+        errno = savedErrno;
+        return;
+    }
+    void *frames[DS_PROF_HANDLER_FRAMES + DS_PROF_MAX_DEPTH];
+    int depth = backtrace(frames, DS_PROF_HANDLER_FRAMES + DS_PROF_MAX_DEPTH) - DS_PROF_HANDLER_FRAMES;
+    // A stack that couldn't be read doesn't claim a slot: every claimed slot ends up as a finished sample
+    unsigned long slot = (depth > 0) ? __atomic_fetch_add(&dsProfile->numSamples, 1, __ATOMIC_RELAXED) : DS_PROF_MAX_SAMPLES;
+    if (slot >= DS_PROF_MAX_SAMPLES)
+    {
+        __atomic_fetch_add(&dsProfile->dropped, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        DSProfSample *s = &dsProfile->samples[slot];
+        memcpy(s->frames, frames + DS_PROF_HANDLER_FRAMES, depth * sizeof(void *));
+        __atomic_store_n(&s->depth, depth, __ATOMIC_RELEASE); // Folded from now on
+    }
+    errno = savedErrno;
+}
+
+void setupDSProfile()
+{
+    dsProfile = mmap(NULL, sizeof(DSProfile), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dsProfile == MAP_FAILED)
+    {
+        perror("[-] Failed to map DS profiler");
+        exit(EXIT_FAILURE);
+    }
+    // The first backtrace loads the unwinder, which mustn't happen inside the handler
+    void *frame;
+    backtrace(&frame, 1);
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = takeDSSample;
+    act.sa_flags = SA_RESTART; // A sample must not fail the system call it lands on
+    sigemptyset(&act.sa_mask);
+    if (sigaction(SIGPROF, &act, NULL) == -1)
+    {
+        perror("[-] Failed to set DS profiler handler");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int startDSProfile(int hz)
+{
+    if (__atomic_load_n(&dsProfile->running, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    unsigned long used = MIN(dsProfile->numSamples, DS_PROF_MAX_SAMPLES);
+    for (unsigned long i = 0; i < used; ++i)
+    {
+        dsProfile->samples[i].depth = 0;
+    }
+    dsProfile->numSamples = 0;
+    dsProfile->dropped = 0;
+    dsProfile->hz = hz;
+    __atomic_store_n(&dsProfile->running, 1, __ATOMIC_RELEASE);
+    armSampling(hz);
+    return 1;
+}
+
+int stopDSProfile()
+{
+    if (!__atomic_load_n(&dsProfile->running, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    __atomic_store_n(&dsProfile->running, 0, __ATOMIC_RELEASE);
+    armSampling(0); // Connection processes disarm on their next sample
+    return 1;
+}
+
+void joinDSProfile()
+{
+    if (__atomic_load_n(&dsProfile->running, __ATOMIC_ACQUIRE))
+    {
+        armSampling(dsProfile->hz);
+    }
+}
+
+int profilerAllowed(struct in_addr addr)
+{
+    if ((ntohl(addr.s_addr) >> 24) == 127)
+    { // Loopback
+        return 1;
+    }
+    for (int i = 0; i < numAdminAddrsDS; ++i)
+    {
+        if (adminAddrsDS[i].s_addr == addr.s_addr)
+        {
+            return 1;
+        }
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    fprintf(stderr, "[-] Refused PRF from %s, which isn't an admin (-a)\n", ip);
+    return 0;
+}
+
+/**
+ * @brief Reads how many slots of the profiler were claimed.
+ *
+ * @return number of slots claimed (at most DS_PROF_MAX_SAMPLES).
+ */
+static unsigned long claimedSlots()
+{
+    return MIN(__atomic_load_n(&dsProfile->numSamples, __ATOMIC_RELAXED), DS_PROF_MAX_SAMPLES);
+}
+
+void countDSProfile(unsigned long *samples, unsigned long *dropped)
+{
+    unsigned long claimed = claimedSlots();
+    *samples = 0;
+    for (unsigned long i = 0; i < claimed; ++i)
+    { // A slot claimed by a sample that's still being taken isn't counted yet
+        if (__atomic_load_n(&dsProfile->samples[i].depth, __ATOMIC_ACQUIRE) > 0)
+        {
+            (*samples)++;
+        }
+    }
+    *dropped = __atomic_load_n(&dsProfile->dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the load bias of the DS executable (dl_iterate_phdr callback: the executable comes first).
+ *
+ * @param info program headers of a loaded object.
+ * @param size size of info.
+ * @param data reference to the bias.
+ * @return 1 to stop at the executable.
+ */
+static int readLoadBias(struct dl_phdr_info *info, size_t size, void *data)
+{
+    *(unsigned long *)data = info->dlpi_addr;
+    return 1;
+}
+
+/**
+ * @brief Compares two symbols by address (for qsort).
+ *
+ * @return negative, zero or positive like strcmp.
+ */
+static int compareSymbols(const void *a, const void *b)
+{
+    const DSSymbol *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/**
+ * @brief Loads the functions of the DS executable from its symbol table, so that static functions get a name too
+ * (dladdr only knows the exported ones). Does nothing if the executable was stripped.
+ *
+ */
+static void loadDSSymbols()
+{
+    int fd = open("/proc/self/exe", O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+    {
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    // Left mapped: the symbol names point into it until the process exits
+    const unsigned char *elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (elf == MAP_FAILED)
+    {
+        return;
+    }
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)elf;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_shoff + (unsigned long)ehdr->e_shnum * sizeof(Elf64_Shdr) > (unsigned long)st.st_size)
+    {
+        return;
+    }
+    unsigned long bias = 0;
+    dl_iterate_phdr(readLoadBias, &bias);
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(elf + ehdr->e_shoff);
+    for (int i = 0; i < ehdr->e_shnum; ++i)
+    {
+        if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+        {
+            continue;
+        }
+        const Elf64_Shdr *strtab = &shdrs[shdrs[i].sh_link];
+        const Elf64_Sym *syms = (const Elf64_Sym *)(elf + shdrs[i].sh_offset);
+        int count = shdrs[i].sh_size / sizeof(Elf64_Sym);
+        if (shdrs[i].sh_offset + shdrs[i].sh_size > (unsigned long)st.st_size || strtab->sh_offset + strtab->sh_size > (unsigned long)st.st_size ||
+            (symbols = malloc(count * sizeof(DSSymbol))) == NULL)
+        {
+            return;
+        }
+        for (int j = 0; j < count; ++j)
+        {
+            if (ELF64_ST_TYPE(syms[j].st_info) == STT_FUNC && syms[j].st_value != 0 && syms[j].st_name < strtab->sh_size)
+            {
+                symbols[numSymbols].addr = bias + syms[j].st_value;
+                symbols[numSymbols].size = syms[j].st_size;
+                symbols[numSymbols].name = (const char *)(elf + strtab->sh_offset + syms[j].st_name);
+                numSymbols++;
+            }
+        }
+        qsort(symbols, numSymbols, sizeof(DSSymbol), compareSymbols);
+        return;
+    }
+}
+
+/**
+ * @brief Finds the function of the DS executable an address belongs to.
+ *
+ * @param addr address.
+ * @return reference to the symbol, NULL if it's outside every function of the executable.
+ */
+static const DSSymbol *findDSSymbol(unsigned long addr)
+{
+    int low = 0, high = numSymbols - 1, found = -1;
+    while (low <= high)
+    { // Last symbol that starts at or before addr
+        int mid = (low + high) / 2;
+        if (symbols[mid].addr <= addr)
+        {
+            found = mid;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    if (found == -1 || addr >= symbols[found].addr + MAX(symbols[found].size, 1))
+    {
+        return NULL;
+    }
+    return &symbols[found];
+}
+
+/**
+ * @brief Turns a frame into the address of the function it's in, so that samples taken anywhere in the same
+ * function fold together. Return addresses are moved back into the call instruction first.
+ *
+ * @param frame address of the frame.
+ * @param leaf 1 if it's the interrupted instruction, 0 if it's a return address.
+ * @return start of the function, the address itself if it's in a loaded object but no function, NULL if it's
+ * outside every loaded object (those all fold together).
+ */
+static void *functionOfFrame(void *frame, int leaf)
+{
+    unsigned long addr = (unsigned long)frame - (leaf ? 0 : 1);
+    const DSSymbol *sym = findDSSymbol(addr);
+    if (sym != NULL)
+    {
+        return (void *)sym->addr;
+    }
+    Dl_info info;
+    if (!dladdr((void *)addr, &info))
+    {
+        return NULL;
+    }
+    return (info.dli_saddr != NULL) ? info.dli_saddr : (void *)addr;
+}
+
+/**
+ * @brief Names a function for a folded stack.
+ *
+ * @param function start of the function (as given by functionOfFrame).
+ * @param name buffer the name is written to (DS_PROF_FRAME_SIZE bytes).
+ */
+static void nameFunction(void *function, char *name)
+{
+    const DSSymbol *sym = (function != NULL) ? findDSSymbol((unsigned long)function) : NULL;
+    Dl_info info;
+    int known = (sym == NULL) && (function != NULL) && dladdr(function, &info);
+    if (sym != NULL)
+    {
+        snprintf(name, DS_PROF_FRAME_SIZE, "%s", sym->name);
+    }
+    else if (known && info.dli_sname != NULL)
+    {
+        snprintf(name, DS_PROF_FRAME_SIZE, "%s", info.dli_sname);
+    }
+    else if (known && info.dli_fname != NULL)
+    { // Outside every known function: the object and the offset are enough for addr2line
+        const char *base = strrchr(info.dli_fname, '/');
+        snprintf(name, DS_PROF_FRAME_SIZE, "%s+0x%lx", base ? base + 1 : info.dli_fname, (unsigned long)function - (unsigned long)info.dli_fbase);
+    }
+    else
+    { // Outside every loaded object: its address would give away where the DS is mapped
+        snprintf(name, DS_PROF_FRAME_SIZE, "[unknown]");
+    }
+}
+
+/**
+ * @brief Compares two folded samples frame by frame (for qsort).
+ *
+ * @return negative, zero or positive like strcmp.
+ */
+static int compareSamples(const void *a, const void *b)
+{
+    const DSProfSample *x = a, *y = b;
+    if (x->depth != y->depth)
+    {
+        return (x->depth > y->depth) - (x->depth < y->depth);
+    }
+    return memcmp(x->frames, y->frames, x->depth * sizeof(void *));
+}
+
+int sendDSProfile(int fd)
+{
+    unsigned long numSamples = claimedSlots();
+    unsigned long dropped = __atomic_load_n(&dsProfile->dropped, __ATOMIC_RELAXED);
+    DSProfSample *folded = malloc((numSamples + 1) * sizeof(DSProfSample));
+    static char buffer[DS_PROF_SENDBUF_SIZE];
+    if (folded == NULL)
+    {
+        return 0;
+    }
+    loadDSSymbols();
+
+    // Copy every finished sample with its frames turned into functions
+    unsigned long n = 0;
+    for (unsigned long i = 0; i < numSamples; ++i)
+    {
+        unsigned int depth = __atomic_load_n(&dsProfile->samples[i].depth, __ATOMIC_ACQUIRE);
+        if (depth == 0)
+        { // Still being taken
+            continue;
+        }
+        folded[n].depth = depth;
+        for (unsigned int f = 0; f < depth; ++f)
+        {
+            folded[n].frames[f] = functionOfFrame(dsProfile->samples[i].frames[f], f == 0);
+        }
+        n++;
+    }
+    qsort(folded, n, sizeof(DSProfSample), compareSamples);
+
+    // One line per distinct stack
+    int len = sprintf(buffer, "%s OK %lu %lu\n", protocolReplyCode(PROFILE), n, dropped);
+    for (unsigned long i = 0; i < n;)
+    {
+        unsigned long same = i + 1;
+        while (same < n && compareSamples(&folded[i], &folded[same]) == 0)
+        {
+            same++;
+        }
+        if (len > DS_PROF_SENDBUF_SIZE - DS_PROF_MAX_DEPTH * DS_PROF_FRAME_SIZE - 32)
+        {
+            if (!sendData(fd, (unsigned char *)buffer, len))
+            {
+                free(folded);
+                return 0;
+            }
+            len = 0;
+        }
+        for (int f = folded[i].depth - 1; f >= 0; --f)
+        { // Outermost frame first
+            nameFunction(folded[i].frames[f], buffer + len);
+            len += strlen(buffer + len);
+            buffer[len++] = (f > 0) ? ';' : ' ';
+        }
+        len += sprintf(buffer + len, "%lu\n", same - i);
+        i = same;
+    }
+    free(folded);
+    return sendData(fd, (unsigned char *)buffer, len);
+}
@@ -0,0 +1,83 @@
+#ifndef DS_PROFILE_H
+#define DS_PROFILE_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <netinet/in.h>
+
+/* Struct that keeps a stack sample: the interrupted instruction first, then the return address of every caller */
+typedef struct dsprofsample
+{
+    unsigned int depth; // 0 while the sample is being taken
+    void *frames[DS_PROF_MAX_DEPTH];
+} DSProfSample;
+
+/* Struct that keeps the profiler. It lives in shared memory: the UDP process and every TCP connection process
+ * started while it runs take samples into it from their SIGPROF handler, and a PRF DUMP connection folds them */
+typedef struct dsprofile
+{
+    int running;              // 1 between PRF START and PRF STOP
+    int hz;                   // samples per second of CPU time of each process
+    unsigned long numSamples; // slots claimed so far (goes past DS_PROF_MAX_SAMPLES once they're all taken)
+    unsigned long dropped;    // samples lost because every slot was taken or the stack couldn't be read
+    DSProfSample samples[DS_PROF_MAX_SAMPLES];
+} DSProfile;
+
+/* Addresses besides the loopback ones that may use PRF (the samples show where the DS's code is) */
+extern struct in_addr adminAddrsDS[DS_MAX_ADMIN_ADDRS];
+extern int numAdminAddrsDS;
+
+/**
+ * @brief Maps the profiler in shared memory and installs the handler that takes the samples.
+ * Must be called before the DS forks. The profiler is off until startDSProfile.
+ *
+ */
+void setupDSProfile();
+
+/**
+ * @brief Drops the samples of the last run and starts sampling the calling process (the UDP one) and every
+ * TCP connection process started from now on.
+ *
+ * @param hz samples per second of CPU time of each process.
+ * @return 1 if the profiler started, 0 if it was already running.
+ */
+int startDSProfile(int hz);
+
+/**
+ * @brief Stops sampling (the samples are kept until the next start).
+ *
+ * @return 1 if the profiler stopped, 0 if it wasn't running.
+ */
+int stopDSProfile();
+
+/**
+ * @brief Arms the sampling timer of a new TCP connection process if the profiler is running.
+ *
+ */
+void joinDSProfile();
+
+/**
+ * @brief Checks if a client may use PRF: a loopback address or one given with -a.
+ *
+ * @param addr IP address of the client.
+ * @return 1 if it may, 0 otherwise.
+ */
+int profilerAllowed(struct in_addr addr);
+
+/**
+ * @brief Reads how many samples the profiler holds.
+ *
+ * @param samples reference to the number of finished samples kept.
+ * @param dropped reference to the number of samples lost because the profiler was full or the stack couldn't be read.
+ */
+void countDSProfile(unsigned long *samples, unsigned long *dropped);
+
+/**
+ * @brief Sends the samples as folded stacks (outermost frame first, frames split by ';' and followed by the
+ * number of samples), after the RPF OK samples dropped line. Can be called while the profiler runs.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @return 1 if everything was sent, 0 otherwise.
+ */
+int sendDSProfile(int fd);
+
+#endif
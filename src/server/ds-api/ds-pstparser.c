@@ -0,0 +1,175 @@
+#include "ds-pstparser.h"
+#include "../../centralizedmsg-api.h"
+#include <string.h>
+#include <stdlib.h>
+
+void pstParserInit(PostParser *p)
+{
+    memset(p, 0, sizeof(PostParser));
+    p->state = PST_UID;
+    p->hasFile = NO_FILE;
+}
+
+void pstParserInitBatch(PostParser *p)
+{
+    pstParserInit(p);
+    p->batch = 1;
+}
+
+void pstParserNextMessage(PostParser *p)
+{
+    p->state = PST_TSIZE;
+    p->TSize = 0;
+    p->hasFile = NO_FILE;
+    p->FSize = 0;
+    p->FRecv = 0;
+    p->fieldLen = 0;
+}
+
+/**
+ * @brief Gathers one more character of a field that is terminated by a space.
+ *
+ * @param p parser that is gathering the field.
+ * @param field buffer that contains the field.
+ * @param maxLen maximum number of characters of the field.
+ * @param c character that was received.
+ * @return 1 if the field is complete, 0 if it needs more characters and -1 if it's too long.
+ */
+static int gatherField(PostParser *p, char *field, int maxLen, char c)
+{
+    if (c == ' ')
+    { // End of the field
+        field[p->fieldLen] = '\0';
+        p->fieldLen = 0;
+        return 1;
+    }
+    if (p->fieldLen == maxLen)
+    { // Field is longer than what the protocol allows
+        return -1;
+    }
+    field[p->fieldLen++] = c;
+    return 0;
+}
+
+size_t pstParserFeed(PostParser *p, const char *buf, size_t len)
+{
+    size_t i = 0;
+    size_t n;
+    int ret = 0;
+    while (i < len && p->state != PST_DONE && p->state != PST_FDATA && p->state != PST_ERROR)
+    {
+        switch (p->state)
+        {
+        case PST_UID:
+            if ((ret = gatherField(p, p->UID, CLIENT_UID_SIZE - 1, buf[i++])) == 1)
+            { // Tejo aborts upon invalid UID
+                p->state = validUID(p->UID) ? PST_GID : PST_ERROR;
+            }
+            break;
+        case PST_GID:
+            if ((ret = gatherField(p, p->GID, DS_GID_SIZE - 1, buf[i++])) == 1)
+            { // Tejo aborts upon invalid GID
+                p->state = !validGID(p->GID) ? PST_ERROR : (p->batch ? PST_COUNT : PST_TSIZE);
+            }
+            break;
+        case PST_COUNT:
+            if ((ret = gatherField(p, p->CountBuf, DS_PSBCOUNT_SIZE - 1, buf[i++])) == 1)
+            { // A batch has between 1 and DS_PSB_MAX_MSGS messages
+                if (p->CountBuf[0] == '\0' || !isNumber(p->CountBuf) || atoi(p->CountBuf) < 1 || atoi(p->CountBuf) > DS_PSB_MAX_MSGS)
+                {
+                    p->state = PST_ERROR;
+                    break;
+                }
+                p->count = atoi(p->CountBuf);
+                p->state = PST_TSIZE;
+            }
+            break;
+        case PST_TSIZE:
+            if ((ret = gatherField(p, p->TSizeBuf, PROTOCOL_TEXTSZ_SIZE - 1, buf[i++])) == 1)
+            { // Tejo aborts upon invalid TSize or greater than 240
+                if (p->TSizeBuf[0] == '\0' || !isNumber(p->TSizeBuf) || atoi(p->TSizeBuf) > 240)
+                {
+                    p->state = PST_ERROR;
+                    break;
+                }
+                p->TSize = atoi(p->TSizeBuf);
+                p->state = (p->TSize > 0) ? PST_TEXT : PST_SEP;
+            }
+            break;
+        case PST_TEXT:
+            // The whole text may already be in the buffer so copy it at once
+            n = MIN(len - i, (size_t)(p->TSize - p->fieldLen));
+            memcpy(p->Text + p->fieldLen, buf + i, n);
+            p->fieldLen += n;
+            i += n;
+            if (p->fieldLen == p->TSize)
+            {
+                p->Text[p->TSize] = '\0';
+                p->fieldLen = 0;
+                p->state = PST_SEP;
+            }
+            break;
+        case PST_SEP:
+            if (buf[i] == '\n')
+            { // Only text was sent
+                p->state = PST_DONE;
+            }
+            else if (buf[i] == ' ')
+            { // There's a file attached to it too
+                p->hasFile = HAS_FILE;
+                p->state = PST_FNAME;
+            }
+            else
+            {
+                p->state = PST_ERROR;
+            }
+            ++i;
+            break;
+        case PST_FNAME:
+            if ((ret = gatherField(p, p->FName, PROTOCOL_FNAME_SIZE - 1, buf[i++])) == 1)
+            { // Tejo aborts on wrong protocol message
+                p->state = validFName(p->FName) ? PST_FSIZE : PST_ERROR;
+            }
+            break;
+        case PST_FSIZE:
+            if ((ret = gatherField(p, p->FSizeBuf, PROTOCOL_FILESZ_SIZE - 1, buf[i++])) == 1)
+            { // Tejo aborts on wrong protocol message
+                if (p->FSizeBuf[0] == '\0' || !isNumber(p->FSizeBuf))
+                {
+                    p->state = PST_ERROR;
+                    break;
+                }
+                p->FSize = atol(p->FSizeBuf);
+                p->FRecv = 0;
+                p->state = PST_FDATA;
+            }
+            break;
+        case PST_END:
+            // All requests must end with a nl
+            p->state = (buf[i++] == '\n') ? PST_DONE : PST_ERROR;
+            break;
+        default:
+            break;
+        }
+        if (ret == -1)
+        {
+            p->state = PST_ERROR;
+        }
+    }
+    return i;
+}
+
+size_t pstParserTakeFile(PostParser *p, size_t len)
+{
+    if (p->state != PST_FDATA)
+    {
+        return 0;
+    }
+    size_t n = MIN(len, (size_t)(p->FSize - p->FRecv));
+    p->FRecv += n;
+    if (p->FRecv == p->FSize)
+    { // Whole file was received
+        p->state = PST_END;
+    }
+    return n;
+}
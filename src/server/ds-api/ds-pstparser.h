@@ -0,0 +1,86 @@
+#ifndef DS_PSTPARSER_H
+#define DS_PSTPARSER_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <stddef.h>
+
+/* States of the incremental PST/PSB request parser (everything after "PST " or "PSB ") */
+typedef enum
+{
+    PST_UID,   // reading "UID "
+    PST_GID,   // reading "GID "
+    PST_COUNT, // reading "N " (PSB only)
+    PST_TSIZE, // reading "TSize "
+    PST_TEXT,  // reading TSize bytes of text
+    PST_SEP,   // text is followed by either \n (no file) or a space (file)
+    PST_FNAME, // reading "FName "
+    PST_FSIZE, // reading "FSize "
+    PST_FDATA, // FSize bytes of file data belong to the caller
+    PST_END,   // the request must end with a \n
+    PST_DONE,  // whole request was parsed
+    PST_ERROR  // wrong protocol message
+} PostParserState;
+
+/* Struct that keeps all the information gathered so far about a PST request */
+typedef struct pstparser
+{
+    PostParserState state;
+    char UID[CLIENT_UID_SIZE];
+    char GID[DS_GID_SIZE];
+    char TSizeBuf[PROTOCOL_TEXTSZ_SIZE];
+    int TSize;
+    char Text[PROTOCOL_TEXT_SIZE];
+    int hasFile; // NO_FILE or HAS_FILE
+    char FName[PROTOCOL_FNAME_SIZE];
+    char FSizeBuf[PROTOCOL_FILESZ_SIZE];
+    long FSize;
+    long FRecv;   // number of file bytes already handed to the caller
+    int fieldLen; // number of bytes gathered in the current field
+    int batch;    // 1 if it's parsing a PSB request
+    char CountBuf[DS_PSBCOUNT_SIZE];
+    int count; // number of messages in a PSB request
+} PostParser;
+
+/**
+ * @brief Resets a PST parser so that it expects the UID of a new request.
+ *
+ * @param p parser to be reset.
+ */
+void pstParserInit(PostParser *p);
+
+/**
+ * @brief Resets a parser so that it expects a PSB request (UID GID N followed by N messages).
+ *
+ * @param p parser to be reset.
+ */
+void pstParserInitBatch(PostParser *p);
+
+/**
+ * @brief Prepares a PSB parser for the next message of the batch (TSize Text[ FName FSize data]).
+ * The UID, GID and number of messages are kept.
+ *
+ * @param p parser whose previous message reached PST_DONE.
+ */
+void pstParserNextMessage(PostParser *p);
+
+/**
+ * @brief Consumes the bytes of a PST request header. It stops as soon as the request is complete
+ * (PST_DONE), the file data begins (PST_FDATA) or a wrong protocol message is found (PST_ERROR).
+ *
+ * @param p parser being fed.
+ * @param buf buffer that contains the received bytes.
+ * @param len number of bytes in buf.
+ * @return number of bytes of buf that were consumed.
+ */
+size_t pstParserFeed(PostParser *p, const char *buf, size_t len);
+
+/**
+ * @brief Claims the bytes of the file data that are available in a buffer while in PST_FDATA.
+ *
+ * @param p parser in the PST_FDATA state.
+ * @param len number of bytes available.
+ * @return number of those bytes that belong to the attached file.
+ */
+size_t pstParserTakeFile(PostParser *p, size_t len);
+
+#endif
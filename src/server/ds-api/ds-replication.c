@@ -0,0 +1,591 @@
+#include "ds-replication.h"
+#include "ds-operations.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+int dsReplication = REPLICATION_OFF;
+char primaryAddrDS[DS_ADDR_SIZE] = "";
+char primaryPortDS[DS_PORT_SIZE] = "";
+struct in_addr followerAddrsDS[DS_MAX_FOLLOWER_ADDRS];
+int numFollowerAddrsDS = 0;
+
+/* Change log of a primary, shared by every process (-1 if this DS isn't a primary) */
+static int changeLogFd = -1;
+
+/* File a follower writes the offset it applied up to through, kept open while it replicates */
+static int appliedOffsetFd = -1;
+
+/* Number of offsets a follower wrote since it last synced them */
+static int unsyncedOffsets = 0;
+
+/* Struct that buffers the changes a follower receives from its primary */
+typedef struct replreader
+{
+    int fd;
+    char buf[DS_REPLBUF_SIZE];
+    size_t start, end;
+} ReplReader;
+
+/**
+ * @brief Gets the wall clock time in milliseconds (change timestamps are compared across hosts).
+ *
+ * @return number of milliseconds since the epoch.
+ */
+static long nowMsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/**
+ * @brief Reads the offset of the primary's change log a follower has applied up to.
+ *
+ * @return the offset (0 if the follower never applied a change).
+ */
+static long loadAppliedOffset()
+{
+    long offset = 0;
+    FILE *replica = fopen("server/REPLICA.txt", "r");
+    if (replica != NULL)
+    {
+        if (fscanf(replica, "%ld", &offset) != 1 || offset < 0)
+        {
+            offset = 0;
+        }
+        fclose(replica);
+    }
+    return offset;
+}
+
+/**
+ * @brief Stores the offset of the primary's change log a follower has applied up to. The offset is synced every
+ * DS_REPL_FSYNC_CHANGES changes and whenever the follower catches up, so a crash makes it apply again at most that
+ * many changes.
+ *
+ * @param offset offset after the last applied change.
+ * @param caughtUp 1 if the follower applied every change the primary had, 0 otherwise.
+ * @return 1 if it was stored, 0 otherwise.
+ */
+static int saveAppliedOffset(long offset, int caughtUp)
+{
+    if (appliedOffsetFd == -1)
+    {
+        appliedOffsetFd = open("server/REPLICA.txt", O_WRONLY | O_CREAT, 0600);
+        if (appliedOffsetFd == -1)
+        {
+            perror("[-] Failed to store the replication offset");
+            return 0;
+        }
+    }
+    char line[DS_REPLOFFSET_SIZE];
+    int len = snprintf(line, sizeof(line), "%020ld\n", offset); // Always the same width so it's overwritten in place
+    if (pwrite(appliedOffsetFd, line, len, 0) != len)
+    {
+        perror("[-] Failed to store the replication offset");
+        return 0;
+    }
+    if (caughtUp || ++unsyncedOffsets >= DS_REPL_FSYNC_CHANGES)
+    {
+        unsyncedOffsets = 0;
+        if (fsync(appliedOffsetFd) == -1)
+        {
+            perror("[-] Failed to sync the replication offset");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void setupDSReplication()
+{
+    if (dsReplication == REPLICATION_PRIMARY)
+    { // Every process appends to the same file description so lines are never interleaved
+        changeLogFd = open("server/CHANGES.log", O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (changeLogFd == -1)
+        {
+            perror("[-] Failed to open the change log");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (dsReplication == REPLICATION_FOLLOWER)
+    {
+        dsStats->replicaFollower = 1;
+        dsStats->replicaApplied = loadAppliedOffset();
+        dsStats->replicaPrimary = dsStats->replicaApplied;
+    }
+}
+
+void logDSChange(const char *change)
+{
+    if (changeLogFd == -1)
+    {
+        return;
+    }
+    char line[DS_CHANGELINE_SIZE];
+    int len = snprintf(line, sizeof(line), "%ld %s\n", nowMsec(), change);
+    if (len >= (int)sizeof(line))
+    {
+        fprintf(stderr, "[-] Change too long for the change log: %s\n", change);
+        return;
+    }
+    // A single write keeps the line whole so a shipper never reads half of it
+    if (write(changeLogFd, line, len) != len)
+    {
+        perror("[-] Failed to write on the change log");
+        return;
+    }
+    notifyDSChange();
+}
+
+void logGroupPosts(const char *GID, int firstMID, int num)
+{
+    char change[DS_CHANGELINE_SIZE];
+    for (int i = 0; i < num; ++i)
+    {
+        sprintf(change, "MSG %s %04d", GID, firstMID + i);
+        logDSChange(change);
+    }
+}
+
+/**
+ * @brief Queues a line of the change log as a shipped change (Next End Timestamp Change). Posts are read
+ * from the group so that the follower gets the message and its file along with the change.
+ *
+ * @param q output queue of the replication connection.
+ * @param line string that contains the line (Timestamp Change, without the nl).
+ * @param next offset of the change log after the line.
+ * @param end size of the change log.
+ * @return 1 if the change was queued, 0 otherwise.
+ */
+static int queueShippedChange(OutQueue *q, char *line, long next, long end)
+{
+    char header[DS_REPLHDR_SIZE];
+    char GID[DS_GID_SIZE], MID[DS_MID_SIZE], messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
+    char *change = strchr(line, ' ');
+    if (change == NULL)
+    { // Not a line written by logDSChange
+        return 0;
+    }
+    if (sscanf(change + 1, "MSG %2s %4s", GID, MID) != 2)
+    {
+        int len = sprintf(header, "%ld %ld %s\n", next, end, line);
+        return outqPushBuffer(q, header, len);
+    }
+    *change = '\0';
+    sprintf(messageDSGroupPath, "server/GROUPS/%s/MSG/%s", GID, MID);
+    if (!directoryExists(messageDSGroupPath))
+    { // Post failed and was removed after being logged
+        int len = sprintf(header, "%ld %ld %s NOP\n", next, end, line);
+        return outqPushBuffer(q, header, len);
+    }
+    int len = sprintf(header, "%ld %ld %s ", next, end, line);
+    return outqPushBuffer(q, header, len) && queueReplicaMessage(q, GID, MID);
+}
+
+int followerAllowed(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *)&addr, &addrlen) == -1 || addr.sin_family != AF_INET)
+    {
+        return 0;
+    }
+    if ((ntohl(addr.sin_addr.s_addr) >> 24) == 127)
+    { // Loopback
+        return 1;
+    }
+    for (int i = 0; i < numFollowerAddrsDS; ++i)
+    {
+        if (followerAddrsDS[i].s_addr == addr.sin_addr.s_addr)
+        {
+            return 1;
+        }
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    fprintf(stderr, "[-] Refused to replicate to %s, which isn't a follower (-r)\n", ip);
+    return 0;
+}
+
+int shipDSChanges(int fd, long offset)
+{
+    FILE *log = fopen("server/CHANGES.log", "r");
+    if (log == NULL)
+    {
+        return 0;
+    }
+    // The follower must resume at the start of a line it hasn't applied yet
+    struct stat logStats;
+    if (fstat(fileno(log), &logStats) == -1 || offset < 0 || offset > logStats.st_size ||
+        (offset > 0 && (fseek(log, offset - 1, SEEK_SET) == -1 || fgetc(log) != '\n')))
+    {
+        fclose(log);
+        return 0;
+    }
+
+    OutQueue q;
+    int ok = outqInit(&q, fd, DS_OUTQ_HIGH_WATERMARK, DS_OUTQ_LOW_WATERMARK) && outqPushBuffer(&q, "RRP OK\n", strlen("RRP OK\n"));
+    char line[DS_CHANGELINE_SIZE], header[DS_REPLHDR_SIZE];
+    while (ok)
+    {
+        // Read the counter before the log's size so that a change appended meanwhile isn't missed
+        unsigned int seen = __atomic_load_n(&dsNotify->changeSeq, __ATOMIC_ACQUIRE);
+        if (fstat(fileno(log), &logStats) == -1 || fseek(log, offset, SEEK_SET) == -1)
+        {
+            break;
+        }
+        long end = logStats.st_size;
+        int shipped = 0;
+        while (ok && offset < end && fgets(line, sizeof(line), log) != NULL)
+        {
+            size_t len = strlen(line);
+            if (line[len - 1] != '\n')
+            { // Line still being written
+                break;
+            }
+            line[len - 1] = '\0';
+            offset += len;
+            ok = queueShippedChange(&q, line, offset, end) && outqThrottle(&q);
+            shipped = 1;
+        }
+        ok = ok && outqFinish(&q);
+        stopTCPDeadline(); // Shipping a file moves the deadline but this connection stays open
+        if (ok && !shipped && !waitForPost(&dsNotify->changeSeq, seen, DS_REPL_HEARTBEAT_MSEC))
+        { // Nothing changed so tell the follower it's caught up
+            int len = sprintf(header, "%ld %ld %ld HBT\n", offset, end, nowMsec());
+            ok = outqPushBuffer(&q, header, len);
+        }
+    }
+    outqFree(&q);
+    fclose(log);
+    return 1;
+}
+
+/**
+ * @brief Makes sure a follower has unconsumed bytes from its primary, receiving more if needed.
+ *
+ * @param r reader of the replication connection.
+ * @return 1 if there are unconsumed bytes, 0 if the connection was lost.
+ */
+static int replFill(ReplReader *r)
+{
+    if (r->start < r->end)
+    {
+        return 1;
+    }
+    int n = recvTCP(r->fd, r->buf, DS_REPLBUF_SIZE);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    r->start = 0;
+    r->end = n;
+    return 1;
+}
+
+/**
+ * @brief Reads a field of a shipped change up to the space or nl that ends it.
+ *
+ * @param r reader of the replication connection.
+ * @param field buffer that will contain the field.
+ * @param size size of the buffer.
+ * @return the character that ended the field, -1 if the field is too long or the connection was lost.
+ */
+static int replField(ReplReader *r, char *field, int size)
+{
+    int len = 0;
+    while (replFill(r))
+    {
+        char c = r->buf[r->start++];
+        if (c == ' ' || c == '\n')
+        {
+            field[len] = '\0';
+            return c;
+        }
+        if (len == size - 1)
+        {
+            return -1;
+        }
+        field[len++] = c;
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads a number of bytes of a shipped change. The bytes are written on a file and/or hashed.
+ *
+ * @param r reader of the replication connection.
+ * @param dest buffer that will contain the bytes (NULL to write them on fileFd).
+ * @param fileFd file descriptor of the file the bytes are written on (-1 to discard them).
+ * @param len number of bytes.
+ * @param hashCtx hash the bytes are added to (NULL if they aren't hashed).
+ * @return 1 if every byte was read, 0 if the connection was lost.
+ */
+static int replBytes(ReplReader *r, char *dest, int fileFd, long len, Sha256Ctx *hashCtx)
+{
+    while (len > 0)
+    {
+        if (!replFill(r))
+        {
+            return 0;
+        }
+        size_t n = r->end - r->start;
+        if ((long)n > len)
+        {
+            n = len;
+        }
+        if (dest != NULL)
+        {
+            memcpy(dest, r->buf + r->start, n);
+            dest += n;
+        }
+        else if (fileFd != -1 && write(fileFd, r->buf + r->start, n) != (ssize_t)n)
+        {
+            perror("[-] Failed to write on replicated file");
+        }
+        if (hashCtx != NULL)
+        {
+            sha256Update(hashCtx, r->buf + r->start, n);
+        }
+        r->start += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+ * @brief Applies a shipped post (MID UID TSize Text[ / FName FSize data] and a nl, after MSG GID). The message
+ * is written from scratch so that a post applied before a crash is simply replaced.
+ *
+ * @param r reader of the replication connection.
+ * @param GID string that contains the group ID.
+ * @return 1 if the change was read (a message that can't be stored is skipped), 0 if the connection was lost
+ * or the change is wrong.
+ */
+static int applyShippedMessage(ReplReader *r, char *GID)
+{
+    char MID[DS_MID_SIZE], UID[CLIENT_UID_SIZE], TSize[DS_REPLFIELD_SIZE], Text[PROTOCOL_TEXT_SIZE];
+    if (!validGID(GID) || replField(r, MID, DS_MID_SIZE) != ' ' || !validMID(MID) || replField(r, UID, CLIENT_UID_SIZE) != ' ' ||
+        !validUID(UID) || replField(r, TSize, DS_REPLFIELD_SIZE) != ' ' || !isNumber(TSize) || atoi(TSize) >= PROTOCOL_TEXT_SIZE ||
+        !replBytes(r, Text, -1, atoi(TSize), NULL))
+    {
+        return 0;
+    }
+    Text[atoi(TSize)] = '\0';
+
+    // Written aside and renamed into its MID once complete, like the primary's posts
+    char stagePath[DS_GROUPSTAGEPATH_SIZE], stagedDir[DS_STAGEDMSGDIRPATH_SIZE];
+    int ok = stageGroupMessage(GID, UID, atoi(TSize), Text, stagePath, stagedDir);
+
+    char sep[DS_REPLFIELD_SIZE];
+    if (!replBytes(r, sep, -1, 1, NULL))
+    {
+        return 0;
+    }
+    if (sep[0] == ' ')
+    { // The message has a file: / FName FSize data
+        char FName[PROTOCOL_FNAME_SIZE], FSize[DS_REPLFIELD_SIZE];
+        if (replField(r, sep, DS_REPLFIELD_SIZE) != ' ' || strcmp(sep, "/") || replField(r, FName, PROTOCOL_FNAME_SIZE) != ' ' ||
+            !validFName(FName) || replField(r, FSize, DS_REPLFIELD_SIZE) != ' ' || !isNumber(FSize))
+        {
+            return 0;
+        }
+        char stagedFilePath[DS_MSGFILEPATH_SIZE];
+        snprintf(stagedFilePath, DS_MSGFILEPATH_SIZE, "%s/%s", stagedDir, FName);
+        int fileFd = ok ? open(stagedFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+        Sha256Ctx hashCtx;
+        sha256Init(&hashCtx);
+        if (!replBytes(r, NULL, fileFd, atol(FSize), &hashCtx))
+        {
+            if (fileFd != -1)
+            {
+                close(fileFd);
+            }
+            if (ok)
+            {
+                removeDirectory(stagePath);
+            }
+            return 0;
+        }
+        char hash[DS_HASH_SIZE];
+        sha256FinalHex(&hashCtx, hash);
+        ok = fileFd != -1 && close(fileFd) == 0 && writeMessageHash(stagedDir, hash);
+        if (!replBytes(r, sep, -1, 1, NULL))
+        {
+            removeDirectory(stagePath);
+            return 0;
+        }
+    }
+    if (sep[0] != '\n')
+    {
+        removeDirectory(stagePath);
+        return 0;
+    }
+
+    // A message shipped again (after a restart) replaces the copy already applied
+    char messageDSGroupPath[DS_GROUPMSGDIRPATH_SIZE];
+    sprintf(messageDSGroupPath, "server/GROUPS/%s/MSG/%s", GID, MID);
+    if (ok && directoryExists(messageDSGroupPath))
+    {
+        removeDirectory(messageDSGroupPath);
+    }
+    if (!ok || rename(stagedDir, messageDSGroupPath) == -1)
+    {
+        fprintf(stderr, "[-] Failed to apply replicated message %s of group %s\n", MID, GID);
+        removeDirectory(stagePath);
+        return 1;
+    }
+    removeDirectory(stagePath);
+    notifyGroupPosts(GID, atoi(MID), 1); // Subscribers streaming from the follower get the post too
+    return 1;
+}
+
+/**
+ * @brief Applies every change a primary ships over a replication connection.
+ *
+ * @param fd file descriptor of the replication connection.
+ * @param applied reference to the offset of the change log applied so far.
+ * @param applyRequest function that applies a UDP request to this DS, writing its reply to the given buffer.
+ */
+static void followChanges(int fd, long *applied, char *(*applyRequest)(char *, char *))
+{
+    ReplReader r;
+    r.fd = fd;
+    r.start = r.end = 0;
+    char next[DS_REPLFIELD_SIZE], end[DS_REPLFIELD_SIZE], ts[DS_REPLFIELD_SIZE], op[PROTOCOL_CODE_SIZE];
+    if (replField(&r, op, PROTOCOL_CODE_SIZE) != ' ' || strcmp(op, "RRP") || replField(&r, next, DS_REPLFIELD_SIZE) != '\n' || strcmp(next, "OK"))
+    {
+        fprintf(stderr, "[-] Primary DS refused to replicate from offset %ld\n", *applied);
+        return;
+    }
+    while (1)
+    {
+        int c;
+        if (replField(&r, next, DS_REPLFIELD_SIZE) != ' ' || !isNumber(next) || replField(&r, end, DS_REPLFIELD_SIZE) != ' ' ||
+            !isNumber(end) || replField(&r, ts, DS_REPLFIELD_SIZE) != ' ' || !isNumber(ts) || (c = replField(&r, op, PROTOCOL_CODE_SIZE)) == -1)
+        {
+            return;
+        }
+        if (!strcmp(op, "MSG"))
+        {
+            char GID[DS_GID_SIZE];
+            if (c != ' ' || replField(&r, GID, DS_GID_SIZE) != ' ' || !applyShippedMessage(&r, GID))
+            {
+                return;
+            }
+        }
+        else if (strcmp(op, "HBT") && strcmp(op, "NOP"))
+        { // A UDP request that changed the primary is applied as if a client had sent it
+            char request[DS_CHANGELINE_SIZE];
+            static char reply[DS_TO_CLIENT_UDP_SIZE]; // the reply is dropped
+            int len = sprintf(request, "%s ", op);
+            while (c == ' ')
+            { // The request's arguments are the rest of the line
+                if (!replFill(&r))
+                {
+                    return;
+                }
+                char ch = r.buf[r.start++];
+                if (ch == '\n')
+                {
+                    break;
+                }
+                if (len == DS_CHANGELINE_SIZE - 1)
+                {
+                    return;
+                }
+                request[len++] = ch;
+            }
+            if (c != ' ')
+            {
+                return;
+            }
+            request[len] = '\0';
+            applyRequest(request, reply);
+        }
+        else if (c != '\n')
+        {
+            return;
+        }
+
+        // Persist the offset so a restarted follower resumes after the last applied change
+        long nextOffset = atol(next), endOffset = atol(end);
+        if (nextOffset != *applied)
+        {
+            *applied = nextOffset;
+            saveAppliedOffset(nextOffset, nextOffset >= endOffset);
+        }
+        __atomic_store_n(&dsStats->replicaApplied, nextOffset, __ATOMIC_RELAXED);
+        __atomic_store_n(&dsStats->replicaPrimary, endOffset, __ATOMIC_RELAXED);
+        long lag = (nextOffset >= endOffset) ? 0 : nowMsec() - atol(ts);
+        __atomic_store_n(&dsStats->replicaLagMsec, (lag > 0) ? lag : 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Connects to the primary and asks it to ship its changes from an offset on.
+ *
+ * @param applied offset of the change log applied so far.
+ * @return file descriptor of the replication connection, -1 if the primary couldn't be reached.
+ */
+static int connectPrimaryDS(long applied)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(primaryAddrDS, primaryPortDS, &hints, &res) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, res->ai_addr, res->ai_addrlen) == -1 || timerOn(fd) == -1)
+    { // The primary sends a heartbeat well before the read timeout so a timeout means it's gone
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    char request[PROTOCOL_CODE_SIZE + DS_RPLREQ_SIZE];
+    sprintf(request, "RPL %ld\n", applied);
+    if (sendTCP(fd, request) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void followPrimaryDS(char *(*applyRequest)(char *, char *))
+{
+    long applied = loadAppliedOffset();
+    while (1)
+    {
+        int fd = connectPrimaryDS(applied);
+        if (fd != -1)
+        {
+            printf("[+] Replicating primary DS %s:%s from offset %ld.\n", primaryAddrDS, primaryPortDS, applied);
+            __atomic_store_n(&dsStats->replicaConnected, 1, __ATOMIC_RELAXED);
+            followChanges(fd, &applied, applyRequest);
+            __atomic_store_n(&dsStats->replicaConnected, 0, __ATOMIC_RELAXED);
+            close(fd);
+            fprintf(stderr, "[-] Lost connection to primary DS %s:%s.\n", primaryAddrDS, primaryPortDS);
+        }
+        sleep(DS_REPL_RETRY_SECS);
+    }
+}
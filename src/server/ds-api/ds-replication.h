@@ -0,0 +1,69 @@
+#ifndef DS_REPLICATION_H
+#define DS_REPLICATION_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <netinet/in.h>
+
+/* Replication role of this DS (REPLICATION_OFF, REPLICATION_PRIMARY or REPLICATION_FOLLOWER) */
+extern int dsReplication;
+
+/* Address and port of the primary a follower replicates */
+extern char primaryAddrDS[DS_ADDR_SIZE];
+extern char primaryPortDS[DS_PORT_SIZE];
+
+/* Addresses a primary ships its changes to besides the loopback ones (the change log holds every user's
+ * password record) */
+extern struct in_addr followerAddrsDS[DS_MAX_FOLLOWER_ADDRS];
+extern int numFollowerAddrsDS;
+
+/**
+ * @brief Prepares the change log of a primary or the replication counters of a follower.
+ * Must be called after setupDSStats and before the DS forks.
+ *
+ */
+void setupDSReplication();
+
+/**
+ * @brief Appends a change to the change log of a primary and wakes up the connections that ship it.
+ * Does nothing if this DS isn't a primary.
+ *
+ * @param change string that contains the change (a UDP request that changed the DS or MSG GID MID).
+ */
+void logDSChange(const char *change);
+
+/**
+ * @brief Appends a post of one or more consecutive messages to the change log of a primary.
+ *
+ * @param GID string that contains the group ID.
+ * @param firstMID integer that contains the first message ID.
+ * @param num number of messages.
+ */
+void logGroupPosts(const char *GID, int firstMID, int num);
+
+/**
+ * @brief Checks if the peer of a TCP connection may replicate this DS: a loopback address or one given with -r.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @return 1 if it may, 0 otherwise.
+ */
+int followerAllowed(int fd);
+
+/**
+ * @brief Replies RRP OK and then ships every change of the change log from an offset on to a follower,
+ * sending a heartbeat whenever there's nothing to ship, until the follower closes the connection.
+ *
+ * @param fd file descriptor where the TCP connection was made.
+ * @param offset offset of the change log the follower has applied up to.
+ * @return 1 once the stream ended, 0 if the offset isn't the start of a change (nothing was sent).
+ */
+int shipDSChanges(int fd, long offset);
+
+/**
+ * @brief Connects to the primary and applies every change it ships, reconnecting whenever the connection
+ * is lost. Never returns.
+ *
+ * @param applyRequest function that applies a UDP request to this DS, writing its reply to the given buffer.
+ */
+void followPrimaryDS(char *(*applyRequest)(char *, char *));
+
+#endif
@@ -0,0 +1,357 @@
+#include "ds-stats.h"
+#include "../../centralizedmsg-api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+DSStats *dsStats;
+DSTimer dsTimer = {-1};
+
+/* Statuses counted for every command (indexed like DSStats.statuses) */
+static const char *statusNames[DS_NUM_STATUSES] = {"OK", "NOK", "DUP", "NEW", "EOF", "ERR", "E_USR", "E_GRP", "E_GNAME", "E_FULL"};
+
+/* Names of the stages (indexed like DSStats.latency) */
+static const char *stageNames[DS_NUM_STAGES + 1] = {"parse", "storage", "send", "total"};
+
+void setupDSStats()
+{
+    dsStats = mmap(NULL, sizeof(DSStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dsStats == MAP_FAILED)
+    {
+        perror("[-] Failed to map DS counters");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void incrementDSStat(unsigned long *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Appends a "name value" line to a snapshot buffer without overflowing it.
+ *
+ * @param buffer string that contains the snapshot.
+ * @param size size of buffer.
+ * @param len number of bytes already in buffer.
+ * @param name name of the counter.
+ * @param value value of the counter.
+ * @return new number of bytes in buffer.
+ */
+static int appendStat(char *buffer, size_t size, int len, const char *name, unsigned long value)
+{
+    if (len >= size)
+    {
+        return len;
+    }
+    int n = snprintf(buffer + len, size - len, "%s %lu\n", name, value);
+    return (n < 0) ? len : MIN(len + n, (int)size - 1);
+}
+
+int formatDSStats(char *buffer, size_t size)
+{
+    char name[DS_STATNAME_SIZE];
+    int len = 0;
+    buffer[0] = '\0';
+    for (int i = 0; i < DS_STATS_NUM_COMMANDS; ++i)
+    {
+        // Index 0 counts the connections that timed out before sending a message code
+        const char *code = (i == 0) ? "NONE" : protocolCommandCode(i);
+        if (code == NULL)
+        { // Client only command
+            continue;
+        }
+        sprintf(name, "timeouts.%s", code);
+        len = appendStat(buffer, size, len, name, __atomic_load_n(&dsStats->tcpTimeouts[i], __ATOMIC_RELAXED));
+    }
+    len = appendStat(buffer, size, len, "rejected.ip", __atomic_load_n(&dsStats->rejectedIP, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "rejected.uid", __atomic_load_n(&dsStats->rejectedUID, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "shed.udp", __atomic_load_n(&dsStats->shedUDP, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "shed.tcp", __atomic_load_n(&dsStats->shedTCP, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "tcp.active", __atomic_load_n(&dsStats->activeTCPConns, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "arena.high_water", __atomic_load_n(&dsStats->arenaHighWater, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "arena.overflows", __atomic_load_n(&dsStats->arenaOverflows, __ATOMIC_RELAXED));
+    len = appendStat(buffer, size, len, "log.dropped", __atomic_load_n(&dsStats->logDropped, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&dsStats->replicaFollower, __ATOMIC_RELAXED))
+    {
+        unsigned long applied = __atomic_load_n(&dsStats->replicaApplied, __ATOMIC_RELAXED);
+        unsigned long primary = __atomic_load_n(&dsStats->replicaPrimary, __ATOMIC_RELAXED);
+        len = appendStat(buffer, size, len, "replica.connected", __atomic_load_n(&dsStats->replicaConnected, __ATOMIC_RELAXED));
+        len = appendStat(buffer, size, len, "replica.applied", applied);
+        len = appendStat(buffer, size, len, "replica.lag_bytes", (primary > applied) ? primary - applied : 0);
+        len = appendStat(buffer, size, len, "replica.lag_ms", __atomic_load_n(&dsStats->replicaLagMsec, __ATOMIC_RELAXED));
+    }
+    return len;
+}
+
+void startDSTimer(int command)
+{
+    dsTimer.command = command;
+    dsTimer.stage = DS_STAGE_PARSE;
+    memset(dsTimer.stageNsec, 0, sizeof(dsTimer.stageNsec));
+    clock_gettime(CLOCK_MONOTONIC, &dsTimer.mark);
+}
+
+void setDSTimerCommand(int command)
+{
+    if (dsTimer.command != -1)
+    {
+        dsTimer.command = (command > 0 && command < DS_STATS_NUM_COMMANDS) ? command : 0;
+    }
+}
+
+int enterDSStage(int stage)
+{
+    if (dsTimer.command == -1)
+    {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dsTimer.stageNsec[dsTimer.stage] += (now.tv_sec - dsTimer.mark.tv_sec) * 1000000000L + (now.tv_nsec - dsTimer.mark.tv_nsec);
+    dsTimer.mark = now;
+    int previous = dsTimer.stage;
+    dsTimer.stage = stage;
+    return previous;
+}
+
+/**
+ * @brief Finds the counts index of a value.
+ *
+ * @param value value in nanoseconds.
+ * @return index in counts.
+ */
+static int histogramIndex(unsigned long value)
+{
+    int bucket = (63 - __builtin_clzl(value | ((1UL << DS_HIST_SUB_BUCKET_BITS) - 1))) - (DS_HIST_SUB_BUCKET_BITS - 1);
+    return (bucket << (DS_HIST_SUB_BUCKET_BITS - 1)) + (value >> bucket);
+}
+
+/**
+ * @brief Finds the highest value that shares a count with the values of a counts index.
+ *
+ * @param index index in counts.
+ * @return highest value in nanoseconds of the index.
+ */
+static unsigned long histogramValue(int index)
+{
+    int half = 1 << (DS_HIST_SUB_BUCKET_BITS - 1);
+    int bucket = index / half - 1;
+    int sub = index % half + half;
+    if (bucket < 0)
+    {
+        bucket = 0;
+        sub -= half;
+    }
+    return ((unsigned long)(sub + 1) << bucket) - 1;
+}
+
+/**
+ * @brief Records a value in a histogram. Every process records into the same histograms with atomic increments.
+ *
+ * @param h histogram.
+ * @param nsec value in nanoseconds.
+ */
+static void recordHistogram(DSHistogram *h, unsigned long nsec)
+{
+    nsec = MIN(nsec, (1UL << DS_HIST_MAX_BITS) - 1);
+    __atomic_fetch_add(&h->counts[histogramIndex(nsec)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, nsec, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (nsec > max && !__atomic_compare_exchange_n(&h->max, &max, nsec, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void recordDSTimer(const DSTimer *t)
+{
+    if (t->command == -1)
+    {
+        return;
+    }
+    unsigned long total = 0;
+    for (int i = 0; i < DS_NUM_STAGES; ++i)
+    {
+        recordHistogram(&dsStats->latency[t->command][i], t->stageNsec[i]);
+        total += t->stageNsec[i];
+    }
+    recordHistogram(&dsStats->latency[t->command][DS_NUM_STAGES], total);
+}
+
+void stopDSTimer()
+{
+    if (enterDSStage(DS_STAGE_PARSE) != -1)
+    {
+        recordDSTimer(&dsTimer);
+        dsTimer.command = -1;
+    }
+}
+
+void countDSStatus(int command, const char *status)
+{
+    size_t n = strcspn(status, " \n");
+    int i = DS_NUM_STATUSES - 1;
+    while (i > 0 && (strlen(statusNames[i]) != n || strncmp(status, statusNames[i], n)))
+    { // Index 0 (OK) is left for everything else
+        --i;
+    }
+    command = (command > 0 && command < DS_STATS_NUM_COMMANDS) ? command : 0;
+    incrementDSStat(&dsStats->statuses[command][i]);
+}
+
+/**
+ * @brief Finds the value at a percentile of a histogram.
+ *
+ * @param h histogram (a snapshot of it).
+ * @param percentile percentile between 0 and 100.
+ * @return highest value of the count the percentile falls in (in nanoseconds).
+ */
+static unsigned long histogramPercentile(const DSHistogram *h, double percentile)
+{
+    unsigned long wanted = MAX((unsigned long)(percentile / 100 * h->total + 0.5), 1);
+    unsigned long seen = 0;
+    for (int i = 0; i < DS_HIST_NUM_COUNTS; ++i)
+    {
+        seen += h->counts[i];
+        if (seen >= wanted)
+        {
+            return MIN(histogramValue(i), h->max);
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Takes a snapshot of the latency histogram of a stage of a command.
+ *
+ * @param cmd command macro (0 for the requests whose command code was invalid).
+ * @param stage stage (DS_NUM_STAGES for the total).
+ * @param h histogram the snapshot is written to.
+ */
+static void snapshotHistogram(int cmd, int stage, DSHistogram *h)
+{
+    for (int i = 0; i < DS_HIST_NUM_COUNTS; ++i)
+    { // Requests go on being recorded while the snapshot is taken, so the total is the sum of its counts
+        h->counts[i] = __atomic_load_n(&dsStats->latency[cmd][stage].counts[i], __ATOMIC_RELAXED);
+    }
+    h->total = 0;
+    for (int i = 0; i < DS_HIST_NUM_COUNTS; ++i)
+    {
+        h->total += h->counts[i];
+    }
+    h->sum = __atomic_load_n(&dsStats->latency[cmd][stage].sum, __ATOMIC_RELAXED);
+    h->max = __atomic_load_n(&dsStats->latency[cmd][stage].max, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Appends the percentiles of a histogram snapshot (in microseconds) to a line.
+ *
+ * @param line string the percentiles are appended to (DS_LATLINE_SIZE bytes, the last 2 are left for the nl).
+ * @param len reference to the length of the line.
+ * @param h histogram snapshot with at least one value.
+ */
+static void appendPercentiles(char *line, int *len, const DSHistogram *h)
+{
+    int n = snprintf(line + *len, DS_LATLINE_SIZE - 1 - *len, "n=%lu mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f", h->total,
+                     h->sum / 1e3 / h->total, histogramPercentile(h, 50) / 1e3, histogramPercentile(h, 90) / 1e3,
+                     histogramPercentile(h, 99) / 1e3, histogramPercentile(h, 99.9) / 1e3, h->max / 1e3);
+    *len = (n < 0) ? *len : MIN(*len + n, DS_LATLINE_SIZE - 2);
+}
+
+/**
+ * @brief Appends the statuses a command was answered with (Status=count) to a line.
+ *
+ * @param line string the statuses are appended to (DS_LATLINE_SIZE bytes, the last 2 are left for the nl).
+ * @param len reference to the length of the line.
+ * @param cmd command macro.
+ */
+static void appendStatuses(char *line, int *len, int cmd)
+{
+    for (int i = 0; i < DS_NUM_STATUSES; ++i)
+    {
+        unsigned long count = __atomic_load_n(&dsStats->statuses[cmd][i], __ATOMIC_RELAXED);
+        if (count > 0)
+        {
+            int n = snprintf(line + *len, DS_LATLINE_SIZE - 1 - *len, " %s=%lu", statusNames[i], count);
+            *len = (n < 0) ? *len : MIN(*len + n, DS_LATLINE_SIZE - 2);
+        }
+    }
+}
+
+/**
+ * @brief Ends a line and appends it to a snapshot if it fits, always leaving room for the line that marks the
+ * snapshot as truncated.
+ *
+ * @param buffer string that contains the snapshot.
+ * @param size size of buffer.
+ * @param len reference to the length of the snapshot.
+ * @param line string that contains the line (without its nl).
+ * @param lineLen length of the line (at most DS_LATLINE_SIZE - 2).
+ * @return 1 if the line was appended, 0 if it didn't fit.
+ */
+static int appendLatencyLine(char *buffer, size_t size, int *len, char *line, int lineLen)
+{
+    line[lineLen++] = '\n';
+    if (*len + lineLen + strlen(DS_LAT_TRUNCATED) >= size)
+    {
+        return 0;
+    }
+    memcpy(buffer + *len, line, lineLen);
+    *len += lineLen;
+    buffer[*len] = '\0';
+    return 1;
+}
+
+int formatDSLatency(char *buffer, size_t size, int command)
+{
+    static DSHistogram h; // too big for the stack
+    char line[DS_LATLINE_SIZE];
+    int len = 0, fits = 1;
+    buffer[0] = '\0';
+    int first = (command > 0) ? command : 0;
+    int last = (command > 0) ? command + 1 : DS_STATS_NUM_COMMANDS;
+    for (int cmd = first; cmd < last && fits; ++cmd)
+    {
+        // Index 0 times the requests whose command code was invalid
+        const char *code = (cmd == 0) ? "NONE" : protocolCommandCode(cmd);
+        if (code == NULL || __atomic_load_n(&dsStats->latency[cmd][DS_NUM_STAGES].total, __ATOMIC_RELAXED) == 0)
+        { // Client only command or no requests yet
+            continue;
+        }
+        int lineLen;
+        if (command == 0)
+        { // A single line per command (its total and statuses) so that every command fits in a UDP reply
+            snapshotHistogram(cmd, DS_NUM_STAGES, &h);
+            if (h.total == 0)
+            {
+                continue;
+            }
+            lineLen = sprintf(line, "%s ", code);
+            appendPercentiles(line, &lineLen, &h);
+            appendStatuses(line, &lineLen, cmd);
+            fits = appendLatencyLine(buffer, size, &len, line, lineLen);
+            continue;
+        }
+        for (int stage = 0; stage <= DS_NUM_STAGES && fits; ++stage)
+        {
+            snapshotHistogram(cmd, stage, &h);
+            if (h.total == 0)
+            {
+                continue;
+            }
+            lineLen = sprintf(line, "%s.%s ", code, stageNames[stage]);
+            appendPercentiles(line, &lineLen, &h);
+            fits = appendLatencyLine(buffer, size, &len, line, lineLen);
+        }
+        lineLen = sprintf(line, "%s.status", code);
+        appendStatuses(line, &lineLen, cmd);
+        fits = fits && appendLatencyLine(buffer, size, &len, line, lineLen);
+    }
+    if (!fits)
+    { // Room for it was always left
+        strcpy(buffer + len, DS_LAT_TRUNCATED);
+        len += strlen(DS_LAT_TRUNCATED);
+    }
+    return len;
+}
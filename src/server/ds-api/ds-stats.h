@@ -0,0 +1,133 @@
+#ifndef DS_STATS_H
+#define DS_STATS_H
+
+#include "../../centralizedmsg-api-constants.h"
+#include <stddef.h>
+#include <time.h>
+
+/* Struct that keeps an HDR latency histogram in nanoseconds: the first 2^DS_HIST_SUB_BUCKET_BITS values have a
+ * count each, then every power of two is split in 2^(DS_HIST_SUB_BUCKET_BITS - 1) counts */
+typedef struct dshistogram
+{
+    unsigned long counts[DS_HIST_NUM_COUNTS];
+    unsigned long total;
+    unsigned long sum;
+    unsigned long max;
+} DSHistogram;
+
+/* Struct that keeps all the DS counters. It lives in shared memory so that the UDP process,
+ * the TCP process and every TCP connection process update the same counters */
+typedef struct dsstats
+{
+    unsigned long tcpTimeouts[DS_STATS_NUM_COMMANDS]; // indexed by command macro (0 = no command code read yet)
+    unsigned long rejectedIP;                         // requests over the per-IP rate
+    unsigned long rejectedUID;                        // requests over the per-UID rate
+    unsigned long shedUDP;                            // UDP requests shed because the DS was saturated
+    unsigned long shedTCP;                            // TCP connections shed because the DS was saturated
+    unsigned long activeTCPConns;                     // TCP connections being served
+    unsigned long replicaFollower;                    // 1 if this DS follows a primary
+    unsigned long replicaConnected;                   // 1 while the follower is connected to its primary
+    unsigned long replicaApplied;                     // offset of the primary's change log applied so far
+    unsigned long replicaPrimary;                     // size of the primary's change log when it last shipped a change
+    unsigned long replicaLagMsec;                     // age of the last applied change (0 once caught up)
+    unsigned long arenaHighWater;                     // most arena bytes a single command needed
+    unsigned long arenaOverflows;                     // arena blocks allocated because a command outgrew the first one
+    unsigned long logDropped;                         // log records dropped because the log ring was full
+    unsigned long statuses[DS_STATS_NUM_COMMANDS][DS_NUM_STATUSES];   // replies of every command by status
+    DSHistogram latency[DS_STATS_NUM_COMMANDS][DS_NUM_STAGES + 1];    // stages of every command and the whole request
+} DSStats;
+
+/* Struct that times the stages of a request: the time between two marks goes to the stage that was running */
+typedef struct dstimer
+{
+    int command; // -1 while the timer is stopped, 0 until the command is known
+    int stage;
+    struct timespec mark;
+    unsigned long stageNsec[DS_NUM_STAGES];
+} DSTimer;
+
+/* Variable that points to the DS counters in shared memory */
+extern DSStats *dsStats;
+
+/* Timer of the request the process is serving */
+extern DSTimer dsTimer;
+
+/**
+ * @brief Maps the DS counters in shared memory. Must be called before the DS forks.
+ *
+ */
+void setupDSStats();
+
+/**
+ * @brief Atomically increments a DS counter. Safe to call from signal handlers.
+ *
+ * @param counter reference to the counter.
+ */
+void incrementDSStat(unsigned long *counter);
+
+/**
+ * @brief Writes a text snapshot of all DS counters (one "name value" pair per line).
+ *
+ * @param buffer string that will contain the snapshot.
+ * @param size size of buffer.
+ * @return number of bytes written to buffer.
+ */
+int formatDSStats(char *buffer, size_t size);
+
+/**
+ * @brief Starts timing a request in its parse stage.
+ *
+ * @param command macro of the command (0 if it isn't known yet).
+ */
+void startDSTimer(int command);
+
+/**
+ * @brief Sets the command of the request being timed.
+ *
+ * @param command macro of the command.
+ */
+void setDSTimerCommand(int command);
+
+/**
+ * @brief Charges the time since the last mark to the running stage and moves the request to another one.
+ * Does nothing while no request is being timed.
+ *
+ * @param stage stage the request moves to.
+ * @return stage that was running (to go back to it), -1 if no request is being timed.
+ */
+int enterDSStage(int stage);
+
+/**
+ * @brief Records a timed request in the latency histograms of its command.
+ *
+ * @param t timer of the request (its running stage must have been charged with enterDSStage).
+ */
+void recordDSTimer(const DSTimer *t);
+
+/**
+ * @brief Charges the running stage, records the request being timed and stops the timer.
+ *
+ */
+void stopDSTimer();
+
+/**
+ * @brief Counts the status of a reply (anything that isn't a known status, like a MID or a list, counts as OK).
+ *
+ * @param command macro of the command replied to.
+ * @param status string that starts with the status.
+ */
+void countDSStatus(int command, const char *status);
+
+/**
+ * @brief Writes a text snapshot of the latency histograms (in microseconds) and statuses of the commands that were
+ * served: one line per stage and one for its statuses for a single command, one line per command (its total and
+ * statuses) for every command. A snapshot that doesn't fit ends with DS_LAT_TRUNCATED.
+ *
+ * @param buffer string that will contain the snapshot.
+ * @param size size of buffer.
+ * @param command macro of the only command to include, 0 to include every command.
+ * @return number of bytes written to buffer.
+ */
+int formatDSLatency(char *buffer, size_t size, int command);
+
+#endif
@@ -0,0 +1,137 @@
+#include "ds-trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+long dsTraceSlowMsec = 0;
+
+/* Trace file shared by every DS process (-1 while tracing is off) */
+static int dsTraceFd = -1;
+
+/* Spans of the request being served by this process */
+static DSSpan spans[DS_TRACE_MAX_SPANS];
+static int numSpans;
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return current time in nanoseconds.
+ */
+static long nowNsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+void setupDSTrace(const char *path)
+{
+    // Events are appended by many processes at once, each request with a single write
+    dsTraceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (dsTraceFd == -1)
+    {
+        perror("[-] Failed to create DS trace file");
+        exit(EXIT_FAILURE);
+    }
+    // JSON array format: the trace viewers don't need the closing bracket, so the DS can stop at any time
+    if (write(dsTraceFd, "[\n", 2) != 2)
+    {
+        perror("[-] Failed to write DS trace file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int beginDSSpan(const char *name)
+{
+    if (dsTraceFd == -1 || numSpans == DS_TRACE_MAX_SPANS)
+    {
+        return -1;
+    }
+    DSSpan *s = &spans[numSpans];
+    s->name = name;
+    s->begin = nowNsec();
+    s->end = 0;
+    s->numArgs = 0;
+    return numSpans++;
+}
+
+void endDSSpan(int span)
+{
+    if (span != -1 && spans[span].end == 0)
+    {
+        spans[span].end = nowNsec();
+    }
+}
+
+long readDSSpanClock(int span)
+{
+    return (span == -1) ? 0 : nowNsec();
+}
+
+void argDSSpan(int span, const char *key, const char *value)
+{
+    if (span == -1 || spans[span].numArgs == DS_TRACE_MAX_ARGS)
+    {
+        return;
+    }
+    DSSpanArg *arg = &spans[span].args[spans[span].numArgs++];
+    arg->key = key;
+    strncpy(arg->value, value, DS_TRACE_ARG_SIZE - 1);
+    arg->value[DS_TRACE_ARG_SIZE - 1] = '\0';
+}
+
+/**
+ * @brief Writes a span as a complete event of the Chrome trace-event format.
+ *
+ * @param s span.
+ * @param pid PID of the process that served the request.
+ * @param event buffer the event is written to (DS_TRACE_EVENT_SIZE bytes).
+ * @return number of bytes of the event.
+ */
+static int formatTraceEvent(const DSSpan *s, int pid, char *event)
+{
+    int len = snprintf(event, DS_TRACE_EVENT_SIZE, "{\"name\":\"%s\",\"cat\":\"ds\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                       s->name, s->begin / 1e3, (s->end - s->begin) / 1e3, pid, pid);
+    for (int i = 0; i < s->numArgs && len < DS_TRACE_EVENT_SIZE; ++i)
+    { // Values are protocol fields and numbers so they need no escaping
+        len += snprintf(event + len, DS_TRACE_EVENT_SIZE - len, "%s\"%s\":\"%s\"", (i > 0) ? "," : "", s->args[i].key, s->args[i].value);
+    }
+    if (len < DS_TRACE_EVENT_SIZE)
+    {
+        len += snprintf(event + len, DS_TRACE_EVENT_SIZE - len, "}},\n");
+    }
+    return MIN(len, DS_TRACE_EVENT_SIZE - 1);
+}
+
+void finishDSTrace()
+{
+    if (numSpans == 0)
+    {
+        return;
+    }
+    long now = nowNsec();
+    for (int i = 0; i < numSpans; ++i)
+    { // Stages cut short by an early reply end with the request
+        if (spans[i].end == 0)
+        {
+            spans[i].end = now;
+        }
+    }
+    if (spans[0].end - spans[0].begin >= dsTraceSlowMsec * 1000000L)
+    { // Only outliers make it to the file (every request when there's no threshold)
+        static char buffer[DS_TRACEBUF_SIZE];
+        int len = 0, pid = getpid();
+        for (int i = 0; i < numSpans; ++i)
+        {
+            len += formatTraceEvent(&spans[i], pid, buffer + len);
+        }
+        if (write(dsTraceFd, buffer, len) != len)
+        {
+            perror("[-] Failed to write DS trace file");
+        }
+    }
+    numSpans = 0;
+}
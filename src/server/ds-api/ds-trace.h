@@ -0,0 +1,73 @@
+#ifndef DS_TRACE_H
+#define DS_TRACE_H
+
+#include "../../centralizedmsg-api-constants.h"
+
+/* Struct that keeps an argument of a span */
+typedef struct dsspanarg
+{
+    const char *key;
+    char value[DS_TRACE_ARG_SIZE];
+} DSSpanArg;
+
+/* Struct that keeps a stage of a request: spans that start and end inside another one are nested in it */
+typedef struct dsspan
+{
+    const char *name;
+    long begin; // monotonic time in nanoseconds
+    long end;   // 0 while the span is open
+    int numArgs;
+    DSSpanArg args[DS_TRACE_MAX_ARGS];
+} DSSpan;
+
+/* Number of milliseconds a traced request must take for its spans to be written out */
+extern long dsTraceSlowMsec;
+
+/**
+ * @brief Creates the trace file every traced request is appended to (in the Chrome trace-event format).
+ * Must be called before the DS forks.
+ *
+ * @param path path of the trace file.
+ */
+void setupDSTrace(const char *path);
+
+/**
+ * @brief Opens a span of the request being served. The first span opened is the root of the request.
+ *
+ * @param name name of the span (a string literal).
+ * @return index of the span, -1 if tracing is off or the request has too many spans.
+ */
+int beginDSSpan(const char *name);
+
+/**
+ * @brief Closes a span.
+ *
+ * @param span index of the span (-1 is ignored).
+ */
+void endDSSpan(int span);
+
+/**
+ * @brief Reads the clock for a span, to add up the time of parts of it that take turns (network and disk).
+ *
+ * @param span index of the span.
+ * @return monotonic time in nanoseconds, 0 if span is -1 (untraced requests don't pay for the clock).
+ */
+long readDSSpanClock(int span);
+
+/**
+ * @brief Attaches an argument to a span.
+ *
+ * @param span index of the span (-1 is ignored).
+ * @param key name of the argument (a string literal).
+ * @param value string that contains the value (cut at DS_TRACE_ARG_SIZE - 1 bytes).
+ */
+void argDSSpan(int span, const char *key, const char *value);
+
+/**
+ * @brief Ends the trace of the request: every open span is closed and, if the root span took at least
+ * dsTraceSlowMsec, every span is appended to the trace file with a single write.
+ *
+ */
+void finishDSTrace();
+
+#endif
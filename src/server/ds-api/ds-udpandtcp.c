@@ -1,15 +1,17 @@
+#define _GNU_SOURCE // recvmmsg and sendmmsg
 #include "ds-udpandtcp.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 /* DS Server information variables */
 char portDS[DS_PORT_SIZE] = DS_DEFAULT_PORT;
-int verbose = VERBOSE_OFF;
 
 /* UDP Socket related variables */
 int fdDSUDP;
@@ -19,6 +21,9 @@ struct addrinfo hintsUDP, *resUDP;
 int listenTCPDS;
 struct addrinfo hintsTCP, *resTCP;
 
+/* Set once the DS is asked to stop (SIGTERM) */
+static volatile sig_atomic_t stopRequested = 0;
+
 void setupDSSockets()
 {
     // UDP
@@ -68,8 +73,10 @@ void setupDSSockets()
         close(listenTCPDS);
         exit(EXIT_FAILURE);
     }
+    int reuse = 1; // A restarted DS must not wait for the connections of the last one to leave TIME_WAIT
+    setsockopt(listenTCPDS, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     err = bind(listenTCPDS, resTCP->ai_addr, resTCP->ai_addrlen);
-    if (err == 1)
+    if (err == -1)
     {
         perror("[-] Server TCP socket failed to bind");
         closeUDPSocket(fdDSUDP, resUDP);
@@ -85,8 +92,8 @@ void setupDSSockets()
         exit(EXIT_FAILURE);
     }
 
-    // If verbose is on print out where the DS server is running and at which port it's listening to
-    if (verbose == VERBOSE_ON)
+    // If the log is on print out where the DS server is running and at which port it's listening to
+    if (dsLogLevel >= DS_LOG_INFO)
     {
         char hostname[DS_HOSTNAME_SIZE + 1];
         if (gethostname(hostname, DS_HOSTNAME_SIZE) == -1)
@@ -97,57 +104,178 @@ void setupDSSockets()
             exit(EXIT_FAILURE);
         }
         printf("[+] DS server started @ %s.\n[!] Currently listening in port %s for UDP and TCP connections...\n\n", hostname, portDS);
+        fflush(stdout); // Or every TCP connection process would print it again when it exits
     }
 }
 
-void logVerbose(char *clientBuf, struct sockaddr_in s)
+/**
+ * @brief Checks the DS load and the token buckets of the client that sent a UDP request.
+ *
+ * @param clientBuf string that contains the request.
+ * @param addr IP address of the client.
+ * @return 1 if the request can be served, 0 otherwise.
+ */
+static int admitUDPRequest(char *clientBuf, struct in_addr addr)
 {
-    printf("[!] Client @ %s in port %d sent: %s\n", inet_ntoa(s.sin_addr), ntohs(s.sin_port), clientBuf);
+    if (!admitUDPLoad() || !admitIP(addr))
+    {
+        return 0;
+    }
+    // All requests but GLS and STA carry the UID right after the command code
+    char UID[CLIENT_UID_SIZE];
+    char *uidStart = clientBuf + PROTOCOL_CODE_SIZE;
+    if (strlen(clientBuf) < PROTOCOL_CODE_SIZE || clientBuf[PROTOCOL_CODE_SIZE - 1] != ' ')
+    {
+        return 1;
+    }
+    size_t uidLen = strcspn(uidStart, " ");
+    if (uidLen != CLIENT_UID_SIZE - 1)
+    {
+        return 1;
+    }
+    memcpy(UID, uidStart, uidLen);
+    UID[uidLen] = '\0';
+    return !validUID(UID) || admitUID(UID);
 }
 
-void handleDSUDP()
+/**
+ * @brief Sends the replies of a batch of UDP requests, retrying the ones a partial sendmmsg left behind.
+ *
+ * @param replies headers of the replies.
+ * @param num number of replies.
+ */
+static void sendDSUDPReplies(struct mmsghdr *replies, int num)
 {
-    char clientBuf[CLIENT_TO_DS_UDP_SIZE];
-    char *serverBuf;
-    struct sockaddr_in cliaddr;
-    socklen_t addrlen;
-    ssize_t n;
-    while (1)
+    int sent = 0;
+    while (sent < num)
     {
-        addrlen = sizeof(cliaddr);
-        n = recvfrom(fdDSUDP, clientBuf, sizeof(clientBuf), 0, (struct sockaddr *)&cliaddr, &addrlen);
+        int n = sendmmsg(fdDSUDP, replies + sent, num - sent, 0);
         if (n == -1)
         {
-            perror("[-] (UDP) DS failed on recvfrom");
+            perror("[-] (UDP) DS failed on sendto");
             closeUDPSocket(fdDSUDP, resUDP);
             exit(EXIT_FAILURE);
         }
-        if (clientBuf[n - 1] != '\n')
-        { // Every request/reply must end with a newline \n
-            n = sendto(fdDSUDP, ERR_MSG, ERR_MSG_SIZE, 0, (struct sockaddr *)&cliaddr, addrlen);
-            if (n == -1)
-            {
-                perror("[-] (UDP) DS failed on sendto");
-                closeUDPSocket(fdDSUDP, resUDP);
-                exit(EXIT_FAILURE);
-            }
+        sent += n;
+    }
+}
+
+/**
+ * @brief Asks the handler loops to stop.
+ *
+ * @param sig signal number.
+ */
+static void requestStop(int sig)
+{
+    stopRequested = 1;
+}
+
+void setupDSStop()
+{
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = requestStop; // No SA_RESTART: a handler waiting for a request must wake up
+    sigemptyset(&act.sa_mask);
+    if (sigaction(SIGTERM, &act, NULL) == -1)
+    {
+        perror("[-] Failed to set DS stop handler");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void handleDSUDP()
+{
+    // Every buffer is reused for the whole life of the DS so no request allocates memory
+    static char clientBufs[DS_UDP_BATCH_SIZE][CLIENT_TO_DS_UDP_SIZE];
+    static char serverBufs[DS_UDP_BATCH_SIZE][DS_TO_CLIENT_UDP_SIZE];
+    static struct sockaddr_in cliaddrs[DS_UDP_BATCH_SIZE];
+    static struct iovec requestIovs[DS_UDP_BATCH_SIZE], replyIovs[DS_UDP_BATCH_SIZE];
+    static struct mmsghdr requests[DS_UDP_BATCH_SIZE], replies[DS_UDP_BATCH_SIZE];
+    static DSTimer timers[DS_UDP_BATCH_SIZE]; // replies are sent together so each request keeps its own timer
+    for (int i = 0; i < DS_UDP_BATCH_SIZE; ++i)
+    {
+        requestIovs[i].iov_base = clientBufs[i];
+        requestIovs[i].iov_len = CLIENT_TO_DS_UDP_SIZE;
+        requests[i].msg_hdr.msg_iov = &requestIovs[i];
+        requests[i].msg_hdr.msg_iovlen = 1;
+        requests[i].msg_hdr.msg_name = &cliaddrs[i];
+        replies[i].msg_hdr.msg_iov = &replyIovs[i];
+        replies[i].msg_hdr.msg_iovlen = 1;
+        replies[i].msg_hdr.msg_name = &cliaddrs[i];
+    }
+    while (!stopRequested)
+    {
+        for (int i = 0; i < DS_UDP_BATCH_SIZE; ++i)
+        {
+            requests[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
         }
-        clientBuf[n - 1] = '\0';
-        if (verbose == VERBOSE_ON)
+        // Wait for one request and take whatever else already arrived along with it
+        int num = recvmmsg(fdDSUDP, requests, DS_UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+        if (num == -1 && stopRequested)
         {
-            logVerbose(clientBuf, cliaddr);
+            break;
         }
-        serverBuf = processClientUDP(clientBuf);
-        n = sendto(fdDSUDP, serverBuf, strlen(serverBuf), 0, (struct sockaddr *)&cliaddr, addrlen);
-        if (n == -1)
+        if (num == -1)
         {
-            perror("[-] (UDP) DS failed on sendto");
-            free(serverBuf);
+            perror("[-] (UDP) DS failed on recvfrom");
             closeUDPSocket(fdDSUDP, resUDP);
             exit(EXIT_FAILURE);
         }
-        free(serverBuf);
+        for (int i = 0; i < num; ++i)
+        {
+            char *clientBuf = clientBufs[i];
+            unsigned int n = requests[i].msg_len;
+            replies[i].msg_hdr.msg_namelen = requests[i].msg_hdr.msg_namelen;
+            replyIovs[i].iov_base = serverBufs[i];
+            startDSTimer(0);
+            if (n == 0 || clientBuf[n - 1] != '\n')
+            { // Every request/reply must end with a newline \n
+                replyIovs[i].iov_base = ERR_MSG;
+                replyIovs[i].iov_len = ERR_MSG_SIZE;
+                countDSStatus(0, "ERR");
+                enterDSStage(DS_STAGE_SEND);
+                timers[i] = dsTimer;
+                continue;
+            }
+            clientBuf[n - 1] = '\0';
+            int logged = sampleDSLog(DS_LOG_INFO);
+            if (logged)
+            { // The log only copies the request: it's formatted and written by another process
+                logDS(DS_LOG_INFO, DS_LOG_REQUEST, 0, &cliaddrs[i], clientBuf);
+            }
+            if (admitUDPRequest(clientBuf, cliaddrs[i].sin_addr))
+            {
+                clientAddrUDP = cliaddrs[i].sin_addr;
+                processClientUDP(clientBuf, serverBufs[i]);
+                if (logged)
+                {
+                    logDS(DS_LOG_DEBUG, DS_LOG_REPLY, 0, &cliaddrs[i], serverBufs[i]);
+                }
+            }
+            else
+            { // Reply right away without touching the file system
+                strcpy(serverBufs[i], ERR_MSG);
+                countDSStatus(0, "ERR");
+                logDS(DS_LOG_WARN, DS_LOG_REFUSED, 0, &cliaddrs[i], clientBuf);
+            }
+            replyIovs[i].iov_len = strlen(serverBufs[i]);
+            enterDSStage(DS_STAGE_SEND);
+            timers[i] = dsTimer;
+        }
+        dsTimer.command = -1;
+
+        // The whole batch goes out at once so every request is charged from its own reply being ready (including
+        // the requests after it in the batch) until the batch was sent
+        struct timespec finish;
+        sendDSUDPReplies(replies, num);
+        clock_gettime(CLOCK_MONOTONIC, &finish);
+        for (int i = 0; i < num; ++i)
+        {
+            timers[i].stageNsec[DS_STAGE_SEND] += (finish.tv_sec - timers[i].mark.tv_sec) * 1000000000L + (finish.tv_nsec - timers[i].mark.tv_nsec);
+            recordDSTimer(&timers[i]);
+        }
     }
+    closeUDPSocket(fdDSUDP, resUDP);
 }
 
 void handleDSTCP()
@@ -156,20 +284,31 @@ void handleDSTCP()
     socklen_t addrlen;
     int newDSFDTCP;
     pid_t pid;
-    while (1)
+    while (!stopRequested)
     {
         addrlen = sizeof(cliaddr);
         if ((newDSFDTCP = accept(listenTCPDS, (struct sockaddr *)&cliaddr, &addrlen)) == -1)
         { // If this connect failed to accept let's continue to try to look for new ones
             continue;
         }
+        if (!admitTCPConnection(cliaddr.sin_addr))
+        { // Refuse it before paying for a fork
+            logDS(DS_LOG_WARN, DS_LOG_REFUSED, 1, &cliaddr, "connection");
+            sendTCP(newDSFDTCP, ERR_MSG);
+            close(newDSFDTCP);
+            continue;
+        }
         if ((pid = fork()) == 0)
         {
             close(listenTCPDS);
+            signal(SIGTERM, SIG_DFL); // A connection asked to stop dies right away
+            startDSTimer(0);
+            joinDSProfile(); // Sampled too if the profiler runs
+            startTCPDeadline(); // The connection is dropped if the request doesn't arrive in time
             char commandCode[PROTOCOL_CODE_SIZE];
             int n = readTCP(newDSFDTCP, commandCode, PROTOCOL_CODE_SIZE);
-            if (n == -1)
-            { // TODO: CHECK TIMEOUT
+            if (n != PROTOCOL_CODE_SIZE)
+            { // Failed to read or client closed the connection before sending a command
                 close(newDSFDTCP);
                 exit(EXIT_FAILURE);
             }
@@ -180,11 +319,19 @@ void handleDSTCP()
                 exit(EXIT_FAILURE);
             }
             commandCode[PROTOCOL_CODE_SIZE - 1] = '\0'; // Remove backspace
-            // TODO: ADD VERBOSE
+            if (sampleDSLog(DS_LOG_INFO))
+            { // Only the message code: the rest of the request may be a file
+                logDS(DS_LOG_INFO, DS_LOG_REQUEST, 1, &cliaddr, commandCode);
+            }
             processClientTCP(newDSFDTCP, commandCode);
             close(newDSFDTCP);
             exit(EXIT_SUCCESS);
         }
+        if (pid > 0)
+        {
+            startedTCPConnection();
+        }
         close(newDSFDTCP);
     }
+    close(listenTCPDS);
 }
\ No newline at end of file
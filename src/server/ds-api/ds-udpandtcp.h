@@ -6,7 +6,6 @@
 #include "../centralizedmsg-server-api.h"
 
 extern char portDS[DS_PORT_SIZE];
-extern int verbose;
 
 /**
  * @brief Create all the DS related sockets (UDP and TCP protocol).
@@ -15,12 +14,11 @@ extern int verbose;
 void setupDSSockets();
 
 /**
- * @brief Logs what the client sent to the DS in STDOUT.
+ * @brief Makes SIGTERM stop the UDP and TCP handlers with exit, so that the at-exit work of a process
+ * (e.g. writing the profile of a PGO training build) is done. Must be called before the DS forks them.
  *
- * @param clientBuf string that contains the message that the client sent.
- * @param s struct that contains the socket address information.
  */
-void logVerbose(char *clientBuf, struct sockaddr_in s);
+void setupDSStop();
 
 /**
  * @brief Handle all messages exchange between the client and the DS via UDP protocol.
@@ -0,0 +1,296 @@
+#include "ds-upload.h"
+#include "ds-operations.h"
+#include <sys/types.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+void setupDSUploads()
+{
+    if (mkdir("server/UPLOADS", 0700) == -1 && errno != EEXIST)
+    {
+        perror("[-] Failed to create uploads directory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Removes every upload session that didn't receive any data for DS_UPLOAD_TTL seconds.
+ *
+ */
+static void pruneUploadSessions()
+{
+    DIR *d = opendir("server/UPLOADS");
+    if (d == NULL)
+    {
+        return;
+    }
+    struct dirent *entry;
+    struct stat stats;
+    char sessionPath[DS_UPLOADPATH_SIZE + 2];
+    time_t now = time(NULL);
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) > DS_SID_SIZE + 1)
+        { // Only sessions (SID) and sessions being committed (SID.c)
+            continue;
+        }
+        snprintf(sessionPath, DS_UPLOADPATH_SIZE + 2, "server/UPLOADS/%.*s", DS_SID_SIZE + 1, entry->d_name);
+        // Every write touches the session's directory so its mtime is the time of the last data
+        if (stat(sessionPath, &stats) == 0 && now - stats.st_mtime > DS_UPLOAD_TTL)
+        {
+            removeDirectory(sessionPath);
+        }
+    }
+    closedir(d);
+}
+
+int createUploadSession(UploadSession *s, int TSize, const char *Text)
+{
+    pruneUploadSessions();
+
+    // mkdir fails if the ID is taken so it's retried with another one
+    char sessionPath[DS_UPLOADPATH_SIZE];
+    srand(time(NULL) ^ getpid());
+    do
+    {
+        snprintf(s->SID, DS_SID_SIZE, "%08u", (unsigned int)rand() % 100000000);
+        sprintf(sessionPath, "server/UPLOADS/%s", s->SID);
+    } while (mkdir(sessionPath, 0700) == -1 && errno == EEXIST);
+    if (!directoryExists(sessionPath))
+    {
+        perror("[-] Failed to create upload session");
+        return 0;
+    }
+
+    // M E T A.txt keeps everything but the text (UID GID FName FSize)
+    char metaPath[DS_UPLOADFILEPATH_SIZE], textPath[DS_UPLOADFILEPATH_SIZE], dataPath[DS_UPLOADFILEPATH_SIZE];
+    sprintf(metaPath, "%s/M E T A.txt", sessionPath);
+    sprintf(textPath, "%s/T E X T.txt", sessionPath);
+    sprintf(dataPath, "%s/%s", sessionPath, s->FName);
+    FILE *meta = fopen(metaPath, "w");
+    FILE *text = fopen(textPath, "w");
+    int dataFd = open(dataPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int ok = meta != NULL && text != NULL && dataFd != -1;
+    ok = ok && fprintf(meta, "%s %s %s %ld\n", s->UID, s->GID, s->FName, s->FSize) > 0;
+    ok = ok && fwrite(Text, sizeof(char), TSize, text) == (size_t)TSize;
+    if (meta != NULL && fclose(meta) == EOF)
+    {
+        ok = 0;
+    }
+    if (text != NULL && fclose(text) == EOF)
+    {
+        ok = 0;
+    }
+    if (dataFd != -1 && close(dataFd) == -1)
+    {
+        ok = 0;
+    }
+    if (!ok)
+    {
+        perror("[-] Failed to write upload session");
+        removeDirectory(sessionPath);
+    }
+    return ok;
+}
+
+int loadUploadSession(UploadSession *s, const char *UID, const char *SID)
+{
+    if (strlen(SID) != DS_SID_SIZE - 1 || !isNumber((char *)SID))
+    {
+        return 0;
+    }
+    char metaPath[DS_UPLOADFILEPATH_SIZE];
+    sprintf(metaPath, "server/UPLOADS/%s/M E T A.txt", SID);
+    FILE *meta = fopen(metaPath, "r");
+    if (meta == NULL)
+    {
+        return 0;
+    }
+    int n = fscanf(meta, "%5s %2s %24s %ld", s->UID, s->GID, s->FName, &s->FSize);
+    fclose(meta);
+    strcpy(s->SID, SID);
+    // Only the user that started the upload can see or continue it
+    return n == 4 && !strcmp(s->UID, UID);
+}
+
+long uploadedBytes(const UploadSession *s)
+{
+    char dataPath[DS_UPLOADFILEPATH_SIZE], chunksPath[DS_UPLOADFILEPATH_SIZE];
+    struct stat stats;
+    sprintf(dataPath, "server/UPLOADS/%s/%s", s->SID, s->FName);
+    sprintf(chunksPath, "server/UPLOADS/%s/C H U N K S.txt", s->SID);
+    if (access(chunksPath, F_OK) == 0)
+    { // A chunked upload's file is preallocated so its size says nothing about what's stored
+        return -1;
+    }
+    if (stat(dataPath, &stats) == -1)
+    {
+        return -1;
+    }
+    return stats.st_size;
+}
+
+int openUploadData(const UploadSession *s, long offset)
+{
+    char dataPath[DS_UPLOADFILEPATH_SIZE];
+    char sessionPath[DS_UPLOADPATH_SIZE];
+    sprintf(sessionPath, "server/UPLOADS/%s", s->SID);
+    sprintf(dataPath, "%s/%s", sessionPath, s->FName);
+    int dataFd = open(dataPath, O_WRONLY);
+    if (dataFd == -1)
+    {
+        return -1;
+    }
+    // A resumed upload may resend bytes that were already stored so the file is cut at the offset
+    if (ftruncate(dataFd, offset) == -1 || lseek(dataFd, offset, SEEK_SET) == -1)
+    {
+        close(dataFd);
+        return -1;
+    }
+    utimes(sessionPath, NULL); // keeps the session from expiring
+    return dataFd;
+}
+
+/**
+ * @brief Gets the number of chunks of an upload.
+ *
+ * @param s upload session.
+ * @return number of chunks.
+ */
+static long numUploadChunks(const UploadSession *s)
+{
+    return (s->FSize + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE;
+}
+
+int openUploadChunks(const UploadSession *s)
+{
+    char sessionPath[DS_UPLOADPATH_SIZE], dataPath[DS_UPLOADFILEPATH_SIZE], chunksPath[DS_UPLOADFILEPATH_SIZE];
+    sprintf(sessionPath, "server/UPLOADS/%s", s->SID);
+    sprintf(dataPath, "%s/%s", sessionPath, s->FName);
+    sprintf(chunksPath, "%s/C H U N K S.txt", sessionPath);
+    // The chunk map has a byte per chunk that's set once the chunk is durable. Every connection of the upload
+    // may be the first one so both files are only ever grown to their final size, never truncated
+    int chunksFd = open(chunksPath, O_WRONLY | O_CREAT, 0600);
+    if (chunksFd == -1)
+    {
+        return -1;
+    }
+    struct stat stats;
+    int ok = fstat(chunksFd, &stats) == 0 && (stats.st_size == numUploadChunks(s) || ftruncate(chunksFd, numUploadChunks(s)) == 0);
+    if (close(chunksFd) == -1 || !ok)
+    {
+        return -1;
+    }
+    int dataFd = open(dataPath, O_WRONLY);
+    if (dataFd == -1)
+    {
+        return -1;
+    }
+    // Chunks are written out of order: preallocating keeps the file from being fragmented and reports ENOSPC now
+    if (posix_fallocate(dataFd, 0, s->FSize) != 0)
+    {
+        close(dataFd);
+        return -1;
+    }
+    utimes(sessionPath, NULL); // keeps the session from expiring
+    return dataFd;
+}
+
+int markUploadChunk(const UploadSession *s, long chunk)
+{
+    char chunksPath[DS_UPLOADFILEPATH_SIZE];
+    sprintf(chunksPath, "server/UPLOADS/%s/C H U N K S.txt", s->SID);
+    int chunksFd = open(chunksPath, O_WRONLY);
+    if (chunksFd == -1)
+    {
+        return 0;
+    }
+    // A single byte write to its own offset never races with the other chunks' connections
+    int ok = pwrite(chunksFd, "1", 1, chunk) == 1 && fdatasync(chunksFd) == 0;
+    return close(chunksFd) == 0 && ok;
+}
+
+int uploadChunksComplete(const UploadSession *s)
+{
+    char chunksPath[DS_UPLOADFILEPATH_SIZE];
+    sprintf(chunksPath, "server/UPLOADS/%s/C H U N K S.txt", s->SID);
+    FILE *chunks = fopen(chunksPath, "r");
+    if (chunks == NULL)
+    {
+        return 0;
+    }
+    long numChunks = numUploadChunks(s), i = 0;
+    int c;
+    while ((c = fgetc(chunks)) == '1')
+    {
+        i++;
+    }
+    fclose(chunks);
+    return c == EOF && i == numChunks;
+}
+
+int commitUploadSession(const UploadSession *s, char *newMID)
+{
+    char sessionPath[DS_UPLOADPATH_SIZE], claimedPath[DS_UPLOADPATH_SIZE + 2];
+    sprintf(sessionPath, "server/UPLOADS/%s", s->SID);
+    sprintf(claimedPath, "%s.c", sessionPath);
+    // Renaming the session claims it so that two connections never commit the same upload
+    if (rename(sessionPath, claimedPath) == -1)
+    {
+        return 0;
+    }
+
+    char textPath[DS_UPLOADFILEPATH_SIZE + 2], dataPath[DS_UPLOADFILEPATH_SIZE + 2];
+    char text[PROTOCOL_TEXT_SIZE];
+    sprintf(textPath, "%s/T E X T.txt", claimedPath);
+    sprintf(dataPath, "%s/%s", claimedPath, s->FName);
+    FILE *textFile = fopen(textPath, "r");
+    if (textFile == NULL)
+    {
+        removeDirectory(claimedPath);
+        return 0;
+    }
+    size_t TSize = fread(text, sizeof(char), PROTOCOL_TEXT_SIZE - 1, textFile);
+    fclose(textFile);
+    text[TSize] = '\0';
+
+    // The message is put together aside, with the file moved (not copied) into it since both live in the same file
+    // system, and only then posted: readers never see the message without its file. The file's ranges may have
+    // arrived over several connections so its hash is only computed now that it's complete
+    char stagePath[DS_GROUPSTAGEPATH_SIZE], stagedDir[DS_STAGEDMSGDIRPATH_SIZE], stagedFilePath[DS_MSGFILEPATH_SIZE];
+    char hash[DS_HASH_SIZE];
+    if (!createGroupStage(s->GID, stagePath))
+    {
+        removeDirectory(claimedPath);
+        return 0;
+    }
+    stagedMessageDir(stagePath, 0, stagedDir);
+    snprintf(stagedFilePath, DS_MSGFILEPATH_SIZE, "%s/%s", stagedDir, s->FName);
+    int mid;
+    int ok = mkdir(stagedDir, 0700) == 0 && writeMessageFiles(stagedDir, s->UID, TSize, text) && sha256File(dataPath, hash) &&
+             rename(dataPath, stagedFilePath) == 0 && writeMessageHash(stagedDir, hash);
+    if (!ok)
+    {
+        removeDirectory(stagePath);
+    }
+    int posted = ok && commitGroupStage(s->GID, stagePath, 1, &mid);
+    ok = posted && flushGroupMessages(s->GID);
+    if (posted && !ok)
+    {
+        removeGroupMessages(s->GID, mid, 1);
+    }
+    if (ok)
+    {
+        snprintf(newMID, DS_MID_SIZE, "%04u", (unsigned int)mid % (DS_MAX_NUM_MSGS + 1));
+    }
+    removeDirectory(claimedPath);
+    return ok;
+}
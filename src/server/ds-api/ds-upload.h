@@ -0,0 +1,95 @@
+#ifndef DS_UPLOAD_H
+#define DS_UPLOAD_H
+
+#include "../../centralizedmsg-api-constants.h"
+
+/* Struct that keeps the information of a resumable upload. The message is only created in its group
+ * once the whole file has arrived: until then it lives in server/UPLOADS/SID */
+typedef struct uploadsession
+{
+    char SID[DS_SID_SIZE];
+    char UID[CLIENT_UID_SIZE];
+    char GID[DS_GID_SIZE];
+    char FName[PROTOCOL_FNAME_SIZE];
+    long FSize;
+} UploadSession;
+
+/**
+ * @brief Creates the directory that keeps the upload sessions (if it doesn't exist yet).
+ *
+ */
+void setupDSUploads();
+
+/**
+ * @brief Creates a new upload session and removes the ones that expired.
+ *
+ * @param s session with its UID, GID, FName and FSize filled in. Its SID is filled in.
+ * @param TSize size of the message text.
+ * @param Text string that contains the message text.
+ * @return 1 if the session was created, 0 otherwise.
+ */
+int createUploadSession(UploadSession *s, int TSize, const char *Text);
+
+/**
+ * @brief Loads an upload session that belongs to a given user.
+ *
+ * @param s session that will contain the upload's information.
+ * @param UID string that contains the user ID.
+ * @param SID string that contains the session ID.
+ * @return 1 if the session exists and belongs to the user, 0 otherwise.
+ */
+int loadUploadSession(UploadSession *s, const char *UID, const char *SID);
+
+/**
+ * @brief Gets the number of bytes of an upload that are stored (the offset the upload resumes from).
+ *
+ * @param s upload session.
+ * @return number of stored bytes, -1 on failure or if the upload is sent in chunks.
+ */
+long uploadedBytes(const UploadSession *s);
+
+/**
+ * @brief Opens an upload's file to write from a given offset on. Bytes past the offset are discarded.
+ *
+ * @param s upload session.
+ * @param offset offset of the first byte to be written (at most the number of stored bytes).
+ * @return file descriptor of the upload's file, -1 on failure.
+ */
+int openUploadData(const UploadSession *s, long offset);
+
+/**
+ * @brief Opens an upload's file to write chunks at their offsets. The first chunk preallocates the whole
+ * file and creates the chunk map, so the upload can no longer be resumed with openUploadData.
+ *
+ * @param s upload session.
+ * @return file descriptor of the upload's file, -1 on failure.
+ */
+int openUploadChunks(const UploadSession *s);
+
+/**
+ * @brief Records that a chunk of an upload is stored.
+ *
+ * @param s upload session.
+ * @param chunk index of the chunk (its offset divided by UPLOAD_CHUNK_SIZE).
+ * @return 1 if it was recorded, 0 otherwise.
+ */
+int markUploadChunk(const UploadSession *s, long chunk);
+
+/**
+ * @brief Checks if every chunk of an upload is stored.
+ *
+ * @param s upload session.
+ * @return 1 if they are, 0 otherwise.
+ */
+int uploadChunksComplete(const UploadSession *s);
+
+/**
+ * @brief Creates the message of a complete upload in its group and removes the session.
+ *
+ * @param s upload session whose file has FSize bytes.
+ * @param newMID string that will contain the new message ID.
+ * @return 1 if the message was created, 0 otherwise.
+ */
+int commitUploadSession(const UploadSession *s, char *newMID);
+
+#endif